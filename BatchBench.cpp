@@ -0,0 +1,86 @@
+#include "WorldBatch.h"
+#include "UserInput.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Batched world benchmark.
+ *
+ * Steps a batch of worlds with random actions on 1, 2, 4, ... threads, up
+ * to the number of cores, and reports how many world ticks per second the
+ * batch gets through in total.
+ */
+
+// Size of the batch
+#define BENCH_WORLDS 64
+#define BENCH_PLAYERS 4
+
+// Steps to settle in before measuring, and steps to measure
+#define BENCH_WARMUP_STEPS 20
+#define BENCH_STEPS 200
+
+// Sets of actions to cycle through, made up in advance so that making them
+// up isn't what we measure
+#define BENCH_ACTION_SETS 16
+
+/*
+ * Random held inputs: a direction or two, and now and again a change of
+ * size.
+ */
+static uint32_t RandomAction()
+{
+    uint32_t action = 0;
+    for (unsigned index = USERINPUT_INDEX_GROW; index < USERINPUT_INDEX_COUNT; ++index) {
+        bool isSize = index == USERINPUT_INDEX_GROW || index == USERINPUT_INDEX_SHRINK;
+        if (rand() % (isSize ? 16 : 3) == 0)
+            action |= GEN_INPUT_MASK(index, true);
+    }
+    return action;
+}
+
+int main(int argc, char** argv)
+{
+    srand(1);
+
+    unsigned numActions = BENCH_WORLDS * BENCH_PLAYERS;
+    std::vector<uint32_t> actions(BENCH_ACTION_SETS * numActions);
+    for (unsigned i = 0; i < actions.size(); ++i)
+        actions[i] = RandomAction();
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned numCores = cores > 0 ? (unsigned) cores : 1;
+
+    printf("%d worlds of %d players\n", BENCH_WORLDS, BENCH_PLAYERS);
+    printf("%8s %12s %10s %10s\n", "threads", "ticks/sec", "speedup", "episodes");
+
+    double baseline = 0.0;
+
+    // Double the threads each time, finishing with all the cores
+    for (unsigned numThreads = 1; ;
+         numThreads = numThreads * 2 < numCores ? numThreads * 2 : numCores) {
+        WorldBatch batch(BENCH_WORLDS, BENCH_PLAYERS, numThreads);
+        for (unsigned i = 0; i < BENCH_WARMUP_STEPS; ++i)
+            batch.Step(&actions[(i % BENCH_ACTION_SETS) * numActions]);
+
+        unsigned episodes = 0;
+        sf::Clock clock;
+        for (unsigned i = 0; i < BENCH_STEPS; ++i) {
+            batch.Step(&actions[(i % BENCH_ACTION_SETS) * numActions]);
+            const uint8_t* dones = batch.GetDones();
+            for (unsigned j = 0; j < BENCH_WORLDS; ++j)
+                episodes += dones[j];
+        }
+        double ticksPerSec = (double) BENCH_STEPS * BENCH_WORLDS / clock.GetElapsedTime();
+        if (numThreads == 1)
+            baseline = ticksPerSec;
+
+        printf("%8u %12.0f %9.2fx %10u\n", numThreads, ticksPerSec,
+               ticksPerSec / baseline, episodes);
+
+        if (numThreads == numCores)
+            break;
+    }
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "CatchUp.h"
+
+CatchUp::CatchUp(float budget, Metrics& metrics) : mBudget(budget)
+                                                 , mTickCost(0.0f)
+                                                 , mLag(0)
+                                                 , mFramesOverBudget(0)
+                                                 , mMetrics(metrics)
+{
+}
+
+unsigned
+CatchUp::Step(WorldModel& world, const Gameclock& clock)
+{
+    sf::Clock frameClock;
+    unsigned ticks = 0;
+    while (world.GetCurrentTimestamp() < clock.Now()) {
+
+        // Stop if the next tick probably won't fit, but always take one
+        float elapsed = frameClock.GetElapsedTime();
+        if (ticks > 0 && elapsed + mTickCost > mBudget)
+            break;
+
+        world.SingleStep();
+        ++ticks;
+
+        float cost = frameClock.GetElapsedTime() - elapsed;
+        mTickCost += (cost - mTickCost) * CATCHUP_COST_SMOOTHING;
+    }
+
+    // Where does that leave us?
+    unsigned now = clock.Now();
+    unsigned timestamp = world.GetCurrentTimestamp();
+    mLag = now > timestamp ? now - timestamp : 0;
+    if (mLag) {
+        ++mFramesOverBudget;
+        mMetrics.Add(METRIC_FRAMES_OVER_BUDGET);
+    }
+    mMetrics.Set(METRIC_GAUGE_TICKS_BEHIND, mLag);
+    mMetrics.Observe(METRIC_HIST_CATCHUP_TICKS, ticks);
+    return ticks;
+}
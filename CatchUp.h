@@ -0,0 +1,82 @@
+#ifndef CATCHUP_H
+#define CATCHUP_H
+
+#include "Framework.h"
+#include "WorldModel.h"
+#include "Gameclock.h"
+
+/*
+ * Bounded catch-up.
+ *
+ * After a stall, the clock can be many ticks ahead of the world. Stepping
+ * them all at once makes the frame that does it slow, which puts the clock
+ * further ahead still, and so on until the game can't keep up at all.
+ * Instead, each frame gets a budget of wall time to simulate in. We step
+ * towards the clock until we reach it or the budget runs out, and leave
+ * the rest for later frames. The world is always stepped at least one tick
+ * per frame when it's behind, so it can't stall completely, and never runs
+ * ahead of the clock.
+ *
+ * Inputs stamped for ticks the world hasn't reached yet wait in the
+ * timeline until it does, so running behind only delays things.
+ */
+
+// Default wall time to spend simulating per frame, in seconds
+#define CATCHUP_DEFAULT_BUDGET 0.016f
+
+// Ticks behind, after catching up, at which we tell the player
+#define CATCHUP_LAG_WARNING_TICKS 4
+
+// Weight of each new tick in the running estimate of tick cost
+#define CATCHUP_COST_SMOOTHING 0.1f
+
+class CatchUp {
+
+    public:
+
+    /*
+     * Constructor. Catch-up metrics go to the given registry.
+     */
+    CatchUp(float budget = CATCHUP_DEFAULT_BUDGET,
+            Metrics& metrics = Metrics::Global());
+
+    /*
+     * Sets the wall time we may spend simulating per frame, in seconds.
+     */
+    void SetBudget(float budget) { mBudget = budget; };
+    float GetBudget() { return mBudget; };
+
+    /*
+     * Steps the world towards the clock, within the budget. Returns the
+     * number of ticks stepped.
+     */
+    unsigned Step(WorldModel& world, const Gameclock& clock);
+
+    /*
+     * How many ticks the world was still behind the clock after the last
+     * Step().
+     */
+    unsigned GetLag() { return mLag; };
+    bool IsBehind() { return mLag > 0; };
+    bool IsLagging() { return mLag >= CATCHUP_LAG_WARNING_TICKS; };
+
+    /*
+     * Number of frames that ran out of budget before catching up.
+     */
+    unsigned GetFramesOverBudget() { return mFramesOverBudget; };
+
+    protected:
+
+    float mBudget;
+
+    // Running estimate of what a tick costs, in seconds
+    float mTickCost;
+
+    unsigned mLag;
+    unsigned mFramesOverBudget;
+
+    // Where we record metrics
+    Metrics& mMetrics;
+};
+
+#endif /* CATCHUP_H */
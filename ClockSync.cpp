@@ -0,0 +1,97 @@
+#include "ClockSync.h"
+#include <math.h>
+
+ClockSync::ClockSync()
+{
+    Reset();
+}
+
+void
+ClockSync::Reset()
+{
+    mNumSamples = 0;
+    mNextSample = 0;
+    mHasEstimate = false;
+    mOffset = 0.0;
+    mRTT = 0.0;
+    mNumRejected = 0;
+}
+
+void
+ClockSync::AddSample(uint64_t sendMicros, uint64_t receiveMicros,
+                     uint64_t remoteMicros, double adjustMicros)
+{
+    // A pong can't arrive before its ping left
+    if (receiveMicros < sendMicros) {
+        ++mNumRejected;
+        return;
+    }
+
+    // Assume the trip was symmetric. The remote clock read remoteMicros
+    // halfway through the round trip.
+    Sample sample;
+    sample.rtt = (double)(receiveMicros - sendMicros);
+    sample.offset = (double) remoteMicros + sample.rtt / 2.0 -
+                    (double) receiveMicros + adjustMicros;
+
+    // Reject outliers once we have a baseline
+    double minRTT = sample.rtt;
+    for (unsigned i = 0; i < mNumSamples; ++i)
+        if (mSamples[i].rtt < minRTT)
+            minRTT = mSamples[i].rtt;
+    if (mNumSamples >= CLOCKSYNC_WINDOW / 4 &&
+        sample.rtt > CLOCKSYNC_OUTLIER_FACTOR * minRTT + CLOCKSYNC_OUTLIER_SLACK_US) {
+        ++mNumRejected;
+        return;
+    }
+
+    // Add it to the window
+    mSamples[mNextSample] = sample;
+    mNextSample = (mNextSample + 1) % CLOCKSYNC_WINDOW;
+    if (mNumSamples < CLOCKSYNC_WINDOW)
+        ++mNumSamples;
+
+    // The sample with the smallest round trip saw the least queueing, so
+    // its offset is the most trustworthy.
+    const Sample* best = &mSamples[0];
+    for (unsigned i = 1; i < mNumSamples; ++i)
+        if (mSamples[i].rtt < best->rtt)
+            best = &mSamples[i];
+
+    // Smooth
+    if (!mHasEstimate) {
+        mOffset = best->offset;
+        mRTT = sample.rtt;
+        mHasEstimate = true;
+    }
+    else {
+        mOffset += CLOCKSYNC_SMOOTHING * (best->offset - mOffset);
+        mRTT += CLOCKSYNC_SMOOTHING * (sample.rtt - mRTT);
+    }
+}
+
+double
+ClockSync::GetOffsetMicros(double adjustMicros)
+{
+    return mOffset - adjustMicros;
+}
+
+float
+ClockSync::SuggestSkew(double adjustMicros, double leadMicros)
+{
+    if (!mHasEstimate)
+        return 0.0f;
+
+    // Positive errors mean we're behind
+    double error = GetOffsetMicros(adjustMicros) + leadMicros;
+    if (fabs(error) < CLOCKSYNC_DEADBAND_US)
+        return 0.0f;
+
+    // Remove the error over the slew period, within limits
+    double skew = error / (CLOCKSYNC_SLEW_SECONDS * 1000000.0);
+    if (skew > CLOCKSYNC_MAX_SKEW)
+        skew = CLOCKSYNC_MAX_SKEW;
+    if (skew < -CLOCKSYNC_MAX_SKEW)
+        skew = -CLOCKSYNC_MAX_SKEW;
+    return (float) skew;
+}
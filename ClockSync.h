@@ -0,0 +1,140 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <stdint.h>
+
+/*
+ * Clock synchronization.
+ *
+ * Peers periodically ping each other. Each ping carries the sender's game
+ * time, and the reply carries the responder's game time. From one round trip
+ * we get a round trip time and an estimate of how far the remote clock is
+ * ahead of ours, NTP-style. Queueing delays only ever add to a round trip,
+ * so the samples with the smallest round trip times give the most accurate
+ * offsets. We keep a window of recent samples, throw out ones whose round
+ * trip is far above the window's minimum, and smooth the offset of the best
+ * remaining sample.
+ *
+ * Clients use the estimate to nudge the rate of their Gameclock, so they
+ * track the server without the jumps of a fast-forward. They aim to run
+ * ahead of the server by half a round trip plus a small margin, so that
+ * their inputs reach the server just before it simulates the tick they're
+ * stamped with, rather than forcing it to roll back.
+ */
+
+// Number of ticks between pings
+#define CLOCKSYNC_PING_INTERVAL 8
+
+// Number of round trips we remember
+#define CLOCKSYNC_WINDOW 16
+
+// Round trips longer than factor * (window minimum) + slack are outliers
+#define CLOCKSYNC_OUTLIER_FACTOR 2.0
+#define CLOCKSYNC_OUTLIER_SLACK_US 5000.0
+
+// Weight of each new filtered estimate in the smoothed offset
+#define CLOCKSYNC_SMOOTHING 0.2
+
+// Clients speed up or slow down their clock by at most this fraction
+#define CLOCKSYNC_MAX_SKEW 0.05
+
+// We try to remove an offset error over about this many seconds
+#define CLOCKSYNC_SLEW_SECONDS 1.0
+
+// Errors smaller than this aren't worth correcting
+#define CLOCKSYNC_DEADBAND_US 2000.0
+
+// Extra lead on top of half a round trip, to absorb jitter
+#define CLOCKSYNC_LEAD_MARGIN_US 8000.0
+
+/*
+ * Ping/pong message. Pings leave replyMicros at zero, and pongs echo the
+ * ping's sequence number and origin time.
+ */
+struct ClockPing {
+
+    ClockPing() : sequence(0), originMicros(0), replyMicros(0) {};
+
+    // Sequence number of the ping
+    uint32_t sequence;
+
+    // Sender's game time when the ping left
+    uint64_t originMicros;
+
+    // Responder's game time when the pong left
+    uint64_t replyMicros;
+};
+
+class ClockSync {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    ClockSync();
+
+    /*
+     * Forgets all samples.
+     */
+    void Reset();
+
+    /*
+     * Adds a round trip. sendMicros and receiveMicros are our game time when
+     * the ping left and when the pong arrived, and remoteMicros is the remote
+     * game time when the pong left. adjustMicros is how far rate skew has
+     * moved our clock so far (see Gameclock::GetSkewAdjustmentMicros()), so
+     * that older samples stay comparable as we slew.
+     */
+    void AddSample(uint64_t sendMicros, uint64_t receiveMicros,
+                   uint64_t remoteMicros, double adjustMicros);
+
+    /*
+     * Do we have enough samples to say anything?
+     */
+    bool HasEstimate() { return mHasEstimate; };
+
+    /*
+     * How far the remote clock is ahead of ours, given our current skew
+     * adjustment.
+     */
+    double GetOffsetMicros(double adjustMicros);
+
+    /*
+     * Smoothed round trip time.
+     */
+    double GetRTTMicros() { return mRTT; };
+
+    /*
+     * Suggests a rate skew that moves our clock towards the remote clock
+     * plus leadMicros.
+     */
+    float SuggestSkew(double adjustMicros, double leadMicros);
+
+    /*
+     * Number of samples thrown out as outliers.
+     */
+    unsigned GetNumRejected() { return mNumRejected; };
+
+    protected:
+
+    struct Sample {
+        double rtt;
+        double offset; // Relative to our clock before any skew adjustment
+    };
+
+    // Window of recent samples
+    Sample mSamples[CLOCKSYNC_WINDOW];
+    unsigned mNumSamples;
+    unsigned mNextSample;
+
+    // Smoothed estimates
+    bool mHasEstimate;
+    double mOffset;
+    double mRTT;
+
+    // Stats
+    unsigned mNumRejected;
+};
+
+#endif /* CLOCKSYNC_H */
@@ -1,6 +1,7 @@
 #include "Communicator.h"
 #include "WorldModel.h"
 #include "Timeline.h"
+#include "Gameclock.h"
 #include "assert.h"
 
 #include <Sockets/Lock.h>
@@ -14,29 +15,69 @@ const unsigned sGrowblesMagic = 0x640E8135;
 
 Payload::~Payload()
 {
-    // If we don't own the data, we have nothing to do
-    if (!ownData)
+    Clear();
+}
+
+void
+Payload::Clear()
+{
+    // If we don't own the data, we have nothing to free
+    if (!ownData) {
+        type = PAYLOAD_TYPE_NONE;
+        data = NULL;
         return;
+    }
 
     // If we're marked as owning the data, we ought to have it.
     assert(data);
 
     // Free the data
-    free(data);
+    switch(type) {
+        case PAYLOAD_TYPE_WORLDSTATE:
+            delete (WorldState*)data;
+            break;
+        case PAYLOAD_TYPE_USERINPUT:
+            delete (UserInput*)data;
+            break;
+        case PAYLOAD_TYPE_PING:
+        case PAYLOAD_TYPE_PONG:
+            delete (ClockPing*)data;
+            break;
+        case PAYLOAD_TYPE_STATEHASH:
+            delete (StateHash*)data;
+            break;
+        default:
+            assert(0); // Not reached
+            break;
+    }
+    type = PAYLOAD_TYPE_NONE;
+    data = NULL;
+    ownData = false;
 }
 
-unsigned
-Payload::GetDataSize()
+void
+Payload::AllocateData()
 {
+    assert(!ownData);
     switch(type) {
         case PAYLOAD_TYPE_WORLDSTATE:
-            return (unsigned) sizeof(WorldState);
+            data = new WorldState;
+            break;
         case PAYLOAD_TYPE_USERINPUT:
-            return (unsigned) sizeof(UserInput);
+            data = new UserInput(0, 0);
+            break;
+        case PAYLOAD_TYPE_PING:
+        case PAYLOAD_TYPE_PONG:
+            data = new ClockPing;
+            break;
+        case PAYLOAD_TYPE_STATEHASH:
+            data = new StateHash;
+            break;
         default:
             assert(0); // Not reached
-            return 0;
+            return;
     }
+    ownData = true;
 }
 
 /*
@@ -47,6 +88,10 @@ GrowblesSocket::GrowblesSocket(ISocketHandler& h) : TcpSocket(h,
                                                               TCP_INPUT_BUFFER_SIZE,
                                                               TCP_OUTPUT_BUFFER_SIZE)
                                                   , mRemoteID(0)
+                                                  , mIncomingSize(0)
+                                                  , mWireBuffer(WIRE_HEADER_SIZE +
+                                                                WIRE_MAX_MESSAGE_SIZE)
+                                                  , mLanesConfigured(false)
 {
     // We don't want TCP to buffer things up
     SetTcpNodelay();
@@ -62,20 +107,28 @@ GrowblesSocket::OnAccept()
     // ConnectAsClient() shouldn't run.
     assert(mRemoteID == 0);
 
-    // We start by sending clients the magic word
-    unsigned message[3];
+    // We start by sending clients the magic word and our protocol version
+    uint32_t message[5];
     message[0] = sGrowblesMagic;
+    message[1] = WIRE_PROTOCOL_VERSION;
 
     // Then we send them our ID
     Communicator* comm = dynamic_cast<GrowblesHandler&>(Handler()).GetCommunicator();
-    message[1] = comm->mPlayerID;
+    message[2] = comm->mPlayerID;
 
     // Then we send them their player ID
     SetRemoteID(comm->mNextPlayerID++);
-    message[2] = mRemoteID;
+    message[3] = mRemoteID;
+
+    // Then the rules of the game
+    message[4] = comm->mDeterministic ? HANDSHAKE_FLAG_DETERMINISTIC : 0;
 
-    // Send
-    SendBuf((const char *)&message, sizeof(message));
+    // Send, in wire byte order
+    uint8_t buffer[sizeof(message)];
+    WireWriter writer(buffer, sizeof(buffer));
+    for (unsigned i = 0; i < 5; ++i)
+        writer.Field(message[i]);
+    SendBuf((const char *)buffer, writer.Size());
 }
 
 unsigned
@@ -97,66 +150,165 @@ void
 GrowblesSocket::SendPayload(Payload& payload)
 {
     // We're using TCP_NODELAY, which sends data immediately. However, we want
-    // our payload to go in a single packet. So we create a buffer here for
-    // the packet.
-    unsigned dataSize = payload.GetDataSize();
-    unsigned buffSize = sizeof(payload.type) + sizeof(dataSize) + dataSize;
-    char* buffer = (char*)malloc(buffSize);
-    assert(buffer);
-
-    // Fill the buffer
-    char* currBuffer = buffer;
-    memcpy(currBuffer, &payload.type, sizeof(payload.type));
-    currBuffer += sizeof(payload.type);
-    memcpy(currBuffer, &dataSize, sizeof(dataSize));
-    currBuffer += sizeof(dataSize);
-    memcpy(currBuffer, payload.data, dataSize);
+    // our payload to go in a single packet. So we encode the whole frame into
+    // our scratch buffer first: the header, then the body.
+    uint8_t* buffer = &mWireBuffer[0];
+    unsigned bodySize = WireEncodePayload(payload.type, payload.data,
+                                          buffer + WIRE_HEADER_SIZE,
+                                          WIRE_MAX_MESSAGE_SIZE);
+    assert(bodySize > 0);
+    WireEncodeHeader(buffer, payload.type, bodySize);
+    GetMetrics().Add(METRIC_PAYLOADS_SENT);
+    GetMetrics().Add(METRIC_BYTES_SENT, WIRE_HEADER_SIZE + bodySize);
+    GetMetrics().Observe(METRIC_HIST_PAYLOAD_BYTES, WIRE_HEADER_SIZE + bodySize);
+
+    // If we're emulating a network, the frame goes onto our outbound link
+    // and gets sent once it's been delivered.
+    GrowblesHandler& handler = dynamic_cast<GrowblesHandler&>(Handler());
+    if (handler.IsSimulatingNetwork()) {
+        ConfigureLanes();
+        double now = handler.GetSimulationTimeMS();
+        mOutbound.Enqueue(buffer, WIRE_HEADER_SIZE + bodySize, now);
+        FlushSimulated(now);
+        return;
+    }
 
     // Send the buffer
-    SendBuf(buffer, buffSize);
+    SendBuf((const char*)buffer, WIRE_HEADER_SIZE + bodySize);
 }
 
 bool
 GrowblesSocket::HasPayload()
 {
-    // If we're waiting for the data portion of a payload
+    // Nothing more from a connection we're dropping
+    if (CloseAndDelete())
+        return false;
+
+    // Without network emulation, frames come straight off the wire
+    GrowblesHandler& handler = dynamic_cast<GrowblesHandler&>(Handler());
+    if (!handler.IsSimulatingNetwork())
+        return HasPayloadOnWire();
+
+    // Otherwise, move any frames that have arrived onto our emulated inbound
+    // link, and see if the link has delivered one yet.
+    ConfigureLanes();
+    double now = handler.GetSimulationTimeMS();
+    while (HasPayloadOnWire()) {
+        uint8_t* buffer = &mWireBuffer[0];
+        WireEncodeHeader(buffer, mIncoming.type, mIncomingSize);
+        ReadInput((char*)buffer + WIRE_HEADER_SIZE, mIncomingSize);
+        mInbound.Enqueue(buffer, WIRE_HEADER_SIZE + mIncomingSize, now);
+        mIncoming.type = PAYLOAD_TYPE_NONE;
+        mIncomingSize = 0;
+    }
+    return mInbound.HasDue(now);
+}
+
+bool
+GrowblesSocket::HasPayloadOnWire()
+{
+    // If we're waiting for the body of a payload
     if (mIncoming.type != PAYLOAD_TYPE_NONE)
-        return GetInputLength() >= mIncoming.GetDataSize();
+        return GetInputLength() >= mIncomingSize;
 
     // Otherwise, we're starting from scratch. See if the header's there.
-    if (GetInputLength() < sizeof(PayloadType) + sizeof(PayloadType))
+    if (GetInputLength() < WIRE_HEADER_SIZE)
         return false;
 
     // We've received the header. Read it in and recur.
-    unsigned dataSize;
-    ReadInput((char*)&mIncoming.type, sizeof(mIncoming.type));
-    ReadInput((char*)&dataSize, sizeof(dataSize));
-    assert(dataSize == mIncoming.GetDataSize()); // Make sure compilers pack
-                                                 // the structs the same way.
-    return HasPayload();
+    uint8_t header[WIRE_HEADER_SIZE];
+    ReadInput((char*)header, WIRE_HEADER_SIZE);
+    if (!WireDecodeHeader(header, mIncoming.type, mIncomingSize)) {
+        printf("Received a malformed or incompatible payload header from "
+               "player %u. Dropping the connection.\n", mRemoteID);
+        GetMetrics().Add(METRIC_MALFORMED_HEADERS);
+        mIncoming.type = PAYLOAD_TYPE_NONE;
+        SetCloseAndDelete();
+        return false;
+    }
+    return HasPayloadOnWire();
 }
 
-void
+bool
 GrowblesSocket::GetPayload(Payload& payload)
 {
     // We must have a payload ready
     assert(HasPayload());
 
-    // Set the type
+    // Find the body. Emulated frames come off our inbound link, with their
+    // header. Otherwise the header has been read, and the body is waiting in
+    // the socket input buffer.
+    const uint8_t* body;
+    if (dynamic_cast<GrowblesHandler&>(Handler()).IsSimulatingNetwork()) {
+        mInbound.Dequeue(mSimFrame);
+        bool valid = WireDecodeHeader(&mSimFrame[0], mIncoming.type, mIncomingSize);
+        assert(valid); // We checked it on the way in
+        (void) valid;
+        body = &mSimFrame[WIRE_HEADER_SIZE];
+    }
+    else {
+        ReadInput((char*)&mWireBuffer[0], mIncomingSize);
+        body = &mWireBuffer[0];
+    }
+
+    // Allocate the message and decode into it
     payload.type = mIncoming.type;
+    payload.AllocateData();
+    bool decoded = WireDecodePayload(payload.type, body, mIncomingSize,
+                                     payload.data);
+    GetMetrics().Add(METRIC_PAYLOADS_RECEIVED);
+    GetMetrics().Add(METRIC_BYTES_RECEIVED, WIRE_HEADER_SIZE + mIncomingSize);
 
-    // Allocate the data buffer
-    payload.data = malloc(payload.GetDataSize());
-    assert(payload.data);
+    // Clear our incoming tracker
+    mIncoming.type = PAYLOAD_TYPE_NONE;
+    mIncomingSize = 0;
+
+    // A good header doesn't make a good body. The body may be cut short or
+    // out of range, and it came off the network, so we treat it like a bad
+    // header.
+    if (!decoded) {
+        printf("Received a malformed payload from player %u. Dropping the "
+               "connection.\n", mRemoteID);
+        GetMetrics().Add(METRIC_MALFORMED_PAYLOADS);
+        payload.Clear();
+        SetCloseAndDelete();
+        return false;
+    }
+    return true;
+}
 
-    // Read the data from the socket input buffer
-    ReadInput((char*)payload.data, payload.GetDataSize());
+void
+GrowblesSocket::FlushSimulated(double nowMS)
+{
+    while (mOutbound.HasDue(nowMS)) {
+        mOutbound.Dequeue(mSimFrame);
+        SendBuf((const char*)&mSimFrame[0], mSimFrame.size());
+    }
+}
 
-    // The given payload owns the data now
-    payload.ownData = true;
+void
+GrowblesSocket::ConfigureLanes()
+{
+    if (mLanesConfigured)
+        return;
 
-    // Clear our incoming tracker
-    mIncoming.type = PAYLOAD_TYPE_NONE;
+    // Each direction of each connection gets its own stream of random
+    // numbers, derived from the handler's seed.
+    NetworkConditions outbound, inbound;
+    unsigned seed;
+    dynamic_cast<GrowblesHandler&>(Handler()).GetNetworkConditions(outbound,
+                                                                   inbound,
+                                                                   seed);
+    uint64_t connectionSeed = ((uint64_t) seed << 32) ^ (mRemoteID * 2654435761U);
+    mOutbound.Configure(outbound, connectionSeed * 2 + 1);
+    mInbound.Configure(inbound, connectionSeed * 2 + 2);
+    mLanesConfigured = true;
+}
+
+Metrics&
+GrowblesSocket::GetMetrics()
+{
+    return dynamic_cast<GrowblesHandler&>(Handler()).GetCommunicator()->mMetrics;
 }
 
 /*
@@ -165,7 +317,49 @@ GrowblesSocket::GetPayload(Payload& payload)
 
 GrowblesHandler::GrowblesHandler(Communicator& c) : SocketHandler()
                                                   , mCommunicator(&c)
+                                                  , mSimulatingNetwork(false)
+                                                  , mSimSeed(0)
+{
+}
+
+void
+GrowblesHandler::SetNetworkConditions(const NetworkConditions& outbound,
+                                      const NetworkConditions& inbound,
+                                      unsigned seed)
 {
+    // Conditions have to be in place before any connections are made
+    assert(m_sockets.size() == 0);
+
+    mSimOutbound = outbound;
+    mSimInbound = inbound;
+    mSimSeed = seed;
+    mSimulatingNetwork = !outbound.IsIdeal() || !inbound.IsIdeal();
+    mSimClock.Reset();
+}
+
+void
+GrowblesHandler::GetNetworkConditions(NetworkConditions& outbound,
+                                      NetworkConditions& inbound,
+                                      unsigned& seed)
+{
+    outbound = mSimOutbound;
+    inbound = mSimInbound;
+    seed = mSimSeed;
+}
+
+void
+GrowblesHandler::PumpSimulatedNetwork()
+{
+    if (!mSimulatingNetwork)
+        return;
+
+    double now = GetSimulationTimeMS();
+    for (socket_m::iterator it = m_sockets.begin();
+         it != m_sockets.end(); ++it) {
+        GrowblesSocket* socket = dynamic_cast<GrowblesSocket*>(it->second);
+        if (socket)
+            socket->FlushSimulated(now);
+    }
 }
 
 void
@@ -176,6 +370,19 @@ GrowblesHandler::AddPlayers(WorldModel& model)
         model.AddPlayer(dynamic_cast<GrowblesSocket*>(it->second)->GetRemoteID());
 }
 
+void
+GrowblesHandler::Adopt(SOCKET s)
+{
+    GrowblesSocket* socket = new GrowblesSocket(*this);
+    socket->Attach(s);
+    socket->SetNonblocking(true);
+    socket->SetConnected(true);
+    socket->Init();
+    socket->SetDeleteByHandler();
+    Add(socket);
+    socket->OnAccept();
+}
+
 void
 GrowblesHandler::SendToAll(Payload& payload)
 {
@@ -207,6 +414,19 @@ GrowblesHandler::SendTo(Payload& payload, unsigned playerID)
     }
 }
 
+void
+GrowblesHandler::Drop(unsigned playerID)
+{
+    for (socket_m::iterator it = m_sockets.begin();
+         it != m_sockets.end(); ++it) {
+        GrowblesSocket* socket = dynamic_cast<GrowblesSocket*>(it->second);
+        if (socket->GetRemoteID() == playerID) {
+            socket->SetCloseAndDelete();
+            return;
+        }
+    }
+}
+
 bool
 GrowblesHandler::HasPayload()
 {
@@ -229,7 +449,8 @@ GrowblesHandler::ReceivePayload(Payload& payload)
          it != m_sockets.end(); ++it) {
         GrowblesSocket* socket = dynamic_cast<GrowblesSocket*>(it->second);
         if (socket->HasPayload()) {
-            socket->GetPayload(payload);
+            if (!socket->GetPayload(payload))
+                return 0;
             return socket->GetRemoteID();
         }
     }
@@ -243,21 +464,39 @@ GrowblesHandler::ReceivePayload(Payload& payload)
  * Communicator Methods.
  */
 
-Communicator::Communicator(Timeline& timeline,
-                           CommunicatorMode mode) : mTimeline(&timeline)
-                                                  , mMode(mode)
-                                                  , mPlayerID(0)
-                                                  , mNextPlayerID(1)
-                                                  , mNumClientsExpected(0)
-                                                  , mSocketHandler(*this)
-                                                  , mSimulatingOutage(false)
-                                                  , mIgnoringAuthority(false)
+Communicator::Communicator(Timeline& timeline, CommunicatorMode mode,
+                           Metrics& metrics) : mTimeline(&timeline)
+                                             , mMode(mode)
+                                             , mPlayerID(0)
+                                             , mNextPlayerID(1)
+                                             , mNumClientsExpected(0)
+                                             , mSocketHandler(*this)
+                                             , mSimulatingOutage(false)
+                                             , mIgnoringAuthority(false)
+                                             , mGameclock(NULL)
+                                             , mNextPingSequence(1)
+                                             , mFirstValidPing(1)
+                                             , mLastPingTick(0)
+                                             , mClockEpoch(0)
+                                             , mDeterministic(false)
+                                             , mRepairPending(false)
+                                             , mDedicated(false)
+                                             , mMetricsFile(NULL)
+                                             , mMetricsInterval(0)
+                                             , mLastMetricsTick(0)
+                                             , mMetrics(metrics)
 {
     // If we're a server, assign ourselves a player ID
     if (mode == COMMUNICATOR_MODE_SERVER)
         mPlayerID = mNextPlayerID++;
 }
 
+Communicator::~Communicator()
+{
+    if (mMetricsFile)
+        fclose(mMetricsFile);
+}
+
 void
 Communicator::SetServer(const char* server)
 {
@@ -292,10 +531,14 @@ Communicator::ConnectAsClient()
     mSocketHandler.Add(socket);
 
     // Read the first transmission from the server
-    unsigned openingMessage[3];
-    while (socket->GetInputLength() < sizeof(openingMessage))
+    uint8_t buffer[5 * sizeof(uint32_t)];
+    while (socket->GetInputLength() < sizeof(buffer))
         mSocketHandler.Select();
-    socket->ReadInput((char *)&openingMessage, sizeof(openingMessage));
+    socket->ReadInput((char *)buffer, sizeof(buffer));
+    uint32_t openingMessage[5];
+    WireReader reader(buffer, sizeof(buffer));
+    for (unsigned i = 0; i < 5; ++i)
+        reader.Field(openingMessage[i]);
 
     // verify the magic word
     if (openingMessage[0] != sGrowblesMagic) {
@@ -303,12 +546,24 @@ Communicator::ConnectAsClient()
         exit(-1);
     }
 
+    // verify that we speak the same protocol
+    if (openingMessage[1] != WIRE_PROTOCOL_VERSION) {
+        printf("Server speaks protocol version %u, but we speak %u!\n",
+               openingMessage[1], WIRE_PROTOCOL_VERSION);
+        exit(-1);
+    }
+
     // Set the server's ID
-    socket->SetRemoteID(openingMessage[1]);
+    socket->SetRemoteID(openingMessage[2]);
 
     // Save our player ID
-    mPlayerID = openingMessage[2];
+    mPlayerID = openingMessage[3];
     printf("Assigned player ID %u\n", mPlayerID);
+
+    // Play by the server's rules
+    mDeterministic = (openingMessage[4] & HANDSHAKE_FLAG_DETERMINISTIC) != 0;
+    if (mDeterministic)
+        printf("Server is running in deterministic mode\n");
 }
 
 void
@@ -334,14 +589,29 @@ Communicator::ConnectAsServer()
         mSocketHandler.Select(1,0);
 }
 
+void
+Communicator::AcceptConnection(SOCKET s)
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+
+    // The handler only counts the new socket once it's selected on
+    unsigned numConnections = mSocketHandler.GetNumActiveSockets();
+    mSocketHandler.Adopt(s);
+    while (mSocketHandler.GetNumActiveSockets() < numConnections + 1)
+        mSocketHandler.Select(0, 1000);
+}
+
 void
 Communicator::Synchronize()
 {
-    // If we're simulating an outage, pretend like nothing arrived
-    if (mSimulatingOutage)
+    if (mSocketHandler.GetNumActiveSockets() == 0)
         return;
 
-    if (mSocketHandler.GetNumActiveSockets() == 0)
+    // Send anything the emulated network has finished delivering
+    mSocketHandler.PumpSimulatedNetwork();
+
+    // If we're simulating an outage, pretend like nothing arrived
+    if (mSimulatingOutage)
         return;
     // Queue up any input we might have, but don't wait
     mSocketHandler.Select(0, 0);
@@ -351,26 +621,62 @@ Communicator::Synchronize()
 
         // Get the payload
         Payload incoming;
-        mSocketHandler.ReceivePayload(incoming);
+        unsigned sourceID = mSocketHandler.ReceivePayload(incoming);
 
         // Handle each type
         switch (incoming.type) {
 
-            // Worldstate dumps should only come from the server.
+            // Worldstate dumps should only come from the server. A client
+            // that sends us one is breaking the protocol, and it came off
+            // the network, so we drop it like a malformed payload.
             case PAYLOAD_TYPE_WORLDSTATE:
-                assert(mMode == COMMUNICATOR_MODE_CLIENT);
+                if (mMode != COMMUNICATOR_MODE_CLIENT) {
+                    printf("Received a state dump from player %u. Dropping the "
+                           "connection.\n", sourceID);
+                    mMetrics.Add(METRIC_PROTOCOL_VIOLATIONS);
+                    mSocketHandler.Drop(sourceID);
+                    break;
+                }
+                mMetrics.Add(METRIC_STATE_DUMPS_RECEIVED);
                 if (!mIgnoringAuthority)
                     mTimeline->AddAuthoritativeState(*(WorldState*)incoming.data);
+                mRepairPending = false;
                 break;
 
-            // User inputs can come from anyone. The server forwards received
-            // inputs to everyone else.
+            // User inputs can come from anyone. The server may buffer late
+            // inputs rather than roll back for them.
             case PAYLOAD_TYPE_USERINPUT:
-                mTimeline->AddInput(*(UserInput*)incoming.data);
-                if (mMode == COMMUNICATOR_MODE_SERVER)
-                    mSocketHandler.SendToAllExcept(incoming,
-                                                   ((UserInput*)incoming.data)
-                                                   ->playerID);
+                mMetrics.Add(METRIC_INPUTS_RECEIVED);
+                if (mMode == COMMUNICATOR_MODE_SERVER && mGameclock) {
+                    unsigned avoided = mInputBuffer.GetRollbacksAvoided();
+                    if (mInputBuffer.Add(*(UserInput*)incoming.data, mGameclock->Now())) {
+                        mMetrics.Add(METRIC_INPUTS_BUFFERED);
+
+                        // Only late inputs would have cost a rollback. The
+                        // rest are on time, queued behind one that wasn't.
+                        if (mInputBuffer.GetRollbacksAvoided() != avoided)
+                            mMetrics.Add(METRIC_ROLLBACKS_AVOIDED);
+                        break;
+                    }
+                }
+                ApplyRemoteInput(*(UserInput*)incoming.data);
+                break;
+
+            // Clock synchronization goes both ways
+            case PAYLOAD_TYPE_PING:
+                HandlePing(*(ClockPing*)incoming.data, sourceID);
+                break;
+            case PAYLOAD_TYPE_PONG:
+                HandlePong(*(ClockPing*)incoming.data, sourceID);
+                break;
+
+            // State hashes go both ways in deterministic mode
+            case PAYLOAD_TYPE_STATEHASH:
+                HandleStateHash(*(StateHash*)incoming.data);
+                break;
+
+            // Malformed, and already dealt with
+            case PAYLOAD_TYPE_NONE:
                 break;
 
             default:
@@ -379,27 +685,236 @@ Communicator::Synchronize()
         }
     }
 
+    // Apply any inputs that were stamped ahead of us, or that we've been
+    // buffering, and are now due
+    mTimeline->ApplyDueInputs();
+    ReleaseBufferedInputs();
+
+    // Keep our clocks in line
+    UpdateClockSync();
+
     // If we're the server, send any authoritative state updates
     if (mMode == COMMUNICATOR_MODE_SERVER)
         mTimeline->SendUpdates(*this);
+
+    // Report how we're doing
+    WriteMetrics();
+}
+
+void
+Communicator::ApplyRemoteInput(UserInput& input)
+{
+    mTimeline->AddInput(input);
+
+    // The server forwards received inputs to everyone else
+    if (mMode == COMMUNICATOR_MODE_SERVER) {
+        Payload outgoing(PAYLOAD_TYPE_USERINPUT, &input);
+        mSocketHandler.SendToAllExcept(outgoing, input.playerID);
+    }
+}
+
+void
+Communicator::ReleaseBufferedInputs()
+{
+    if (mMode != COMMUNICATOR_MODE_SERVER || !mGameclock)
+        return;
+
+    // Released inputs are restamped to the current tick, so every peer
+    // applies them at the same tick we do.
+    UserInput input(0, 0);
+    while (mInputBuffer.PopDue(mGameclock->Now(), input))
+        ApplyRemoteInput(input);
+}
+
+void
+Communicator::SetInputBufferMaxDepth(unsigned maxDepth)
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+    assert(!maxDepth || !mDeterministic); // See SetDeterministic()
+    mInputBuffer.SetMaxDepth(maxDepth);
+}
+
+void
+Communicator::SetMetricsLog(const char* path, unsigned intervalTicks)
+{
+    assert(!mMetricsFile);
+    mMetricsFile = fopen(path, "a");
+    if (!mMetricsFile) {
+        printf("Couldn't open metrics log %s!\n", path);
+        return;
+    }
+    mMetricsInterval = intervalTicks ? intervalTicks : 1;
+}
+
+void
+Communicator::WriteMetrics()
+{
+    if (!mMetricsFile || !mGameclock)
+        return;
+    if (mGameclock->Now() < mLastMetricsTick + mMetricsInterval)
+        return;
+
+    UpdateGauges();
+    mMetrics.WriteJSON(mMetricsFile,
+                       mMode == COMMUNICATOR_MODE_SERVER ? "server" : "client",
+                       mPlayerID, mGameclock->Now());
+    mLastMetricsTick = mGameclock->Now();
+}
+
+void
+Communicator::UpdateGauges()
+{
+    mMetrics.Set(METRIC_GAUGE_INPUTS_HELD, mInputBuffer.GetNumHeld());
+    mMetrics.Set(METRIC_GAUGE_INPUT_BUFFER_DEPTH, mInputBuffer.GetLargestDepth());
+    if (mGameclock)
+        mMetrics.Set(METRIC_GAUGE_CLOCK_SKEW_PPM,
+                     (int64_t)(mGameclock->GetRateSkew() * 1000000.0f));
+}
+
+void
+Communicator::UpdateClockSync()
+{
+    // Nothing to do until we have a clock
+    if (!mGameclock)
+        return;
+
+    // If our clock has been Set() since we last looked, all our
+    // measurements are against a clock that no longer exists.
+    if (mGameclock->GetEpoch() != mClockEpoch) {
+        mClockEpoch = mGameclock->GetEpoch();
+        for (std::map<unsigned, ClockSync>::iterator it = mClockSync.begin();
+             it != mClockSync.end(); ++it)
+            it->second.Reset();
+        mFirstValidPing = mNextPingSequence;
+        mLastPingTick = mGameclock->Now();
+        mGameclock->SetRateSkew(0.0f);
+    }
+
+    // Ping everybody every so often. Servers ping each client so they know
+    // each one's round trip time, and clients ping the server.
+    if (mGameclock->Now() >= mLastPingTick + CLOCKSYNC_PING_INTERVAL) {
+        ClockPing ping;
+        ping.sequence = mNextPingSequence++;
+        ping.originMicros = mGameclock->NowMicros();
+        Payload outgoing(PAYLOAD_TYPE_PING, &ping);
+        mSocketHandler.SendToAll(outgoing);
+        mLastPingTick = mGameclock->Now();
+    }
+
+    // Clients slew their clock towards the server's, plus enough lead that
+    // our inputs arrive just in time. The server's clock is the reference,
+    // so it never adjusts.
+    if (mMode == COMMUNICATOR_MODE_CLIENT && mClockSync.size() == 1) {
+        ClockSync& sync = mClockSync.begin()->second;
+        double lead = sync.GetRTTMicros() / 2.0 + CLOCKSYNC_LEAD_MARGIN_US;
+        mGameclock->SetRateSkew(sync.SuggestSkew(mGameclock->GetSkewAdjustmentMicros(),
+                                                 lead));
+    }
+}
+
+void
+Communicator::HandlePing(ClockPing& ping, unsigned sourceID)
+{
+    // We can't answer without a clock
+    if (!mGameclock)
+        return;
+
+    // Reply straight away with our time
+    ping.replyMicros = mGameclock->NowMicros();
+    Payload outgoing(PAYLOAD_TYPE_PONG, &ping);
+    mSocketHandler.SendTo(outgoing, sourceID);
+}
+
+void
+Communicator::HandlePong(ClockPing& pong, unsigned sourceID)
+{
+    // Ignore pongs for pings from a previous clock epoch
+    if (!mGameclock || pong.sequence < mFirstValidPing)
+        return;
+
+    uint64_t now = mGameclock->NowMicros();
+    if (now >= pong.originMicros)
+        mMetrics.Observe(METRIC_HIST_RTT_MS, (now - pong.originMicros) / 1000);
+    mClockSync[sourceID].AddSample(pong.originMicros, now,
+                                   pong.replyMicros,
+                                   mGameclock->GetSkewAdjustmentMicros());
+}
+
+double
+Communicator::GetRTTMicros(unsigned playerID)
+{
+    std::map<unsigned, ClockSync>::iterator it = mClockSync.find(playerID);
+    if (it == mClockSync.end() || !it->second.HasEstimate())
+        return 0.0;
+    return it->second.GetRTTMicros();
 }
 
 void
 Communicator::SendAuthoritativeState(WorldState& state)
 {
     assert(mMode == COMMUNICATOR_MODE_SERVER);
+    mMetrics.Add(METRIC_STATE_DUMPS_SENT);
     Payload payload(PAYLOAD_TYPE_WORLDSTATE, &state);
     mSocketHandler.SendToAll(payload);
 }
 
+void
+Communicator::SendStateHash(StateHash& hash)
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+    mMetrics.Add(METRIC_STATE_HASHES_SENT);
+    Payload payload(PAYLOAD_TYPE_STATEHASH, &hash);
+    mSocketHandler.SendToAll(payload);
+}
+
+void
+Communicator::SetDeterministic(bool deterministic)
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+    assert(!deterministic || !mInputBuffer.IsEnabled()); // See SetDeterministic()
+    mDeterministic = deterministic;
+}
+
+void
+Communicator::SetDedicated(bool dedicated)
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+    mDedicated = dedicated;
+}
+
+void
+Communicator::HandleStateHash(StateHash& hash)
+{
+    // Servers only get these when a client wants a repair
+    if (mMode == COMMUNICATOR_MODE_SERVER) {
+        if (hash.repair)
+            mTimeline->RequestRepair();
+        return;
+    }
+
+    // Clients check the server's hashes against their own state. If we've
+    // drifted, ask for the real thing.
+    if (mIgnoringAuthority || mTimeline->CheckStateHash(hash) || mRepairPending)
+        return;
+    StateHash request;
+    request.tick = hash.tick;
+    request.hash = 0;
+    request.repair = true;
+    Payload outgoing(PAYLOAD_TYPE_STATEHASH, &request);
+    mSocketHandler.SendToAll(outgoing);
+    mMetrics.Add(METRIC_REPAIRS_REQUESTED);
+    mRepairPending = true;
+}
+
 void
 Communicator::Bootstrap(WorldModel& world, Gameclock& clock)
 {
     // If we're the server
     if (mMode == COMMUNICATOR_MODE_SERVER) {
 
-        // Add the server player
-        world.AddPlayer(mPlayerID);
+        // Add the server player, unless we're only refereeing
+        if (!mDedicated)
+            world.AddPlayer(mPlayerID);
 
         // Add the client players
         mSocketHandler.AddPlayers(world);
@@ -413,19 +928,33 @@ Communicator::Bootstrap(WorldModel& world, Gameclock& clock)
     // If we're the client
     else {
 
-        // Receive the worldstate payload
+        // Receive the worldstate payload. We poll rather than block, because
+        // an emulated network may be holding a frame that has already arrived.
         Payload received;
         while (!mSocketHandler.HasPayload())
-            mSocketHandler.Select();
+            mSocketHandler.Select(0, 1000);
         mSocketHandler.ReceivePayload(received);
-        assert(received.type == PAYLOAD_TYPE_WORLDSTATE);
+        if (received.type != PAYLOAD_TYPE_WORLDSTATE) {
+            printf("Didn't get a starting world state from the server!\n");
+            exit(-1);
+        }
 
         // Apply it
         world.SetState(*(WorldState*)received.data);
     }
 
+    // Everybody has to agree on how to simulate before we start
+    world.SetDeterministic(mDeterministic);
+    mTimeline->SetDeterministic(mDeterministic);
+
     // Start our timeline
     mTimeline->Init(world, clock, mMode);
+
+    // Remember the clock so that we can keep it in sync
+    mGameclock = &clock;
+    mClockEpoch = clock.GetEpoch();
+    mLastPingTick = clock.Now();
+    mLastMetricsTick = clock.Now();
 }
 
 void
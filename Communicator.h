@@ -2,6 +2,13 @@
 #define COMMUNICATOR_H
 
 #include "UserInput.h"
+#include "WireFormat.h"
+#include "NetworkSimulator.h"
+#include "ClockSync.h"
+#include "InputBuffer.h"
+#include "Metrics.h"
+#include <map>
+#include <vector>
 #include <Sockets/SocketHandler.h>
 #include <Sockets/TcpSocket.h>
 
@@ -9,6 +16,9 @@
 #define TCP_INPUT_BUFFER_SIZE 100000
 #define TCP_OUTPUT_BUFFER_SIZE 16000
 
+// Flags in the server's opening message
+#define HANDSHAKE_FLAG_DETERMINISTIC 0x1
+
 class WorldModel;
 class WorldState;
 class UserInput;
@@ -18,12 +28,6 @@ class Communicator;
 class Timeline;
 class Gameclock;
 
-typedef enum {
-    PAYLOAD_TYPE_NONE = 0,
-    PAYLOAD_TYPE_WORLDSTATE,
-    PAYLOAD_TYPE_USERINPUT
-} PayloadType;
-
 struct Payload {
 
     Payload() : type(PAYLOAD_TYPE_NONE), data(NULL), ownData(false) {};
@@ -31,8 +35,12 @@ struct Payload {
 
     ~Payload();
 
-    // Gets the data size for a given type
-    unsigned GetDataSize();
+    // Frees our data, if we own it, and leaves us empty.
+    void Clear();
+
+    // Allocates a default-constructed message of our type, which we then
+    // own.
+    void AllocateData();
 
     // The type of the payload
     PayloadType type;
@@ -74,16 +82,41 @@ class GrowblesSocket : public TcpSocket {
     bool HasPayload();
 
     // Gets a payload. Caller must deallocate.
-    // HasPayload() must return true first;
-    void GetPayload(Payload& payload);
+    // HasPayload() must return true first. Returns false, leaving the
+    // payload empty, if the body doesn't decode, in which case the
+    // connection is dropped.
+    bool GetPayload(Payload& payload);
+
+    // Sends any outgoing frames that the emulated network has finished
+    // delivering. Only does anything when the handler is emulating a network.
+    void FlushSimulated(double nowMS);
 
     protected:
 
+    // Do we have a complete frame in the socket's input buffer?
+    bool HasPayloadOnWire();
+
+    // Sets up our emulated links from the handler's conditions
+    void ConfigureLanes();
+
+    // Where our communicator records metrics
+    Metrics& GetMetrics();
+
     // The ID of the remote player this socket connects us to.
     unsigned mRemoteID;
 
-    // Incoming payload
+    // Incoming payload, and the size of its encoded body
     Payload mIncoming;
+    unsigned mIncomingSize;
+
+    // Scratch space for encoding and decoding payloads
+    std::vector<uint8_t> mWireBuffer;
+
+    // Emulated network links, used when the handler is emulating a network
+    NetworkLane mOutbound;
+    NetworkLane mInbound;
+    bool mLanesConfigured;
+    std::vector<uint8_t> mSimFrame;
 };
 
 class GrowblesHandler : public SocketHandler {
@@ -108,25 +141,63 @@ class GrowblesHandler : public SocketHandler {
     // Sends a payload to a specific player
     void SendTo(Payload& payload, unsigned playerID);
 
+    // Drops the connection to a specific player. Nothing more is read
+    // from it.
+    void Drop(unsigned playerID);
+
     // Do any of the sockets have a payload?
     bool HasPayload();
 
     // Gets any available payload, returning the playerID of the source
-    // HasPayload() must return true.
+    // HasPayload() must return true. A payload that doesn't decode is
+    // dropped along with its connection, and comes back empty
+    // (PAYLOAD_TYPE_NONE).
     unsigned ReceivePayload(Payload& payload);
 
     // Gets our Communicator
     Communicator* GetCommunicator() { return mCommunicator; };
 
+    // Adds a connection accepted somewhere else, the way a ListenSocket
+    // would add one it accepted itself.
+    //
+    // Should only be called on the server.
+    void Adopt(SOCKET s);
+
     // For some dumb reason SocketHandler has a staging area for sockets (m_add),
     // and includes the number of staged sockets in GetCount(). We want to know
     // how many sockets are actually active.
     unsigned GetNumActiveSockets() { return m_sockets.size(); };
 
+    /*
+     * Network emulation. Every connection gets its own pair of links with
+     * the given conditions, seeded deterministically from seed and the
+     * remote player ID.
+     */
+    void SetNetworkConditions(const NetworkConditions& outbound,
+                              const NetworkConditions& inbound,
+                              unsigned seed);
+    bool IsSimulatingNetwork() { return mSimulatingNetwork; };
+    void GetNetworkConditions(NetworkConditions& outbound,
+                              NetworkConditions& inbound,
+                              unsigned& seed);
+
+    // Milliseconds on the emulated network's clock
+    double GetSimulationTimeMS() { return 1000.0 * mSimClock.GetElapsedTime(); };
+
+    // Releases outgoing frames the emulated network has delivered
+    void PumpSimulatedNetwork();
+
     protected:
 
     // The Communicator possessing this handler
     Communicator* mCommunicator;
+
+    // Network emulation
+    bool mSimulatingNetwork;
+    NetworkConditions mSimOutbound;
+    NetworkConditions mSimInbound;
+    unsigned mSimSeed;
+    sf::Clock mSimClock;
 };
 
 typedef enum {
@@ -142,9 +213,15 @@ class Communicator {
     public:
 
     /*
-     * Constructor.
+     * Constructor. Network metrics go to the given registry.
      */
-    Communicator(Timeline& timeline, CommunicatorMode mode);
+    Communicator(Timeline& timeline, CommunicatorMode mode,
+                 Metrics& metrics = Metrics::Global());
+
+    /*
+     * Destructor.
+     */
+    ~Communicator();
 
     /*
      * Sets the server IP address. Only valid for client mode.
@@ -167,6 +244,13 @@ class Communicator {
      */
     void Connect();
 
+    /*
+     * Takes over a connection someone else accepted (see MatchHost.h), and
+     * greets it as if we'd accepted it ourselves. Only valid for the
+     * server, in place of Connect().
+     */
+    void AcceptConnection(SOCKET s);
+
     /*
      * For clients: Send any new input to the server, apply world updates.
      * For server: Handle input updates, send world updates.
@@ -178,6 +262,33 @@ class Communicator {
      */
     void SendAuthoritativeState(WorldState& state);
 
+    /*
+     * Sends a state hash to clients. Only valid for the server.
+     */
+    void SendStateHash(StateHash& hash);
+
+    /*
+     * Runs the game in deterministic mode (see Determinism.h). Only valid
+     * for the server, before Connect(); clients learn it from the server.
+     *
+     * Not compatible with the input buffer. A buffered input is restamped,
+     * and its sender keeps the original until a full state dump corrects
+     * it, which in deterministic mode only comes after a desync.
+     */
+    void SetDeterministic(bool deterministic);
+    bool IsDeterministic() { return mDeterministic; };
+
+    /*
+     * Dedicated servers only referee; they don't put a player of their own
+     * in the world. Only valid for the server, before Bootstrap().
+     */
+    void SetDedicated(bool dedicated);
+
+    /*
+     * Gets the number of players we're still connected to.
+     */
+    unsigned GetNumConnections() { return mSocketHandler.GetNumActiveSockets(); };
+
     /*
      * Bootstraps the client and server and gets everyone on the same page.
      */
@@ -209,8 +320,77 @@ class Communicator {
      */
     void SetIgnoringAuthoritativeDumps(bool ignore) { mIgnoringAuthority = ignore; };
 
+    /*
+     * Emulates a bad network on our connections. Use a fixed seed to get
+     * the same delays every run.
+     */
+    void SetNetworkConditions(const NetworkConditions& outbound,
+                              const NetworkConditions& inbound,
+                              unsigned seed)
+    { mSocketHandler.SetNetworkConditions(outbound, inbound, seed); };
+
+    /*
+     * Gets the smoothed round trip time to a connected player, in
+     * microseconds. Zero if we don't have an estimate yet.
+     */
+    double GetRTTMicros(unsigned playerID);
+
+    /*
+     * Server-side input jitter buffer. Late inputs are held for up to
+     * maxDepth ticks and applied at the current tick, instead of forcing a
+     * rollback. Zero (the default) disables it. Only valid for servers that
+     * aren't deterministic (see SetDeterministic()).
+     */
+    void SetInputBufferMaxDepth(unsigned maxDepth);
+
+    /*
+     * Appends a snapshot of our metrics (see Metrics.h) to the given file
+     * as a JSON line every intervalTicks ticks.
+     */
+    void SetMetricsLog(const char* path, unsigned intervalTicks);
+
+    /*
+     * Brings our gauges (held inputs, buffer depth, clock skew) up to date,
+     * ready for a snapshot.
+     */
+    void UpdateGauges();
+
     protected:
 
+    /*
+     * Applies an input from the network to our timeline, and if we're the
+     * server, forwards it to everybody else.
+     */
+    void ApplyRemoteInput(UserInput& input);
+
+    /*
+     * Applies any buffered inputs that are now due.
+     */
+    void ReleaseBufferedInputs();
+
+    /*
+     * Writes a metrics snapshot, if one is due.
+     */
+    void WriteMetrics();
+
+    /*
+     * Sends pings when they're due, and on clients, slews our clock towards
+     * the server's.
+     */
+    void UpdateClockSync();
+
+    /*
+     * Handles pings and pongs from a remote player.
+     */
+    void HandlePing(ClockPing& ping, unsigned sourceID);
+    void HandlePong(ClockPing& pong, unsigned sourceID);
+
+    /*
+     * Handles state hashes: checks them on clients, and on servers, takes
+     * them as requests for a full state dump.
+     */
+    void HandleStateHash(StateHash& hash);
+
     /*
      * Connection routines for client and server.
      */
@@ -243,6 +423,38 @@ class Communicator {
 
     // Are we ignoring authoritative dumps?
     bool mIgnoringAuthority;
+
+    // Our game clock. Set at Bootstrap().
+    Gameclock* mGameclock;
+
+    // Clock synchronization state for each remote player
+    std::map<unsigned, ClockSync> mClockSync;
+
+    // Ping bookkeeping. Pongs for pings sent before the clock was last Set()
+    // are meaningless, so we ignore anything below mFirstValidPing.
+    uint32_t mNextPingSequence;
+    uint32_t mFirstValidPing;
+    unsigned mLastPingTick;
+    unsigned mClockEpoch;
+
+    // Deterministic mode. Clients ask for a repair at most once until the
+    // state dump arrives.
+    bool mDeterministic;
+    bool mRepairPending;
+
+    // Do we leave our own player out of the world?
+    bool mDedicated;
+
+    // Jitter buffer for inputs from clients. Only used by servers.
+    InputJitterBuffer mInputBuffer;
+
+    // Metrics log
+    FILE* mMetricsFile;
+    unsigned mMetricsInterval;
+    unsigned mLastMetricsTick;
+
+    // Where we record metrics
+    Metrics& mMetrics;
 };
 
 #endif /* COMMUNICATOR_H */
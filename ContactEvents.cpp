@@ -0,0 +1,168 @@
+#include "ContactEvents.h"
+
+/*
+ * Bullet calls this for every contact point its narrowphase adds or
+ * refreshes. The callback is a global, shared by every world, so the
+ * objects' shapes tell us which world's queue the contact belongs to.
+ */
+static bool
+ContactProcessed(btManifoldPoint& point, void* body0, void* body1)
+{
+    btCollisionObject* object0 = static_cast<btCollisionObject*>(body0);
+    btCollisionObject* object1 = static_cast<btCollisionObject*>(body1);
+    ContactQueue* queue =
+        static_cast<ContactQueue*>(object0->getCollisionShape()->getUserPointer());
+    if (!queue)
+        queue = static_cast<ContactQueue*>(object1->getCollisionShape()->getUserPointer());
+    if (!queue || !queue->IsActive())
+        return false;
+
+    queue->AddContact(object0->getUserPointer(),
+                      object1->getUserPointer(),
+                      point.getDistance());
+    return false;
+}
+
+ContactQueue::ContactQueue() : mActive(false)
+{
+    // A tick rarely sees more than a handful of pairs touching
+    mEvents.reserve(16);
+}
+
+void
+ContactQueue::BeginTick()
+{
+    mEvents.clear();
+}
+
+void
+ContactQueue::Watch(btCollisionObject* object)
+{
+    gContactProcessedCallback = ContactProcessed;
+    object->getCollisionShape()->setUserPointer(this);
+}
+
+bool
+ContactQueue::Classify(void* tag0, void* tag1, ContactEvent& eventOut,
+                       float& signOut)
+{
+    // Put the player first, if there is one
+    signOut = 1.0f;
+    if (ContactTagKind(tag0) != CONTACT_KIND_PLAYER) {
+        void* swap = tag0;
+        tag0 = tag1;
+        tag1 = swap;
+        signOut = -signOut;
+    }
+    if (ContactTagKind(tag0) != CONTACT_KIND_PLAYER)
+        return false;
+
+    unsigned playerID = ContactTagIndex(tag0);
+    unsigned otherIndex = ContactTagIndex(tag1);
+    switch (ContactTagKind(tag1)) {
+        case CONTACT_KIND_PLAYER:
+            eventOut.type = CONTACT_EVENT_PLAYER_PLAYER;
+            eventOut.playerID = MIN(playerID, otherIndex);
+            eventOut.otherIndex = MAX(playerID, otherIndex);
+            if (eventOut.playerID != playerID)
+                signOut = -signOut;
+            return true;
+        case CONTACT_KIND_RING:
+            eventOut.type = CONTACT_EVENT_PLAYER_RING;
+            eventOut.playerID = playerID;
+            eventOut.otherIndex = otherIndex;
+            return true;
+        default:
+            return false;
+    }
+}
+
+ContactEvent*
+ContactQueue::Find(const ContactEvent& event)
+{
+    for (unsigned i = 0; i < mEvents.size(); ++i) {
+        ContactEvent& existing = mEvents[i];
+        if (existing.type == event.type &&
+            existing.playerID == event.playerID &&
+            existing.otherIndex == event.otherIndex)
+            return &existing;
+    }
+    return NULL;
+}
+
+void
+ContactQueue::AddContact(void* tag0, void* tag1, float distance)
+{
+    if (distance >= CONTACT_EVENT_DISTANCE)
+        return;
+
+    ContactEvent event;
+    float sign;
+    if (!Classify(tag0, tag1, event, sign))
+        return;
+    event.depth = -distance;
+    event.numContacts = 1;
+    event.impulse[0] = event.impulse[1] = event.impulse[2] = 0.0f;
+
+    // Merge with an event we already have for this pair
+    ContactEvent* existing = Find(event);
+    if (existing) {
+        existing->depth = MAX(existing->depth, event.depth);
+        ++existing->numContacts;
+        return;
+    }
+    mEvents.push_back(event);
+}
+
+void
+ContactQueue::AddImpulse(void* tag0, void* tag1, float x, float y, float z)
+{
+    ContactEvent event;
+    float sign;
+    if (!Classify(tag0, tag1, event, sign))
+        return;
+    ContactEvent* existing = Find(event);
+    if (!existing)
+        return;
+    existing->impulse[0] += sign * x;
+    existing->impulse[1] += sign * y;
+    existing->impulse[2] += sign * z;
+}
+
+void
+ContactQueue::AddImpulses(btDispatcher* dispatcher)
+{
+    // Only pairs the broadphase let through have manifolds, so this costs
+    // as much as there are contacts
+    for (int i = 0; i < dispatcher->getNumManifolds(); ++i) {
+        btPersistentManifold* manifold = dispatcher->getManifoldByIndexInternal(i);
+        if (manifold->getNumContacts() == 0)
+            continue;
+
+        // The normal points from the second body to the first, so the
+        // first is pushed along it
+        btVector3 impulse(0, 0, 0);
+        for (int j = 0; j < manifold->getNumContacts(); ++j) {
+            const btManifoldPoint& point = manifold->getContactPoint(j);
+            impulse += point.m_normalWorldOnB * point.getAppliedImpulse();
+        }
+        if (impulse.length2() == 0.0f)
+            continue;
+        btCollisionObject* object0 = static_cast<btCollisionObject*>(manifold->getBody0());
+        btCollisionObject* object1 = static_cast<btCollisionObject*>(manifold->getBody1());
+        AddImpulse(object0->getUserPointer(), object1->getUserPointer(),
+                   impulse.x(), impulse.y(), impulse.z());
+    }
+}
+
+bool
+ContactQueue::HasEvent(ContactEventType type, unsigned playerID) const
+{
+    for (unsigned i = 0; i < mEvents.size(); ++i)
+        if (mEvents[i].type == type &&
+            (mEvents[i].playerID == playerID ||
+             (type == CONTACT_EVENT_PLAYER_PLAYER &&
+              mEvents[i].otherIndex == playerID)))
+            return true;
+    return false;
+}
@@ -0,0 +1,150 @@
+#ifndef CONTACTEVENTS_H
+#define CONTACTEVENTS_H
+
+#include "Framework.h"
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Contact events.
+ *
+ * Rather than scanning every manifold after each substep, we let Bullet
+ * tell us about contacts as its narrowphase processes them. Each collision
+ * object carries a tag in its user pointer saying what it is, so sorting a
+ * contact into an event is a couple of integer compares, and its shape
+ * carries the queue of the world it's in, so that worlds stepping on
+ * separate threads each hear only about their own. Contacts between
+ * the same pair of objects during one tick are merged, and the resulting
+ * list is what gameplay, audio and haptics look at.
+ */
+
+// Contacts further apart than this aren't touching
+#define CONTACT_EVENT_DISTANCE 1.0f
+
+/*
+ * What a collision object is.
+ */
+typedef enum {
+    CONTACT_KIND_NONE = 0,
+    CONTACT_KIND_PLAYER,
+    CONTACT_KIND_RING
+} ContactKind;
+
+/*
+ * Tags for collision object user pointers. The kind goes in the low bits
+ * and the index (player ID or ring number) above it, so no storage is
+ * needed.
+ */
+inline void* ContactTag(ContactKind kind, unsigned index)
+{ return (void*)(((uintptr_t) index << 2) | (uintptr_t) kind); }
+inline ContactKind ContactTagKind(void* tag)
+{ return (ContactKind)((uintptr_t) tag & 3); }
+inline unsigned ContactTagIndex(void* tag)
+{ return (unsigned)((uintptr_t) tag >> 2); }
+
+typedef enum {
+    CONTACT_EVENT_PLAYER_PLAYER = 0,
+    CONTACT_EVENT_PLAYER_RING
+} ContactEventType;
+
+/*
+ * One pair of objects touching during a tick.
+ */
+struct ContactEvent {
+
+    // What hit what
+    ContactEventType type;
+
+    // The player involved. For player-player events, the lower ID.
+    unsigned playerID;
+
+    // The other player's ID, or the ring number
+    unsigned otherIndex;
+
+    // Deepest penetration seen this tick (positive means overlapping)
+    float depth;
+
+    // Number of contact points merged into this event
+    unsigned numContacts;
+
+    // Total impulse the solver applied to playerID through this contact
+    // this tick, in world coordinates. The other player got the opposite.
+    float impulse[3];
+};
+
+class ContactQueue {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    ContactQueue();
+
+    /*
+     * Starts collecting for a new tick. Events from the last tick are
+     * discarded.
+     */
+    void BeginTick();
+
+    /*
+     * Has Bullet report contacts involving the given object to us. We keep
+     * ourselves in the user pointer of its collision shape, so the shape
+     * mustn't be shared with an object in another world.
+     */
+    void Watch(btCollisionObject* object);
+
+    /*
+     * Starts or stops collecting. Contacts Bullet reports while we aren't
+     * collecting are ignored.
+     */
+    void SetActive(bool active) { mActive = active; };
+    bool IsActive() const { return mActive; };
+
+    /*
+     * Records a contact between two tagged objects.
+     */
+    void AddContact(void* tag0, void* tag1, float distance);
+
+    /*
+     * Adds to the impulse of the event for two tagged objects, given the
+     * impulse on the first. Contacts we have no event for are ignored.
+     */
+    void AddImpulse(void* tag0, void* tag1, float x, float y, float z);
+
+    /*
+     * Adds the impulses from every contact in Bullet's manifolds. Call
+     * after each substep: that's as long as the solver's numbers last.
+     */
+    void AddImpulses(btDispatcher* dispatcher);
+
+    /*
+     * The events of the current tick.
+     */
+    const std::vector<ContactEvent>& GetEvents() const { return mEvents; };
+
+    /*
+     * Does the given player touch anyone or anything of the given type?
+     */
+    bool HasEvent(ContactEventType type, unsigned playerID) const;
+
+    protected:
+
+    /*
+     * Works out which event two tagged objects belong to. Returns false if
+     * they aren't a pair we track. sign is -1 if the objects come in the
+     * opposite order to the event's.
+     */
+    static bool Classify(void* tag0, void* tag1, ContactEvent& eventOut,
+                         float& signOut);
+
+    /*
+     * Finds the event for a pair, or NULL.
+     */
+    ContactEvent* Find(const ContactEvent& event);
+
+    std::vector<ContactEvent> mEvents;
+    bool mActive;
+};
+
+#endif /* CONTACTEVENTS_H */
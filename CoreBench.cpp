@@ -0,0 +1,375 @@
+#include "WorldModel.h"
+#include "Timeline.h"
+#include "Communicator.h"
+#include "WireFormat.h"
+#include "SceneGraph.h"
+#include "Matrix.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*
+ * Core micro-benchmarks.
+ *
+ * Times the paths every tick or every frame goes through, each on its own:
+ * stepping the world, getting and setting its state, finding and pruning
+ * keyframes, framing payloads as the socket does, matrix products, and
+ * turning the shipped meshes into vertex arrays.
+ *
+ * Results are printed as JSON, one entry per benchmark, with names that
+ * don't change from one commit to the next, so that runs can be saved and
+ * compared:
+ *
+ *   {"bench":"corebench","results":[
+ *    {"name":"worldmodel.single_step.8_players","iterations":600,"ns_per_op":...},
+ *    ...]}
+ *
+ * Usage: corebench [file]. With a file, the JSON goes there rather than to
+ * stdout; warnings go to stderr either way. Run it from the top of the
+ * tree, where scenefiles/ is.
+ */
+
+// Ticks to settle in before measuring, and ticks to measure
+#define BENCH_WARMUP_TICKS 60
+#define BENCH_STEP_TICKS 600
+
+// State gets and sets
+#define BENCH_STATES 2000
+
+// Keyframe lookups, and rounds of filling and pruning a timeline
+#define BENCH_FINDS 200000
+#define BENCH_PRUNE_ROUNDS 20
+
+// Payloads framed, and matrix products
+#define BENCH_FRAMES 100000
+#define BENCH_PRODUCTS 2000000
+
+// Times each mesh file is converted
+#define BENCH_MESH_REPEATS 20
+
+static const unsigned sPlayerCounts[] = { 2, 8, 32 };
+static const unsigned sNumPlayerCounts = sizeof(sPlayerCounts) / sizeof(sPlayerCounts[0]);
+
+// Timelines as long as a server keeps, and as long as a laggy client does
+static const unsigned sKeyframeCounts[] = { 16, 128 };
+static const unsigned sNumKeyframeCounts = sizeof(sKeyframeCounts) / sizeof(sKeyframeCounts[0]);
+
+static const char* sMeshFiles[] = { "armadillo.3ds", "sphere.3ds", "worldmesh.3ds", "ring1.3DS" };
+static const unsigned sNumMeshFiles = sizeof(sMeshFiles) / sizeof(sMeshFiles[0]);
+
+/*
+ * Results, in the order they're measured.
+ */
+struct BenchResult {
+    std::string name;
+    unsigned iterations;
+    double nanosPerOp;
+};
+
+static std::vector<BenchResult> sResults;
+
+/*
+ * Records a result, from a clock started when the iterations were.
+ */
+static void Report(const char* name, sf::Clock& clock, unsigned iterations)
+{
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nanosPerOp = 1e9 * clock.GetElapsedTime() / iterations;
+    sResults.push_back(result);
+}
+
+// Somewhere for results to go, so that the work isn't optimised away
+static volatile float sSink;
+
+/*
+ * Now and again, has each player start or stop moving in some direction.
+ */
+static void Wander(WorldModel& world, unsigned numPlayers)
+{
+    for (unsigned playerID = 1; playerID <= numPlayers; ++playerID) {
+        if (rand() % 8)
+            continue;
+        UserInput input(playerID, world.GetCurrentTimestamp());
+        unsigned direction = USERINPUT_INDEX_UP + rand() % 4;
+        bool isBegin = rand() % 2;
+        input.inputs = GEN_INPUT_MASK(direction, isBegin);
+        world.ApplyInput(input);
+    }
+}
+
+/*
+ * A headless world with players that have been moving about for a while.
+ */
+static WorldModel* MakeWorld(unsigned numPlayers)
+{
+    WorldModel* world = new WorldModel;
+    world->InitHeadless();
+    for (unsigned playerID = 1; playerID <= numPlayers; ++playerID)
+        world->AddPlayer(playerID);
+    for (unsigned i = 0; i < BENCH_WARMUP_TICKS; ++i) {
+        Wander(*world, numPlayers);
+        world->SingleStep();
+    }
+    return world;
+}
+
+static void BenchWorld()
+{
+    char name[64];
+    for (unsigned run = 0; run < sNumPlayerCounts; ++run) {
+        unsigned numPlayers = sPlayerCounts[run];
+        WorldModel* world = MakeWorld(numPlayers);
+
+        // The inputs are made up front, so that only the steps are timed
+        std::vector<UserInput> inputs;
+        for (unsigned i = 0; i < BENCH_STEP_TICKS; ++i) {
+            UserInput input(1 + rand() % numPlayers, world->GetCurrentTimestamp() + i);
+            input.inputs = GEN_INPUT_MASK(USERINPUT_INDEX_UP + rand() % 4, rand() % 2);
+            inputs.push_back(input);
+        }
+        sf::Clock clock;
+        for (unsigned i = 0; i < BENCH_STEP_TICKS; ++i) {
+            world->ApplyInput(inputs[i]);
+            world->SingleStep();
+        }
+        sprintf(name, "worldmodel.single_step.%u_players", numPlayers);
+        Report(name, clock, BENCH_STEP_TICKS);
+
+        WorldState state;
+        clock.Reset();
+        for (unsigned i = 0; i < BENCH_STATES; ++i)
+            world->GetState(state);
+        sprintf(name, "worldmodel.get_state.%u_players", numPlayers);
+        Report(name, clock, BENCH_STATES);
+
+        clock.Reset();
+        for (unsigned i = 0; i < BENCH_STATES; ++i)
+            world->SetState(state);
+        sprintf(name, "worldmodel.set_state.%u_players", numPlayers);
+        Report(name, clock, BENCH_STATES);
+
+        delete world;
+    }
+}
+
+/*
+ * A timeline we can reach into. FindKeyframe() and Prune() are for the
+ * timeline's own use, so we time them from a subclass.
+ */
+class BenchTimeline : public Timeline {
+
+    public:
+
+    /*
+     * Adds a keyframe for each of the next count ticks, as a server does.
+     */
+    void Fill(WorldModel& world, unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i) {
+            world.SingleStep();
+            GenerateCurrentKeyframe();
+        }
+    }
+
+    unsigned First() { return mKeyframes.front()->timestamp; };
+    unsigned Size() { return mKeyframes.size(); };
+
+    using Timeline::FindKeyframe;
+    using Timeline::Prune;
+};
+
+static void BenchTimelineOps()
+{
+    char name[64];
+    for (unsigned run = 0; run < sNumKeyframeCounts; ++run) {
+        unsigned numKeyframes = sKeyframeCounts[run];
+        WorldModel* world = MakeWorld(8);
+        Gameclock gameclock(GAMECLOCK_TICK_MS);
+        gameclock.Set(world->GetCurrentTimestamp());
+
+        // Looking up keyframes anywhere in the timeline, as late inputs do
+        BenchTimeline* timeline = new BenchTimeline;
+        timeline->Init(*world, gameclock, COMMUNICATOR_MODE_SERVER);
+        timeline->Fill(*world, numKeyframes - 1);
+        unsigned first = timeline->First();
+        std::vector<unsigned> timestamps(BENCH_FINDS);
+        for (unsigned i = 0; i < BENCH_FINDS; ++i)
+            timestamps[i] = first + rand() % numKeyframes;
+        unsigned found = 0;
+        sf::Clock clock;
+        for (unsigned i = 0; i < BENCH_FINDS; ++i)
+            found += (*timeline->FindKeyframe(timestamps[i]))->timestamp;
+        sSink = found;
+        sprintf(name, "timeline.find_keyframe.%u_keyframes", numKeyframes);
+        Report(name, clock, BENCH_FINDS);
+
+        // Pruning them a state dump's worth at a time. Only the pruning is
+        // timed, and it's counted per keyframe.
+        float seconds = 0.0f;
+        unsigned pruned = 0;
+        for (unsigned round = 0; round < BENCH_PRUNE_ROUNDS; ++round) {
+            timeline->Fill(*world, numKeyframes - timeline->Size());
+            clock.Reset();
+            while (timeline->Size() > MIN_STATEDUMP_SEPARATION) {
+                timeline->Prune(timeline->First() + MIN_STATEDUMP_SEPARATION);
+                pruned += MIN_STATEDUMP_SEPARATION;
+            }
+            seconds += clock.GetElapsedTime();
+        }
+        BenchResult result;
+        sprintf(name, "timeline.prune.%u_keyframes", numKeyframes);
+        result.name = name;
+        result.iterations = pruned;
+        result.nanosPerOp = 1e9 * seconds / pruned;
+        sResults.push_back(result);
+
+        delete timeline;
+        delete world;
+    }
+}
+
+/*
+ * Framing as GrowblesSocket does it, minus the socket: frames are encoded
+ * one after another into a buffer standing in for the connection, and read
+ * back off it, header first, into newly allocated payloads.
+ */
+static void BenchFraming(const char* name, PayloadType type, void* data,
+                         unsigned count)
+{
+    char fullName[64];
+    std::vector<uint8_t> wire(WIRE_MAX_MESSAGE_SIZE);
+    unsigned frameSize = WIRE_HEADER_SIZE +
+                         WireEncodePayload(type, data, &wire[0], wire.size());
+    wire.resize(count * frameSize);
+    unsigned offset = 0;
+    sf::Clock clock;
+    for (unsigned i = 0; i < count; ++i) {
+        uint8_t* buffer = &wire[offset];
+        unsigned bodySize = WireEncodePayload(type, data, buffer + WIRE_HEADER_SIZE,
+                                              frameSize - WIRE_HEADER_SIZE);
+        WireEncodeHeader(buffer, type, bodySize);
+        offset += WIRE_HEADER_SIZE + bodySize;
+    }
+    sprintf(fullName, "socket.send_payload.%s", name);
+    Report(fullName, clock, count);
+
+    unsigned end = offset;
+    unsigned decoded = 0;
+    offset = 0;
+    clock.Reset();
+    while (offset < end) {
+        Payload payload;
+        unsigned bodySize;
+        if (!WireDecodeHeader(&wire[offset], payload.type, bodySize))
+            break;
+        offset += WIRE_HEADER_SIZE;
+        payload.AllocateData();
+        decoded += WireDecodePayload(payload.type, &wire[offset], bodySize, payload.data);
+        offset += bodySize;
+    }
+    sprintf(fullName, "socket.get_payload.%s", name);
+    Report(fullName, clock, count);
+    if (decoded != count)
+        fprintf(stderr, "Warning - Decoded %u of %u %s payloads\n", decoded, count, name);
+}
+
+static void BenchPayloads()
+{
+    UserInput input(3, 12345);
+    input.inputs = GEN_INPUT_MASK(USERINPUT_INDEX_LEFT, true);
+    BenchFraming("userinput", PAYLOAD_TYPE_USERINPUT, &input, BENCH_FRAMES);
+
+    WorldModel* world = MakeWorld(8);
+    WorldState state;
+    world->GetState(state);
+    BenchFraming("worldstate.8_players", PAYLOAD_TYPE_WORLDSTATE, &state, BENCH_FRAMES / 10);
+    delete world;
+}
+
+static void BenchMatrix()
+{
+    Matrix m, n;
+    m.Rotate(30.0f, 0.0f, 1.0f, 0.0f);
+    m.Translate(1.0f, 2.0f, 3.0f);
+    n.Rotate(-45.0f, 1.0f, 0.0f, 0.0f);
+
+    // Each product feeds the next, so none can be skipped
+    Matrix product = m;
+    sf::Clock clock;
+    for (unsigned i = 0; i < BENCH_PRODUCTS; ++i)
+        product = (i & 1 ? m : n).MMProduct(product);
+    sSink = product[0].x;
+    Report("matrix.mm_product", clock, BENCH_PRODUCTS);
+
+    Vector v(1.0f, 0.0f, 0.0f, 1.0f);
+    clock.Reset();
+    for (unsigned i = 0; i < BENCH_PRODUCTS; ++i)
+        v = m.MVProduct(v);
+    sSink = v.x;
+    Report("matrix.mv_product", clock, BENCH_PRODUCTS);
+}
+
+static void BenchMeshes()
+{
+    char name[64];
+    for (unsigned file = 0; file < sNumMeshFiles; ++file) {
+
+        // Import the way SceneGraph::LoadScene() does. That's assimp's time,
+        // not ours, so it isn't counted.
+        std::string path = std::string("scenefiles/") + sMeshFiles[file];
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path.c_str(),
+            aiProcess_CalcTangentSpace |
+            aiProcess_Triangulate |
+            aiProcess_JoinIdenticalVertices |
+            aiProcessPreset_TargetRealtime_Quality);
+        if (!scene) {
+            fprintf(stderr, "Warning - Couldn't load %s, skipping it\n", path.c_str());
+            continue;
+        }
+
+        sf::Clock clock;
+        for (unsigned repeat = 0; repeat < BENCH_MESH_REPEATS; ++repeat) {
+            std::vector<SceneMesh> meshes;
+            for (unsigned i = 0; i < scene->mNumMeshes; ++i) {
+                meshes.push_back(SceneMesh(NULL, scene->mMeshes[i]->mName.data, 0));
+                meshes.back().InitWithMesh(scene->mMeshes[i]);
+            }
+        }
+
+        // Named for the file, without its extension
+        std::string stem(sMeshFiles[file], strchr(sMeshFiles[file], '.'));
+        sprintf(name, "scenemesh.init_with_mesh.%s", stem.c_str());
+        Report(name, clock, BENCH_MESH_REPEATS);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    FILE* out = stdout;
+    if (argc > 1 && !(out = fopen(argv[1], "w"))) {
+        fprintf(stderr, "Couldn't open %s!\n", argv[1]);
+        return 1;
+    }
+
+    srand(1);
+    BenchWorld();
+    BenchTimelineOps();
+    BenchPayloads();
+    BenchMatrix();
+    BenchMeshes();
+
+    fprintf(out, "{\"bench\":\"corebench\",\"results\":[");
+    for (unsigned i = 0; i < sResults.size(); ++i)
+        fprintf(out, "%s\n {\"name\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.1f}",
+                i ? "," : "", sResults[i].name.c_str(), sResults[i].iterations,
+                sResults[i].nanosPerOp);
+    fprintf(out, "]}\n");
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
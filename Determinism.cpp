@@ -0,0 +1,58 @@
+#include "Determinism.h"
+#include <fenv.h>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+#if defined(__i386__) && defined(__linux__)
+#include <fpu_control.h>
+#endif
+
+StateHashHistory::StateHashHistory()
+{
+    for (unsigned i = 0; i < STATEHASH_HISTORY; ++i) {
+        mTicks[i] = 0;
+        mHashes[i] = 0;
+        mValid[i] = false;
+    }
+}
+
+void
+StateHashHistory::Record(unsigned tick, uint64_t hash)
+{
+    unsigned slot = tick % STATEHASH_HISTORY;
+    mTicks[slot] = tick;
+    mHashes[slot] = hash;
+    mValid[slot] = true;
+}
+
+bool
+StateHashHistory::Lookup(unsigned tick, uint64_t& hashOut)
+{
+    unsigned slot = tick % STATEHASH_HISTORY;
+    if (!mValid[slot] || mTicks[slot] != tick)
+        return false;
+    hashOut = mHashes[slot];
+    return true;
+}
+
+void
+SetDeterministicFloatingPoint()
+{
+    fesetround(FE_TONEAREST);
+
+#if defined(__SSE__) || defined(__x86_64__)
+    // Clear flush-to-zero (bit 15) and denormals-are-zero (bit 6), which
+    // some libraries turn on behind our backs
+    _mm_setcsr(_mm_getcsr() & ~((1 << 15) | (1 << 6)));
+#endif
+
+#if defined(__i386__) && defined(__linux__)
+    // x87 keeps intermediates at extended precision unless told otherwise
+    fpu_control_t control;
+    _FPU_GETCW(control);
+    control = (control & ~_FPU_EXTENDED) | _FPU_SINGLE;
+    _FPU_SETCW(control);
+#endif
+}
@@ -0,0 +1,82 @@
+#ifndef DETERMINISM_H
+#define DETERMINISM_H
+
+#include <stdint.h>
+
+/*
+ * Deterministic simulation.
+ *
+ * Rollback only works if every peer computes the same physics from the
+ * same inputs. In deterministic mode we pin down the things that would
+ * otherwise vary between machines and runs: the floating point environment,
+ * Bullet's solver settings, and any uninitialised bytes in our state. Each
+ * peer then hashes its world state every tick. The server broadcasts the
+ * hash of each tick once no more inputs can change it, and clients compare
+ * it against their own. A desync costs a few bytes per tick to detect, and
+ * full state dumps become a rare repair instead of the main way we stay in
+ * sync.
+ */
+
+// Number of ticks of state hashes we remember
+#define STATEHASH_HISTORY 256
+
+// Even when everyone agrees, the server sends a full dump this often, in
+// ticks, in case something the hash doesn't cover has drifted
+#define STATE_REPAIR_INTERVAL 300
+
+/*
+ * Hash of the world state at a tick. The server sends these to clients.
+ * Clients send one back, with repair set, when theirs doesn't match.
+ */
+struct StateHash {
+
+    StateHash() : tick(0), hash(0), repair(false) {};
+
+    // Tick the hash describes, before that tick's inputs are applied
+    uint32_t tick;
+
+    // The hash itself
+    uint64_t hash;
+
+    // Set by clients to ask for a full state dump
+    bool repair;
+};
+
+/*
+ * Remembers the state hash of recent ticks. Resimulating a tick simply
+ * overwrites its hash.
+ */
+class StateHashHistory {
+
+    public:
+
+    /*
+     * Constructor. The history starts out empty.
+     */
+    StateHashHistory();
+
+    /*
+     * Records the hash for a tick.
+     */
+    void Record(unsigned tick, uint64_t hash);
+
+    /*
+     * Looks up the hash for a tick. Returns false if we don't have it.
+     */
+    bool Lookup(unsigned tick, uint64_t& hashOut);
+
+    protected:
+
+    unsigned mTicks[STATEHASH_HISTORY];
+    uint64_t mHashes[STATEHASH_HISTORY];
+    bool mValid[STATEHASH_HISTORY];
+};
+
+/*
+ * Puts the floating point unit in the same mode on every machine: round to
+ * nearest, no flushing of denormals, and on x87 machines, every operation
+ * rounded to single precision like SSE does. Affects the calling thread.
+ */
+void SetDeterministicFloatingPoint();
+
+#endif /* DETERMINISM_H */
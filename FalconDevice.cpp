@@ -1,56 +1,103 @@
 #include "FalconDevice.h"
+#include "Gameclock.h"
+#include <string.h>
 
+#ifdef FALCON
 void hapticsLoopCallback();
 static FalconDevice *hapticsLoopThisPtr = NULL;
+#endif
 
 //DON"T CHANGE THE ORDER OF THESE
 enum SwitchIndexT{  SWITCH_INDEX_JUMP=0, SWITCH_INDEX_SHRINK, SWITCH_INDEX_DASH,
-    SWITCH_INDEX_GROW };
-
-FalconDevice::FalconDevice(){
-    isReady = false;
-#ifdef FALCON
-    //prevHeight = 0;
-    height = 0;
-    mSimulationRunning = false;
-    mSimulationFinished = false;
-    mHapticHandler = new cHapticDeviceHandler();
-
-    // get access to the first available haptic device
-    mHapticHandler->getDevice(mHapticDevice, 0);
+    SWITCH_INDEX_GROW, SWITCH_INDEX_COUNT };
 
-    // retrieve information about the current haptic device
-    if (mHapticDevice){
-        mHapticDeviceInfo = mHapticDevice->getSpecifications();
-    }
-    int result = 0;
-    // open connection to device
-    result = mHapticDevice->open();
+static HapticGrip restingGrip(){
+    HapticGrip grip;
+    grip.position = Vector(0,0,0,0);
+    grip.velocity = Vector(0,0,0,0);
+    grip.force = Vector(0,0,0,0);
+    grip.switches = 0;
+    return grip;
+}
 
-	// initialize device
-	if (result == 0){
-		result = mHapticDevice->initialize();
-	}
+FalconDevice::FalconDevice() : mNumActiveImpulses(0)
+                             , mDroppedImpulses(0)
+                             , mTargetHeight(0.0f)
+                             , mScene(HapticScene())
+                             , mGrip(restingGrip())
+                             , mBackend(NULL)
+                             , mOwnsBackend(false)
+                             , mSimulationRunning(false)
+                             , mSimulationFinished(true)
+{
+#ifdef FALCON
+    mBackend = new ChaiHapticBackend();
+    mOwnsBackend = true;
+    mBackend->Open();
+#else
+    mHapticsThread = NULL;
+#endif
+    memset(&mLoopStats, 0, sizeof(mLoopStats));
+}
 
+FalconDevice::FalconDevice(HapticBackend *backend) : mNumActiveImpulses(0)
+                                                   , mDroppedImpulses(0)
+                                                   , mTargetHeight(0.0f)
+                                                   , mScene(HapticScene())
+                                                   , mGrip(restingGrip())
+                                                   , mBackend(backend)
+                                                   , mOwnsBackend(false)
+                                                   , mSimulationRunning(false)
+                                                   , mSimulationFinished(true)
+{
+#ifndef FALCON
+    mHapticsThread = NULL;
 #endif
+    memset(&mLoopStats, 0, sizeof(mLoopStats));
+    mBackend->Open();
 }
 
 FalconDevice::~FalconDevice(){
-#ifdef FALCON
-    if(!isConnected())
+    Stop();
+    if(!mBackend)
         return;
-    mHapticDevice->close();
-    mSimulationRunning = false;
-    mSimulationFinished = true;
-#endif
+    mBackend->Close();
+    if(mOwnsBackend)
+        delete mBackend;
+}
+
+#ifndef FALCON
+static void hapticsThreadEntry(void *device){
+    ((FalconDevice *)device)->hapticsLoop();
 }
+#endif
 
 void FalconDevice::Init(){
+    if(!mBackend)
+        return;
+    mSimulationRunning = true;
+    mSimulationFinished = false;
 #ifdef FALCON
     cThread *hapticsThread = new cThread();
-    mSimulationRunning = true;
     hapticsLoopThisPtr = this;
     hapticsThread->set(hapticsLoopCallback, CHAI_THREAD_PRIORITY_HAPTICS);
+#else
+    mHapticsThread = new sf::Thread(&hapticsThreadEntry, this);
+    mHapticsThread->Launch();
+#endif
+}
+
+void FalconDevice::Stop(){
+    mSimulationRunning = false;
+#ifdef FALCON
+    while(!mSimulationFinished)
+        sf::Sleep(0.001f);
+#else
+    if(mHapticsThread){
+        mHapticsThread->Wait();
+        delete mHapticsThread;
+        mHapticsThread = NULL;
+    }
 #endif
 }
 
@@ -58,80 +105,66 @@ void FalconDevice::getPosition(float &up, float &right, float &forward){
     up = 0;
     right = 0;
     forward = 0;
-#ifdef FALCON
     if(!isConnected())
         return;
-    cVector3d tempPos;
-    mHapticDevice->getPosition(tempPos);
-    up = tempPos.z;
-    right = tempPos.y;
-    forward = -tempPos.x;
-#endif
+    const Vector& pos = mGrip.Read().position;
+    up = pos.z;
+    right = pos.y;
+    forward = -pos.x;
 }
 void FalconDevice::getVelocity(float &up, float &right, float &forward){
     up = 0;
     right = 0;
     forward = 0;
-#ifdef FALCON
     if(!isConnected())
         return;
-    cVector3d tempVel;
-    mHapticDevice->getLinearVelocity(tempVel);
-    up = tempVel.z;
-    right = tempVel.y;
-    forward = -tempVel.x;
-#endif
+    const Vector& vel = mGrip.Read().velocity;
+    up = vel.z;
+    right = vel.y;
+    forward = -vel.x;
 }
 void FalconDevice::getForce(float &up, float &right, float &forward){
     up = 0;
     right = 0;
     forward = 0;
-#ifdef FALCON
     if(!isConnected())
         return;
-    cVector3d tempForce;
-    mHapticDevice->getForce(tempForce);
-    up = tempForce.z;
-    right = tempForce.y;
-    forward = -tempForce.x;
-#endif
+    const Vector& force = mGrip.Read().force;
+    up = force.z;
+    right = force.y;
+    forward = -force.x;
 }
 
 void FalconDevice::setVerticalForce(float _height){
-#ifdef FALCON
+    if(!mBackend)
+        return;
     if(_height > 1)
         _height = 1;
     else if(_height < -1)
         _height = -1;
-    //prevHeight = height;
-    height = _height*mHapticDeviceInfo.m_workspaceRadius;
-#endif
+    mTargetHeight.Write(_height*mBackend->GetWorkspaceRadius());
+}
+
+void FalconDevice::setScene(const HapticScene &scene){
+    if(!mBackend)
+        return;
+    mScene.Write(scene);
 }
 
 void FalconDevice::setHorizontalForce(float right, float forward){
-#ifdef FALCON
-    forcesToApply.push_back(cVector3d(-forward, right, FALCON_IMPULSE_LENGTH));
-#endif
+    if(!mBackend)
+        return;
+    HapticImpulse impulse;
+    impulse.back = -forward;
+    impulse.right = right;
+    impulse.remaining = FALCON_IMPULSE_LENGTH;
+    impulse.sent = MonotonicMicros();
+    if(!mImpulseQueue.Push(impulse))
+        __sync_fetch_and_add(&mDroppedImpulses, 1);
 }
 
 bool FalconDevice::isConnected(){
-#ifdef FALCON
-    if(isReady)
-        return true;
-    if(mHapticDevice != NULL){
-        cVector3d position;
-        mHapticDevice->getPosition(position);
-        //The Falcon always has position (0.01,0,0) when it is not yet ready.
-        static const int INITIAL_X = 1008981770;
-        if(position.x < .0099998 || position.x > .0100001 || position.y != 0 || position.z != 0){
-            isReady = true;
-            return true;
-        }
-    }
-    return false;
-#else
-    return false;
-#endif
+    return mBackend != NULL && mBackend->IsReady();
 }
 
 void PressInputIfNotActive(UserInputIndex inputIndex, UserInput &input, uint32_t activeInputs){
@@ -148,30 +181,43 @@ void ReleaseInputIfActive(UserInputIndex inputIndex, UserInput &input, uint32_t
     }
 }
 
-void FalconDevice::setInputs(UserInput &input, uint32_t activeInputs){
-#ifdef FALCON
+void FalconDevice::sampleInputs(Vector &axes, uint32_t &held){
+    axes = Vector(0,0,0,0);
+    held = 0;
+    if(!mBackend)
+        return;
     //Falcon reference frame:
     //x increases out of screen
     //y increases right
     //z increases up
-    cVector3d tempPos;
-    mHapticDevice->getPosition(tempPos);
-    input.falconInputs[FALCON_INPUT_FORWARD] = -tempPos.x/mHapticDeviceInfo.m_workspaceRadius;
-    input.falconInputs[FALCON_INPUT_RIGHT] = tempPos.y/mHapticDeviceInfo.m_workspaceRadius;
-    //NOTE: input.falconInput[FALCON_INPUT_UP] is not set!
-    bool buttonIsOn;
-    mHapticDevice->getUserSwitch(SWITCH_INDEX_GROW, buttonIsOn);
-    if(buttonIsOn)
+    const HapticGrip& grip = mGrip.Read();
+    float radius = mBackend->GetWorkspaceRadius();
+    axes[FALCON_INPUT_FORWARD] = -grip.position.x/radius;
+    axes[FALCON_INPUT_RIGHT] = grip.position.y/radius;
+    //NOTE: axes[FALCON_INPUT_UP] is not set!
+    if(grip.switches & (1 << SWITCH_INDEX_GROW))
+        held |= GEN_INPUT_MASK(USERINPUT_INDEX_GROW, true);
+    if(grip.switches & (1 << SWITCH_INDEX_SHRINK))
+        held |= GEN_INPUT_MASK(USERINPUT_INDEX_SHRINK, true);
+}
+
+void FalconDevice::setInputs(UserInput &input, uint32_t activeInputs){
+    if(!mBackend)
+        return;
+    Vector axes;
+    uint32_t held;
+    sampleInputs(axes, held);
+    input.falconInputs[FALCON_INPUT_FORWARD] = axes[FALCON_INPUT_FORWARD];
+    input.falconInputs[FALCON_INPUT_RIGHT] = axes[FALCON_INPUT_RIGHT];
+    if(held & GEN_INPUT_MASK(USERINPUT_INDEX_GROW, true))
         PressInputIfNotActive(USERINPUT_INDEX_GROW, input, activeInputs);
     else
         ReleaseInputIfActive(USERINPUT_INDEX_GROW, input, activeInputs);
     
-    mHapticDevice->getUserSwitch(SWITCH_INDEX_SHRINK, buttonIsOn);
-    if(buttonIsOn)
+    if(held & GEN_INPUT_MASK(USERINPUT_INDEX_SHRINK, true))
         PressInputIfNotActive(USERINPUT_INDEX_SHRINK, input, activeInputs);
     else
         ReleaseInputIfActive(USERINPUT_INDEX_SHRINK, input, activeInputs);
-#endif
 }
 
 /*
@@ -200,52 +246,122 @@ float sinusoid(float t){
     return sin(5*t)/t;
 }
 
+void FalconDevice::recordIteration(uint64_t periodMicros){
+    HapticLoopStats& stats = mLoopStats;
+    double period = periodMicros/1000000.0;
+    ++stats.iterations;
+    stats.periodSum += period;
+    stats.periodSumSquares += period*period;
+    if(period > stats.periodMax)
+        stats.periodMax = period;
+    ++stats.periodBuckets[Metrics::Bucket(periodMicros)];
+}
+
 void FalconDevice::hapticsLoop(){
-#ifdef FALCON
-    cPrecisionClock pclock;
-    pclock.setTimeoutPeriodSeconds(1.0);
-    pclock.start(true);
-    int counter = 0;
+    uint64_t prevTimestepMicros = MonotonicMicros();
 
-	double prevTimestepTime = pclock.getCPUTimeSeconds();
+    // Impulses picked up this pass, waiting for their force to go out
+    HapticImpulse fresh[FALCON_MAX_ACTIVE_IMPULSES];
+    unsigned numFresh;
+    HapticGrip grip;
 
     // main haptic simulation loop
     while(mSimulationRunning){
-        if(!isConnected())
+
+        // Nothing paces us without the device, so wait for it to come
+        // back, and don't count the gap as a long pass
+        if(!isConnected()){
+            sf::Sleep(FALCON_DISCONNECTED_POLL);
+            prevTimestepMicros = MonotonicMicros();
             continue;
-        
-		double newtime = pclock.getCPUTimeSeconds();
-
-        cVector3d pos(0,0,0);
-        cVector3d vel(0,0,0);
-        cVector3d totalForce(0,0,0);
-        
-        mHapticDevice->getPosition(pos);
-        totalForce.z += -FALCON_VERTICAL_STIFFNESS*(pos.z-height);
-        mHapticDevice->getLinearVelocity(vel);
+        }
+
+        // Reading the position waits for the device, which paces us
+        Vector pos = mBackend->GetPosition();
+        uint64_t newMicros = MonotonicMicros();
+        recordIteration(newMicros-prevTimestepMicros);
+        float dt = (newMicros-prevTimestepMicros)/1000000.0f;
+
+        // Bring the proxy up to date. Once there is one, it decides the
+        // height and adds the contact forces.
+        const HapticScene& scene = mScene.Read();
+        if(scene.sequence != mProxy.GetSequence())
+            mProxy.SetScene(scene);
+        mProxy.Step(dt);
+
+        Vector totalForce(0,0,0,0);
+        float targetHeight = mTargetHeight.Read();
+        if(mProxy.IsActive()){
+            targetHeight = mProxy.GetHeight()*mBackend->GetWorkspaceRadius();
+            const Vector& contact = mProxy.GetContactForce();
+            totalForce.x += -contact.x;
+            totalForce.y += contact.z;
+        }
+        totalForce.z += -FALCON_VERTICAL_STIFFNESS*(pos.z-targetHeight);
+        Vector vel = mBackend->GetVelocity();
         float dampenTerm = -FALCON_DAMPENING*vel.z;
         if((totalForce.z+dampenTerm)*totalForce.z < 0)
             totalForce.z = 0;
         else
             totalForce.z += dampenTerm;
-        
-        for(int i = 0; i < forcesToApply.size(); ++i){
-            cVector3d currForce = forcesToApply[i];
-            cVector3d currForceXY(currForce.x, currForce.y, 0);
-            totalForce += currForceXY*sinusoid(currForce.z);
-            //remember currForce.z is timestamp
-            currForce.z -= (newtime-prevTimestepTime);
-            if(currForce.z < 0)
-                forcesToApply.erase(forcesToApply.begin()+i);
+
+        // Pick up new impulses. If we're already playing as many as we
+        // can, the new one is dropped.
+        HapticImpulse impulse;
+        numFresh = 0;
+        while(mImpulseQueue.Pop(impulse)){
+            if(mNumActiveImpulses < FALCON_MAX_ACTIVE_IMPULSES){
+                mActiveImpulses[mNumActiveImpulses++] = impulse;
+                fresh[numFresh++] = impulse;
+            }
+            else
+                __sync_fetch_and_add(&mDroppedImpulses, 1);
+        }
+
+        // Play them, forgetting the ones that have run out
+        unsigned i = 0;
+        while(i < mNumActiveImpulses){
+            HapticImpulse& curr = mActiveImpulses[i];
+            float strength = sinusoid(curr.remaining);
+            totalForce.x += curr.back*strength;
+            totalForce.y += curr.right*strength;
+            curr.remaining -= dt;
+            if(curr.remaining < 0)
+                curr = mActiveImpulses[--mNumActiveImpulses];
+            else
+                ++i;
         }
-        mHapticDevice->setForce(totalForce);
+        mBackend->SetForce(totalForce);
 
-        prevTimestepTime = newtime;
+        // Let the game see where the grip is
+        grip.position = pos;
+        grip.velocity = vel;
+        grip.force = totalForce;
+        grip.switches = 0;
+        for(unsigned index = 0; index < SWITCH_INDEX_COUNT; ++index)
+            if(mBackend->GetSwitch(index))
+                grip.switches |= 1 << index;
+        mGrip.Write(grip);
+
+        // The new impulses are being felt now
+        if(numFresh){
+            uint64_t output = MonotonicMicros();
+            for(unsigned j = 0; j < numFresh; ++j){
+                float latency = (output-fresh[j].sent)/1000000.0f;
+                ++mLoopStats.impulses;
+                mLoopStats.latencySum += latency;
+                if(latency > mLoopStats.latencyMax)
+                    mLoopStats.latencyMax = latency;
+            }
+        }
+
+        prevTimestepMicros = newMicros;
     }
     mSimulationFinished = true;
-#endif
 }
 
+#ifdef FALCON
 void hapticsLoopCallback(){
     hapticsLoopThisPtr->hapticsLoop();
 }
+#endif
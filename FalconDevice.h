@@ -4,6 +4,10 @@
 #include "Framework.h"
 #include "Vector.h"
 #include "UserInput.h"
+#include "HapticChannel.h"
+#include "HapticBackend.h"
+#include "HapticProxy.h"
+#include "Metrics.h"
 using namespace std;
 
 const double FALCON_IMPULSE_STRENGTH = 1;
@@ -13,14 +17,74 @@ static const double FALCON_DAMPENING = 5;
 
 enum FalconInputIndex{ FALCON_INPUT_FORWARD, FALCON_INPUT_RIGHT, FALCON_INPUT_UP };
 
+// Impulses waiting for the haptics thread, and impulses it plays at once.
+// Anything beyond these is dropped rather than waited for.
+#define FALCON_IMPULSE_QUEUE_SIZE 64
+#define FALCON_MAX_ACTIVE_IMPULSES 16
+
+// How often the haptics loop looks for the device while it's disconnected,
+// in seconds
+#define FALCON_DISCONNECTED_POLL 0.01f
+
+/*
+ * A push on the device. The game thread sends the direction, and the
+ * haptics thread keeps track of how long it has left to play.
+ */
+struct HapticImpulse {
+    float back;
+    float right;
+    float remaining;
+
+    // When the game thread sent it, on the monotonic clock (see
+    // Gameclock.h), in microseconds
+    uint64_t sent;
+};
+
+/*
+ * The grip as of the haptics loop's last pass, in the device's frame.
+ */
+struct HapticGrip {
+    Vector position;
+    Vector velocity;
+    Vector force;
+    unsigned switches;
+};
+
+/*
+ * What the haptics loop has been up to. Written by the haptics thread only;
+ * read it once the loop has stopped.
+ */
+struct HapticLoopStats {
+    unsigned iterations;
+
+    // Time between iterations, in seconds, and its spread in microseconds,
+    // bucketed like the metrics histograms
+    double periodSum;
+    double periodSumSquares;
+    float periodMax;
+    unsigned periodBuckets[METRICS_NUM_BUCKETS];
+
+    // Time from an impulse being sent to its force first being output
+    unsigned impulses;
+    double latencySum;
+    float latencyMax;
+};
+
 class FalconDevice{
 
 public:
     /*
-     * Constructor. Attempts to connect with the USB Haptic Device.
+     * Constructor. Attempts to connect with the USB Haptic Device, if we
+     * were built with FALCON.
      */
     FalconDevice();
 
+    /*
+     * Constructor. Drives the given device instead, e.g. a simulated one.
+     * The caller keeps ownership of it.
+     */
+    FalconDevice(HapticBackend *backend);
+
     /*
      * Destructor
      */
@@ -31,6 +95,11 @@ public:
      */
     void Init();
 
+    /*
+     * Stops the haptics thread and waits for it to finish.
+     */
+    void Stop();
+
     /*
      * Returns whether or not the haptic device is connected
      */
@@ -55,6 +124,14 @@ public:
     // Sets the vertical force
     void setVerticalForce(float platformHeight);
 
+    /*
+     * Sends the haptics thread the world around our player, once a tick.
+     * From then on the haptics thread works out the vertical and contact
+     * forces itself, at its own rate (see HapticProxy.h), and
+     * setVerticalForce() is ignored.
+     */
+    void setScene(const HapticScene &scene);
+
     /*
      * Sets the input, given the previous tick's activeInputs.
      * Stores information indicating the current state of the haptic
@@ -62,28 +139,66 @@ public:
      */
     void setInputs(UserInput &input, uint32_t activeInputs);
 
+    /*
+     * Gets the grip's position as Falcon axes, and the inputs its buttons
+     * are holding down, as begin bits.
+     *
+     * The grip comes from the haptics thread through a triple buffer, so
+     * only one thread may read it: whichever calls this, setInputs() and
+     * the getters above.
+     */
+    void sampleInputs(Vector &axes, uint32_t &held);
+
     void hapticsLoop();
 
+    /*
+     * Number of impulses dropped because the haptics thread was behind, or
+     * already playing as many as it can. Either thread counts.
+     */
+    unsigned getDroppedImpulses() { return mDroppedImpulses; };
+
+    /*
+     * Timing of the haptics loop. Only meaningful after Stop().
+     */
+    const HapticLoopStats& getLoopStats() { return mLoopStats; };
+
 protected:
 
+    /*
+     * Records one pass of the haptics loop.
+     */
+    void recordIteration(uint64_t periodMicros);
 
-#ifdef FALCON
-    //saves the horizontal forces being applied
-    vector<cVector3d> forcesToApply; //x is back, y is right, z is time remaining
-    
-    //saves whether or not the FalconDevice is currently falling.
-    //used to compute the vertical force.
-    //float prevHeight;
-    float height;
+    // Everything the game thread tells the haptics thread goes through
+    // these, so neither ever waits for the other (see HapticChannel.h).
+    // The impulses being played belong to the haptics thread alone.
+    SpscRing<HapticImpulse, FALCON_IMPULSE_QUEUE_SIZE> mImpulseQueue;
+    HapticImpulse mActiveImpulses[FALCON_MAX_ACTIVE_IMPULSES];
+    unsigned mNumActiveImpulses;
+    unsigned mDroppedImpulses;
+
+    // The height the device is pulled towards, in device units
+    TripleBuffer<float> mTargetHeight;
+
+    // The latest scene, and the proxy world built from it, which belongs
+    // to the haptics thread
+    TripleBuffer<HapticScene> mScene;
+    HapticProxy mProxy;
+
+    // And back the other way: only the haptics thread talks to the device,
+    // and the game thread reads the grip from here
+    TripleBuffer<HapticGrip> mGrip;
 
     // Haptics
-    cHapticDeviceHandler *mHapticHandler;
-    cGenericHapticDevice *mHapticDevice;
-    cHapticDeviceInfo mHapticDeviceInfo;
-    bool mSimulationRunning;
-    bool mSimulationFinished;
-#endif 
-    bool isReady;
+    HapticBackend *mBackend;
+    bool mOwnsBackend;
+    volatile bool mSimulationRunning;
+    volatile bool mSimulationFinished;
+#ifndef FALCON
+    sf::Thread *mHapticsThread;
+#endif
+
+    HapticLoopStats mLoopStats;
 
 };
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "Game.h"
+#include "Metrics.h"
 
 Game::Game(Timeline& tl, Communicator& comm)
 {
@@ -9,11 +10,13 @@ Game::Game(Timeline& tl, Communicator& comm)
 
 Game::~Game()
 {
+    sampler.Stop();
     delete clock;
     delete renderContext;
     delete sceneGraph;
     delete world;
     delete mainMenu;
+    delete effects;
 }
 
 void
@@ -35,6 +38,10 @@ Game::Setup()
     
     // Setup main menu
     mainMenu = new Menu(renderContext);
+
+    // Sounds for game events
+    effects = new SoundEffects;
+    effects->Init();
     
     // Top level game loop
     while (renderContext->GetWindow()->IsOpened()) {
@@ -79,6 +86,7 @@ Game::Step()
 
         world->SetFalcon(renderContext->falcon);
         world->SetThisPlayer(communicator->GetPlayerID());
+        sampler.Start(&renderContext->falcon);
         
         // Start the clock
         clock->Start();
@@ -103,28 +111,32 @@ Game::Step()
     
     else if (state == PLAYING) {
         
-        // Handle input. Local input is applied immediately, global input
-        // is recorded so that we can send it over the network.
-        UserInput input(communicator->GetPlayerID(), clock->Now());
-        input.LoadInput(*renderContext, *communicator, *world);
-        if (input.inputs != 0 || input.falconInputs.x != 0 || 
-            input.falconInputs.y != 0 || input.falconInputs.z != 0){
-            communicator->ApplyInput(input);
-        }
-        
         // Apply any state updates that may have come in, and send off any
         // necessary updates.
         communicator->Synchronize();
         
-        // Tick the clock
-        clock->Tick();
+        // Tick the clock. If we're still catching up, there's no need to
+        // wait for it. Otherwise keep taking window events while we wait,
+        // so each is stamped with when it came rather than with the frame.
+        if (catchUp.IsBehind())
+            clock->Poll();
+        else
+            while (!clock->Poll())
+                UserInput::PumpEvents(*renderContext, *communicator, sampler);
+        
+        // Handle input. Local input is applied immediately, global input
+        // is sent over the network, stamped with the tick it happened in.
+        HandleInput();
         
-        // Step the world
-        world->Step(clock->Now() - clock->Then());
+        // Step the world towards the clock, as far as our budget allows
+        catchUp.Step(*world, *clock);
+        world->SyncRenderState();
+
+        // Fire the effects of anything new that happened
+        FireEvents();
 		
-		// Apply Haptic Forces to Falcon
-        world->ApplyHapticGravityForce();
-        world->ApplyHapticCollisionForce();
+		// Let the Falcon know what's around us
+        world->UpdateHapticProxy();
         
         // Render the skybox
         renderContext->RenderSkybox();
@@ -178,6 +190,10 @@ Game::Step()
             }
         }
         
+        // Let the player know if we can't keep up
+        if (catchUp.IsLagging())
+            renderContext->RenderString("Catching up...", 32, 20, 40, 40);
+
         // Render the scenegraph
         renderContext->Render(*sceneGraph);
 
@@ -188,28 +204,32 @@ Game::Step()
     
     else if (state == END) {
         
-        // Handle input. Local input is applied immediately, global input
-        // is recorded so that we can send it over the network.
-        UserInput input(communicator->GetPlayerID(), clock->Now());
-        input.LoadInput(*renderContext, *communicator, *world);
-        if (input.inputs != 0 || input.falconInputs.x != 0 || 
-            input.falconInputs.y != 0 || input.falconInputs.z != 0){
-            communicator->ApplyInput(input);
-        }
-        
         // Apply any state updates that may have come in, and send off any
         // necessary updates.
         communicator->Synchronize();
         
-        // Tick the clock
-        clock->Tick();
+        // Tick the clock. If we're still catching up, there's no need to
+        // wait for it. Otherwise keep taking window events while we wait,
+        // so each is stamped with when it came rather than with the frame.
+        if (catchUp.IsBehind())
+            clock->Poll();
+        else
+            while (!clock->Poll())
+                UserInput::PumpEvents(*renderContext, *communicator, sampler);
+        
+        // Handle input. Local input is applied immediately, global input
+        // is sent over the network, stamped with the tick it happened in.
+        HandleInput();
         
-        // Step the world
-        world->Step(clock->Now() - clock->Then());
+        // Step the world towards the clock, as far as our budget allows
+        catchUp.Step(*world, *clock);
+        world->SyncRenderState();
+
+        // Fire the effects of anything new that happened
+        FireEvents();
 		
-		// Apply Haptic Forces to Falcon
-        world->ApplyHapticGravityForce();
-        world->ApplyHapticCollisionForce();
+		// Let the Falcon know what's around us
+        world->UpdateHapticProxy();
         
         // Render the skybox
         renderContext->RenderSkybox();
@@ -240,3 +260,54 @@ Game::Step()
         renderContext->RenderAllElse();
     } // EOF state == END
 }
+
+void
+Game::FireEvents()
+{
+    gameEvents.clear();
+    world->GetEvents().Collect(world->GetCurrentTimestamp(), gameEvents);
+    for (unsigned i = 0; i < gameEvents.size(); ++i)
+        effects->Play(gameEvents[i]);
+}
+
+void
+Game::HandleInput()
+{
+    UserInput::PumpEvents(*renderContext, *communicator, sampler);
+
+    // The world hasn't stepped yet, so its current tick is the earliest we
+    // can put input on without rolling ourselves back
+    unsigned earliest = world->GetCurrentTimestamp();
+    sampler.Drain(*clock, earliest, inputEvents);
+
+    Player* player = world->GetPlayer(communicator->GetPlayerID());
+    uint32_t activeInputs = player ? player->GetActiveInputs() : 0;
+
+    // One input per tick with events, the last also carrying the Falcon's
+    // axes. Without any events, there's just the one for the axes.
+    unsigned i = 0;
+    do {
+        unsigned timestamp = earliest;
+        uint64_t seen = 0;
+        if (i < inputEvents.size()) {
+            timestamp = inputEvents[i].timestamp;
+            seen = inputEvents[i].micros;
+        }
+        for (; i < inputEvents.size() && inputEvents[i].timestamp == timestamp; ++i)
+            inputTracker.Key(inputEvents[i].index, inputEvents[i].isPress);
+
+        UserInput input(communicator->GetPlayerID(), timestamp);
+        input.inputs = inputTracker.Transitions(activeInputs, earliest, timestamp);
+        if (i == inputEvents.size())
+            input.falconInputs = sampler.GetFalconInputs();
+        if (input.inputs != 0 || input.falconInputs.x != 0 ||
+            input.falconInputs.y != 0 || input.falconInputs.z != 0) {
+            communicator->ApplyInput(input);
+
+            // From the oldest event in it being seen to it being sent
+            if (input.inputs != 0 && seen != 0)
+                Metrics::Global().Observe(METRIC_HIST_INPUT_LATENCY_US,
+                                          sampler.NowMicros() - seen);
+        }
+    } while (i < inputEvents.size());
+}
@@ -9,6 +9,10 @@
 #include "Timeline.h"
 #include "UserInput.h"
 #include "Menu.h"
+#include "SoundEffects.h"
+#include "CatchUp.h"
+#include "InputTracker.h"
+#include "InputSampler.h"
 
 class Game {
     
@@ -25,11 +29,28 @@ public:
     ~Game();
     
     void Setup();
+
+    /*
+     * Sets the wall time we may spend simulating per frame, in seconds
+     * (see CatchUp.h).
+     */
+    void SetStepBudget(float budget) { catchUp.SetBudget(budget); };
     
     /*
      * Steps the model forward in time.
      */
     void Step();
+
+    /*
+     * Plays the effects of new game events.
+     */
+    void FireEvents();
+
+    /*
+     * Turns the key and button changes seen since the last frame into
+     * inputs, one per tick they happened in, and sends them.
+     */
+    void HandleInput();
     
     enum STATE {
         MENU,
@@ -47,6 +68,12 @@ protected:
     Timeline* timeline;
     Communicator* communicator;
     Menu* mainMenu;
+    SoundEffects* effects;
+    CatchUp catchUp;
+    InputTracker inputTracker;
+    InputSampler sampler;
+    std::vector<InputEvent> inputEvents;
+    std::vector<GameEvent> gameEvents;
     unsigned state;
     float prevPlayerX, prevPlayerZ;
 };
@@ -0,0 +1,73 @@
+#include "GameEvents.h"
+
+void
+GameEventLog::Emit(const GameEvent& event)
+{
+    Trim(event.tick);
+
+    // If we rewound past this event, we're resimulating it. Events that
+    // aren't provisional happened on this run, so a second one is real.
+    for (unsigned i = 0; i < mEntries.size(); ++i) {
+        Entry& entry = mEntries[i];
+        if (!entry.provisional || entry.event.type != event.type ||
+            entry.event.a != event.a || entry.event.b != event.b)
+            continue;
+        unsigned distance = entry.event.tick > event.tick
+                          ? entry.event.tick - event.tick
+                          : event.tick - entry.event.tick;
+        if (distance <= GAMEEVENT_MATCH_TICKS) {
+            entry.provisional = false;
+            return;
+        }
+    }
+
+    Entry entry;
+    entry.event = event;
+    entry.fired = false;
+    entry.provisional = false;
+    mEntries.push_back(entry);
+}
+
+void
+GameEventLog::Rewind(unsigned tick)
+{
+    Trim(tick);
+    for (unsigned i = 0; i < mEntries.size(); ++i)
+        if (mEntries[i].event.tick >= tick)
+            mEntries[i].provisional = true;
+}
+
+void
+GameEventLog::Collect(unsigned now, std::vector<GameEvent>& eventsOut)
+{
+    Trim(now);
+    for (unsigned i = 0; i < mEntries.size(); ++i) {
+        Entry& entry = mEntries[i];
+        if (!entry.fired && !entry.provisional && entry.event.tick <= now) {
+            eventsOut.push_back(entry.event);
+            entry.fired = true;
+        }
+    }
+}
+
+void
+GameEventLog::Trim(unsigned now)
+{
+    // Keep what's left in place, so that trimming doesn't allocate
+    unsigned kept = 0;
+    for (unsigned i = 0; i < mEntries.size(); ++i) {
+        const Entry& entry = mEntries[i];
+
+        // Provisional events the resimulation has gone well past without
+        // emitting again never really happened
+        if (entry.provisional && entry.event.tick + GAMEEVENT_MATCH_TICKS < now)
+            continue;
+
+        // Forget old history. Nothing will rewind that far.
+        if (entry.event.tick + GAMEEVENT_HISTORY_TICKS < now)
+            continue;
+
+        mEntries[kept++] = entry;
+    }
+    mEntries.resize(kept);
+}
@@ -0,0 +1,102 @@
+#ifndef GAMEEVENTS_H
+#define GAMEEVENTS_H
+
+#include <vector>
+
+/*
+ * Game events.
+ *
+ * The simulation doesn't play sounds or touch the scenegraph itself,
+ * because Timeline::Rectify() re-runs it every time an input arrives late.
+ * Instead it records what happened, and when, in a GameEventLog. The game
+ * loop collects new events from the log after stepping and fires their
+ * effects.
+ *
+ * When we rewind, everything in the log from that point on becomes
+ * provisional. Events the resimulation emits again are matched against the
+ * provisional ones (allowing for a tick or two of drift) and don't fire a
+ * second time. Provisional events that never come back were mispredicted,
+ * and are forgotten.
+ *
+ * The log trims itself as the simulation moves along, so worlds nobody
+ * collects events from (headless servers, replays, benchmarks) don't
+ * accumulate history.
+ */
+
+// How far apart, in ticks, two emissions of the same event may be and
+// still count as one
+#define GAMEEVENT_MATCH_TICKS 3
+
+// How many ticks of history we keep
+#define GAMEEVENT_HISTORY_TICKS 256
+
+typedef enum {
+    GAME_EVENT_BOUNCE = 0,      // Two players ran into each other
+    GAME_EVENT_RING_WARNING,    // A ring started blinking
+    GAME_EVENT_RING_DROP,       // A ring started falling
+    GAME_EVENT_COUNT
+} GameEventType;
+
+struct GameEvent {
+
+    GameEvent() : tick(0), type(GAME_EVENT_COUNT), a(0), b(0) {};
+    GameEvent(unsigned t, GameEventType ty, unsigned first, unsigned second)
+        : tick(t), type(ty), a(first), b(second) {};
+
+    // Tick the event happened on
+    unsigned tick;
+
+    // What happened
+    GameEventType type;
+
+    // Who it happened to. For bounces, the two player IDs. For rings, the
+    // ring number.
+    unsigned a;
+    unsigned b;
+};
+
+class GameEventLog {
+
+    public:
+
+    /*
+     * Records an event. Called from the simulation.
+     */
+    void Emit(const GameEvent& event);
+
+    /*
+     * Marks everything from tick on as provisional. Called whenever the
+     * world is rewound.
+     */
+    void Rewind(unsigned tick);
+
+    /*
+     * Appends the events that haven't fired yet, up to and including tick
+     * now, to eventsOut, and marks them fired.
+     */
+    void Collect(unsigned now, std::vector<GameEvent>& eventsOut);
+
+    /*
+     * Number of events in the log.
+     */
+    unsigned GetSize() { return (unsigned) mEntries.size(); };
+
+    protected:
+
+    /*
+     * Forgets mispredictions the simulation has gone past, and history
+     * older than GAMEEVENT_HISTORY_TICKS, as of tick now.
+     */
+    void Trim(unsigned now);
+
+    struct Entry {
+        GameEvent event;
+        bool fired;
+        bool provisional;
+    };
+
+    // Events, roughly in tick order
+    std::vector<Entry> mEntries;
+};
+
+#endif /* GAMEEVENTS_H */
@@ -1,10 +1,22 @@
 #include "Gameclock.h"
 #include <assert.h>
+#include <time.h>
+
+uint64_t
+MonotonicMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
 
 Gameclock::Gameclock(unsigned tickMS) : mTimestamp(0)
                                       , mLastStep(0)
                                       , mTickDuration(tickMS / 1000.0)
                                       , mClockRemainder(0.0f)
+                                      , mSkew(0.0f)
+                                      , mSkewAdjustment(0.0)
+                                      , mEpoch(0)
 {
 }
 
@@ -29,17 +41,44 @@ Gameclock::Set(unsigned timestamp)
     mTimestamp = timestamp;
     mLastStep = 0;
     mClockRemainder = 0.0f;
+    mSkewAdjustment = 0.0;
+    ++mEpoch;
     mClock.Reset();
 }
 
+uint64_t
+Gameclock::NowMicros() const
+{
+    double elapsedTime = mClock.GetElapsedTime() * (1.0 + mSkew) + mClockRemainder;
+    double seconds = mTimestamp * (double) mTickDuration + elapsedTime;
+    return (uint64_t)(seconds * 1000000.0);
+}
+
 void
 Gameclock::Tick()
 {
     // Busywait until a tick has passed
-    float elapsedTime;
-    do {
-        elapsedTime = mClock.GetElapsedTime() + mClockRemainder;
-    } while (elapsedTime < mTickDuration);
+    while (!Poll());
+}
+
+float
+Gameclock::SecondsUntilTick() const
+{
+    float elapsedTime = mClock.GetElapsedTime() * (1.0f + mSkew) + mClockRemainder;
+    if (elapsedTime >= mTickDuration)
+        return 0.0f;
+    return (mTickDuration - elapsedTime) / (1.0f + mSkew);
+}
+
+bool
+Gameclock::Poll()
+{
+    // Has a tick passed? Skew makes time pass a little faster or slower.
+    float rawTime = mClock.GetElapsedTime();
+    float elapsedTime = rawTime * (1.0f + mSkew) + mClockRemainder;
+    if (elapsedTime < mTickDuration)
+        return false;
+    mSkewAdjustment += rawTime * mSkew;
 
     // Reset the clock
     mClock.Reset();
@@ -58,4 +97,5 @@ Gameclock::Tick()
 
     // Remember the step we took
     mLastStep = nTicks;
+    return true;
 }
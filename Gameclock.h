@@ -2,9 +2,17 @@
 #define GAMECLOCK_H
 
 #include "Framework.h"
+#include <stdint.h>
 
 #define GAMECLOCK_TICK_MS 32
 
+/*
+ * Microseconds on the system's monotonic clock, from an arbitrary start.
+ * Integer all the way, so it keeps full resolution however long we run,
+ * unlike the float seconds sf::Clock gives us. Any thread.
+ */
+uint64_t MonotonicMicros();
+
 class Gameclock {
 
     public:
@@ -34,6 +42,17 @@ class Gameclock {
      */
     void Tick();
 
+    /*
+     * Like Tick(), but never waits. Returns false, and leaves the clock
+     * alone, if a tick hasn't passed yet.
+     */
+    bool Poll();
+
+    /*
+     * Seconds until Poll() will next succeed. Zero if it would now.
+     */
+    float SecondsUntilTick() const;
+
     /*
      * Gets the current timestamp.
      */
@@ -44,6 +63,36 @@ class Gameclock {
      */
     unsigned Then() const;
 
+    /*
+     * Gets the current game time in microseconds, including the time since
+     * the last tick.
+     */
+    uint64_t NowMicros() const;
+
+    /*
+     * Number of seconds per tick.
+     */
+    float GetTickDuration() const { return mTickDuration; };
+
+    /*
+     * Runs the clock slightly fast (positive skew) or slow (negative skew).
+     * A skew of 0.01 makes ticks come 1% sooner. This lets us slew towards
+     * another clock without jumping.
+     */
+    void SetRateSkew(float skew) { mSkew = skew; };
+    float GetRateSkew() const { return mSkew; };
+
+    /*
+     * How far skew has moved the clock, in total, since the last Set().
+     */
+    double GetSkewAdjustmentMicros() const { return mSkewAdjustment * 1000000.0; };
+
+    /*
+     * Incremented every time the clock is Set(). Measurements taken against
+     * an earlier epoch are no longer valid.
+     */
+    unsigned GetEpoch() const { return mEpoch; };
+
 
     protected:
 
@@ -61,6 +110,13 @@ class Gameclock {
 
     // The remainder on the clock after the last tick
     float mClockRemainder;
+
+    // Rate skew, and the total adjustment it has made in seconds
+    float mSkew;
+    double mSkewAdjustment;
+
+    // Number of times we've been Set()
+    unsigned mEpoch;
 };
 
 #endif /* GAMECLOCK_H */
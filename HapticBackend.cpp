@@ -0,0 +1,280 @@
+#include "HapticBackend.h"
+#include "Gameclock.h"
+#include <stdio.h>
+#include <math.h>
+
+#ifdef FALCON
+
+/*
+ * ChaiHapticBackend methods.
+ */
+
+ChaiHapticBackend::ChaiHapticBackend() : mHapticHandler(NULL)
+                                       , mHapticDevice(NULL)
+                                       , mReady(false)
+{
+}
+
+ChaiHapticBackend::~ChaiHapticBackend()
+{
+    delete mHapticHandler;
+}
+
+bool
+ChaiHapticBackend::Open()
+{
+    mHapticHandler = new cHapticDeviceHandler();
+
+    // get access to the first available haptic device
+    mHapticHandler->getDevice(mHapticDevice, 0);
+    if (!mHapticDevice)
+        return false;
+
+    // retrieve information about the current haptic device
+    mHapticDeviceInfo = mHapticDevice->getSpecifications();
+
+    // open connection to device, and initialize it
+    int result = mHapticDevice->open();
+    if (result == 0)
+        result = mHapticDevice->initialize();
+    return result == 0;
+}
+
+void
+ChaiHapticBackend::Close()
+{
+    if (mHapticDevice)
+        mHapticDevice->close();
+}
+
+bool
+ChaiHapticBackend::IsReady()
+{
+    if (mReady)
+        return true;
+    if (mHapticDevice != NULL) {
+        cVector3d position;
+        mHapticDevice->getPosition(position);
+        //The Falcon always has position (0.01,0,0) when it is not yet ready.
+        if (position.x < .0099998 || position.x > .0100001 || position.y != 0 || position.z != 0) {
+            mReady = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+Vector
+ChaiHapticBackend::GetPosition()
+{
+    cVector3d position;
+    mHapticDevice->getPosition(position);
+    return Vector(position.x, position.y, position.z, 0);
+}
+
+Vector
+ChaiHapticBackend::GetVelocity()
+{
+    cVector3d velocity;
+    mHapticDevice->getLinearVelocity(velocity);
+    return Vector(velocity.x, velocity.y, velocity.z, 0);
+}
+
+bool
+ChaiHapticBackend::GetSwitch(unsigned index)
+{
+    bool isOn = false;
+    mHapticDevice->getUserSwitch(index, isOn);
+    return isOn;
+}
+
+void
+ChaiHapticBackend::SetForce(const Vector& force)
+{
+    mHapticDevice->setForce(cVector3d(force.x, force.y, force.z));
+}
+
+Vector
+ChaiHapticBackend::GetForce()
+{
+    cVector3d force;
+    mHapticDevice->getForce(force);
+    return Vector(force.x, force.y, force.z, 0);
+}
+
+#endif
+
+/*
+ * SimulatedHapticBackend methods.
+ */
+
+// Sleeping is coarse, so we spin for the last bit of each wait
+#define SIMHAPTICS_SPIN_MICROS 500
+
+SimulatedHapticBackend::SimulatedHapticBackend(unsigned maxForceSamples) : mLooping(false)
+                                                                         , mOpenMicros(0)
+                                                                         , mNextTick(0)
+                                                                         , mOpen(false)
+                                                                         , mPosition(0, 0, 0, 0)
+                                                                         , mVelocity(0, 0, 0, 0)
+                                                                         , mSwitches(0)
+                                                                         , mForce(0, 0, 0, 0)
+                                                                         , mForceSamples(maxForceSamples)
+                                                                         , mNumForceSamples(0)
+{
+}
+
+void
+SimulatedHapticBackend::AddWaypoint(float time, const Vector& position,
+                                    unsigned switches)
+{
+    Waypoint waypoint;
+    waypoint.time = time;
+    waypoint.position = position;
+    waypoint.switches = switches;
+    mWaypoints.push_back(waypoint);
+}
+
+bool
+SimulatedHapticBackend::LoadTrajectory(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("Couldn't open trajectory %s!\n", path);
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#')
+            continue;
+        float time, x, y, z;
+        unsigned switches;
+        if (sscanf(line, "%f %f %f %f %u", &time, &x, &y, &z, &switches) == 5)
+            AddWaypoint(time, Vector(x, y, z, 0), switches);
+    }
+    fclose(file);
+    return true;
+}
+
+bool
+SimulatedHapticBackend::WriteForceLog(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        printf("Couldn't open force log %s!\n", path);
+        return false;
+    }
+    for (unsigned i = 0; i < mNumForceSamples; ++i) {
+        const ForceSample& sample = mForceSamples[i];
+        fprintf(file, "%.6f %f %f %f\n", sample.time, sample.force.x,
+                sample.force.y, sample.force.z);
+    }
+    fclose(file);
+    return true;
+}
+
+bool
+SimulatedHapticBackend::Open()
+{
+    mOpenMicros = MonotonicMicros();
+    mNextTick = 0;
+    Sample(0.0f, mPosition, mVelocity, mSwitches);
+    mOpen = true;
+    return true;
+}
+
+Vector
+SimulatedHapticBackend::GetPosition()
+{
+    // Wait for the next servo tick
+    uint64_t now = Elapsed();
+    if (mNextTick > now + SIMHAPTICS_SPIN_MICROS)
+        sf::Sleep((mNextTick - now - SIMHAPTICS_SPIN_MICROS) / 1000000.0f);
+    while ((now = Elapsed()) < mNextTick)
+        ;
+
+    // If we're late, we're late; the device doesn't queue up ticks
+    mNextTick += SIMHAPTICS_PERIOD_MICROS;
+    if (mNextTick < now)
+        mNextTick = now + SIMHAPTICS_PERIOD_MICROS;
+
+    Sample(now / 1000000.0f, mPosition, mVelocity, mSwitches);
+    return mPosition;
+}
+
+Vector
+SimulatedHapticBackend::GetVelocity()
+{
+    return mVelocity;
+}
+
+bool
+SimulatedHapticBackend::GetSwitch(unsigned index)
+{
+    return (mSwitches >> index) & 1;
+}
+
+void
+SimulatedHapticBackend::SetForce(const Vector& force)
+{
+    mForce = force;
+    if (mNumForceSamples < mForceSamples.size()) {
+        ForceSample& sample = mForceSamples[mNumForceSamples++];
+        sample.time = Elapsed() / 1000000.0;
+        sample.force = force;
+    }
+}
+
+uint64_t
+SimulatedHapticBackend::Elapsed()
+{
+    return MonotonicMicros() - mOpenMicros;
+}
+
+void
+SimulatedHapticBackend::Sample(float time, Vector& positionOut,
+                               Vector& velocityOut, unsigned& switchesOut)
+{
+    positionOut = Vector(0, 0, 0, 0);
+    velocityOut = Vector(0, 0, 0, 0);
+    switchesOut = 0;
+    if (mWaypoints.empty())
+        return;
+
+    // Wrap around, if we loop
+    float length = mWaypoints.back().time;
+    if (mLooping && length > 0.0f)
+        time = fmodf(time, length);
+
+    // Before the start or past the end, the grip rests
+    if (time <= mWaypoints.front().time || time >= length) {
+        const Waypoint& rest = time <= mWaypoints.front().time ? mWaypoints.front()
+                                                                : mWaypoints.back();
+        positionOut = rest.position;
+        switchesOut = rest.switches;
+        return;
+    }
+
+    // Find the segment we're on
+    unsigned low = 0;
+    unsigned high = mWaypoints.size() - 1;
+    while (high - low > 1) {
+        unsigned middle = (low + high) / 2;
+        if (mWaypoints[middle].time <= time)
+            low = middle;
+        else
+            high = middle;
+    }
+    const Waypoint& from = mWaypoints[low];
+    const Waypoint& to = mWaypoints[high];
+
+    // Move along it
+    float duration = to.time - from.time;
+    float t = (time - from.time) / duration;
+    for (int i = 0; i < 3; ++i) {
+        positionOut[i] = from.position[i] + t * (to.position[i] - from.position[i]);
+        velocityOut[i] = (to.position[i] - from.position[i]) / duration;
+    }
+    switchesOut = from.switches;
+}
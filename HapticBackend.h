@@ -0,0 +1,197 @@
+#ifndef HAPTICBACKEND_H
+#define HAPTICBACKEND_H
+
+#include "Framework.h"
+#include "Vector.h"
+#include <vector>
+
+/*
+ * Haptic device backends.
+ *
+ * FalconDevice runs the haptics loop and talks to the device through this
+ * interface. ChaiHapticBackend is the real Novint Falcon, through CHAI3D,
+ * and only exists when built with FALCON. SimulatedHapticBackend needs no
+ * hardware: it moves the grip along a scripted or recorded trajectory,
+ * presses the buttons when told to, and records every force it's given,
+ * so the haptics pipeline can be run and timed anywhere.
+ *
+ * Everything is in the device's frame: x points out of the screen, y to the
+ * right and z up.
+ */
+class HapticBackend {
+
+    public:
+
+    virtual ~HapticBackend() {};
+
+    /*
+     * Connects to the device. Returns false if there isn't one.
+     */
+    virtual bool Open() = 0;
+    virtual void Close() = 0;
+
+    /*
+     * Is the device connected and reporting real positions yet?
+     */
+    virtual bool IsReady() = 0;
+
+    /*
+     * Reads the grip. Like the real device, reading the position waits
+     * for the device's next servo tick, which is what paces the haptics
+     * loop.
+     */
+    virtual Vector GetPosition() = 0;
+    virtual Vector GetVelocity() = 0;
+    virtual bool GetSwitch(unsigned index) = 0;
+
+    /*
+     * Sets the force the device pushes the grip with, and gets the one it
+     * was last given.
+     */
+    virtual void SetForce(const Vector& force) = 0;
+    virtual Vector GetForce() = 0;
+
+    /*
+     * Radius of the space the grip can move in.
+     */
+    virtual float GetWorkspaceRadius() = 0;
+};
+
+#ifdef FALCON
+
+/*
+ * The real thing.
+ */
+class ChaiHapticBackend : public HapticBackend {
+
+    public:
+
+    ChaiHapticBackend();
+    ~ChaiHapticBackend();
+
+    bool Open();
+    void Close();
+    bool IsReady();
+    Vector GetPosition();
+    Vector GetVelocity();
+    bool GetSwitch(unsigned index);
+    void SetForce(const Vector& force);
+    Vector GetForce();
+    float GetWorkspaceRadius() { return mHapticDeviceInfo.m_workspaceRadius; };
+
+    protected:
+
+    cHapticDeviceHandler *mHapticHandler;
+    cGenericHapticDevice *mHapticDevice;
+    cHapticDeviceInfo mHapticDeviceInfo;
+    bool mReady;
+};
+
+#endif
+
+// Servo rate of the simulated device, in Hz. The Falcon runs at 1kHz.
+#define SIMHAPTICS_RATE 1000
+#define SIMHAPTICS_PERIOD_MICROS (1000000 / SIMHAPTICS_RATE)
+
+// Forces recorded by default (two minutes at the servo rate)
+#define SIMHAPTICS_DEFAULT_FORCE_SAMPLES 120000
+
+// Workspace radius of the simulated device. The Falcon's is about 6cm.
+#define SIMHAPTICS_WORKSPACE_RADIUS 0.06f
+
+/*
+ * A device in software.
+ */
+class SimulatedHapticBackend : public HapticBackend {
+
+    public:
+
+    /*
+     * A point on the grip's path, and the buttons held from then on.
+     */
+    struct Waypoint {
+        float time;
+        Vector position;
+        unsigned switches;
+    };
+
+    /*
+     * A force the device was given, and when, in seconds since Open().
+     */
+    struct ForceSample {
+        double time;
+        Vector force;
+    };
+
+    /*
+     * Constructor. Records up to maxForceSamples forces, then stops
+     * recording.
+     */
+    SimulatedHapticBackend(unsigned maxForceSamples = SIMHAPTICS_DEFAULT_FORCE_SAMPLES);
+
+    /*
+     * Scripts the grip's path. Waypoints must be added in time order, and
+     * the grip moves in straight lines between them. Without any, it sits
+     * still at the origin.
+     */
+    void AddWaypoint(float time, const Vector& position, unsigned switches);
+    void SetLooping(bool looping) { mLooping = looping; };
+
+    /*
+     * Loads a recorded path: one waypoint per line, as
+     * "seconds x y z switches". Lines starting with # are ignored.
+     */
+    bool LoadTrajectory(const char* path);
+
+    /*
+     * Writes the recorded forces, one per line, as "seconds x y z".
+     */
+    bool WriteForceLog(const char* path);
+    unsigned GetNumForceSamples() { return mNumForceSamples; };
+
+    bool Open();
+    void Close() { mOpen = false; };
+    bool IsReady() { return mOpen; };
+    Vector GetPosition();
+    Vector GetVelocity();
+    bool GetSwitch(unsigned index);
+    void SetForce(const Vector& force);
+    Vector GetForce() { return mForce; };
+    float GetWorkspaceRadius() { return SIMHAPTICS_WORKSPACE_RADIUS; };
+
+    protected:
+
+    /*
+     * Where the grip is at a given time, and which way it's going.
+     */
+    void Sample(float time, Vector& positionOut, Vector& velocityOut,
+                unsigned& switchesOut);
+
+    /*
+     * Microseconds since we were opened.
+     */
+    uint64_t Elapsed();
+
+    // The path
+    std::vector<Waypoint> mWaypoints;
+    bool mLooping;
+
+    // When we were opened, on the monotonic clock (see Gameclock.h), and
+    // when the next servo tick is due, in microseconds since then
+    uint64_t mOpenMicros;
+    uint64_t mNextTick;
+    bool mOpen;
+
+    // The grip as of the last tick
+    Vector mPosition;
+    Vector mVelocity;
+    unsigned mSwitches;
+
+    // Forces given to us. Allocated up front; the haptics thread mustn't
+    // allocate.
+    Vector mForce;
+    std::vector<ForceSample> mForceSamples;
+    unsigned mNumForceSamples;
+};
+
+#endif /* HAPTICBACKEND_H */
@@ -0,0 +1,178 @@
+#include "FalconDevice.h"
+#include "HapticBackend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/*
+ * Haptics benchmark.
+ *
+ * Runs the real haptics loop against a simulated device, with no hardware
+ * and no window. The grip circles the workspace with the buttons going up
+ * and down, or follows a recorded trajectory, while a game-rate thread sends
+ * the haptic proxy a scene with an opponent rolling back and forth through
+ * our player, reads the inputs and now and again sends a collision impulse.
+ * Prints the loop's rate and jitter, and how long an impulse takes to reach
+ * the device's output.
+ *
+ * Usage: hapticbench [seconds [force log [trajectory]]]
+ */
+
+// How long to run, by default
+#define BENCH_DEFAULT_SECONDS 10.0f
+
+// How often the game thread runs, as in Game.h
+#define BENCH_FRAME_SECONDS 0.032f
+
+// Frames between collisions
+#define BENCH_COLLISION_FRAMES 7
+
+// The scripted path: a circle, this big, this often, in this many pieces
+#define BENCH_CIRCLE_RADIUS 0.03f
+#define BENCH_CIRCLE_SECONDS 2.0f
+#define BENCH_CIRCLE_WAYPOINTS 64
+
+static volatile bool sStop = false;
+static unsigned sFrames = 0;
+static unsigned sCollisions = 0;
+
+/*
+ * Our player sitting on a single ring, and an opponent rolling through
+ * them, as WorldModel::UpdateHapticProxy() would send it.
+ */
+static HapticScene BuildScene(unsigned sequence, float time)
+{
+    HapticScene scene;
+    scene.sequence = sequence;
+    scene.player.position = Vector(0, 4, 0, 0);
+    scene.player.velocity = Vector(0, 0, 0, 0);
+    scene.player.radius = 1.0f;
+    scene.numOpponents = 1;
+    scene.opponents[0].position = Vector(3.0f * sinf(time), 4, 0, 0);
+    scene.opponents[0].velocity = Vector(3.0f * cosf(time), 0, 0, 0);
+    scene.opponents[0].radius = 1.0f;
+    scene.numRings = 1;
+    scene.ringRadius[0] = 15.0f;
+    scene.ringTop[0] = 3.0f;
+    return scene;
+}
+
+/*
+ * The game's side: what WorldModel does with the Falcon each tick.
+ */
+static void GameThread(void* data)
+{
+    FalconDevice& falcon = *(FalconDevice*)data;
+    sf::Clock clock;
+    float nextFrame = 0.0f;
+    while (!sStop) {
+        float wait = nextFrame - clock.GetElapsedTime();
+        if (wait > 0.0f)
+            sf::Sleep(wait);
+        nextFrame += BENCH_FRAME_SECONDS;
+
+        falcon.setScene(BuildScene(sFrames + 1, clock.GetElapsedTime()));
+
+        UserInput input(1, sFrames);
+        input.inputs = 0;
+        falcon.setInputs(input, 0);
+
+        if (sFrames % BENCH_COLLISION_FRAMES == 0) {
+            falcon.setHorizontalForce(rand() / (float)RAND_MAX - 0.5f,
+                                      rand() / (float)RAND_MAX - 0.5f);
+            ++sCollisions;
+        }
+        ++sFrames;
+    }
+}
+
+/*
+ * Circles the grip, holding down the grow button for the first quarter of
+ * each lap and the shrink button for the third.
+ */
+static void ScriptCircle(SimulatedHapticBackend& device)
+{
+    for (unsigned i = 0; i <= BENCH_CIRCLE_WAYPOINTS; ++i) {
+        float fraction = (float)i / BENCH_CIRCLE_WAYPOINTS;
+        float angle = fraction * 2.0f * M_PI;
+        unsigned switches = 0;
+        if (fraction < 0.25f)
+            switches = 1 << 3;
+        else if (fraction >= 0.5f && fraction < 0.75f)
+            switches = 1 << 1;
+        device.AddWaypoint(fraction * BENCH_CIRCLE_SECONDS,
+                           Vector(BENCH_CIRCLE_RADIUS * cosf(angle),
+                                  BENCH_CIRCLE_RADIUS * sinf(angle), 0, 0),
+                           switches);
+    }
+    device.SetLooping(true);
+}
+
+/*
+ * The period below which a fraction of the loop's iterations fall, to the
+ * nearest power of two of a microsecond.
+ */
+static uint64_t PeriodPercentile(const HapticLoopStats& stats, float fraction)
+{
+    unsigned target = (unsigned)ceilf(stats.iterations * fraction);
+    unsigned seen = 0;
+    for (unsigned b = 0; b < METRICS_NUM_BUCKETS; ++b) {
+        seen += stats.periodBuckets[b];
+        if (seen >= target)
+            return (uint64_t)1 << b;
+    }
+    return (uint64_t)1 << (METRICS_NUM_BUCKETS - 1);
+}
+
+int main(int argc, char** argv)
+{
+    float seconds = argc > 1 ? atof(argv[1]) : BENCH_DEFAULT_SECONDS;
+    const char* forceLog = argc > 2 ? argv[2] : NULL;
+    const char* trajectory = argc > 3 ? argv[3] : NULL;
+
+    SimulatedHapticBackend device(seconds * SIMHAPTICS_RATE);
+    if (trajectory) {
+        if (!device.LoadTrajectory(trajectory))
+            return 1;
+    } else {
+        ScriptCircle(device);
+    }
+
+    FalconDevice falcon(&device);
+    falcon.Init();
+    sf::Thread game(&GameThread, &falcon);
+    game.Launch();
+
+    sf::Sleep(seconds);
+    sStop = true;
+    game.Wait();
+    falcon.Stop();
+
+    const HapticLoopStats& stats = falcon.getLoopStats();
+    if (!stats.iterations) {
+        printf("The haptics loop never ran!\n");
+        return 1;
+    }
+    double meanPeriod = stats.periodSum / stats.iterations;
+    double variance = stats.periodSumSquares / stats.iterations -
+                      meanPeriod * meanPeriod;
+    double jitter = variance > 0.0 ? sqrt(variance) : 0.0;
+
+    printf("haptics loop: %u iterations, %.1f Hz (target %d Hz)\n",
+           stats.iterations, stats.iterations / seconds, SIMHAPTICS_RATE);
+    printf("period: mean %.1f us, jitter %.1f us, p99 < %llu us, max %.1f us\n",
+           1000000.0 * meanPeriod, 1000000.0 * jitter,
+           (unsigned long long)PeriodPercentile(stats, 0.99f), 1000000.0f * stats.periodMax);
+    printf("impulses: %u sent, %u output, %u dropped\n", sCollisions,
+           stats.impulses, falcon.getDroppedImpulses());
+    if (stats.impulses)
+        printf("impulse latency: mean %.1f us, max %.1f us\n",
+               1000000.0 * stats.latencySum / stats.impulses,
+               1000000.0f * stats.latencyMax);
+    printf("game frames: %u, forces recorded: %u\n", sFrames,
+           device.GetNumForceSamples());
+
+    if (forceLog && !device.WriteForceLog(forceLog))
+        return 1;
+    return 0;
+}
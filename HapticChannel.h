@@ -0,0 +1,140 @@
+#ifndef HAPTICCHANNEL_H
+#define HAPTICCHANNEL_H
+
+/*
+ * Channels between the game thread and the haptics thread.
+ *
+ * The haptics loop runs at around 1kHz and must never wait on the game, so
+ * nothing here takes a lock or allocates. Each channel has exactly one
+ * writer thread and one reader thread, and both sides finish in a bounded
+ * number of steps no matter what the other is doing. Ordering comes from
+ * the GCC atomic builtins, which clang supports as well.
+ *
+ * SpscRing carries discrete events (impulses) that must each arrive once,
+ * in order. TripleBuffer carries a continuously updated value (a target)
+ * where only the latest one matters: the writer never overwrites what the
+ * reader is looking at, so the reader never sees half of one update and
+ * half of another.
+ */
+
+/*
+ * Fixed-size single-producer, single-consumer queue. N must be a power of
+ * two. The counters run freely and wrap; only their difference matters.
+ */
+template <typename T, unsigned N>
+class SpscRing {
+
+    public:
+
+    SpscRing() : mHead(0), mTail(0) {};
+
+    /*
+     * Adds an item. Returns false, dropping it, if the ring is full.
+     * Writer side only.
+     */
+    bool Push(const T& item)
+    {
+        unsigned tail = mTail;
+        if (tail - mHead == N)
+            return false;
+        mItems[tail & (N - 1)] = item;
+
+        // The item must land before the reader can see it
+        __sync_synchronize();
+        mTail = tail + 1;
+        return true;
+    };
+
+    /*
+     * Takes the oldest item. Returns false if the ring is empty. Reader
+     * side only.
+     */
+    bool Pop(T& itemOut)
+    {
+        unsigned head = mHead;
+        if (head == mTail)
+            return false;
+        __sync_synchronize();
+        itemOut = mItems[head & (N - 1)];
+
+        // We must be done with the slot before the writer can reuse it
+        __sync_synchronize();
+        mHead = head + 1;
+        return true;
+    };
+
+    /*
+     * Number of items waiting. Only a hint from either side.
+     */
+    unsigned Size() const { return mTail - mHead; };
+
+    protected:
+
+    T mItems[N];
+
+    // Next to read, written by the reader only, and next to write, written
+    // by the writer only
+    volatile unsigned mHead;
+    volatile unsigned mTail;
+};
+
+/*
+ * Latest-value channel. Three copies of the value: the reader owns one,
+ * the writer owns one, and the third is the most recent complete write,
+ * waiting to be picked up. Publishing and picking up are a single atomic
+ * exchange of which copy is which.
+ */
+template <typename T>
+class TripleBuffer {
+
+    public:
+
+    TripleBuffer(const T& initial) : mBack(0)
+                                   , mMiddle(1)
+                                   , mFront(2)
+    {
+        mBuffers[0] = mBuffers[1] = mBuffers[2] = initial;
+    };
+
+    /*
+     * Publishes a new value. Writer side only.
+     */
+    void Write(const T& value)
+    {
+        mBuffers[mBack] = value;
+
+        // Swap our copy into the middle, marked fresh, and take whatever
+        // was there
+        __sync_synchronize();
+        unsigned old = __sync_lock_test_and_set(&mMiddle, mBack | FRESH);
+        mBack = old & INDEX_MASK;
+    };
+
+    /*
+     * Gets the latest published value. Reader side only.
+     */
+    const T& Read()
+    {
+        if (mMiddle & FRESH) {
+            unsigned old = __sync_lock_test_and_set(&mMiddle, mFront);
+            mFront = old & INDEX_MASK;
+            __sync_synchronize();
+        }
+        return mBuffers[mFront];
+    };
+
+    protected:
+
+    // Flags on mMiddle
+    enum { INDEX_MASK = 3, FRESH = 4 };
+
+    T mBuffers[3];
+
+    // Which copy is whose. mBack belongs to the writer and mFront to the
+    // reader; mMiddle is shared.
+    unsigned mBack;
+    volatile unsigned mMiddle;
+    unsigned mFront;
+};
+
+#endif /* HAPTICCHANNEL_H */
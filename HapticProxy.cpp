@@ -0,0 +1,144 @@
+#include "HapticProxy.h"
+#include <math.h>
+
+// Below the platform
+#define HAPTICPROXY_NO_FLOOR -1.0e30f
+
+HapticProxy::HapticProxy() : mSceneAge(0.0f)
+                           , mPosition(0, 0, 0, 0)
+                           , mVelocity(0, 0, 0, 0)
+                           , mContactForce(0, 0, 0, 0)
+                           , mKick(0, 0, 0, 0)
+{
+}
+
+void
+HapticProxy::SetScene(const HapticScene& scene)
+{
+    if (!IsActive()) {
+        mPosition = scene.player.position;
+        mVelocity = scene.player.velocity;
+    }
+    mScene = scene;
+    mSceneAge = 0.0f;
+
+    mKick.x += HAPTICPROXY_IMPULSE_GAIN * scene.impulse.x;
+    mKick.z += HAPTICPROXY_IMPULSE_GAIN * scene.impulse.z;
+}
+
+/*
+ * Moves a body along with its velocity.
+ */
+static void Drift(HapticProxyBody& body, float dt)
+{
+    for (int i = 0; i < 3; ++i)
+        body.position[i] += body.velocity[i] * dt;
+}
+
+void
+HapticProxy::Step(float dt)
+{
+    mContactForce = Vector(0, 0, 0, 0);
+    if (!IsActive())
+        return;
+    if (dt > HAPTICPROXY_MAX_EXTRAPOLATION)
+        dt = HAPTICPROXY_MAX_EXTRAPOLATION;
+
+    // Where the game's bodies will have got to, unless the game has gone
+    // quiet, in which case we stop guessing
+    if (mSceneAge < HAPTICPROXY_MAX_EXTRAPOLATION) {
+        mSceneAge += dt;
+        Drift(mScene.player, dt);
+        for (unsigned i = 0; i < mScene.numOpponents; ++i)
+            Drift(mScene.opponents[i], dt);
+    }
+
+    // Pull the proxy towards our sphere, in short enough steps to stay
+    // stable
+    unsigned substeps = (unsigned) ceilf(dt / HAPTICPROXY_MAX_SUBSTEP);
+    for (unsigned i = 0; i < substeps; ++i)
+        StepCoupling(dt / substeps);
+    const HapticProxyBody& player = mScene.player;
+
+    // Push back against every opponent it overlaps, harder the further in
+    // and the faster they're closing
+    for (unsigned i = 0; i < mScene.numOpponents; ++i) {
+        const HapticProxyBody& other = mScene.opponents[i];
+        float dx = mPosition.x - other.position.x;
+        float dz = mPosition.z - other.position.z;
+        float dy = mPosition.y - other.position.y;
+        float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+        float overlap = player.radius + other.radius - distance;
+        if (overlap <= 0.0f || distance <= 0.0f)
+            continue;
+        float nx = dx / distance;
+        float nz = dz / distance;
+        float closing = (other.velocity.x - mVelocity.x) * nx +
+                        (other.velocity.z - mVelocity.z) * nz;
+        float push = HAPTICPROXY_CONTACT_STIFFNESS * overlap;
+        if (closing > 0.0f)
+            push += HAPTICPROXY_CONTACT_DAMPING * closing;
+        mContactForce.x += push * nx;
+        mContactForce.z += push * nz;
+    }
+
+    // Collisions the solver has dealt with
+    float decay = expf(-dt / HAPTICPROXY_IMPULSE_DECAY);
+    mKick.x *= decay;
+    mKick.z *= decay;
+    mContactForce.x += mKick.x;
+    mContactForce.z += mKick.z;
+
+    float magnitude = sqrtf(mContactForce.x * mContactForce.x +
+                            mContactForce.z * mContactForce.z);
+    if (magnitude > HAPTICPROXY_MAX_CONTACT_FORCE) {
+        mContactForce.x *= HAPTICPROXY_MAX_CONTACT_FORCE / magnitude;
+        mContactForce.z *= HAPTICPROXY_MAX_CONTACT_FORCE / magnitude;
+    }
+}
+
+void
+HapticProxy::StepCoupling(float dt)
+{
+    const HapticProxyBody& player = mScene.player;
+    for (int i = 0; i < 3; ++i) {
+        float accel = HAPTICPROXY_COUPLING_STIFFNESS * (player.position[i] - mPosition[i]) +
+                      HAPTICPROXY_COUPLING_DAMPING * (player.velocity[i] - mVelocity[i]);
+        mVelocity[i] += accel * dt;
+        mPosition[i] += mVelocity[i] * dt;
+    }
+
+    // It can't sink into the platform
+    float floor = FloorHeight(mPosition.x, mPosition.z) + player.radius;
+    if (mPosition.y < floor) {
+        mPosition.y = floor;
+        if (mVelocity.y < 0.0f)
+            mVelocity.y = 0.0f;
+    }
+}
+
+float
+HapticProxy::GetHeight() const
+{
+    float height = (mPosition.y - HAPTICPROXY_HEIGHT_OFFSET) / HAPTICPROXY_HEIGHT_RANGE;
+    if (height > 1.0f)
+        return 1.0f;
+    if (height < -1.0f)
+        return -1.0f;
+    return height;
+}
+
+float
+HapticProxy::FloorHeight(float x, float z) const
+{
+    // The rings are coaxial discs; we're standing on the highest one
+    // that reaches this far out
+    float distanceSquared = x * x + z * z;
+    float floor = HAPTICPROXY_NO_FLOOR;
+    for (unsigned i = 0; i < mScene.numRings; ++i) {
+        float radius = mScene.ringRadius[i];
+        if (distanceSquared <= radius * radius && mScene.ringTop[i] > floor)
+            floor = mScene.ringTop[i];
+    }
+    return floor;
+}
@@ -0,0 +1,160 @@
+#ifndef HAPTICPROXY_H
+#define HAPTICPROXY_H
+
+#include "Vector.h"
+
+/*
+ * Haptic-rate stand-in for the world.
+ *
+ * The game ticks at about 31Hz, but the Falcon wants a new force every
+ * millisecond. Rather than run Bullet a thousand times a second, each tick
+ * the game hands the haptics thread a small scene: our player's sphere, the
+ * opponents nearest to it, and the heights of the platform rings. Between
+ * ticks the haptics thread moves the opponents along with their velocities
+ * and moves a proxy of our sphere towards where the game says it is. The
+ * proxy is tied to the game's sphere by a spring and damper (a virtual
+ * coupling), so a correction from the game pulls it over smoothly instead
+ * of jumping, and the forces rendered from it stay continuous.
+ *
+ * Two forces come out of the proxy: how high the grip should sit, from how
+ * high the sphere is above the platform, and a contact force pushing the
+ * grip away from any opponent the sphere overlaps. On top of the contact
+ * force, the impulse the physics solver gave our sphere in each collision
+ * is played as a kick that dies away.
+ *
+ * Everything here is in world coordinates, with y up. The haptics thread
+ * owns the proxy; the game only ever builds HapticScenes.
+ */
+
+// Opponents and rings a scene holds. The nearest opponents are the ones
+// that are sent.
+#define HAPTICPROXY_MAX_OPPONENTS 8
+#define HAPTICPROXY_MAX_RINGS 8
+
+// Coupling between the proxy and the game's sphere, per unit of mass. Just
+// about critically damped.
+#define HAPTICPROXY_COUPLING_STIFFNESS 400.0f
+#define HAPTICPROXY_COUPLING_DAMPING 40.0f
+
+// The coupling is integrated explicitly, which only stays stable for short
+// steps. A step longer than a few haptic periods (after a stall, say) is
+// taken in pieces no longer than this, in seconds.
+#define HAPTICPROXY_NOMINAL_PERIOD 0.001f
+#define HAPTICPROXY_MAX_SUBSTEP (4 * HAPTICPROXY_NOMINAL_PERIOD)
+
+// Contact force on the grip, in newtons per unit of overlap and per unit of
+// closing speed, and the most it may be
+#define HAPTICPROXY_CONTACT_STIFFNESS 6.0f
+#define HAPTICPROXY_CONTACT_DAMPING 0.5f
+#define HAPTICPROXY_MAX_CONTACT_FORCE 8.0f
+
+// Force of the kick from a collision, in newtons per unit of impulse, and
+// how quickly it dies away, in seconds
+#define HAPTICPROXY_IMPULSE_GAIN 2.0f
+#define HAPTICPROXY_IMPULSE_DECAY 0.05f
+
+// The sphere's height maps onto the grip's: this height is the middle of
+// the grip's range, and this much higher or lower is the end of it
+#define HAPTICPROXY_HEIGHT_OFFSET 4.0f
+#define HAPTICPROXY_HEIGHT_RANGE 10.0f
+
+// How long we keep moving things along if the game stops sending scenes,
+// in seconds. Also the longest single Step() we take; any more is dropped.
+#define HAPTICPROXY_MAX_EXTRAPOLATION 0.1f
+
+/*
+ * A sphere in a scene.
+ */
+struct HapticProxyBody {
+    Vector position;
+    Vector velocity;
+    float radius;
+};
+
+/*
+ * What the game sends the haptics thread each tick.
+ */
+struct HapticScene {
+
+    HapticScene() : sequence(0), numOpponents(0), impulse(0, 0, 0, 0), numRings(0) {};
+
+    // Bumped with every scene. Zero means there isn't one yet.
+    unsigned sequence;
+
+    HapticProxyBody player;
+    HapticProxyBody opponents[HAPTICPROXY_MAX_OPPONENTS];
+    unsigned numOpponents;
+
+    // Impulse the solver gave our sphere in collisions with other players
+    // during the tick
+    Vector impulse;
+
+    // The rings, as radius and height of the top face
+    float ringRadius[HAPTICPROXY_MAX_RINGS];
+    float ringTop[HAPTICPROXY_MAX_RINGS];
+    unsigned numRings;
+};
+
+class HapticProxy {
+
+    public:
+
+    HapticProxy();
+
+    /*
+     * Takes a new scene from the game. The first one places the proxy;
+     * after that the coupling pulls it along.
+     */
+    void SetScene(const HapticScene& scene);
+
+    /*
+     * Advances dt seconds, up to HAPTICPROXY_MAX_EXTRAPOLATION.
+     */
+    void Step(float dt);
+
+    /*
+     * Have we been given a scene yet? Until then there's nothing to feel.
+     */
+    bool IsActive() const { return mScene.sequence != 0; };
+    unsigned GetSequence() const { return mScene.sequence; };
+
+    /*
+     * Where the grip should sit, from -1 (bottom) to 1 (top).
+     */
+    float GetHeight() const;
+
+    /*
+     * Force pushing us away from the opponents we're touching, and from
+     * recent collisions, in newtons. Only x and z are used.
+     */
+    const Vector& GetContactForce() const { return mContactForce; };
+
+    /*
+     * Height of the platform at a point, or a long way down if it isn't
+     * under there.
+     */
+    float FloorHeight(float x, float z) const;
+
+    protected:
+
+    /*
+     * Moves the proxy along the coupling for dt seconds, which must be no
+     * more than HAPTICPROXY_MAX_SUBSTEP.
+     */
+    void StepCoupling(float dt);
+
+    // The latest scene, with its bodies moved along to now
+    HapticScene mScene;
+    float mSceneAge;
+
+    // Our sphere, as the haptics thread sees it
+    Vector mPosition;
+    Vector mVelocity;
+
+    Vector mContactForce;
+
+    // What's left of the collision kicks
+    Vector mKick;
+};
+
+#endif /* HAPTICPROXY_H */
@@ -0,0 +1,168 @@
+#include "Framework.h"
+#include "HapticChannel.h"
+#include <stdio.h>
+
+/*
+ * Haptic channel stress test.
+ *
+ * Runs the writer and reader sides of each channel in HapticChannel.h on
+ * two threads, both flat out, and checks what comes through. Every item
+ * pushed onto the ring must come off exactly once and in order, and every
+ * value read from the triple buffer must be one complete write, never
+ * older than the one before it. Exits non-zero if anything is wrong.
+ */
+
+// How long each channel is hammered, in seconds
+#define STRESS_SECONDS 2.0f
+
+// Ring size. Small, so that it's often full and often empty.
+#define STRESS_RING_SIZE 16
+
+// Words in each triple buffer value. Big enough that a torn copy is likely
+// to be caught.
+#define STRESS_VALUE_WORDS 15
+
+/*
+ * A value that can tell whether it was copied in one piece: every word is
+ * derived from the sequence number.
+ */
+struct StressValue {
+
+    StressValue() { Set(0); };
+
+    void Set(unsigned s)
+    {
+        seq = s;
+        for (unsigned i = 0; i < STRESS_VALUE_WORDS; ++i)
+            words[i] = s * (i + 1) + i;
+    };
+
+    bool IsWhole() const
+    {
+        for (unsigned i = 0; i < STRESS_VALUE_WORDS; ++i)
+            if (words[i] != seq * (i + 1) + i)
+                return false;
+        return true;
+    };
+
+    unsigned seq;
+    unsigned words[STRESS_VALUE_WORDS];
+};
+
+static SpscRing<unsigned, STRESS_RING_SIZE> sRing;
+static TripleBuffer<StressValue> sTarget((StressValue()));
+static volatile bool sStop = false;
+
+// Written by the writer threads, read once they've finished
+static unsigned sNumWritten;
+static unsigned sNumFull;
+
+static void RingWriter(void*)
+{
+    unsigned next = 0;
+    unsigned full = 0;
+    while (!sStop) {
+        if (sRing.Push(next))
+            ++next;
+        else
+            ++full;
+    }
+    sNumWritten = next;
+    sNumFull = full;
+}
+
+static void TargetWriter(void*)
+{
+    unsigned seq = 0;
+    StressValue value;
+    while (!sStop) {
+        value.Set(++seq);
+        sTarget.Write(value);
+    }
+    sNumWritten = seq;
+}
+
+/*
+ * Reads the ring until the writer stops, then drains it. Returns the number
+ * of errors.
+ */
+static unsigned StressRing()
+{
+    sStop = false;
+    sf::Thread writer(&RingWriter, NULL);
+    writer.Launch();
+
+    unsigned expected = 0;
+    unsigned errors = 0;
+    unsigned empty = 0;
+    unsigned item;
+    sf::Clock clock;
+    while (clock.GetElapsedTime() < STRESS_SECONDS) {
+        if (!sRing.Pop(item)) {
+            ++empty;
+            continue;
+        }
+        if (item != expected)
+            ++errors;
+        expected = item + 1;
+    }
+    float seconds = clock.GetElapsedTime();
+    sStop = true;
+    writer.Wait();
+
+    // Whatever's left
+    while (sRing.Pop(item)) {
+        if (item != expected)
+            ++errors;
+        expected = item + 1;
+    }
+    if (expected != sNumWritten)
+        ++errors;
+
+    printf("ring: %u items (%.1fM/sec), full %u times, empty %u times, %u errors\n",
+           sNumWritten, sNumWritten / seconds / 1000000.0f, sNumFull, empty, errors);
+    return errors;
+}
+
+/*
+ * Reads the triple buffer until time is up. Returns the number of errors.
+ */
+static unsigned StressTarget()
+{
+    sStop = false;
+    sf::Thread writer(&TargetWriter, NULL);
+    writer.Launch();
+
+    unsigned reads = 0;
+    unsigned changes = 0;
+    unsigned torn = 0;
+    unsigned backwards = 0;
+    unsigned last = 0;
+    sf::Clock clock;
+    while (clock.GetElapsedTime() < STRESS_SECONDS) {
+        const StressValue& value = sTarget.Read();
+        ++reads;
+        if (!value.IsWhole())
+            ++torn;
+        if (value.seq < last)
+            ++backwards;
+        else if (value.seq > last)
+            ++changes;
+        last = value.seq;
+    }
+    float seconds = clock.GetElapsedTime();
+    sStop = true;
+    writer.Wait();
+
+    printf("triple buffer: %u writes (%.1fM/sec), %u reads, %u new values, "
+           "%u torn, %u out of order\n", sNumWritten,
+           sNumWritten / seconds / 1000000.0f, reads, changes, torn, backwards);
+    return torn + backwards;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned errors = StressRing() + StressTarget();
+    printf(errors ? "FAILED\n" : "OK\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+#include "InputCodec.h"
+#include "MatchLog.h"
+#include "Framework.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+/*
+ * Input encoding benchmark.
+ *
+ * Encodes sessions of inputs the way the wire does (each input on its own)
+ * and the way keyframes do (a stream per tick), checks that they decode to
+ * what went in, and prints how big they are next to the old fixed-size
+ * encoding, how long encoding and decoding take, and a histogram of
+ * encoded sizes.
+ *
+ * With no arguments, it makes up two sessions: four keyboard players, and
+ * four Falcon players who send their axes every tick. Otherwise each
+ * argument is a match log (MatchLog.h), and the inputs recorded in it are
+ * measured, in the order the timeline was given them.
+ */
+
+// Length of the made-up sessions, in ticks (three minutes)
+#define BENCH_SESSION_TICKS 5625
+#define BENCH_SESSION_PLAYERS 4
+
+// The old encoding: inputs, three axes, timestamp and player ID
+#define BENCH_FIXED_SIZE 24
+
+// Times each session is encoded and decoded, for timing
+#define BENCH_REPEATS 200
+
+/*
+ * Keyboard players. Now and again each one presses or lets go of a key.
+ * Only changes are sent.
+ */
+static void MakeKeyboardSession(std::vector<UserInput>& session)
+{
+    srand(1);
+    uint32_t held[BENCH_SESSION_PLAYERS] = { 0 };
+    for (unsigned tick = 0; tick < BENCH_SESSION_TICKS; ++tick) {
+        for (unsigned player = 0; player < BENCH_SESSION_PLAYERS; ++player) {
+            if (rand() % 6)
+                continue;
+            UserInputIndex index = (UserInputIndex)(USERINPUT_INDEX_UP + rand() % 4);
+            bool isPress = !(held[player] & GEN_INPUT_MASK(index, true));
+            held[player] ^= GEN_INPUT_MASK(index, true);
+            UserInput input(player + 1, tick);
+            input.inputs = GEN_INPUT_MASK(index, isPress);
+            session.push_back(input);
+        }
+    }
+}
+
+/*
+ * Falcon players. The grip wanders, and sends its position every tick.
+ */
+static void MakeFalconSession(std::vector<UserInput>& session)
+{
+    srand(2);
+    float x[BENCH_SESSION_PLAYERS] = { 0 };
+    float y[BENCH_SESSION_PLAYERS] = { 0 };
+    for (unsigned tick = 0; tick < BENCH_SESSION_TICKS; ++tick) {
+        for (unsigned player = 0; player < BENCH_SESSION_PLAYERS; ++player) {
+            x[player] = 0.95f * x[player] + 0.1f * (rand() / (float) RAND_MAX - 0.5f);
+            y[player] = 0.95f * y[player] + 0.1f * (rand() / (float) RAND_MAX - 0.5f);
+            UserInput input(player + 1, tick);
+            input.falconInputs = Vector(x[player], y[player], 0, 0);
+            if (rand() % 50 == 0)
+                input.inputs = GEN_INPUT_MASK(USERINPUT_INDEX_GROW, rand() % 2);
+            session.push_back(input);
+        }
+    }
+}
+
+/*
+ * Reads the inputs from a match log. Returns false if it can't be read. A
+ * log that's malformed part of the way through still gives us the inputs
+ * before that.
+ */
+static bool LoadSession(const char* path, std::vector<UserInput>& session)
+{
+    MatchLog log;
+    if (!log.Open(path)) {
+        printf("Couldn't open match log %s!\n", path);
+        return false;
+    }
+    MatchLogRecord record;
+    while (log.Next(record))
+        if (record.type == MATCHLOG_RECORD_INPUT)
+            session.push_back(record.input);
+    return true;
+}
+
+static bool SameInput(const UserInput& a, const UserInput& b)
+{
+    return a.inputs == b.inputs && a.timestamp == b.timestamp &&
+           a.playerID == b.playerID && a.falconInputs.x == b.falconInputs.x &&
+           a.falconInputs.y == b.falconInputs.y && a.falconInputs.z == b.falconInputs.z;
+}
+
+static void Measure(const char* name, std::vector<UserInput>& session)
+{
+    if (session.empty()) {
+        printf("%s: no inputs\n", name);
+        return;
+    }
+    for (unsigned i = 0; i < session.size(); ++i)
+        InputCodec::Quantise(session[i]);
+
+    // On the wire, each on its own
+    std::vector<uint8_t> buffer(session.size() * INPUTCODEC_MAX_SIZE);
+    std::vector<unsigned> sizes(session.size());
+    unsigned histogram[INPUTCODEC_MAX_SIZE + 1] = { 0 };
+    unsigned wireBytes = 0;
+    sf::Clock clock;
+    for (unsigned repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+        wireBytes = 0;
+        for (unsigned i = 0; i < session.size(); ++i) {
+            InputCodec codec;
+            sizes[i] = codec.Encode(session[i], &buffer[wireBytes], INPUTCODEC_MAX_SIZE);
+            wireBytes += sizes[i];
+        }
+    }
+    double encodeNanos = 1e9 * clock.GetElapsedTime() / (BENCH_REPEATS * session.size());
+
+    unsigned errors = 0;
+    clock.Reset();
+    for (unsigned repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+        unsigned offset = 0;
+        for (unsigned i = 0; i < session.size(); ++i) {
+            InputCodec codec;
+            UserInput input(0, 0);
+            if (codec.Decode(&buffer[offset], sizes[i], input) != sizes[i] ||
+                !SameInput(input, session[i]))
+                ++errors;
+            offset += sizes[i];
+        }
+    }
+    double decodeNanos = 1e9 * clock.GetElapsedTime() / (BENCH_REPEATS * session.size());
+    for (unsigned i = 0; i < session.size(); ++i)
+        ++histogram[sizes[i]];
+
+    // In keyframes, a stream per tick
+    unsigned streamBytes = 0;
+    unsigned first = 0;
+    while (first < session.size()) {
+        InputStream stream(session[first].timestamp);
+        unsigned last = first;
+        while (last < session.size() && session[last].timestamp == session[first].timestamp)
+            stream.Append(session[last++]);
+        InputStream::Reader reader(stream);
+        UserInput input(0, 0);
+        for (unsigned i = first; i < last; ++i)
+            if (!reader.Next(input) || !SameInput(input, session[i]))
+                ++errors;
+        streamBytes += stream.Bytes();
+        first = last;
+    }
+
+    unsigned fixedBytes = session.size() * BENCH_FIXED_SIZE;
+    printf("%s: %u inputs\n", name, (unsigned) session.size());
+    printf("  fixed    %8u bytes, %5.2f per input\n", fixedBytes,
+           (float) fixedBytes / session.size());
+    printf("  wire     %8u bytes, %5.2f per input (%.0f%% of fixed)\n", wireBytes,
+           (float) wireBytes / session.size(), 100.0f * wireBytes / fixedBytes);
+    printf("  keyframe %8u bytes, %5.2f per input (%.0f%% of fixed)\n", streamBytes,
+           (float) streamBytes / session.size(), 100.0f * streamBytes / fixedBytes);
+    printf("  encode %.1f ns, decode %.1f ns per input, %u errors\n", encodeNanos,
+           decodeNanos, errors);
+    printf("  wire sizes:\n");
+    for (unsigned size = 0; size <= INPUTCODEC_MAX_SIZE; ++size) {
+        if (!histogram[size])
+            continue;
+        printf("    %2u bytes %8u ", size, histogram[size]);
+        for (unsigned bar = 0; bar < 50 * histogram[size] / session.size(); ++bar)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::vector<UserInput> keyboard, falcon;
+        MakeKeyboardSession(keyboard);
+        MakeFalconSession(falcon);
+        Measure("keyboard", keyboard);
+        Measure("falcon", falcon);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        std::vector<UserInput> session;
+        if (!LoadSession(argv[i], session))
+            return 1;
+        Measure(argv[i], session);
+    }
+    return 0;
+}
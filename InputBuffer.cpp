@@ -0,0 +1,100 @@
+#include "InputBuffer.h"
+#include <algorithm>
+#include <math.h>
+
+InputJitterBuffer::InputJitterBuffer() : mMaxDepth(0)
+                                       , mRollbacksAvoided(0)
+                                       , mRollbacksNotAvoided(0)
+{
+}
+
+bool
+InputJitterBuffer::Add(UserInput& input, unsigned now)
+{
+    if (!IsEnabled())
+        return false;
+
+    // Record how late this input is
+    PlayerState& player = mPlayers[input.playerID];
+    int lateness = (int) now - (int) input.timestamp;
+    player.lateness[player.nextSample] = lateness;
+    player.nextSample = (player.nextSample + 1) % INPUTBUFFER_WINDOW;
+    if (player.numSamples < INPUTBUFFER_WINDOW)
+        ++player.numSamples;
+    UpdateDepth(player);
+
+    // Inputs that are on time, or early, don't need us. The exception is
+    // when we're still holding something from this player: nothing may
+    // overtake it.
+    if (lateness <= 0 && player.numHeld == 0)
+        return false;
+
+    // Schedule the input, keeping the player's inputs in order
+    unsigned scheduled = input.timestamp + player.depth;
+    if (scheduled < player.lastScheduled)
+        scheduled = player.lastScheduled;
+
+    // Too late even for us
+    if (scheduled < now) {
+        ++mRollbacksNotAvoided;
+        return false;
+    }
+
+    mHeld.insert(std::make_pair(scheduled, input));
+    player.lastScheduled = scheduled;
+    ++player.numHeld;
+    if (lateness > 0)
+        ++mRollbacksAvoided;
+    return true;
+}
+
+bool
+InputJitterBuffer::PopDue(unsigned now, UserInput& inputOut)
+{
+    if (mHeld.empty() || mHeld.begin()->first > now)
+        return false;
+
+    // Apply at the current tick. If we were stepped more than one tick at
+    // once we may be past the scheduled tick, but applying it now still
+    // doesn't cost a rollback.
+    inputOut = mHeld.begin()->second;
+    inputOut.timestamp = now;
+    mHeld.erase(mHeld.begin());
+    --mPlayers[inputOut.playerID].numHeld;
+    return true;
+}
+
+unsigned
+InputJitterBuffer::GetDepth(unsigned playerID)
+{
+    std::map<unsigned, PlayerState>::iterator it = mPlayers.find(playerID);
+    return it == mPlayers.end() ? 0 : it->second.depth;
+}
+
+unsigned
+InputJitterBuffer::GetLargestDepth()
+{
+    unsigned largest = 0;
+    for (std::map<unsigned, PlayerState>::iterator it = mPlayers.begin();
+         it != mPlayers.end(); ++it)
+        largest = std::max(largest, it->second.depth);
+    return largest;
+}
+
+void
+InputJitterBuffer::UpdateDepth(PlayerState& player)
+{
+    // Find the lateness that covers INPUTBUFFER_PERCENTILE of arrivals
+    int sorted[INPUTBUFFER_WINDOW];
+    std::copy(player.lateness, player.lateness + player.numSamples, sorted);
+    unsigned index = (unsigned) ceil(INPUTBUFFER_PERCENTILE * player.numSamples) - 1;
+    std::nth_element(sorted, sorted + index, sorted + player.numSamples);
+    int depth = sorted[index];
+
+    // Clamp to what we're allowed
+    if (depth < 0)
+        depth = 0;
+    if ((unsigned) depth > mMaxDepth)
+        depth = mMaxDepth;
+    player.depth = (unsigned) depth;
+}
@@ -0,0 +1,125 @@
+#ifndef INPUTBUFFER_H
+#define INPUTBUFFER_H
+
+#include "UserInput.h"
+#include <map>
+
+/*
+ * Server-side input jitter buffer.
+ *
+ * An input that reaches the server after the tick it's stamped with forces
+ * a rollback, on the server and on every client it's forwarded to. If we're
+ * willing to add a little latency, we can avoid most of those: instead of
+ * applying a late input in the past, we hold it for a fixed number of ticks
+ * past its timestamp and apply it then, at the current tick. Holding every
+ * input from a player for the same delay keeps the spacing between their
+ * inputs intact.
+ *
+ * The delay for each player adapts to how late their inputs have been
+ * arriving, and never exceeds a configured maximum. Inputs too late even
+ * for the buffer are applied in the past as before.
+ */
+
+// Number of arrivals we look at when sizing the buffer
+#define INPUTBUFFER_WINDOW 32
+
+// The buffer covers this fraction of recent arrivals
+#define INPUTBUFFER_PERCENTILE 0.9
+
+class InputJitterBuffer {
+
+    public:
+
+    /*
+     * Constructor. The buffer starts out disabled.
+     */
+    InputJitterBuffer();
+
+    /*
+     * Sets the largest delay we'll add, in ticks. Zero disables the buffer.
+     */
+    void SetMaxDepth(unsigned maxDepth) { mMaxDepth = maxDepth; };
+    bool IsEnabled() { return mMaxDepth > 0; };
+
+    /*
+     * Offers an input that arrived at tick now. Returns true if the buffer
+     * took it. Otherwise the input should be applied as usual.
+     */
+    bool Add(UserInput& input, unsigned now);
+
+    /*
+     * Pops the next held input that is due at tick now, restamped to now.
+     * Returns false if nothing is due. Inputs come out in the order they're
+     * scheduled.
+     */
+    bool PopDue(unsigned now, UserInput& inputOut);
+
+    /*
+     * Current delay for a player, in ticks.
+     */
+    unsigned GetDepth(unsigned playerID);
+
+    /*
+     * Largest current delay of any player, in ticks.
+     */
+    unsigned GetLargestDepth();
+
+    /*
+     * Number of late inputs we absorbed instead of rolling back for.
+     */
+    unsigned GetRollbacksAvoided() { return mRollbacksAvoided; };
+
+    /*
+     * Number of late inputs we couldn't absorb.
+     */
+    unsigned GetRollbacksNotAvoided() { return mRollbacksNotAvoided; };
+
+    /*
+     * Number of inputs currently held.
+     */
+    unsigned GetNumHeld() { return (unsigned) mHeld.size(); };
+
+    protected:
+
+    struct PlayerState {
+
+        PlayerState() : numSamples(0), nextSample(0), depth(0)
+                      , lastScheduled(0), numHeld(0) {};
+
+        // Recent lateness, in ticks. Negative means early.
+        int lateness[INPUTBUFFER_WINDOW];
+        unsigned numSamples;
+        unsigned nextSample;
+
+        // Current delay
+        unsigned depth;
+
+        // Tick the player's most recent held input is scheduled for. Later
+        // inputs never get scheduled ahead of it.
+        unsigned lastScheduled;
+
+        // Number of the player's inputs we're holding
+        unsigned numHeld;
+    };
+
+    /*
+     * Recomputes a player's delay from their recent lateness.
+     */
+    void UpdateDepth(PlayerState& player);
+
+    // Largest delay we're allowed to add. Zero means disabled.
+    unsigned mMaxDepth;
+
+    // Per-player state
+    std::map<unsigned, PlayerState> mPlayers;
+
+    // Held inputs, keyed by the tick they're scheduled for. Equal keys
+    // come out in the order they went in.
+    std::multimap<unsigned, UserInput> mHeld;
+
+    // Stats
+    unsigned mRollbacksAvoided;
+    unsigned mRollbacksNotAvoided;
+};
+
+#endif /* INPUTBUFFER_H */
@@ -0,0 +1,175 @@
+#include "InputCodec.h"
+#include <math.h>
+
+// Which optional parts follow the flags byte
+#define INPUTCODEC_FLAG_BITS 0x01
+#define INPUTCODEC_FLAG_FALCON_X 0x02
+#define INPUTCODEC_FLAG_FALCON_Y 0x04
+#define INPUTCODEC_FLAG_FALCON_Z 0x08
+#define INPUTCODEC_FLAG_ALL 0x0F
+
+// Largest quantised axis value
+#define INPUTCODEC_FALCON_SCALE ((1 << (INPUTCODEC_FALCON_BITS - 1)) - 1)
+
+// The inputs that exist, in the order their bits are packed.
+// USERINPUT_INDEX_COUNT isn't one.
+static const UserInputIndex sPackedInputs[] = {
+    USERINPUT_INDEX_GROW, USERINPUT_INDEX_SHRINK, USERINPUT_INDEX_UP,
+    USERINPUT_INDEX_DOWN, USERINPUT_INDEX_LEFT, USERINPUT_INDEX_RIGHT,
+    USERINPUT_INDEX_DASH, USERINPUT_INDEX_JUMP, USERINPUT_INDEX_BRAKE
+};
+static const unsigned sNumPackedInputs = sizeof(sPackedInputs) / sizeof(sPackedInputs[0]);
+
+/*
+ * Packs the begin and end bits of the inputs that exist next to each
+ * other, and back.
+ */
+static uint32_t PackBits(uint32_t inputs)
+{
+    uint32_t packed = 0;
+    for (unsigned i = 0; i < sNumPackedInputs; ++i)
+        packed |= ((inputs >> (2 * sPackedInputs[i])) & 3) << (2 * i);
+    return packed;
+}
+
+static uint32_t UnpackBits(uint32_t packed)
+{
+    uint32_t inputs = 0;
+    for (unsigned i = 0; i < sNumPackedInputs; ++i)
+        inputs |= ((packed >> (2 * i)) & 3) << (2 * sPackedInputs[i]);
+    return inputs;
+}
+
+/*
+ * Falcon axes, to and from the quantisation grid.
+ */
+static int QuantiseAxis(float value)
+{
+    if (value > 1.0f)
+        value = 1.0f;
+    else if (value < -1.0f)
+        value = -1.0f;
+    return (int) lroundf(value * INPUTCODEC_FALCON_SCALE);
+}
+
+static float AxisValue(int quantised)
+{
+    return quantised / (float) INPUTCODEC_FALCON_SCALE;
+}
+
+unsigned
+InputCodec::Encode(const UserInput& input, uint8_t* buffer, unsigned capacity)
+{
+    uint32_t packed = PackBits(input.inputs);
+    int axes[3];
+    uint8_t flags = packed ? INPUTCODEC_FLAG_BITS : 0;
+    for (int i = 0; i < 3; ++i) {
+        axes[i] = QuantiseAxis(input.falconInputs[i]);
+        if (axes[i])
+            flags |= INPUTCODEC_FLAG_FALCON_X << i;
+    }
+
+    if (capacity < 1)
+        return 0;
+    unsigned offset = 0;
+    buffer[offset++] = flags;
+    if (!PutVarint(Zigzag((int32_t)(input.timestamp - mPrevTimestamp)), buffer, capacity, offset) ||
+        !PutVarint(input.playerID, buffer, capacity, offset))
+        return 0;
+    if (packed && !PutVarint(packed, buffer, capacity, offset))
+        return 0;
+    for (int i = 0; i < 3; ++i)
+        if (axes[i] && !PutVarint(Zigzag(axes[i]), buffer, capacity, offset))
+            return 0;
+
+    mPrevTimestamp = input.timestamp;
+    return offset;
+}
+
+unsigned
+InputCodec::Decode(const uint8_t* buffer, unsigned size, UserInput& inputOut)
+{
+    if (size < 1)
+        return 0;
+    unsigned offset = 0;
+    uint8_t flags = buffer[offset++];
+    if (flags & ~INPUTCODEC_FLAG_ALL)
+        return 0;
+
+    uint32_t delta, playerID, packed = 0;
+    if (!GetVarint(buffer, size, offset, delta) ||
+        !GetVarint(buffer, size, offset, playerID))
+        return 0;
+    if ((flags & INPUTCODEC_FLAG_BITS) && !GetVarint(buffer, size, offset, packed))
+        return 0;
+
+    inputOut.falconInputs = Vector(0, 0, 0, 0);
+    for (int i = 0; i < 3; ++i) {
+        if (!(flags & (INPUTCODEC_FLAG_FALCON_X << i)))
+            continue;
+        uint32_t axis;
+        if (!GetVarint(buffer, size, offset, axis))
+            return 0;
+        int quantised = Unzigzag(axis);
+        if (quantised > INPUTCODEC_FALCON_SCALE || quantised < -INPUTCODEC_FALCON_SCALE)
+            return 0;
+        inputOut.falconInputs[i] = AxisValue(quantised);
+    }
+
+    inputOut.timestamp = mPrevTimestamp + Unzigzag(delta);
+    inputOut.playerID = playerID;
+    inputOut.inputs = UnpackBits(packed);
+    mPrevTimestamp = inputOut.timestamp;
+    return offset;
+}
+
+void
+InputCodec::Quantise(UserInput& input)
+{
+    input.inputs = UnpackBits(PackBits(input.inputs));
+    for (int i = 0; i < 3; ++i)
+        input.falconInputs[i] = AxisValue(QuantiseAxis(input.falconInputs[i]));
+    input.falconInputs.w = 0.0f;
+}
+
+/*
+ * InputStream methods.
+ */
+
+InputStream::InputStream(unsigned baseTimestamp) : mBase(baseTimestamp)
+                                                 , mCodec(baseTimestamp)
+                                                 , mCount(0)
+{
+}
+
+void
+InputStream::Append(const UserInput& input)
+{
+    unsigned offset = mBytes.size();
+    mBytes.resize(offset + INPUTCODEC_MAX_SIZE);
+    unsigned size = mCodec.Encode(input, &mBytes[offset], INPUTCODEC_MAX_SIZE);
+    assert(size);
+    mBytes.resize(offset + size);
+    ++mCount;
+}
+
+void
+InputStream::Clear(unsigned baseTimestamp)
+{
+    mBase = baseTimestamp;
+    mCodec = InputCodec(baseTimestamp);
+    mBytes.clear();
+    mCount = 0;
+}
+
+bool
+InputStream::Reader::Next(UserInput& inputOut)
+{
+    if (mOffset >= mStream.mBytes.size())
+        return false;
+    unsigned size = mCodec.Decode(&mStream.mBytes[mOffset],
+                                  mStream.mBytes.size() - mOffset, inputOut);
+    assert(size);
+    mOffset += size;
+    return true;
+}
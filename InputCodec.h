@@ -0,0 +1,178 @@
+#ifndef INPUTCODEC_H
+#define INPUTCODEC_H
+
+#include "UserInput.h"
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Compact input encoding.
+ *
+ * A UserInput in memory is a 32-bit bitfield, four floats of Falcon axes, a
+ * timestamp and a player ID, and nearly all of it is zeros or repeats. The
+ * compact form sends only what carries information:
+ *
+ *   - a flags byte saying which of the optional parts follow,
+ *   - the timestamp, as a zigzag varint delta against the previous input
+ *     in the stream (or against the stream's base, for the first),
+ *   - the player ID, as a varint,
+ *   - the begin/end bits of the inputs that exist, packed together, as a
+ *     varint, if any are set,
+ *   - each Falcon axis that isn't zero, quantised to
+ *     INPUTCODEC_FALCON_BITS bits.
+ *
+ * A key press on the wire takes about six bytes rather than 24. Quantising the Falcon
+ * axes loses precision, so inputs are quantised with Quantise() before
+ * they're applied anywhere, and every peer simulates exactly what was sent.
+ *
+ * Network payloads are self-contained, since the emulated network may
+ * reorder them, so each one is a stream of one input against a base of
+ * zero. Keyframes keep their inputs as a stream based at the keyframe's
+ * timestamp, where the deltas are almost always zero.
+ */
+
+// Bits per quantised Falcon axis, sign included. Axes run from -1 to 1.
+#define INPUTCODEC_FALCON_BITS 12
+
+// Largest encoded input: flags, two 5-byte varints, a 3-byte varint of
+// input bits and three 2-byte axes
+#define INPUTCODEC_MAX_SIZE 20
+
+/*
+ * Zigzag maps small signed numbers to small unsigned ones: 0, -1, 1, -2...
+ * The match log (MatchLog.h) uses these for its record headers too.
+ */
+inline uint32_t Zigzag(int32_t v) { return ((uint32_t) v << 1) ^ (uint32_t)(v >> 31); }
+inline int32_t Unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+/*
+ * Varints: seven bits per byte, low bits first, high bit set on every byte
+ * but the last. Both advance offset, and return false if the buffer ends
+ * first. Offsets into a match log can pass 4GB, so reading takes either
+ * width.
+ */
+inline bool PutVarint(uint32_t v, uint8_t* buffer, unsigned capacity,
+                      unsigned& offset)
+{
+    do {
+        if (offset >= capacity)
+            return false;
+        uint8_t byte = v & 0x7F;
+        v >>= 7;
+        buffer[offset++] = byte | (v ? 0x80 : 0);
+    } while (v);
+    return true;
+}
+
+template <typename Offset>
+inline bool GetVarint(const uint8_t* buffer, Offset size, Offset& offset,
+                      uint32_t& v)
+{
+    v = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        if (offset >= size)
+            return false;
+        uint8_t byte = buffer[offset++];
+        v |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Encoder and decoder for a stream of inputs. Each remembers the last
+ * timestamp it saw, which the next one is relative to.
+ */
+class InputCodec {
+
+    public:
+
+    InputCodec(unsigned baseTimestamp = 0) : mPrevTimestamp(baseTimestamp) {};
+
+    /*
+     * Starts a new stream.
+     */
+    void Reset(unsigned baseTimestamp = 0) { mPrevTimestamp = baseTimestamp; };
+
+    /*
+     * Appends an input to buffer. Returns the number of bytes written, or
+     * 0 if it didn't fit.
+     */
+    unsigned Encode(const UserInput& input, uint8_t* buffer, unsigned capacity);
+
+    /*
+     * Reads an input from buffer. Returns the number of bytes consumed, or
+     * 0 if the input is malformed or cut short.
+     */
+    unsigned Decode(const uint8_t* buffer, unsigned size, UserInput& inputOut);
+
+    /*
+     * Rounds an input to what survives encoding: Falcon axes onto the
+     * quantisation grid, and no bits for inputs that don't exist.
+     */
+    static void Quantise(UserInput& input);
+
+    protected:
+
+    unsigned mPrevTimestamp;
+};
+
+/*
+ * A growing list of inputs kept in compact form.
+ */
+class InputStream {
+
+    public:
+
+    InputStream(unsigned baseTimestamp = 0);
+
+    /*
+     * Adds an input to the end.
+     */
+    void Append(const UserInput& input);
+
+    /*
+     * Empties the stream and rebases it, keeping its buffer.
+     */
+    void Clear(unsigned baseTimestamp);
+
+    /*
+     * Number of inputs, and the bytes they take.
+     */
+    unsigned Size() const { return mCount; };
+    unsigned Bytes() const { return mBytes.size(); };
+    const uint8_t* Data() const { return mBytes.empty() ? NULL : &mBytes[0]; };
+
+    /*
+     * Reads the inputs back, in order.
+     */
+    class Reader {
+
+        public:
+
+        Reader(const InputStream& stream) : mStream(stream)
+                                          , mCodec(stream.mBase)
+                                          , mOffset(0) {};
+
+        /*
+         * Gets the next input. Returns false at the end.
+         */
+        bool Next(UserInput& inputOut);
+
+        protected:
+
+        const InputStream& mStream;
+        InputCodec mCodec;
+        unsigned mOffset;
+    };
+
+    protected:
+
+    unsigned mBase;
+    InputCodec mCodec;
+    std::vector<uint8_t> mBytes;
+    unsigned mCount;
+};
+
+#endif /* INPUTCODEC_H */
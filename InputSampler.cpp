@@ -0,0 +1,130 @@
+#include "InputSampler.h"
+#include "FalconDevice.h"
+#include <algorithm>
+
+InputSampler::InputSampler() : mDropped(0)
+                             , mFalconInputs(Vector(0, 0, 0, 0))
+                             , mDeviceHeld(0)
+                             , mFalcon(NULL)
+                             , mThread(NULL)
+                             , mRunning(false)
+                             , mEpochMicros(MonotonicMicros())
+{
+}
+
+InputSampler::~InputSampler()
+{
+    Stop();
+}
+
+static void DeviceThreadEntry(void* sampler)
+{
+    ((InputSampler*) sampler)->DeviceLoop();
+}
+
+void
+InputSampler::Start(FalconDevice *falcon)
+{
+    if (mThread || !falcon || !falcon->isConnected())
+        return;
+    mFalcon = falcon;
+    mRunning = true;
+    mThread = new sf::Thread(&DeviceThreadEntry, this);
+    mThread->Launch();
+}
+
+void
+InputSampler::Stop()
+{
+    mRunning = false;
+    if (mThread) {
+        mThread->Wait();
+        delete mThread;
+        mThread = NULL;
+    }
+}
+
+uint64_t
+InputSampler::NowMicros() const
+{
+    return MonotonicMicros() - mEpochMicros;
+}
+
+void
+InputSampler::Post(SpscRing<InputEvent, INPUTSAMPLER_QUEUE_SIZE>& queue,
+                   UserInputIndex index, bool isPress)
+{
+    InputEvent event;
+    event.index = index;
+    event.isPress = isPress;
+    event.micros = NowMicros();
+    event.timestamp = 0;
+    if (!queue.Push(event))
+        __sync_fetch_and_add(&mDropped, 1);
+}
+
+void
+InputSampler::Key(UserInputIndex index, bool isPress)
+{
+    Post(mWindowEvents, index, isPress);
+}
+
+void
+InputSampler::DeviceLoop()
+{
+    while (mRunning) {
+        Vector axes;
+        uint32_t held;
+        mFalcon->sampleInputs(axes, held);
+        mFalconInputs.Write(axes);
+
+        // Only the buttons that changed make events
+        uint32_t changed = held ^ mDeviceHeld;
+        for (unsigned index = 0; changed; ++index) {
+            uint32_t mask = GEN_INPUT_MASK(index, true);
+            if (changed & mask) {
+                Post(mDeviceEvents, (UserInputIndex) index, (held & mask) != 0);
+                changed &= ~mask;
+            }
+        }
+        mDeviceHeld = held;
+
+        sf::Sleep(INPUTSAMPLER_DEVICE_PERIOD);
+    }
+}
+
+static bool EarlierEvent(const InputEvent& a, const InputEvent& b)
+{
+    return a.micros < b.micros;
+}
+
+void
+InputSampler::Drain(const Gameclock& clock, unsigned earliest,
+                    std::vector<InputEvent>& eventsOut)
+{
+    // Each queue is in order already, so put them together
+    InputEvent event;
+    mWindowScratch.clear();
+    while (mWindowEvents.Pop(event))
+        mWindowScratch.push_back(event);
+    mDeviceScratch.clear();
+    while (mDeviceEvents.Pop(event))
+        mDeviceScratch.push_back(event);
+    eventsOut.resize(mWindowScratch.size() + mDeviceScratch.size());
+    std::merge(mWindowScratch.begin(), mWindowScratch.end(),
+               mDeviceScratch.begin(), mDeviceScratch.end(),
+               eventsOut.begin(), EarlierEvent);
+
+    // Line our clock up with the game's, and find the tick each event
+    // fell in
+    uint64_t now = NowMicros();
+    uint64_t gameNow = clock.NowMicros();
+    uint64_t tickMicros = (uint64_t)(clock.GetTickDuration() * 1000000.0);
+    unsigned latest = std::max(clock.Now(), earliest);
+    for (unsigned i = 0; i < eventsOut.size(); ++i) {
+        uint64_t age = now - std::min(eventsOut[i].micros, now);
+        uint64_t gameMicros = gameNow - std::min(age, gameNow);
+        unsigned timestamp = (unsigned)(gameMicros / tickMicros);
+        eventsOut[i].timestamp = std::min(std::max(timestamp, earliest), latest);
+    }
+}
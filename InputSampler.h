@@ -0,0 +1,149 @@
+#ifndef INPUTSAMPLER_H
+#define INPUTSAMPLER_H
+
+#include "Framework.h"
+#include "UserInput.h"
+#include "HapticChannel.h"
+#include "Gameclock.h"
+#include <stdint.h>
+#include <vector>
+
+class FalconDevice;
+
+/*
+ * Input sampling, off the frame.
+ *
+ * Input used to be read once per frame and stamped with the tick the frame
+ * started on, so everything that happened while we rendered, or while we
+ * waited for the next tick, was late by up to a frame and lumped into one
+ * tick. The sampler instead stamps every key and button change with the
+ * time it was seen, in whole microseconds on the monotonic clock
+ * (MonotonicMicros()), and hands them to the game thread through lock-free
+ * queues (HapticChannel.h). When the game takes them, each is mapped back
+ * to the tick it happened in.
+ *
+ * Device events come from a thread of the sampler's own, which reads the
+ * Falcon's grip a thousand times a second. Window events can't: SFML's
+ * windows may only be pumped on the thread that made them, which also
+ * renders. So the game thread pumps the window whenever it would otherwise
+ * be idle, while it waits for the next tick, and passes on what it finds.
+ *
+ * How long each input took from being seen to being sent is recorded in
+ * the input_latency_us histogram.
+ */
+
+// Events each queue holds before new ones are dropped
+#define INPUTSAMPLER_QUEUE_SIZE 256
+
+// Seconds between reads of the device
+#define INPUTSAMPLER_DEVICE_PERIOD 0.001f
+
+/*
+ * A key or button going down or up.
+ */
+struct InputEvent {
+    UserInputIndex index;
+    bool isPress;
+
+    // When it was seen, on the sampler's clock
+    uint64_t micros;
+
+    // The tick it happened in. Filled in by Drain().
+    unsigned timestamp;
+};
+
+class InputSampler {
+
+    public:
+
+    /*
+     * Constructor. Nothing is sampled until Start().
+     */
+    InputSampler();
+
+    /*
+     * Destructor. Stops the device thread.
+     */
+    ~InputSampler();
+
+    /*
+     * Starts reading the device, if there is one, on the sampler's
+     * thread. The device must outlive the sampler, or Stop().
+     */
+    void Start(FalconDevice *falcon);
+
+    /*
+     * Stops the device thread and waits for it to finish.
+     */
+    void Stop();
+
+    /*
+     * Records a key press or release from the window, as of now. Game
+     * thread only.
+     */
+    void Key(UserInputIndex index, bool isPress);
+
+    /*
+     * Takes every event seen so far, in the order they happened, each
+     * stamped with the tick it happened in according to clock. Nothing is
+     * stamped before earliest (the tick the world is about to step, so that
+     * our own input never rolls us back) or after the clock's current tick.
+     * Game thread only.
+     */
+    void Drain(const Gameclock& clock, unsigned earliest,
+               std::vector<InputEvent>& eventsOut);
+
+    /*
+     * The device's latest axes. Zero without one. Game thread only.
+     */
+    const Vector& GetFalconInputs() { return mFalconInputs.Read(); };
+
+    /*
+     * The sampler's clock, in microseconds since it was made. Any thread.
+     */
+    uint64_t NowMicros() const;
+
+    /*
+     * Events dropped because a queue was full.
+     */
+    unsigned GetDropped() { return mDropped; };
+
+    /*
+     * Body of the device thread.
+     */
+    void DeviceLoop();
+
+    protected:
+
+    /*
+     * Queues an event, counting it if it doesn't fit.
+     */
+    void Post(SpscRing<InputEvent, INPUTSAMPLER_QUEUE_SIZE>& queue,
+              UserInputIndex index, bool isPress);
+
+    // Window events, from the game thread to itself, and device events,
+    // from the device thread
+    SpscRing<InputEvent, INPUTSAMPLER_QUEUE_SIZE> mWindowEvents;
+    SpscRing<InputEvent, INPUTSAMPLER_QUEUE_SIZE> mDeviceEvents;
+    unsigned mDropped;
+
+    // Latest axes, from the device thread
+    TripleBuffer<Vector> mFalconInputs;
+
+    // What the device's buttons were holding down, as of the last read.
+    // Device thread only.
+    uint32_t mDeviceHeld;
+
+    FalconDevice *mFalcon;
+    sf::Thread *mThread;
+    volatile bool mRunning;
+
+    // Scratch for Drain()
+    std::vector<InputEvent> mWindowScratch;
+    std::vector<InputEvent> mDeviceScratch;
+
+    // When we were made, on the monotonic clock. Read by both threads.
+    uint64_t mEpochMicros;
+};
+
+#endif /* INPUTSAMPLER_H */
@@ -0,0 +1,77 @@
+#include "InputTracker.h"
+#include "Metrics.h"
+
+InputTracker::InputTracker() : mHeld(0)
+                             , mTouched(0)
+                             , mSent(0)
+                             , mSentTimestamp(0)
+                             , mSentPending(false)
+                             , mNumEvents(0)
+                             , mSuppressed(0)
+                             , mWindowSuppressed(0)
+                             , mSuppressedPerSecond(0.0f)
+{
+}
+
+void
+InputTracker::Key(UserInputIndex index, bool isPress)
+{
+    if (isPress)
+        mHeld |= GEN_INPUT_MASK(index, true);
+    else
+        mHeld &= ~GEN_INPUT_MASK(index, true);
+    mTouched |= GEN_INPUT_MASK(index, true);
+    ++mNumEvents;
+}
+
+/*
+ * Number of bits set.
+ */
+static unsigned CountBits(uint32_t bits)
+{
+    unsigned count = 0;
+    for (; bits; bits &= bits - 1)
+        ++count;
+    return count;
+}
+
+uint32_t
+InputTracker::Transitions(uint32_t activeInputs, unsigned worldTimestamp,
+                          unsigned inputTimestamp)
+{
+    // What the player is doing, or will be once what we sent lands. Only
+    // inputs the keyboard has had a say in are ours to compare; the rest
+    // may belong to the Falcon.
+    if (mSentPending && worldTimestamp > mSentTimestamp)
+        mSentPending = false;
+    uint32_t current = (mSentPending ? mSent : activeInputs) & mTouched;
+
+    uint32_t begins = mHeld & ~current;
+    uint32_t ends = current & ~mHeld;
+    uint32_t transitions = begins | (ends << 1);
+
+    // Whatever didn't turn into a transition was a repeat, or cancelled
+    // out
+    unsigned numTransitions = CountBits(transitions);
+    if (mNumEvents > numTransitions) {
+        unsigned suppressed = mNumEvents - numTransitions;
+        mSuppressed += suppressed;
+        mWindowSuppressed += suppressed;
+        Metrics::Global().Add(METRIC_INPUTS_SUPPRESSED, suppressed);
+    }
+    mNumEvents = 0;
+
+    float elapsed = mWindowClock.GetElapsedTime();
+    if (elapsed >= INPUTTRACKER_RATE_WINDOW) {
+        mSuppressedPerSecond = mWindowSuppressed / elapsed;
+        mWindowSuppressed = 0;
+        mWindowClock.Reset();
+    }
+
+    if (transitions) {
+        mSent = (current | begins) & ~ends;
+        mSentTimestamp = inputTimestamp;
+        mSentPending = true;
+    }
+    return transitions;
+}
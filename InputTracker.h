@@ -0,0 +1,77 @@
+#ifndef INPUTTRACKER_H
+#define INPUTTRACKER_H
+
+#include "Framework.h"
+#include "UserInput.h"
+#include <stdint.h>
+
+/*
+ * Keyboard input change detection.
+ *
+ * Holding a key down makes the operating system repeat its KeyPressed
+ * event, and every one of those used to become a begin bit, a payload to
+ * every peer and a rollback on each of them. The tracker instead follows
+ * which keys are held, in the order the events arrive, and once per frame
+ * sends only what differs from what the player is already doing. A key
+ * pressed and released within the same frame cancels out, which is what
+ * applying both bits at once did anyway.
+ *
+ * What the player is doing comes from their active inputs in the world,
+ * except while our last input is still on its way there; until the world
+ * has stepped past it, we compare against what we sent.
+ */
+
+// Seconds over which the suppression rate is measured
+#define INPUTTRACKER_RATE_WINDOW 1.0f
+
+class InputTracker {
+
+    public:
+
+    /*
+     * Constructor. Nothing is held.
+     */
+    InputTracker();
+
+    /*
+     * Records a key press or release for an input.
+     */
+    void Key(UserInputIndex index, bool isPress);
+
+    /*
+     * Works out the begin and end bits to send for this frame, given the
+     * player's active inputs as of the world's current timestamp, and the
+     * timestamp the input will carry.
+     */
+    uint32_t Transitions(uint32_t activeInputs, unsigned worldTimestamp,
+                         unsigned inputTimestamp);
+
+    /*
+     * Key events that didn't need sending: in total, and per second over
+     * the last whole window.
+     */
+    unsigned GetSuppressed() { return mSuppressed; };
+    float GetSuppressedPerSecond() { return mSuppressedPerSecond; };
+
+    protected:
+
+    // Keys held, and every input the keyboard has pressed or released, as
+    // begin bits
+    uint32_t mHeld;
+    uint32_t mTouched;
+
+    // What we last sent, and when it takes effect
+    uint32_t mSent;
+    unsigned mSentTimestamp;
+    bool mSentPending;
+
+    // Key events since the last Transitions()
+    unsigned mNumEvents;
+
+    unsigned mSuppressed;
+    unsigned mWindowSuppressed;
+    float mSuppressedPerSecond;
+    sf::Clock mWindowClock;
+};
+
+#endif /* INPUTTRACKER_H */
@@ -8,10 +8,19 @@
 #include "Timeline.h"
 #include "Gameclock.h"
 #include "Game.h"
+#include "Metrics.h"
+#include "MatchHost.h"
+#include "MatchLog.h"
 #include <stdlib.h>
 
 
 char* getOption(int argc, char** argv, const char* flag);
+char* findOption(int argc, char** argv, const char* flag);
+bool findFlag(int argc, char** argv, const char* flag);
+void parseNetworkConditions(int argc, char** argv, Communicator& communicator);
+int runHost(int argc, char** argv);
+int runReplay(int argc, char** argv);
+void checkServerOptions(int argc, char** argv);
 void printUsageAndExit(char* programName);
 
 int main(int argc, char** argv) {
@@ -25,6 +34,15 @@ int main(int argc, char** argv) {
     
     // Client or server mode?
     char* modeString = getOption(argc, argv, "-m");
+
+    // Hosts run many matches without a window, and are set up separately
+    if (!strcmp(modeString, "host"))
+        return runHost(argc, argv);
+
+    // So are replays of recorded matches
+    if (!strcmp(modeString, "replay"))
+        return runReplay(argc, argv);
+
     CommunicatorMode mode = COMMUNICATOR_MODE_NONE;
     if (!strcmp(modeString, "client"))
         mode = COMMUNICATOR_MODE_CLIENT;
@@ -49,6 +67,39 @@ int main(int argc, char** argv) {
         if (numClients < 0)
             printUsageAndExit(argv[0]);
         communicator.SetNumClientsExpected((unsigned) numClients);
+        checkServerOptions(argc, argv);
+
+        // Should we buffer late inputs?
+        char* bufferString = findOption(argc, argv, "-inputbuffer");
+        if (bufferString)
+            communicator.SetInputBufferMaxDepth((unsigned) atoi(bufferString));
+
+        // Should we check determinism with state hashes?
+        if (findFlag(argc, argv, "-deterministic"))
+            communicator.SetDeterministic(true);
+    }
+
+    // Are we emulating a bad network?
+    parseNetworkConditions(argc, argv, communicator);
+
+    // Should we log metrics?
+    char* metricsString = findOption(argc, argv, "-metrics");
+    if (metricsString) {
+        char* intervalString = findOption(argc, argv, "-metrics-interval");
+        unsigned interval = intervalString ? (unsigned) atoi(intervalString)
+                                           : METRICS_DEFAULT_INTERVAL;
+        communicator.SetMetricsLog(metricsString, interval);
+    }
+    
+    // Should we record the match?
+    MatchRecorder recorder;
+    char* recordString = findOption(argc, argv, "-record");
+    if (recordString) {
+        if (!recorder.Open(recordString)) {
+            printf("Couldn't create match log %s!\n", recordString);
+            exit(-1);
+        }
+        timeline.SetRecorder(&recorder);
     }
     
     // Start background music
@@ -61,17 +112,80 @@ int main(int argc, char** argv) {
     Music.Play();
 
     Game growblesGame(timeline, communicator);
+
+    // How long may a frame spend catching up?
+    char* budgetString = findOption(argc, argv, "-budget");
+    if (budgetString)
+        growblesGame.SetStepBudget(atoi(budgetString) / 1000.0f);
+
     growblesGame.Setup();
 
     return 0;
 }
 
+int runHost(int argc, char** argv)
+{
+    // How many clients make a match, and how many threads run them?
+    int clientsPerMatch = atoi(getOption(argc, argv, "-n"));
+    if (clientsPerMatch <= 0)
+        printUsageAndExit(argv[0]);
+    char* workersString = findOption(argc, argv, "-workers");
+    int numWorkers = workersString ? atoi(workersString) : MATCHHOST_DEFAULT_WORKERS;
+    if (numWorkers <= 0)
+        printUsageAndExit(argv[0]);
+
+    MatchHost host((unsigned) numWorkers, (unsigned) clientsPerMatch);
+
+    // The same options as a standalone server, for every match
+    checkServerOptions(argc, argv);
+    char* bufferString = findOption(argc, argv, "-inputbuffer");
+    if (bufferString)
+        host.SetInputBufferMaxDepth((unsigned) atoi(bufferString));
+    if (findFlag(argc, argv, "-deterministic"))
+        host.SetDeterministic(true);
+    char* budgetString = findOption(argc, argv, "-budget");
+    if (budgetString)
+        host.SetStepBudget(atoi(budgetString) / 1000.0f);
+
+    // Where do per-match reports go?
+    char* metricsString = findOption(argc, argv, "-metrics");
+    if (metricsString)
+        host.SetReportLog(metricsString);
+
+    return host.Run() ? 0 : -1;
+}
+
+int runReplay(int argc, char** argv)
+{
+    MatchLog log;
+    char* logString = getOption(argc, argv, "-log");
+    if (!log.Open(logString)) {
+        printf("Couldn't read match log %s!\n", logString);
+        return -1;
+    }
+
+    MatchReplayStats stats;
+    bool complete = ReplayMatch(log, stats);
+    if (!stats.states) {
+        printf("Match log %s doesn't start with a state!\n", logString);
+        return -1;
+    }
+    printf("Replayed %u ticks, %u inputs and %u states in %.2fs (%.0f ticks/sec)\n",
+           stats.ticks, stats.inputs, stats.states, stats.seconds,
+           stats.seconds > 0.0f ? stats.ticks / stats.seconds : 0.0f);
+    printf("%llu rollbacks, %llu resimulated ticks, %u mismatched states\n",
+           (unsigned long long) Metrics::Global().Get(METRIC_ROLLBACKS),
+           (unsigned long long) Metrics::Global().Get(METRIC_RESIMULATED_TICKS),
+           stats.mismatches);
+    return complete ? 0 : -1;
+}
+
 char* getOption(int argc, char** argv, const char* flag)
 {
     // Search for the flag
-    for (int i = 0; i < argc - 1; ++i)
-        if (!strcmp(argv[i], flag))
-            return argv[i + 1];
+    char* option = findOption(argc, argv, flag);
+    if (option)
+        return option;
 
     // If the flag wasn't found, bail out.
     printUsageAndExit(argv[0]);
@@ -80,8 +194,69 @@ char* getOption(int argc, char** argv, const char* flag)
     return NULL;
 }
 
+char* findOption(int argc, char** argv, const char* flag)
+{
+    for (int i = 0; i < argc - 1; ++i)
+        if (!strcmp(argv[i], flag))
+            return argv[i + 1];
+    return NULL;
+}
+
+bool findFlag(int argc, char** argv, const char* flag)
+{
+    for (int i = 1; i < argc; ++i)
+        if (!strcmp(argv[i], flag))
+            return true;
+    return false;
+}
+
+void parseNetworkConditions(int argc, char** argv, Communicator& communicator)
+{
+    NetworkConditions outbound, inbound;
+    unsigned seed = 1;
+
+    // -netsim applies to both directions, -netsim-out and -netsim-in override
+    // one direction each.
+    char* both = findOption(argc, argv, "-netsim");
+    if (both && (!outbound.Parse(both) || !inbound.Parse(both)))
+        printUsageAndExit(argv[0]);
+    char* out = findOption(argc, argv, "-netsim-out");
+    if (out && !outbound.Parse(out))
+        printUsageAndExit(argv[0]);
+    char* in = findOption(argc, argv, "-netsim-in");
+    if (in && !inbound.Parse(in))
+        printUsageAndExit(argv[0]);
+    char* seedString = findOption(argc, argv, "-netseed");
+    if (seedString)
+        seed = (unsigned) strtoul(seedString, NULL, 10);
+
+    communicator.SetNetworkConditions(outbound, inbound, seed);
+}
+
+void checkServerOptions(int argc, char** argv)
+{
+    // The input buffer restamps late inputs, and their senders only find
+    // out from the next full state dump. Deterministic mode hardly ever
+    // sends one, so every buffered input would end in a desync.
+    if (findOption(argc, argv, "-inputbuffer") && findFlag(argc, argv, "-deterministic")) {
+        printf("-inputbuffer can't be used with -deterministic!\n");
+        exit(-1);
+    }
+}
+
 void printUsageAndExit(char* programName)
 {
-    printf("Usage: %s -m [client,server] [-s address | -n numClients]\n", programName);
+    printf("Usage: %s -m [client,server] [-s address | -n numClients\n"
+           "          [-inputbuffer maxTicks | -deterministic]]\n"
+           "          [-netsim spec] [-netsim-out spec] [-netsim-in spec] [-netseed n]\n"
+           "          [-metrics file [-metrics-interval ticks]] [-budget ms]\n"
+           "          [-record file]\n"
+           "       %s -m host -n clientsPerMatch [-workers n]\n"
+           "          [-inputbuffer maxTicks | -deterministic] [-metrics file] [-budget ms]\n"
+           "       %s -m replay -log file\n"
+           "\n"
+           "Network emulation specs are latencyMS:jitterMS:lossRate:reorderRate:bytesPerSec,\n"
+           "and trailing fields may be omitted. For example, -netsim 80:15:0.01\n",
+           programName, programName, programName);
     exit(-1);
 }
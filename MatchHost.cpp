@@ -0,0 +1,279 @@
+#include "MatchHost.h"
+#include "Determinism.h"
+#include <Sockets/socket_include.h>
+#include <string.h>
+
+/*
+ * Match methods.
+ */
+
+Match::Match(unsigned matchID, unsigned numClients) : running(false)
+                                                     , mID(matchID)
+                                                     , mNumClients(numClients)
+                                                     , mWorld(mMetrics)
+                                                     , mTimeline(mMetrics)
+                                                     , mCommunicator(mTimeline,
+                                                                     COMMUNICATOR_MODE_SERVER,
+                                                                     mMetrics)
+                                                     , mClock(GAMECLOCK_TICK_MS)
+                                                     , mCatchUp(CATCHUP_DEFAULT_BUDGET, mMetrics)
+                                                     , mFrames(0)
+                                                     , mTotalMicros(0.0)
+                                                     , mMaxMicros(0.0)
+{
+    memset(mFrameBuckets, 0, sizeof(mFrameBuckets));
+}
+
+void
+Match::Start()
+{
+    // We never render, and we only referee
+    mWorld.InitHeadless();
+    mCommunicator.SetDedicated(true);
+
+    // Get everyone on the same page
+    mCommunicator.Bootstrap(mWorld, mClock);
+
+    // Go
+    mClock.Start();
+    mReportClock.Reset();
+}
+
+bool
+Match::Frame()
+{
+    // Nothing to do until a tick has passed, unless we're behind
+    if (!mClock.Poll() && !mCatchUp.IsBehind())
+        return true;
+
+    sf::Clock frameClock;
+
+    // Same as a standalone server: handle the network, then step
+    mCommunicator.Synchronize();
+    mCatchUp.Step(mWorld, mClock);
+
+    // Record how long that took
+    double micros = 1000000.0 * frameClock.GetElapsedTime();
+    ++mFrames;
+    mTotalMicros += micros;
+    if (micros > mMaxMicros)
+        mMaxMicros = micros;
+    ++mFrameBuckets[Metrics::Bucket((uint64_t) micros)];
+
+    // Are we done?
+    return mCommunicator.GetNumConnections() > 0 && mClock.Now() < MATCH_MAX_TICKS;
+}
+
+void
+Match::WriteReport(FILE* out)
+{
+    // Upper bound of the bucket holding the 99th percentile
+    uint64_t p99 = 0;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < METRICS_NUM_BUCKETS && mFrames; ++b) {
+        seen += mFrameBuckets[b];
+        if (seen * 100 >= (uint64_t) mFrames * 99) {
+            p99 = (uint64_t) 1 << b;
+            break;
+        }
+    }
+
+    // Then everything the match recorded, frames over budget and ticks
+    // behind included
+    fprintf(out, "{\"match\":%u,\"tick\":%u,\"players\":%u,\"frames\":%u,"
+            "\"frame_mean_us\":%.1f,\"frame_max_us\":%.1f,\"frame_p99_us\":%llu",
+            mID, mClock.Now(), mCommunicator.GetNumConnections(), mFrames,
+            mFrames ? mTotalMicros / mFrames : 0.0, mMaxMicros,
+            (unsigned long long) p99);
+    mCommunicator.UpdateGauges();
+    mMetrics.WriteFields(out);
+    fprintf(out, "}\n");
+    fflush(out);
+    mReportClock.Reset();
+}
+
+/*
+ * MatchHost methods.
+ */
+
+MatchHost::MatchHost(unsigned numWorkers,
+                     unsigned clientsPerMatch) : mListenSocket(INVALID_SOCKET)
+                                               , mNumWorkers(numWorkers)
+                                               , mClientsPerMatch(clientsPerMatch)
+                                               , mInputBufferMaxDepth(0)
+                                               , mDeterministic(false)
+                                               , mStepBudget(CATCHUP_DEFAULT_BUDGET)
+                                               , mNextMatchID(1)
+                                               , mNextScan(0)
+                                               , mStopping(false)
+                                               , mReportFile(stdout)
+{
+}
+
+MatchHost::~MatchHost()
+{
+    // Stop the workers
+    mStopping = true;
+    for (unsigned i = 0; i < mWorkers.size(); ++i) {
+        mWorkers[i]->Wait();
+        delete mWorkers[i];
+    }
+
+    // End everything
+    for (unsigned i = 0; i < mMatches.size(); ++i)
+        delete mMatches[i];
+
+    if (mReportFile != stdout)
+        fclose(mReportFile);
+    if (mListenSocket != INVALID_SOCKET)
+        closesocket(mListenSocket);
+}
+
+void
+MatchHost::SetReportLog(const char* path)
+{
+    FILE* file = fopen(path, "a");
+    if (!file) {
+        printf("Couldn't open report log %s!\n", path);
+        return;
+    }
+    mReportFile = file;
+}
+
+bool
+MatchHost::Listen()
+{
+    mListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (mListenSocket == INVALID_SOCKET) {
+        printf("Couldn't create a socket to listen on!\n");
+        return false;
+    }
+
+    // Don't wait out connections a previous host left behind
+    int reuse = 1;
+    setsockopt(mListenSocket, SOL_SOCKET, SO_REUSEADDR, (char*) &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(GROWBLES_PORT);
+    if (bind(mListenSocket, (struct sockaddr*) &address, sizeof(address)) ||
+        listen(mListenSocket, MATCHHOST_LISTEN_BACKLOG)) {
+        printf("Couldn't bind to port %u!\n", GROWBLES_PORT);
+        closesocket(mListenSocket);
+        mListenSocket = INVALID_SOCKET;
+        return false;
+    }
+    return true;
+}
+
+bool
+MatchHost::Run()
+{
+    if (!Listen())
+        return false;
+
+    // Start the workers
+    for (unsigned i = 0; i < mNumWorkers; ++i) {
+        sf::Thread* worker = new sf::Thread(&MatchHost::WorkerEntry, this);
+        worker->Launch();
+        mWorkers.push_back(worker);
+    }
+
+    // Fill matches one after another
+    while (!mStopping) {
+        Match* match = new Match(mNextMatchID++, mClientsPerMatch);
+        match->SetInputBufferMaxDepth(mInputBufferMaxDepth);
+        match->SetDeterministic(mDeterministic);
+        match->SetStepBudget(mStepBudget);
+
+        // Connections that come in while a match is starting wait in the
+        // backlog for the next one
+        printf("Match %u waiting for %u players\n", match->GetID(), mClientsPerMatch);
+        while (!match->IsFull()) {
+            SOCKET s = accept(mListenSocket, NULL, NULL);
+            if (s == INVALID_SOCKET) {
+                printf("Warning - Couldn't accept a connection\n");
+                continue;
+            }
+            match->AddConnection(s);
+        }
+        match->Start();
+        printf("Match %u started\n", match->GetID());
+
+        sf::Lock lock(mLock);
+        mMatches.push_back(match);
+    }
+    return true;
+}
+
+void
+MatchHost::WorkerEntry(void* host)
+{
+    ((MatchHost*)host)->WorkerLoop();
+}
+
+void
+MatchHost::WorkerLoop()
+{
+    // Floating point settings are per thread
+    if (mDeterministic)
+        SetDeterministicFloatingPoint();
+
+    while (!mStopping) {
+
+        // Find something to do
+        Match* match;
+        float wait;
+        {
+            sf::Lock lock(mLock);
+            match = TakeDueMatch(wait);
+        }
+        if (!match) {
+            sf::Sleep(wait < MATCHHOST_MAX_IDLE ? wait : MATCHHOST_MAX_IDLE);
+            continue;
+        }
+
+        // Run it
+        bool playing = match->Frame();
+
+        // Hand it back, reporting on the way
+        sf::Lock lock(mLock);
+        if (!playing || match->ReportDue())
+            match->WriteReport(mReportFile);
+        match->running = false;
+        if (!playing) {
+            printf("Match %u is over\n", match->GetID());
+            for (unsigned i = 0; i < mMatches.size(); ++i) {
+                if (mMatches[i] == match) {
+                    mMatches.erase(mMatches.begin() + i);
+                    break;
+                }
+            }
+            delete match;
+        }
+    }
+}
+
+Match*
+MatchHost::TakeDueMatch(float& waitOut)
+{
+    waitOut = MATCHHOST_MAX_IDLE;
+    unsigned numMatches = mMatches.size();
+    for (unsigned i = 0; i < numMatches; ++i) {
+        Match* match = mMatches[(mNextScan + i) % numMatches];
+        if (match->running)
+            continue;
+        float untilDue = match->SecondsUntilDue();
+        if (untilDue > 0.0f) {
+            if (untilDue < waitOut)
+                waitOut = untilDue;
+            continue;
+        }
+        mNextScan = (mNextScan + i + 1) % numMatches;
+        match->running = true;
+        return match;
+    }
+    return NULL;
+}
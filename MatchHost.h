@@ -0,0 +1,220 @@
+#ifndef MATCHHOST_H
+#define MATCHHOST_H
+
+#include "WorldModel.h"
+#include "Timeline.h"
+#include "Communicator.h"
+#include "Gameclock.h"
+#include "Metrics.h"
+#include "CatchUp.h"
+#include <vector>
+#include <stdio.h>
+
+/*
+ * Multi-match host.
+ *
+ * Runs many independent, headless server matches in one process. The main
+ * thread is the router: it keeps the one socket listening on GROWBLES_PORT
+ * for as long as the host runs, and hands each connection it accepts to
+ * the match that's filling up, starting a new match as soon as the last
+ * one is full. Full matches go into a run queue, from which a
+ * fixed pool of worker threads picks whichever match's next tick is due.
+ * Matches share no simulation state, so any worker can run any match, as
+ * long as only one runs it at a time. Idle workers sleep rather than spin.
+ *
+ * Bullet's built-in profiler isn't thread safe, so hosts with more than one
+ * worker need a Bullet built with BT_NO_PROFILE.
+ */
+
+// Default number of worker threads
+#define MATCHHOST_DEFAULT_WORKERS 4
+
+// A match ends when its players have all left, or after this many ticks
+// (three minutes)
+#define MATCH_MAX_TICKS 5625
+
+// Longest an idle worker sleeps before looking for work again, in seconds
+#define MATCHHOST_MAX_IDLE 0.002f
+
+// Connections waiting to be handed to a match
+#define MATCHHOST_LISTEN_BACKLOG 64
+
+// How often per-match metrics are reported, in seconds
+#define MATCHHOST_REPORT_INTERVAL 5.0f
+
+/*
+ * One match: a world, its timeline, and the connections to its players.
+ */
+class Match {
+
+    public:
+
+    /*
+     * Constructor. The match waits for numClients players.
+     */
+    Match(unsigned matchID, unsigned numClients);
+
+    /*
+     * Match options. Must be set before Start().
+     */
+    void SetInputBufferMaxDepth(unsigned maxDepth)
+    { mCommunicator.SetInputBufferMaxDepth(maxDepth); };
+    void SetDeterministic(bool deterministic)
+    { mCommunicator.SetDeterministic(deterministic); };
+    void SetStepBudget(float budget) { mCatchUp.SetBudget(budget); };
+
+    /*
+     * Takes a connection to one of our players, accepted by the host.
+     */
+    void AddConnection(SOCKET s) { mCommunicator.AcceptConnection(s); };
+
+    /*
+     * Have all our players connected?
+     */
+    bool IsFull() { return mCommunicator.GetNumConnections() >= mNumClients; };
+
+    /*
+     * Starts the game with the players who've connected.
+     */
+    void Start();
+
+    /*
+     * Handles the network and steps the world, if a tick is due or we're
+     * behind. Returns false once the match is over.
+     */
+    bool Frame();
+
+    /*
+     * Seconds until the next tick is due. Matches that are catching up are
+     * always due.
+     */
+    float SecondsUntilDue()
+    { return mCatchUp.IsBehind() ? 0.0f : mClock.SecondsUntilTick(); };
+
+    /*
+     * Is it time to report our metrics again?
+     */
+    bool ReportDue() { return mReportClock.GetElapsedTime() >= MATCHHOST_REPORT_INTERVAL; };
+
+    /*
+     * Writes our tick time and netcode metrics as a JSON line.
+     */
+    void WriteReport(FILE* out);
+
+    /*
+     * Gets our ID.
+     */
+    unsigned GetID() { return mID; };
+
+    // Is a worker running us right now? Guarded by the host's lock.
+    bool running;
+
+    protected:
+
+    // Our ID, and how many players we wait for
+    unsigned mID;
+    unsigned mNumClients;
+
+    // Our own metrics, so that matches don't mix their numbers. They have
+    // to come before the game, which records into them.
+    Metrics mMetrics;
+
+    // The game. The timeline has to come before the communicator, which
+    // holds onto it.
+    WorldModel mWorld;
+    Timeline mTimeline;
+    Communicator mCommunicator;
+    Gameclock mClock;
+    CatchUp mCatchUp;
+
+    // Wall time spent in each frame that stepped the world, in
+    // microseconds, as a log2 histogram (see Metrics::Bucket())
+    unsigned mFrames;
+    double mTotalMicros;
+    double mMaxMicros;
+    uint64_t mFrameBuckets[METRICS_NUM_BUCKETS];
+    sf::Clock mReportClock;
+};
+
+class MatchHost {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    MatchHost(unsigned numWorkers, unsigned clientsPerMatch);
+
+    /*
+     * Destructor. Stops the workers, and ends any matches still running.
+     */
+    ~MatchHost();
+
+    /*
+     * Options for every match we start.
+     */
+    void SetInputBufferMaxDepth(unsigned maxDepth) { mInputBufferMaxDepth = maxDepth; };
+    void SetDeterministic(bool deterministic) { mDeterministic = deterministic; };
+    void SetStepBudget(float budget) { mStepBudget = budget; };
+
+    /*
+     * Appends per-match tick time metrics to the given file, as JSON lines.
+     * Without this they go to stdout.
+     */
+    void SetReportLog(const char* path);
+
+    /*
+     * Starts listening and the workers, then routes connections to matches
+     * forever. Returns false if we can't listen.
+     */
+    bool Run();
+
+    protected:
+
+    /*
+     * Opens our listening socket. Returns false, having said why, if we
+     * can't.
+     */
+    bool Listen();
+
+    /*
+     * Worker thread body.
+     */
+    static void WorkerEntry(void* host);
+    void WorkerLoop();
+
+    /*
+     * Picks a match that's due and isn't already being run, and marks it
+     * as running. Returns NULL, and how long until one is due, if none is
+     * due yet. Must hold mLock.
+     */
+    Match* TakeDueMatch(float& waitOut);
+
+    // Where connections come in
+    SOCKET mListenSocket;
+
+    // Settings
+    unsigned mNumWorkers;
+    unsigned mClientsPerMatch;
+    unsigned mInputBufferMaxDepth;
+    bool mDeterministic;
+    float mStepBudget;
+
+    // Matches in play, and the ID of the next one. Workers look for due
+    // matches starting from a rotating position, so that nobody starves.
+    std::vector<Match*> mMatches;
+    unsigned mNextMatchID;
+    unsigned mNextScan;
+
+    // Workers
+    std::vector<sf::Thread*> mWorkers;
+    volatile bool mStopping;
+
+    // Guards mMatches, the running flags and the report log
+    sf::Mutex mLock;
+
+    // Where reports go
+    FILE* mReportFile;
+};
+
+#endif /* MATCHHOST_H */
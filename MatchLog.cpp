@@ -0,0 +1,358 @@
+#include "MatchLog.h"
+#include "InputCodec.h"
+#include "Timeline.h"
+#include "Gameclock.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * MatchRecorder methods.
+ */
+
+MatchRecorder::MatchRecorder() : mFile(-1)
+                               , mMap(NULL)
+                               , mCapacity(0)
+                               , mSize(0)
+                               , mPrevTick(0)
+                               , mFailures(0)
+                               , mFlags(0)
+{
+}
+
+MatchRecorder::~MatchRecorder()
+{
+    Close();
+}
+
+bool
+MatchRecorder::Open(const char* path)
+{
+    assert(!IsOpen());
+    mFile = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mFile < 0)
+        return false;
+    mSize = MATCHLOG_HEADER_SIZE;
+    mPrevTick = 0;
+    if (!Reserve(0)) {
+        close(mFile);
+        mFile = -1;
+        return false;
+    }
+    WriteHeader();
+    return true;
+}
+
+void
+MatchRecorder::Close()
+{
+    if (!IsOpen())
+        return;
+    if (mMap) {
+        WriteHeader();
+        munmap(mMap, mCapacity);
+        mMap = NULL;
+    }
+    if (ftruncate(mFile, mSize) != 0)
+        printf("Warning - Couldn't trim the match log\n");
+    close(mFile);
+    mFile = -1;
+    mCapacity = 0;
+}
+
+bool
+MatchRecorder::Reserve(unsigned bytes)
+{
+    if (mMap && mSize + bytes <= mCapacity)
+        return true;
+
+    // Grow the file, and map all of it again
+    uint64_t capacity = mCapacity;
+    while (capacity < mSize + bytes)
+        capacity += MATCHLOG_GROW_SIZE;
+    if (mMap) {
+        munmap(mMap, mCapacity);
+        mMap = NULL;
+    }
+    if (ftruncate(mFile, capacity) != 0)
+        return false;
+    void* map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0);
+    if (map == MAP_FAILED)
+        return false;
+    mMap = (uint8_t*) map;
+    mCapacity = capacity;
+    return true;
+}
+
+void
+MatchRecorder::WriteHeader()
+{
+    uint32_t magic = MATCHLOG_MAGIC;
+    uint16_t version = MATCHLOG_VERSION;
+    uint8_t wireVersion = WIRE_PROTOCOL_VERSION;
+    uint64_t size = mSize;
+
+    WireWriter writer(mMap, MATCHLOG_HEADER_SIZE);
+    writer.Field(magic);
+    writer.Field(version);
+    writer.Field(wireVersion);
+    writer.Field(mFlags);
+    writer.Field(size);
+    assert(writer.Ok());
+}
+
+void
+MatchRecorder::SetDeterministic(bool deterministic)
+{
+    if (deterministic)
+        mFlags |= MATCHLOG_FLAG_DETERMINISTIC;
+    else
+        mFlags &= ~MATCHLOG_FLAG_DETERMINISTIC;
+    if (mMap)
+        WriteHeader();
+}
+
+void
+MatchRecorder::Append(MatchLogRecordType type, unsigned tick,
+                      const uint8_t* body, unsigned bodySize)
+{
+    if (!Reserve(MATCHLOG_MAX_RECORD_SIZE - WIRE_MAX_MESSAGE_SIZE + bodySize)) {
+        ++mFailures;
+        return;
+    }
+    uint8_t* record = mMap + mSize;
+    unsigned headerSize = MATCHLOG_MAX_RECORD_SIZE - WIRE_MAX_MESSAGE_SIZE;
+    unsigned offset = 0;
+    record[offset++] = (uint8_t) type;
+    bool fits = PutVarint(Zigzag((int32_t)(tick - mPrevTick)), record, headerSize, offset) &&
+                PutVarint(bodySize, record, headerSize, offset);
+    assert(fits);
+    memcpy(record + offset, body, bodySize);
+    mSize += offset + bodySize;
+    mPrevTick = tick;
+
+    // Only now does the record count
+    WriteHeader();
+}
+
+void
+MatchRecorder::RecordInput(unsigned tick, const UserInput& input)
+{
+    if (!IsOpen())
+        return;
+    InputCodec codec(tick);
+    unsigned size = codec.Encode(input, mScratch, sizeof(mScratch));
+    if (!size) {
+        ++mFailures;
+        return;
+    }
+    Append(MATCHLOG_RECORD_INPUT, tick, mScratch, size);
+}
+
+void
+MatchRecorder::RecordState(unsigned tick, WorldState& state)
+{
+    if (!IsOpen())
+        return;
+    unsigned size = WireEncodePayload(PAYLOAD_TYPE_WORLDSTATE, &state, mScratch,
+                                      sizeof(mScratch));
+    if (!size) {
+        ++mFailures;
+        return;
+    }
+    Append(MATCHLOG_RECORD_STATE, tick, mScratch, size);
+}
+
+/*
+ * MatchLog methods.
+ */
+
+MatchLog::MatchLog() : mFile(-1)
+                     , mMap(NULL)
+                     , mMapSize(0)
+                     , mSize(0)
+                     , mOffset(0)
+                     , mPrevTick(0)
+                     , mMalformed(false)
+                     , mFlags(0)
+{
+}
+
+MatchLog::~MatchLog()
+{
+    Close();
+}
+
+bool
+MatchLog::Open(const char* path)
+{
+    assert(mFile < 0);
+    mFile = open(path, O_RDONLY);
+    if (mFile < 0)
+        return false;
+    struct stat info;
+    if (fstat(mFile, &info) != 0 || info.st_size < MATCHLOG_HEADER_SIZE) {
+        Close();
+        return false;
+    }
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, mFile, 0);
+    if (map == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    mMap = (const uint8_t*) map;
+    mMapSize = info.st_size;
+
+    // Is it a log, and one we can read?
+    uint32_t magic;
+    uint16_t version;
+    uint8_t wireVersion;
+    uint64_t size;
+    WireReader reader(mMap, MATCHLOG_HEADER_SIZE);
+    reader.Field(magic);
+    reader.Field(version);
+    reader.Field(wireVersion);
+    reader.Field(mFlags);
+    reader.Field(size);
+    if (!reader.Ok() || magic != MATCHLOG_MAGIC || version != MATCHLOG_VERSION ||
+        wireVersion != WIRE_PROTOCOL_VERSION || size < MATCHLOG_HEADER_SIZE) {
+        Close();
+        return false;
+    }
+
+    // A log that was cut short is good up to where it ends
+    mSize = size < mMapSize ? size : mMapSize;
+    Rewind();
+    return true;
+}
+
+void
+MatchLog::Close()
+{
+    if (mMap) {
+        munmap((void*) mMap, mMapSize);
+        mMap = NULL;
+    }
+    if (mFile >= 0) {
+        close(mFile);
+        mFile = -1;
+    }
+    mMapSize = mSize = mOffset = 0;
+    mFlags = 0;
+}
+
+void
+MatchLog::Rewind()
+{
+    mOffset = MATCHLOG_HEADER_SIZE;
+    mPrevTick = 0;
+    mMalformed = false;
+}
+
+bool
+MatchLog::Next(MatchLogRecord& recordOut)
+{
+    while (mOffset < mSize) {
+        uint64_t start = mOffset;
+        uint8_t type = mMap[mOffset++];
+        uint32_t delta, bodySize;
+        bool ok = GetVarint(mMap, mSize, mOffset, delta) &&
+                  GetVarint(mMap, mSize, mOffset, bodySize) &&
+                  bodySize <= mSize - mOffset;
+        const uint8_t* body = mMap + mOffset;
+        if (ok) {
+            mOffset += bodySize;
+            mPrevTick += Unzigzag(delta);
+            recordOut.tick = mPrevTick;
+        }
+
+        if (ok && type == MATCHLOG_RECORD_INPUT) {
+            InputCodec codec(recordOut.tick);
+            ok = codec.Decode(body, bodySize, recordOut.input) == bodySize;
+        }
+        else if (ok && type == MATCHLOG_RECORD_STATE)
+            ok = WireDecodePayload(PAYLOAD_TYPE_WORLDSTATE, body, bodySize,
+                                   &recordOut.state);
+
+        // Records from a later version that we don't know about can be
+        // skipped
+        else if (ok)
+            continue;
+
+        if (!ok) {
+            printf("Warning - Match log is malformed at byte %llu\n",
+                   (unsigned long long) start);
+            mMalformed = true;
+            mOffset = mSize;
+            return false;
+        }
+        recordOut.type = (MatchLogRecordType) type;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Replay.
+ */
+
+bool
+ReplayMatch(MatchLog& log, MatchReplayStats& statsOut)
+{
+    memset(&statsOut, 0, sizeof(statsOut));
+    bool deterministic = log.IsDeterministic();
+    MatchLogRecord record;
+    if (!log.Next(record) || record.type != MATCHLOG_RECORD_STATE)
+        return false;
+    sf::Clock wallClock;
+
+    // Start where the match started
+    WorldModel world;
+    world.InitHeadless();
+    world.SetState(record.state);
+    world.SetDeterministic(deterministic);
+    Gameclock clock(GAMECLOCK_TICK_MS);
+    clock.Set(world.GetCurrentTimestamp());
+    Timeline timeline;
+    timeline.SetDeterministic(deterministic);
+    timeline.Init(world, clock, COMMUNICATOR_MODE_CLIENT);
+    unsigned firstTick = world.GetCurrentTimestamp();
+    ++statsOut.states;
+
+    while (log.Next(record)) {
+
+        // Catch up to where the world was when this came in, taking held
+        // inputs as they fall due
+        while (world.GetCurrentTimestamp() < record.tick) {
+            timeline.ApplyDueInputs();
+            world.SingleStep();
+        }
+        timeline.ApplyDueInputs();
+        clock.Set(world.GetCurrentTimestamp());
+
+        if (record.type == MATCHLOG_RECORD_INPUT) {
+            timeline.AddInput(record.input);
+            ++statsOut.inputs;
+        }
+        else {
+            if (deterministic) {
+                StateHash hash;
+                hash.tick = record.state.timestamp;
+                hash.hash = WireHashState(record.state);
+                hash.repair = false;
+                if (!timeline.CheckStateHash(hash))
+                    ++statsOut.mismatches;
+            }
+            timeline.AddAuthoritativeState(record.state);
+            ++statsOut.states;
+        }
+    }
+
+    statsOut.ticks = world.GetCurrentTimestamp() - firstTick;
+    statsOut.seconds = wallClock.GetElapsedTime();
+    return !log.IsMalformed();
+}
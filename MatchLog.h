@@ -0,0 +1,240 @@
+#ifndef MATCHLOG_H
+#define MATCHLOG_H
+
+#include "WorldModel.h"
+#include "UserInput.h"
+#include "WireFormat.h"
+#include <stdint.h>
+
+/*
+ * Match recording and replay.
+ *
+ * A recorder attached to a Timeline appends everything that drives the
+ * simulation to a log: every input the timeline is given, and every full
+ * world state, starting with the one it was initialised from. Each record
+ * is stamped with the tick our world was on when it came in, so a replay
+ * can hand things to the timeline at the same point in the match it had
+ * them, late inputs and rollbacks included.
+ *
+ * The log is append-only and written through a shared memory mapping,
+ * grown a megabyte at a time, so recording costs a copy into memory and
+ * never a system call per record. The pages belong to the kernel, so if
+ * the game dies, everything recorded up to then still reaches the file;
+ * the header says how much of it is valid.
+ *
+ * Records are a type byte, the tick as a zigzag varint delta from the
+ * previous record's, the body size as a varint, and the body: inputs in
+ * their compact form (InputCodec.h) relative to the tick, and states in
+ * their wire form (WireFormat.h). A three player match logs at most about
+ * 2KB a second, nearly all of it states, so a three minute match comes to
+ * under half a megabyte.
+ */
+
+// "GRML", little-endian, and the version of the record layout
+#define MATCHLOG_MAGIC 0x4c4d5247
+#define MATCHLOG_VERSION 1
+
+// Magic (4 bytes), log version (2), wire version (1), flags (1), and the
+// size of the valid part of the log, header included (8)
+#define MATCHLOG_HEADER_SIZE 16
+
+// Header flags. Logs from before there were any have none set.
+#define MATCHLOG_FLAG_DETERMINISTIC 0x01
+
+// How much the file grows by when it fills up, in bytes
+#define MATCHLOG_GROW_SIZE (1 << 20)
+
+// Type byte, two 5-byte varints, and the largest body
+#define MATCHLOG_MAX_RECORD_SIZE (11 + WIRE_MAX_MESSAGE_SIZE)
+
+typedef enum {
+    MATCHLOG_RECORD_NONE = 0,
+    MATCHLOG_RECORD_INPUT,
+    MATCHLOG_RECORD_STATE
+} MatchLogRecordType;
+
+/*
+ * Appends to a log.
+ */
+class MatchRecorder {
+
+    public:
+
+    MatchRecorder();
+
+    /*
+     * Destructor. Closes the log.
+     */
+    ~MatchRecorder();
+
+    /*
+     * Starts a new log at path, replacing anything there. Returns false if
+     * it can't be created.
+     */
+    bool Open(const char* path);
+
+    /*
+     * Finishes the log, trimming the file to what was written.
+     */
+    void Close();
+
+    bool IsOpen() { return mFile >= 0; };
+
+    /*
+     * Marks the match as played in deterministic mode (see Determinism.h),
+     * so that replays run it the same way.
+     */
+    void SetDeterministic(bool deterministic);
+
+    /*
+     * Appends an input or a state, as of the given tick. Failures are
+     * counted and otherwise ignored; the game carries on without the log.
+     */
+    void RecordInput(unsigned tick, const UserInput& input);
+    void RecordState(unsigned tick, WorldState& state);
+
+    /*
+     * Bytes written so far, header included, and records that couldn't be.
+     */
+    uint64_t GetSize() { return mSize; };
+    unsigned GetFailures() { return mFailures; };
+
+    protected:
+
+    /*
+     * Appends a record with an encoded body.
+     */
+    void Append(MatchLogRecordType type, unsigned tick, const uint8_t* body,
+                unsigned bodySize);
+
+    /*
+     * Makes sure the mapping has room for bytes more. Returns false if the
+     * file couldn't be grown.
+     */
+    bool Reserve(unsigned bytes);
+
+    /*
+     * Writes the header, with the current size.
+     */
+    void WriteHeader();
+
+    int mFile;
+    uint8_t* mMap;
+    uint64_t mCapacity;
+    uint64_t mSize;
+
+    // Tick of the last record
+    unsigned mPrevTick;
+
+    unsigned mFailures;
+
+    // Header flags (MATCHLOG_FLAG_*)
+    uint8_t mFlags;
+
+    // Bodies are encoded here first, since their size goes before them
+    uint8_t mScratch[WIRE_MAX_MESSAGE_SIZE];
+};
+
+/*
+ * A record read back from a log.
+ */
+struct MatchLogRecord {
+
+    MatchLogRecord() : type(MATCHLOG_RECORD_NONE), tick(0), input(0, 0) {};
+
+    MatchLogRecordType type;
+    unsigned tick;
+
+    // Whichever the type says
+    UserInput input;
+    WorldState state;
+};
+
+/*
+ * Reads a log, in order.
+ */
+class MatchLog {
+
+    public:
+
+    MatchLog();
+
+    /*
+     * Destructor. Closes the log.
+     */
+    ~MatchLog();
+
+    /*
+     * Maps the log at path. Returns false if it can't be read, or isn't a
+     * log we understand.
+     */
+    bool Open(const char* path);
+    void Close();
+
+    /*
+     * Gets the next record. Returns false at the end of the log, or if the
+     * rest of it is malformed (see IsMalformed()).
+     */
+    bool Next(MatchLogRecord& recordOut);
+
+    /*
+     * Starts again from the first record.
+     */
+    void Rewind();
+
+    /*
+     * Size of the valid part of the log, and whether reading stopped short
+     * of it.
+     */
+    uint64_t GetSize() { return mSize; };
+    bool IsMalformed() { return mMalformed; };
+
+    /*
+     * Was the match played in deterministic mode?
+     */
+    bool IsDeterministic() { return (mFlags & MATCHLOG_FLAG_DETERMINISTIC) != 0; };
+
+    protected:
+
+    int mFile;
+    const uint8_t* mMap;
+    uint64_t mMapSize;
+    uint64_t mSize;
+    uint64_t mOffset;
+    unsigned mPrevTick;
+    bool mMalformed;
+    uint8_t mFlags;
+};
+
+/*
+ * What a replay did.
+ */
+struct MatchReplayStats {
+    unsigned inputs;
+    unsigned states;
+    unsigned ticks;
+
+    // States the replay didn't agree with, in deterministic mode
+    unsigned mismatches;
+
+    // Wall time taken, in seconds
+    float seconds;
+};
+
+/*
+ * Feeds a log through a headless world and timeline, as fast as they go.
+ *
+ * The world starts from the log's first state. Before each record, the
+ * world is stepped up to the record's tick, and then the record is handed
+ * to the timeline: inputs as inputs, and states as authoritative state,
+ * just as a client gets them. If the match was played in deterministic
+ * mode, so is the replay, and it also checks each state against the one it
+ * reached by itself before taking it, and counts those that differ.
+ *
+ * Returns false if the log doesn't start with a state, or turns out to be
+ * malformed part of the way through, in which case the stats cover what
+ * came before.
+ */
+bool ReplayMatch(MatchLog& log, MatchReplayStats& statsOut);
+
+#endif /* MATCHLOG_H */
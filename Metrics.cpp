@@ -0,0 +1,186 @@
+#include "Metrics.h"
+#include <string.h>
+
+/*
+ * All updates go through the GCC atomic builtins, which clang supports as
+ * well.
+ */
+
+// The process-wide registry
+static Metrics sGlobal;
+
+// Names, in the same order as the enums
+static const char* sCounterNames[METRIC_COUNTER_COUNT] = {
+    "bytes_sent",
+    "bytes_received",
+    "payloads_sent",
+    "payloads_received",
+    "malformed_headers",
+    "malformed_payloads",
+    "protocol_violations",
+    "state_dumps_sent",
+    "state_dumps_received",
+    "inputs_received",
+    "inputs_buffered",
+    "rollbacks_avoided",
+    "inputs_held_early",
+    "inputs_dropped_late",
+    "inputs_dropped_early",
+    "rollbacks",
+    "resimulated_ticks",
+    "clock_fast_forwards",
+    "snapshot_restores",
+    "snapshot_fallbacks",
+    "snapshot_contacts_missed",
+    "state_hashes_sent",
+    "state_hashes_checked",
+    "desyncs",
+    "repairs_requested",
+    "frames_over_budget",
+    "inputs_suppressed"
+};
+
+static const char* sGaugeNames[METRIC_GAUGE_COUNT] = {
+    "keyframes",
+    "inputs_held",
+    "input_buffer_depth",
+    "clock_skew_ppm",
+    "ticks_behind"
+};
+
+static const char* sHistogramNames[METRIC_HIST_COUNT] = {
+    "rollback_depth",
+    "payload_bytes",
+    "rtt_ms",
+    "catchup_ticks",
+    "input_latency_us"
+};
+
+// Atomic loads, without needing C++11
+template <typename T>
+static T
+AtomicLoad(T* value)
+{
+    return __sync_add_and_fetch(value, 0);
+}
+
+Metrics::Metrics()
+{
+    Reset();
+}
+
+Metrics&
+Metrics::Global()
+{
+    return sGlobal;
+}
+
+void
+Metrics::Add(MetricCounter counter, uint64_t amount)
+{
+    __sync_fetch_and_add(&mCounters[counter], amount);
+}
+
+void
+Metrics::Set(MetricGauge gauge, int64_t value)
+{
+    // There's no plain atomic store builtin, so swap until it sticks
+    int64_t old = AtomicLoad(&mGauges[gauge]);
+    while (!__sync_bool_compare_and_swap(&mGauges[gauge], old, value))
+        old = AtomicLoad(&mGauges[gauge]);
+}
+
+void
+Metrics::Observe(MetricHistogram histogram, uint64_t value)
+{
+    HistogramSlot& slot = mHistograms[histogram];
+    __sync_fetch_and_add(&slot.buckets[Bucket(value)], 1);
+    __sync_fetch_and_add(&slot.sum, value);
+    __sync_fetch_and_add(&slot.count, 1);
+}
+
+uint64_t
+Metrics::Get(MetricCounter counter)
+{
+    return AtomicLoad(&mCounters[counter]);
+}
+
+int64_t
+Metrics::Get(MetricGauge gauge)
+{
+    return AtomicLoad(&mGauges[gauge]);
+}
+
+uint64_t
+Metrics::GetCount(MetricHistogram histogram)
+{
+    return AtomicLoad(&mHistograms[histogram].count);
+}
+
+uint64_t
+Metrics::GetSum(MetricHistogram histogram)
+{
+    return AtomicLoad(&mHistograms[histogram].sum);
+}
+
+unsigned
+Metrics::Bucket(uint64_t value)
+{
+    unsigned bucket = 0;
+    while (value && bucket < METRICS_NUM_BUCKETS - 1) {
+        value >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void
+Metrics::WriteJSON(FILE* out, const char* role, unsigned playerID,
+                   unsigned tick)
+{
+    fprintf(out, "{\"role\":\"%s\",\"player\":%u,\"tick\":%u", role, playerID,
+            tick);
+    WriteFields(out);
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+void
+Metrics::WriteFields(FILE* out)
+{
+    for (unsigned i = 0; i < METRIC_COUNTER_COUNT; ++i)
+        fprintf(out, ",\"%s\":%llu", sCounterNames[i],
+                (unsigned long long) Get((MetricCounter) i));
+
+    for (unsigned i = 0; i < METRIC_GAUGE_COUNT; ++i)
+        fprintf(out, ",\"%s\":%lld", sGaugeNames[i],
+                (long long) Get((MetricGauge) i));
+
+    // Histograms list their buckets up to the last non-empty one
+    for (unsigned i = 0; i < METRIC_HIST_COUNT; ++i) {
+        HistogramSlot& slot = mHistograms[i];
+        uint64_t buckets[METRICS_NUM_BUCKETS];
+        unsigned numBuckets = 0;
+        for (unsigned b = 0; b < METRICS_NUM_BUCKETS; ++b) {
+            buckets[b] = AtomicLoad(&slot.buckets[b]);
+            if (buckets[b])
+                numBuckets = b + 1;
+        }
+
+        fprintf(out, ",\"%s\":{\"count\":%llu,\"sum\":%llu,\"buckets\":[",
+                sHistogramNames[i],
+                (unsigned long long) GetCount((MetricHistogram) i),
+                (unsigned long long) GetSum((MetricHistogram) i));
+        for (unsigned b = 0; b < numBuckets; ++b)
+            fprintf(out, "%s%llu", b ? "," : "", (unsigned long long) buckets[b]);
+        fprintf(out, "]}");
+    }
+}
+
+void
+Metrics::Reset()
+{
+    memset(mCounters, 0, sizeof(mCounters));
+    memset(mGauges, 0, sizeof(mGauges));
+    memset(mHistograms, 0, sizeof(mHistograms));
+}
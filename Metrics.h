@@ -0,0 +1,154 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Netcode telemetry.
+ *
+ * A fixed registry of counters, gauges and histograms. Every metric is a
+ * slot in an array, known at compile time, so recording never allocates or
+ * takes a lock: updates are single atomic instructions, and any thread may
+ * record while another takes a snapshot. Snapshots are written as JSON
+ * lines, one object per line, so a run can be graphed with any
+ * off-the-shelf tool.
+ *
+ * Each registry is an instance. A standalone peer records everything in
+ * the process-wide one, Global(). The match host gives every match its own,
+ * passed to its world, timeline, communicator and catch-up, so that each
+ * match reports only what happened in it.
+ */
+
+/*
+ * Counters only ever go up.
+ */
+typedef enum {
+    METRIC_BYTES_SENT = 0,
+    METRIC_BYTES_RECEIVED,
+    METRIC_PAYLOADS_SENT,
+    METRIC_PAYLOADS_RECEIVED,
+    METRIC_MALFORMED_HEADERS,
+    METRIC_MALFORMED_PAYLOADS,
+    METRIC_PROTOCOL_VIOLATIONS,
+    METRIC_STATE_DUMPS_SENT,
+    METRIC_STATE_DUMPS_RECEIVED,
+    METRIC_INPUTS_RECEIVED,
+    METRIC_INPUTS_BUFFERED,
+    METRIC_ROLLBACKS_AVOIDED,
+    METRIC_INPUTS_HELD_EARLY,
+    METRIC_INPUTS_DROPPED_LATE,
+    METRIC_INPUTS_DROPPED_EARLY,
+    METRIC_ROLLBACKS,
+    METRIC_RESIMULATED_TICKS,
+    METRIC_CLOCK_FAST_FORWARDS,
+    METRIC_SNAPSHOT_RESTORES,
+    METRIC_SNAPSHOT_FALLBACKS,
+    METRIC_SNAPSHOT_CONTACTS_MISSED,
+    METRIC_STATE_HASHES_SENT,
+    METRIC_STATE_HASHES_CHECKED,
+    METRIC_DESYNCS,
+    METRIC_REPAIRS_REQUESTED,
+    METRIC_FRAMES_OVER_BUDGET,
+    METRIC_INPUTS_SUPPRESSED,
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+/*
+ * Gauges hold the latest value we've seen.
+ */
+typedef enum {
+    METRIC_GAUGE_KEYFRAMES = 0,
+    METRIC_GAUGE_INPUTS_HELD,
+    METRIC_GAUGE_INPUT_BUFFER_DEPTH,
+    METRIC_GAUGE_CLOCK_SKEW_PPM,
+    METRIC_GAUGE_TICKS_BEHIND,
+    METRIC_GAUGE_COUNT
+} MetricGauge;
+
+/*
+ * Histograms count observations in power-of-two buckets. Bucket 0 holds
+ * zeros, and bucket i holds values in [2^(i-1), 2^i).
+ */
+typedef enum {
+    METRIC_HIST_ROLLBACK_DEPTH = 0,
+    METRIC_HIST_PAYLOAD_BYTES,
+    METRIC_HIST_RTT_MS,
+    METRIC_HIST_CATCHUP_TICKS,
+    METRIC_HIST_INPUT_LATENCY_US,
+    METRIC_HIST_COUNT
+} MetricHistogram;
+
+#define METRICS_NUM_BUCKETS 33
+
+// Default number of ticks between logged snapshots (about a second)
+#define METRICS_DEFAULT_INTERVAL 32
+
+class Metrics {
+
+    public:
+
+    /*
+     * Constructor. Everything starts at zero.
+     */
+    Metrics();
+
+    /*
+     * The process-wide registry.
+     */
+    static Metrics& Global();
+
+    /*
+     * Recording. Safe to call from any thread.
+     */
+    void Add(MetricCounter counter, uint64_t amount = 1);
+    void Set(MetricGauge gauge, int64_t value);
+    void Observe(MetricHistogram histogram, uint64_t value);
+
+    /*
+     * Reading. Safe to call from any thread, though a snapshot taken while
+     * others are recording isn't guaranteed to be consistent across
+     * metrics.
+     */
+    uint64_t Get(MetricCounter counter);
+    int64_t Get(MetricGauge gauge);
+    uint64_t GetCount(MetricHistogram histogram);
+    uint64_t GetSum(MetricHistogram histogram);
+
+    /*
+     * Writes a snapshot of every metric as a single JSON line, labelled
+     * with the given role, player and game tick.
+     */
+    void WriteJSON(FILE* out, const char* role, unsigned playerID,
+                   unsigned tick);
+
+    /*
+     * Writes every metric as JSON fields, each preceded by a comma, for
+     * callers that write the rest of the object themselves.
+     */
+    void WriteFields(FILE* out);
+
+    /*
+     * Zeroes everything. Not safe to call while others are recording.
+     */
+    void Reset();
+
+    /*
+     * Which bucket a value falls in.
+     */
+    static unsigned Bucket(uint64_t value);
+
+    protected:
+
+    struct HistogramSlot {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t buckets[METRICS_NUM_BUCKETS];
+    };
+
+    uint64_t mCounters[METRIC_COUNTER_COUNT];
+    int64_t mGauges[METRIC_GAUGE_COUNT];
+    HistogramSlot mHistograms[METRIC_HIST_COUNT];
+};
+
+#endif /* METRICS_H */
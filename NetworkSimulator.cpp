@@ -0,0 +1,118 @@
+#include "NetworkSimulator.h"
+#include <stdio.h>
+#include <assert.h>
+
+// How long a "lost" frame waits before TCP retransmits it. Real stacks
+// use at least 200ms, or a couple of round trips on slow links.
+#define NETSIM_MIN_RETRANSMIT_MS 200.0
+
+/*
+ * NetworkConditions Methods.
+ */
+
+bool
+NetworkConditions::Parse(const char* spec)
+{
+    NetworkConditions parsed;
+    int numParsed = sscanf(spec, "%f:%f:%f:%f:%u",
+                           &parsed.latencyMS, &parsed.jitterMS, &parsed.lossRate,
+                           &parsed.reorderRate, &parsed.bandwidthBytesPerSec);
+    if (numParsed < 1)
+        return false;
+
+    // Sanity check
+    if (parsed.latencyMS < 0.0f || parsed.jitterMS < 0.0f)
+        return false;
+    if (parsed.lossRate < 0.0f || parsed.lossRate >= 1.0f)
+        return false;
+    if (parsed.reorderRate < 0.0f || parsed.reorderRate > 1.0f)
+        return false;
+
+    *this = parsed;
+    return true;
+}
+
+bool
+NetworkConditions::IsIdeal() const
+{
+    return latencyMS == 0.0f && jitterMS == 0.0f && lossRate == 0.0f &&
+           reorderRate == 0.0f && bandwidthBytesPerSec == 0;
+}
+
+/*
+ * NetworkLane Methods.
+ */
+
+NetworkLane::NetworkLane() : mActive(false)
+                           , mLinkFreeAt(0.0)
+                           , mLastDeliveryAt(0.0)
+{
+}
+
+void
+NetworkLane::Configure(const NetworkConditions& conditions, uint64_t seed)
+{
+    mConditions = conditions;
+    mRandom.Seed(seed);
+    mActive = !conditions.IsIdeal();
+    mLinkFreeAt = 0.0;
+    mLastDeliveryAt = 0.0;
+}
+
+void
+NetworkLane::Enqueue(const uint8_t* frame, unsigned size, double nowMS)
+{
+    // We always draw the same number of random values per frame, so that
+    // the sequence for a given seed doesn't depend on the conditions.
+    double jitterDraw = mRandom.NextUnit();
+    double lossDraw = mRandom.NextUnit();
+    double reorderDraw = mRandom.NextUnit();
+
+    // Bandwidth: the frame can't start until the link is free, and takes
+    // time proportional to its size to get onto the link.
+    double sendAt = nowMS > mLinkFreeAt ? nowMS : mLinkFreeAt;
+    if (mConditions.bandwidthBytesPerSec > 0)
+        sendAt += 1000.0 * size / mConditions.bandwidthBytesPerSec;
+    mLinkFreeAt = sendAt;
+
+    // Latency and jitter
+    double delay = mConditions.latencyMS +
+                   mConditions.jitterMS * (2.0 * jitterDraw - 1.0);
+    if (delay < 0.0)
+        delay = 0.0;
+
+    // Loss shows up as a retransmission
+    if (lossDraw < mConditions.lossRate) {
+        double rto = 2.0 * (mConditions.latencyMS + mConditions.jitterMS);
+        delay += rto > NETSIM_MIN_RETRANSMIT_MS ? rto : NETSIM_MIN_RETRANSMIT_MS;
+    }
+
+    double deliverAt = sendAt + delay;
+
+    // Unless this frame is reordered, it can't arrive before the ones
+    // ahead of it.
+    if (reorderDraw >= mConditions.reorderRate) {
+        if (deliverAt < mLastDeliveryAt)
+            deliverAt = mLastDeliveryAt;
+        mLastDeliveryAt = deliverAt;
+    }
+
+    // Put it in flight
+    std::multimap<double, std::vector<uint8_t> >::iterator it =
+        mInFlight.insert(std::make_pair(deliverAt, std::vector<uint8_t>()));
+    it->second.assign(frame, frame + size);
+}
+
+bool
+NetworkLane::HasDue(double nowMS)
+{
+    return !mInFlight.empty() && mInFlight.begin()->first <= nowMS;
+}
+
+void
+NetworkLane::Dequeue(std::vector<uint8_t>& frameOut)
+{
+    assert(!mInFlight.empty());
+    frameOut.swap(mInFlight.begin()->second);
+    mInFlight.erase(mInFlight.begin());
+}
@@ -0,0 +1,145 @@
+#ifndef NETWORKSIMULATOR_H
+#define NETWORKSIMULATOR_H
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+
+/*
+ * Network emulation.
+ *
+ * For netcode tuning we want to reproduce bad networks on a single machine,
+ * the same way every run. A NetworkLane sits on one direction of a
+ * connection and holds each frame until its emulated delivery time. All
+ * randomness comes from a seeded generator, so a given seed and traffic
+ * pattern always produce the same delays.
+ */
+
+/*
+ * Conditions for one direction of a link.
+ */
+struct NetworkConditions {
+
+    NetworkConditions() : latencyMS(0.0f)
+                        , jitterMS(0.0f)
+                        , lossRate(0.0f)
+                        , reorderRate(0.0f)
+                        , bandwidthBytesPerSec(0) {};
+
+    /*
+     * Parses "latency:jitter:loss:reorder:bandwidth". Trailing fields may be
+     * omitted. Returns false if the string is malformed.
+     */
+    bool Parse(const char* spec);
+
+    /*
+     * Is this a perfect link?
+     */
+    bool IsIdeal() const;
+
+    // One-way delay, in milliseconds
+    float latencyMS;
+
+    // Each frame's delay varies uniformly by up to this much either way
+    float jitterMS;
+
+    // Probability that a frame is lost. We run over TCP, so a lost frame
+    // isn't dropped: it shows up after a retransmission timeout, and holds
+    // up everything behind it.
+    float lossRate;
+
+    // Probability that a frame ignores ordering and may overtake earlier
+    // frames
+    float reorderRate;
+
+    // Link capacity. Zero means unlimited.
+    unsigned bandwidthBytesPerSec;
+};
+
+/*
+ * Small, fast, seedable PRNG (xorshift64*). We don't use rand() because
+ * other code draws from it, which would make our sequence depend on
+ * whatever else the game is doing.
+ */
+class NetworkRandom {
+
+    public:
+
+    NetworkRandom(uint64_t seed = 1) { Seed(seed); };
+
+    void Seed(uint64_t seed) { mState = seed ? seed : 0x9E3779B97F4A7C15ULL; };
+
+    uint64_t Next()
+    {
+        mState ^= mState >> 12;
+        mState ^= mState << 25;
+        mState ^= mState >> 27;
+        return mState * 0x2545F4914F6CDD1DULL;
+    };
+
+    // Uniform in [0, 1)
+    double NextUnit() { return (Next() >> 11) * (1.0 / 9007199254740992.0); };
+
+    protected:
+
+    uint64_t mState;
+};
+
+/*
+ * One direction of an emulated link.
+ */
+class NetworkLane {
+
+    public:
+
+    NetworkLane();
+
+    /*
+     * Sets the conditions and reseeds the lane.
+     */
+    void Configure(const NetworkConditions& conditions, uint64_t seed);
+
+    /*
+     * Is this lane doing anything?
+     */
+    bool IsActive() { return mActive; };
+
+    /*
+     * Hands a frame to the link at time nowMS.
+     */
+    void Enqueue(const uint8_t* frame, unsigned size, double nowMS);
+
+    /*
+     * Is a frame ready for delivery at time nowMS?
+     */
+    bool HasDue(double nowMS);
+
+    /*
+     * Pops the next deliverable frame. HasDue() must return true first.
+     */
+    void Dequeue(std::vector<uint8_t>& frameOut);
+
+    /*
+     * Number of frames in flight.
+     */
+    unsigned GetNumInFlight() { return (unsigned) mInFlight.size(); };
+
+    protected:
+
+    // Conditions and randomness
+    NetworkConditions mConditions;
+    NetworkRandom mRandom;
+    bool mActive;
+
+    // Time at which the link finishes transmitting what it has been given
+    double mLinkFreeAt;
+
+    // Delivery time of the last in-order frame
+    double mLastDeliveryAt;
+
+    // Frames in flight, keyed by delivery time. Frames with equal delivery
+    // times come out in the order they went in.
+    std::multimap<double, std::vector<uint8_t> > mInFlight;
+};
+
+#endif /* NETWORKSIMULATOR_H */
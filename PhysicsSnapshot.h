@@ -0,0 +1,88 @@
+#ifndef PHYSICSSNAPSHOT_H
+#define PHYSICSSNAPSHOT_H
+
+#include "Framework.h"
+#include <vector>
+
+/*
+ * Full physics checkpoint.
+ *
+ * WorldState only carries what the network needs: transforms, velocities
+ * and scale. Restoring from it throws away everything else Bullet keeps
+ * between steps, most importantly the contact manifolds whose cached
+ * impulses warm-start the solver, so a resimulation drifts from the
+ * original run. A PhysicsSnapshot captures the rest of the mutable
+ * simulation state as well.
+ *
+ * What it can't capture is Bullet's broadphase: the tree of bounding boxes
+ * and the overlapping pairs, which own the manifolds and point into the
+ * world, so they can't simply be copied back. Restoring refills whatever
+ * manifolds exist at the time, which comes close but isn't exact. In
+ * deterministic mode the world instead starts every tick with those caches
+ * empty (WorldModel::SetDeterministic()), so a rewind is exact there.
+ *
+ * Its arrays only ever grow, so retaking a snapshot into the same object
+ * doesn't allocate once it has seen a world of that size.
+ *
+ * Snapshots are only meaningful for the WorldModel that took them, and only
+ * while the set of bodies in the world is unchanged.
+ */
+
+/*
+ * Everything mutable about a single collision object.
+ */
+struct BodySnapshot {
+    btTransform worldTransform;
+    btTransform interpolationWorldTransform;
+    btVector3 interpolationLinearVel;
+    btVector3 interpolationAngularVel;
+    btVector3 linearVel;
+    btVector3 angularVel;
+    btVector3 totalForce;
+    btVector3 totalTorque;
+    btVector3 invInertiaLocal;
+    btVector3 localScaling;
+    btScalar hitFraction;
+    btScalar deactivationTime;
+    int activationState;
+};
+
+/*
+ * The cached contact points between a pair of bodies. Bodies are referred
+ * to by their index in the dynamics world.
+ */
+struct ManifoldSnapshot {
+    int body0;
+    int body1;
+    int numContacts;
+    btManifoldPoint contacts[MANIFOLD_CACHE_SIZE];
+};
+
+struct PhysicsSnapshot {
+
+    PhysicsSnapshot() : valid(false), numBodies(0), numManifolds(0)
+                      , solverSeed(0) {};
+
+    /*
+     * Marks the snapshot as stale, for instance when the state it goes with
+     * has been replaced from elsewhere.
+     */
+    void Invalidate() { valid = false; };
+
+    // Is there anything here?
+    bool valid;
+
+    // Bodies, in dynamics world order. Only the first numBodies are in use.
+    int numBodies;
+    std::vector<BodySnapshot> bodies;
+
+    // Contact caches, in dispatcher order. Only the first numManifolds are
+    // in use.
+    int numManifolds;
+    std::vector<ManifoldSnapshot> manifolds;
+
+    // The solver's random seed
+    unsigned long solverSeed;
+};
+
+#endif /* PHYSICSSNAPSHOT_H */
@@ -0,0 +1,330 @@
+#include "Timeline.h"
+#include "Communicator.h"
+#include "NetworkSimulator.h"
+#include "InputCodec.h"
+#include "MatchLog.h"
+#include "Metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Rollback benchmark.
+ *
+ * Plays a match into a headless server timeline, the way a server sees it:
+ * every player's inputs are made on time, but each player's reach the
+ * timeline through an emulated network link of its own (NetworkSimulator.h),
+ * and so arrive late, out of step and now and again very late. Each late
+ * input rolls the timeline back and resimulates. The timeline sends its
+ * state updates as usual, which is what lets it forget old keyframes, and
+ * inputs later than that are dropped.
+ *
+ * For each network spec given (in -netsim form, latencyMS:jitterMS:loss:
+ * reorder:bandwidth), it prints how many rollbacks there were per second of
+ * play, how deep they went (mean and 99th percentile, in ticks), how much
+ * CPU time rolling back and resimulating took per second of play, and how
+ * many heap allocations the timeline and world made per tick, and how many
+ * inputs came too late to use. Last, it times how long throwing away and
+ * rebuilding Bullet's collision caches takes in the world as the match left
+ * it, which deterministic mode does every tick.
+ *
+ * Usage: rollbackbench [-log file] [-players n] [-ticks n] [-deterministic]
+ *                      [spec ...]
+ *
+ * The inputs are made up, like keyboard players, unless -log gives a
+ * recorded match (see MatchLog.h), whose inputs are sent again at the
+ * ticks they're stamped with. A recorded match that was deterministic is
+ * run deterministically, as if -deterministic were given. Without specs, a
+ * few typical ones are run.
+ */
+
+// The made-up match: players, and its length in ticks (three minutes)
+#define BENCH_DEFAULT_PLAYERS 3
+#define BENCH_DEFAULT_TICKS 5625
+
+// Collision cache rebuilds timed after each run
+#define BENCH_CACHE_RESETS 1000
+
+static const char* sDefaultSpecs[] = { "0", "30:5", "80:20", "150:50:0.01:0.05" };
+static const unsigned sNumDefaultSpecs = sizeof(sDefaultSpecs) / sizeof(sDefaultSpecs[0]);
+
+/*
+ * Counting heap allocations. Only the timeline's and the world's work is
+ * counted, not the emulated network's.
+ */
+static bool sCountingAllocs = false;
+static unsigned long sAllocs = 0;
+
+#if __cplusplus >= 201103L
+#define BENCH_THROWS_BAD_ALLOC
+#else
+#define BENCH_THROWS_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+void* operator new(size_t size) BENCH_THROWS_BAD_ALLOC
+{
+    if (sCountingAllocs)
+        ++sAllocs;
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+/*
+ * A world whose collision cache rebuild we can time on its own.
+ */
+class BenchWorld : public WorldModel {
+
+    public:
+
+    using WorldModel::ResetCollisionCaches;
+};
+
+/*
+ * A match to play: where it starts, and the inputs in the order they're
+ * made.
+ */
+struct BenchMatch {
+    WorldState start;
+    bool hasStart;
+    std::vector<UserInput> inputs;
+    unsigned endTick;
+
+    // Was it played in deterministic mode?
+    bool deterministic;
+};
+
+/*
+ * Keyboard players. Now and again each one presses or lets go of a key.
+ */
+static void MakeMatch(unsigned numPlayers, unsigned numTicks, BenchMatch& match)
+{
+    srand(1);
+    match.hasStart = false;
+    match.endTick = numTicks;
+    match.deterministic = false;
+    std::vector<uint32_t> held(numPlayers + 1, 0);
+    for (unsigned tick = 1; tick < numTicks; ++tick) {
+        for (unsigned player = 1; player <= numPlayers; ++player) {
+            if (rand() % 6)
+                continue;
+            UserInputIndex index = (UserInputIndex)(USERINPUT_INDEX_UP + rand() % 4);
+            bool isPress = !(held[player] & GEN_INPUT_MASK(index, true));
+            held[player] ^= GEN_INPUT_MASK(index, true);
+            UserInput input(player, tick);
+            input.inputs = GEN_INPUT_MASK(index, isPress);
+            match.inputs.push_back(input);
+        }
+    }
+}
+
+static bool EarlierInput(const UserInput& a, const UserInput& b)
+{
+    return a.timestamp < b.timestamp;
+}
+
+/*
+ * A recorded match. Returns false if it can't be read.
+ */
+static bool LoadMatch(const char* path, BenchMatch& match)
+{
+    MatchLog log;
+    if (!log.Open(path)) {
+        printf("Couldn't read match log %s!\n", path);
+        return false;
+    }
+    match.hasStart = false;
+    match.endTick = 0;
+    match.deterministic = log.IsDeterministic();
+    MatchLogRecord record;
+    while (log.Next(record)) {
+        if (record.type == MATCHLOG_RECORD_STATE && !match.hasStart) {
+            match.start = record.state;
+            match.hasStart = true;
+        }
+        else if (record.type == MATCHLOG_RECORD_INPUT) {
+            match.inputs.push_back(record.input);
+            if (record.input.timestamp + 1 > match.endTick)
+                match.endTick = record.input.timestamp + 1;
+        }
+    }
+    if (!match.hasStart) {
+        printf("Match log %s doesn't start with a state!\n", path);
+        return false;
+    }
+    std::stable_sort(match.inputs.begin(), match.inputs.end(), EarlierInput);
+    return true;
+}
+
+static void Run(const char* spec, BenchMatch& match, unsigned numPlayers,
+                bool deterministic)
+{
+    NetworkConditions conditions;
+    if (!conditions.Parse(spec)) {
+        printf("%-20s bad spec\n", spec);
+        return;
+    }
+
+    // A dedicated server's world and timeline, with nobody to send to
+    BenchWorld world;
+    world.InitHeadless();
+    if (match.hasStart)
+        world.SetState(match.start);
+    else
+        for (unsigned playerID = 1; playerID <= numPlayers; ++playerID)
+            world.AddPlayer(playerID);
+    Gameclock clock(GAMECLOCK_TICK_MS);
+    clock.Set(world.GetCurrentTimestamp());
+    Timeline timeline;
+    Communicator communicator(timeline, COMMUNICATOR_MODE_SERVER);
+    world.SetDeterministic(deterministic);
+    timeline.SetDeterministic(deterministic);
+    timeline.Init(world, clock, COMMUNICATOR_MODE_SERVER);
+
+    // A link per player
+    std::map<unsigned, NetworkLane> lanes;
+    uint64_t rollbacksBefore = Metrics::Global().Get(METRIC_ROLLBACKS);
+    uint64_t droppedBefore = Metrics::Global().Get(METRIC_INPUTS_DROPPED_LATE);
+    std::vector<unsigned> depths;
+    double resimMicros = 0.0;
+    unsigned long allocs = 0;
+
+    uint8_t frame[INPUTCODEC_MAX_SIZE];
+    std::vector<uint8_t> delivered;
+    unsigned next = 0;
+    unsigned firstTick = world.GetCurrentTimestamp();
+    sf::Clock cpuClock;
+    for (unsigned tick = firstTick; tick < match.endTick; ++tick) {
+        double nowMS = tick * (double) GAMECLOCK_TICK_MS;
+
+        // Send what's made this tick
+        for (; next < match.inputs.size() && match.inputs[next].timestamp <= tick; ++next) {
+            UserInput& input = match.inputs[next];
+            std::map<unsigned, NetworkLane>::iterator lane = lanes.find(input.playerID);
+            if (lane == lanes.end()) {
+                lane = lanes.insert(std::make_pair(input.playerID, NetworkLane())).first;
+                lane->second.Configure(conditions, input.playerID);
+            }
+            InputCodec codec;
+            unsigned size = codec.Encode(input, frame, sizeof(frame));
+            lane->second.Enqueue(frame, size, nowMS);
+        }
+
+        // Take what's arrived, timing the inputs that make us roll back
+        for (std::map<unsigned, NetworkLane>::iterator lane = lanes.begin();
+             lane != lanes.end(); ++lane) {
+            while (lane->second.HasDue(nowMS)) {
+                lane->second.Dequeue(delivered);
+                UserInput input(0, 0);
+                InputCodec codec;
+                if (codec.Decode(&delivered[0], delivered.size(), input) != delivered.size())
+                    continue;
+
+                uint64_t rollbacks = Metrics::Global().Get(METRIC_ROLLBACKS);
+                uint64_t resimulated = Metrics::Global().Get(METRIC_RESIMULATED_TICKS);
+                sAllocs = 0;
+                sCountingAllocs = true;
+                cpuClock.Reset();
+                timeline.AddInput(input);
+                double micros = 1000000.0 * cpuClock.GetElapsedTime();
+                sCountingAllocs = false;
+                allocs += sAllocs;
+
+                if (Metrics::Global().Get(METRIC_ROLLBACKS) != rollbacks) {
+                    resimMicros += micros;
+                    depths.push_back(Metrics::Global().Get(METRIC_RESIMULATED_TICKS) - resimulated);
+                }
+            }
+        }
+
+        // The rest of the server's tick
+        sAllocs = 0;
+        sCountingAllocs = true;
+        timeline.ApplyDueInputs();
+        timeline.SendUpdates(communicator);
+        world.SingleStep();
+        sCountingAllocs = false;
+        allocs += sAllocs;
+        clock.Set(world.GetCurrentTimestamp());
+    }
+
+    unsigned numTicks = match.endTick > firstTick ? match.endTick - firstTick : 0;
+    float seconds = numTicks * GAMECLOCK_TICK_MS / 1000.0f;
+    uint64_t rollbacks = Metrics::Global().Get(METRIC_ROLLBACKS) - rollbacksBefore;
+    uint64_t dropped = Metrics::Global().Get(METRIC_INPUTS_DROPPED_LATE) - droppedBefore;
+
+    double meanDepth = 0.0;
+    unsigned p99Depth = 0;
+    if (!depths.empty()) {
+        for (unsigned i = 0; i < depths.size(); ++i)
+            meanDepth += depths[i];
+        meanDepth /= depths.size();
+        std::sort(depths.begin(), depths.end());
+        p99Depth = depths[(depths.size() * 99 + 99) / 100 - 1];
+    }
+
+    // What a deterministic tick pays up front
+    cpuClock.Reset();
+    for (unsigned i = 0; i < BENCH_CACHE_RESETS; ++i)
+        world.ResetCollisionCaches();
+    double resetMicros = 1000000.0 * cpuClock.GetElapsedTime() / BENCH_CACHE_RESETS;
+
+    printf("%-20s %12.1f %10.2f %9u %12.2f %12.1f %8llu %10.1f\n", spec,
+           seconds > 0.0f ? rollbacks / seconds : 0.0f, meanDepth, p99Depth,
+           seconds > 0.0f ? resimMicros / 1000.0 / seconds : 0.0,
+           numTicks ? (double) allocs / numTicks : 0.0, (unsigned long long) dropped,
+           resetMicros);
+}
+
+int main(int argc, char** argv)
+{
+    const char* logPath = NULL;
+    unsigned numPlayers = BENCH_DEFAULT_PLAYERS;
+    unsigned numTicks = BENCH_DEFAULT_TICKS;
+    bool deterministic = false;
+    std::vector<const char*> specs;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-log") && i + 1 < argc)
+            logPath = argv[++i];
+        else if (!strcmp(argv[i], "-players") && i + 1 < argc)
+            numPlayers = (unsigned) atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-ticks") && i + 1 < argc)
+            numTicks = (unsigned) atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-deterministic"))
+            deterministic = true;
+        else
+            specs.push_back(argv[i]);
+    }
+    if (specs.empty())
+        specs.assign(sDefaultSpecs, sDefaultSpecs + sNumDefaultSpecs);
+
+    BenchMatch match;
+    if (logPath) {
+        if (!LoadMatch(logPath, match))
+            return 1;
+        printf("%s: %u inputs over %u ticks\n", logPath, (unsigned) match.inputs.size(),
+               match.endTick);
+    }
+    else {
+        MakeMatch(numPlayers, numTicks, match);
+        printf("%u made-up players: %u inputs over %u ticks\n", numPlayers,
+               (unsigned) match.inputs.size(), match.endTick);
+    }
+
+    printf("%-20s %12s %10s %9s %12s %12s %8s %10s\n", "network", "rollbacks/s",
+           "mean depth", "p99 depth", "resim ms/s", "allocs/tick", "dropped",
+           "reset us");
+    for (unsigned i = 0; i < specs.size(); ++i)
+        Run(specs[i], match, numPlayers, deterministic || match.deterministic);
+    return 0;
+}
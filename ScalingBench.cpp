@@ -0,0 +1,122 @@
+#include "WorldModel.h"
+#include "UserInput.h"
+#include "WireFormat.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Scaling benchmark.
+ *
+ * Runs a headless world with more and more players, and measures what a
+ * tick, a state snapshot, a snapshot restore and a rollback cost at each
+ * size. The players wander around at random so that they bump into each
+ * other like they would in a real game.
+ */
+
+// Ticks to settle in before measuring, and ticks to measure
+#define BENCH_WARMUP_TICKS 60
+#define BENCH_STEP_TICKS 300
+
+// Snapshots to take and restore
+#define BENCH_SNAPSHOTS 200
+
+// Rollbacks to do, and how far back each one goes
+#define BENCH_ROLLBACKS 30
+#define BENCH_ROLLBACK_DEPTH 10
+
+static const unsigned sPlayerCounts[] = { 2, 8, 32, 64 };
+static const unsigned sNumPlayerCounts = sizeof(sPlayerCounts) / sizeof(sPlayerCounts[0]);
+
+/*
+ * Now and again, has each player start or stop moving in some direction.
+ */
+static void Wander(WorldModel& world, unsigned numPlayers)
+{
+    for (unsigned playerID = 1; playerID <= numPlayers; ++playerID) {
+        if (rand() % 8)
+            continue;
+        UserInput input(playerID, world.GetCurrentTimestamp());
+        unsigned direction = USERINPUT_INDEX_UP + rand() % 4;
+        bool isBegin = rand() % 2;
+        input.inputs = GEN_INPUT_MASK(direction, isBegin);
+        world.ApplyInput(input);
+    }
+}
+
+/*
+ * Microseconds per iteration.
+ */
+static double MicrosPer(sf::Clock& clock, unsigned iterations)
+{
+    return 1000000.0 * clock.GetElapsedTime() / iterations;
+}
+
+int main(int argc, char** argv)
+{
+    srand(1);
+
+    printf("%8s %10s %10s %10s %10s %12s %12s\n", "players", "tick us",
+           "ticks/sec", "take us", "restore us", "rollback us", "state bytes");
+
+    for (unsigned run = 0; run < sNumPlayerCounts; ++run) {
+        unsigned numPlayers = sPlayerCounts[run];
+
+        // Set up the world
+        WorldModel* world = new WorldModel;
+        world->InitHeadless();
+        for (unsigned playerID = 1; playerID <= numPlayers; ++playerID)
+            world->AddPlayer(playerID);
+        for (unsigned i = 0; i < BENCH_WARMUP_TICKS; ++i) {
+            Wander(*world, numPlayers);
+            world->SingleStep();
+        }
+
+        // Stepping
+        sf::Clock clock;
+        for (unsigned i = 0; i < BENCH_STEP_TICKS; ++i) {
+            Wander(*world, numPlayers);
+            world->SingleStep();
+        }
+        double tickMicros = MicrosPer(clock, BENCH_STEP_TICKS);
+
+        // Taking a snapshot, like the timeline does for every keyframe
+        WorldState state;
+        PhysicsSnapshot snapshot;
+        clock.Reset();
+        for (unsigned i = 0; i < BENCH_SNAPSHOTS; ++i) {
+            world->GetState(state);
+            world->TakeSnapshot(snapshot);
+        }
+        double takeMicros = MicrosPer(clock, BENCH_SNAPSHOTS);
+
+        // Restoring it
+        clock.Reset();
+        for (unsigned i = 0; i < BENCH_SNAPSHOTS; ++i)
+            world->RestoreSnapshot(state, snapshot);
+        double restoreMicros = MicrosPer(clock, BENCH_SNAPSHOTS);
+
+        // Rolling back and resimulating
+        clock.Reset();
+        for (unsigned i = 0; i < BENCH_ROLLBACKS; ++i) {
+            world->RestoreSnapshot(state, snapshot);
+            for (unsigned j = 0; j < BENCH_ROLLBACK_DEPTH; ++j) {
+                Wander(*world, numPlayers);
+                world->SingleStep();
+            }
+        }
+        double rollbackMicros = MicrosPer(clock, BENCH_ROLLBACKS);
+
+        // How big the state is on the wire
+        uint8_t buffer[WIRE_MAX_MESSAGE_SIZE];
+        unsigned stateBytes = WireEncodePayload(PAYLOAD_TYPE_WORLDSTATE, &state,
+                                                buffer, sizeof(buffer));
+
+        printf("%8u %10.1f %10.0f %10.1f %10.1f %12.1f %12u\n", numPlayers,
+               tickMicros, 1000000.0 / tickMicros, takeMicros, restoreMicros,
+               rollbackMicros, stateBytes);
+
+        delete world;
+    }
+
+    return 0;
+}
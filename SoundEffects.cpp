@@ -0,0 +1,45 @@
+#include "SoundEffects.h"
+
+/*
+ * Helper to load a sound file and bind it to a sound.
+ */
+static void LoadSound(const char* path, sf::SoundBuffer& buffer,
+                      sf::Sound& sound, float volume)
+{
+    // Load sound file into sound buffer, sound cannot be used for music
+    if (!buffer.LoadFromFile(path))
+    {
+        std::cout << "Error loading sound file\n";
+    }
+    // Bind sound buffer to sound
+    sound.SetBuffer(buffer);
+    sound.SetVolume(volume);
+}
+
+void
+SoundEffects::Init()
+{
+    LoadSound("scenefiles/bounce.wav", mBounceBuffer, mBounce, 50.f);
+    LoadSound("scenefiles/warning.wav", mWarningBuffer, mWarning, 100.f);
+    LoadSound("scenefiles/boom.ogg", mBoomBuffer, mBoom, 100.f);
+}
+
+void
+SoundEffects::Play(const GameEvent& event)
+{
+    switch (event.type) {
+        case GAME_EVENT_BOUNCE:
+            // Bounces come in bunches, so don't restart one that's playing
+            if (mBounce.GetStatus() != sf::Sound::Playing)
+                mBounce.Play();
+            break;
+        case GAME_EVENT_RING_WARNING:
+            mWarning.Play();
+            break;
+        case GAME_EVENT_RING_DROP:
+            mBoom.Play();
+            break;
+        default:
+            break;
+    }
+}
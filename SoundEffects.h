@@ -0,0 +1,35 @@
+#ifndef SOUNDEFFECTS_H
+#define SOUNDEFFECTS_H
+
+#include "Framework.h"
+#include "GameEvents.h"
+
+/*
+ * Plays the sound for each game event. Lives outside the simulation, so
+ * that resimulating a stretch of time doesn't replay its sounds.
+ */
+class SoundEffects {
+
+    public:
+
+    /*
+     * Loads the sounds.
+     */
+    void Init();
+
+    /*
+     * Plays the sound for an event, if it has one.
+     */
+    void Play(const GameEvent& event);
+
+    protected:
+
+    sf::SoundBuffer mBounceBuffer;
+    sf::Sound mBounce;
+    sf::SoundBuffer mWarningBuffer;
+    sf::Sound mWarning;
+    sf::SoundBuffer mBoomBuffer;
+    sf::Sound mBoom;
+};
+
+#endif /* SOUNDEFFECTS_H */
@@ -0,0 +1,147 @@
+#include "WorldModel.h"
+#include "UserInput.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/*
+ * Physics backend benchmark.
+ *
+ * Runs the same game on Bullet and on SpherePhysics, and compares what a
+ * tick and a 10-tick rollback cost on each, with more and more players. It
+ * also starts both from the same state, feeds them the same inputs for a
+ * second, and reports how far apart the players end up.
+ */
+
+// Ticks to settle in before measuring, and ticks to measure
+#define BENCH_WARMUP_TICKS 60
+#define BENCH_STEP_TICKS 300
+
+// Rollbacks to do, and how far back each one goes
+#define BENCH_ROLLBACKS 30
+#define BENCH_ROLLBACK_DEPTH 10
+
+// How long the backends run side by side when comparing them
+#define BENCH_DIVERGENCE_TICKS 30
+
+static const unsigned sPlayerCounts[] = { 8, 32, 64 };
+static const unsigned sNumPlayerCounts = sizeof(sPlayerCounts) / sizeof(sPlayerCounts[0]);
+
+/*
+ * Now and again, has each player start or stop moving in some direction.
+ */
+static void Wander(WorldModel& world, unsigned numPlayers)
+{
+    for (unsigned playerID = 1; playerID <= numPlayers; ++playerID) {
+        if (rand() % 8)
+            continue;
+        UserInput input(playerID, world.GetCurrentTimestamp());
+        unsigned direction = USERINPUT_INDEX_UP + rand() % 4;
+        bool isBegin = rand() % 2;
+        input.inputs = GEN_INPUT_MASK(direction, isBegin);
+        world.ApplyInput(input);
+    }
+}
+
+/*
+ * Steps a world with wandering players. The same seed gives the same
+ * inputs.
+ */
+static void Run(WorldModel& world, unsigned numPlayers, unsigned numTicks,
+                unsigned seed)
+{
+    srand(seed);
+    for (unsigned i = 0; i < numTicks; ++i) {
+        Wander(world, numPlayers);
+        world.SingleStep();
+    }
+}
+
+/*
+ * Microseconds per iteration.
+ */
+static double MicrosPer(sf::Clock& clock, unsigned iterations)
+{
+    return 1000000.0 * clock.GetElapsedTime() / iterations;
+}
+
+/*
+ * Times stepping and rolling back a world.
+ */
+static void Measure(WorldModel& world, unsigned numPlayers,
+                    double& tickMicrosOut, double& rollbackMicrosOut)
+{
+    sf::Clock clock;
+    Run(world, numPlayers, BENCH_STEP_TICKS, 2);
+    tickMicrosOut = MicrosPer(clock, BENCH_STEP_TICKS);
+
+    WorldState state;
+    PhysicsSnapshot snapshot;
+    world.GetState(state);
+    world.TakeSnapshot(snapshot);
+    clock.Reset();
+    for (unsigned i = 0; i < BENCH_ROLLBACKS; ++i) {
+        world.RestoreSnapshot(state, snapshot);
+        Run(world, numPlayers, BENCH_ROLLBACK_DEPTH, 3 + i);
+    }
+    rollbackMicrosOut = MicrosPer(clock, BENCH_ROLLBACKS);
+}
+
+int main(int argc, char** argv)
+{
+    printf("%8s %10s %10s %8s %12s %12s %10s %10s\n", "players", "bullet us",
+           "spheres us", "speedup", "bullet rb us", "spheres rb us", "mean err",
+           "max err");
+
+    for (unsigned run = 0; run < sNumPlayerCounts; ++run) {
+        unsigned numPlayers = sPlayerCounts[run];
+
+        // Two copies of the same game
+        WorldModel* bullet = new WorldModel;
+        WorldModel* spheres = new WorldModel;
+        bullet->InitHeadless();
+        spheres->InitHeadless();
+        spheres->SetPhysicsBackend(PHYSICS_BACKEND_SPHERES);
+        for (unsigned playerID = 1; playerID <= numPlayers; ++playerID) {
+            bullet->AddPlayer(playerID);
+            spheres->AddPlayer(playerID);
+        }
+
+        // Let the players get going, then start both from the same state
+        Run(*bullet, numPlayers, BENCH_WARMUP_TICKS, 1);
+        WorldState state;
+        bullet->GetState(state);
+        spheres->SetState(state);
+
+        // See how far apart they drift
+        Run(*bullet, numPlayers, BENCH_DIVERGENCE_TICKS, 4);
+        Run(*spheres, numPlayers, BENCH_DIVERGENCE_TICKS, 4);
+        double totalError = 0.0;
+        double maxError = 0.0;
+        for (unsigned playerID = 1; playerID <= numPlayers; ++playerID) {
+            Vector difference = bullet->GetPlayerPosition(playerID) -
+                                spheres->GetPlayerPosition(playerID);
+            double error = sqrt(difference.x * difference.x +
+                                difference.y * difference.y +
+                                difference.z * difference.z);
+            totalError += error;
+            if (error > maxError)
+                maxError = error;
+        }
+
+        // Race them
+        double bulletTick, bulletRollback, spheresTick, spheresRollback;
+        Measure(*bullet, numPlayers, bulletTick, bulletRollback);
+        Measure(*spheres, numPlayers, spheresTick, spheresRollback);
+
+        printf("%8u %10.1f %10.1f %7.1fx %12.1f %12.1f %10.3f %10.3f\n",
+               numPlayers, bulletTick, spheresTick, bulletTick / spheresTick,
+               bulletRollback, spheresRollback, totalError / numPlayers,
+               maxError);
+
+        delete bullet;
+        delete spheres;
+    }
+
+    return 0;
+}
@@ -0,0 +1,471 @@
+#include "SpherePhysics.h"
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#define SPHEREPHYSICS_SSE
+#endif
+
+/*
+ * Four floats at once. With SSE these are single instructions; otherwise
+ * plain loops the compiler can still unroll. Comparisons produce masks,
+ * lanes of all ones or all zeros, as SSE does.
+ */
+struct F4 {
+#ifdef SPHEREPHYSICS_SSE
+    F4() {};
+    F4(__m128 x) : v(x) {};
+    explicit F4(float s) : v(_mm_set1_ps(s)) {};
+    __m128 v;
+#else
+    F4() {};
+    explicit F4(float s) { v[0] = v[1] = v[2] = v[3] = s; };
+    float v[4];
+#endif
+};
+
+#ifdef SPHEREPHYSICS_SSE
+
+static inline F4 Load(const float* p) { return _mm_loadu_ps(p); }
+static inline void Store(float* p, F4 a) { _mm_storeu_ps(p, a.v); }
+static inline F4 operator+(F4 a, F4 b) { return _mm_add_ps(a.v, b.v); }
+static inline F4 operator-(F4 a, F4 b) { return _mm_sub_ps(a.v, b.v); }
+static inline F4 operator*(F4 a, F4 b) { return _mm_mul_ps(a.v, b.v); }
+static inline F4 operator/(F4 a, F4 b) { return _mm_div_ps(a.v, b.v); }
+static inline F4 Min(F4 a, F4 b) { return _mm_min_ps(a.v, b.v); }
+static inline F4 Max(F4 a, F4 b) { return _mm_max_ps(a.v, b.v); }
+static inline F4 Sqrt(F4 a) { return _mm_sqrt_ps(a.v); }
+static inline F4 Less(F4 a, F4 b) { return _mm_cmplt_ps(a.v, b.v); }
+static inline F4 LessEq(F4 a, F4 b) { return _mm_cmple_ps(a.v, b.v); }
+static inline F4 Greater(F4 a, F4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+static inline F4 GreaterEq(F4 a, F4 b) { return _mm_cmpge_ps(a.v, b.v); }
+static inline F4 And(F4 a, F4 b) { return _mm_and_ps(a.v, b.v); }
+static inline F4 Or(F4 a, F4 b) { return _mm_or_ps(a.v, b.v); }
+static inline F4 Select(F4 mask, F4 a, F4 b)
+{ return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+static inline unsigned MoveMask(F4 mask) { return _mm_movemask_ps(mask.v); }
+
+#else
+
+static inline uint32_t Bits(float f) { uint32_t u; memcpy(&u, &f, 4); return u; }
+static inline float FromBits(uint32_t u) { float f; memcpy(&f, &u, 4); return f; }
+static inline float MaskOf(bool b) { return FromBits(b ? 0xFFFFFFFF : 0); }
+
+#define F4_LANEWISE(expr) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = (expr); return r; }
+
+static inline F4 Load(const float* p) F4_LANEWISE(p[i])
+static inline void Store(float* p, F4 a) { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+static inline F4 operator+(F4 a, F4 b) F4_LANEWISE(a.v[i] + b.v[i])
+static inline F4 operator-(F4 a, F4 b) F4_LANEWISE(a.v[i] - b.v[i])
+static inline F4 operator*(F4 a, F4 b) F4_LANEWISE(a.v[i] * b.v[i])
+static inline F4 operator/(F4 a, F4 b) F4_LANEWISE(a.v[i] / b.v[i])
+static inline F4 Min(F4 a, F4 b) F4_LANEWISE(a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+static inline F4 Max(F4 a, F4 b) F4_LANEWISE(a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+static inline F4 Sqrt(F4 a) F4_LANEWISE(sqrtf(a.v[i]))
+static inline F4 Less(F4 a, F4 b) F4_LANEWISE(MaskOf(a.v[i] < b.v[i]))
+static inline F4 LessEq(F4 a, F4 b) F4_LANEWISE(MaskOf(a.v[i] <= b.v[i]))
+static inline F4 Greater(F4 a, F4 b) F4_LANEWISE(MaskOf(a.v[i] > b.v[i]))
+static inline F4 GreaterEq(F4 a, F4 b) F4_LANEWISE(MaskOf(a.v[i] >= b.v[i]))
+static inline F4 And(F4 a, F4 b) F4_LANEWISE(FromBits(Bits(a.v[i]) & Bits(b.v[i])))
+static inline F4 Or(F4 a, F4 b) F4_LANEWISE(FromBits(Bits(a.v[i]) | Bits(b.v[i])))
+static inline F4 Select(F4 mask, F4 a, F4 b) F4_LANEWISE(Bits(mask.v[i]) ? a.v[i] : b.v[i])
+static inline unsigned MoveMask(F4 mask)
+{
+    unsigned bits = 0;
+    for (int i = 0; i < 4; ++i)
+        if (Bits(mask.v[i]))
+            bits |= 1 << i;
+    return bits;
+}
+
+#undef F4_LANEWISE
+
+#endif
+
+// Lane numbers, for building per-lane indices
+static const float sLaneIndex[SPHEREPHYSICS_LANES] = { 0.0f, 1.0f, 2.0f, 3.0f };
+
+// Guards against dividing by zero
+#define SPHEREPHYSICS_EPSILON 1e-6f
+
+/*
+ * SpherePhysics methods.
+ */
+
+SpherePhysics::SpherePhysics() : mNumSpheres(0)
+                               , mNumPadded(0)
+                               , mGravityY(-10.0f)
+                               , mSphereFriction(0.5f)
+                               , mSphereRestitution(0.0f)
+                               , mAngularDamping(0.0f)
+                               , mNumRings(0)
+{
+}
+
+void
+SpherePhysics::Resize(unsigned numSpheres)
+{
+    mNumSpheres = numSpheres;
+    mNumPadded = (numSpheres + SPHEREPHYSICS_LANES - 1) & ~(SPHEREPHYSICS_LANES - 1);
+
+    std::vector<float>* arrays[] = { &px, &py, &pz, &vx, &vy, &vz, &wx, &wy, &wz,
+                                     &fx, &fy, &fz, &tx, &ty, &tz, &radius,
+                                     &invMass, &invInertia, &mRingDistance,
+                                     &mRingNX, &mRingNY, &mRingNZ, &mRingTarget,
+                                     &mRingFrictionCoeff, &mRingImpulse,
+                                     &mRingJX, &mRingJY, &mRingJZ };
+    for (unsigned i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++i)
+        arrays[i]->resize(mNumPadded, 0.0f);
+    mRingOf.resize(mNumPadded, -1.0f);
+
+    // Padding lanes must stay inert
+    for (unsigned i = numSpheres; i < mNumPadded; ++i) {
+        invMass[i] = 0.0f;
+        invInertia[i] = 0.0f;
+        radius[i] = 0.0f;
+    }
+}
+
+void
+SpherePhysics::SetSphereMaterial(float friction, float restitution,
+                                 float angularDamping)
+{
+    mSphereFriction = friction;
+    mSphereRestitution = restitution;
+    mAngularDamping = angularDamping;
+}
+
+void
+SpherePhysics::SetNumRings(unsigned numRings)
+{
+    if (numRings > SPHEREPHYSICS_MAX_RINGS)
+        numRings = SPHEREPHYSICS_MAX_RINGS;
+    mNumRings = numRings;
+}
+
+void
+SpherePhysics::SetRing(unsigned ring, float radius, float top, float friction,
+                       float restitution)
+{
+    if (ring >= SPHEREPHYSICS_MAX_RINGS)
+        return;
+    mRingRadius[ring] = radius;
+    mRingTop[ring] = top;
+    mRingFriction[ring] = friction;
+    mRingRestitution[ring] = restitution;
+}
+
+void
+SpherePhysics::Step(float dt)
+{
+    ApplyForces(dt);
+
+    // Contacts are found at the current positions, as Bullet does
+    FindRingContacts(dt);
+    FindSphereContacts(dt);
+
+    for (unsigned i = 0; i < SPHEREPHYSICS_ITERATIONS; ++i) {
+        SolveSphereContacts();
+        SolveRingContacts();
+    }
+
+    Integrate(dt);
+
+    // Report everything we touched
+    mContacts.assign(mSphereContacts.begin(), mSphereContacts.end());
+    for (unsigned i = 0; i < mNumSpheres; ++i) {
+        if (mRingOf[i] < 0.0f)
+            continue;
+        SphereContact contact;
+        contact.type = SPHERE_CONTACT_RING;
+        contact.sphere = i;
+        contact.other = (unsigned) mRingOf[i];
+        contact.distance = mRingDistance[i];
+        contact.nx = mRingNX[i];
+        contact.ny = mRingNY[i];
+        contact.nz = mRingNZ[i];
+        contact.target = mRingTarget[i];
+        contact.impulse = mRingImpulse[i];
+        mContacts.push_back(contact);
+    }
+}
+
+void
+SpherePhysics::ApplyForces(float dt)
+{
+    F4 step(dt);
+    F4 zero(0.0f);
+    F4 gravity(mGravityY);
+    float damping = 1.0f - dt * mAngularDamping;
+    F4 angularScale(damping < 0.0f ? 0.0f : (damping > 1.0f ? 1.0f : damping));
+
+    for (unsigned b = 0; b < mNumPadded; b += SPHEREPHYSICS_LANES) {
+        F4 im = Load(&invMass[b]);
+        F4 ii = Load(&invInertia[b]);
+        F4 active = Greater(im, zero);
+
+        // Gravity only pulls on things that can move
+        Store(&vx[b], Load(&vx[b]) + Load(&fx[b]) * im * step);
+        Store(&vy[b], Load(&vy[b]) + (Load(&fy[b]) * im + And(active, gravity)) * step);
+        Store(&vz[b], Load(&vz[b]) + Load(&fz[b]) * im * step);
+
+        Store(&wx[b], (Load(&wx[b]) + Load(&tx[b]) * ii * step) * angularScale);
+        Store(&wy[b], (Load(&wy[b]) + Load(&ty[b]) * ii * step) * angularScale);
+        Store(&wz[b], (Load(&wz[b]) + Load(&tz[b]) * ii * step) * angularScale);
+
+        Store(&fx[b], zero);
+        Store(&fy[b], zero);
+        Store(&fz[b], zero);
+        Store(&tx[b], zero);
+        Store(&ty[b], zero);
+        Store(&tz[b], zero);
+    }
+}
+
+void
+SpherePhysics::FindRingContacts(float dt)
+{
+    F4 zero(0.0f);
+    F4 one(1.0f);
+    F4 epsilon(SPHEREPHYSICS_EPSILON);
+    F4 restitutionSphere(mSphereRestitution);
+    F4 frictionSphere(mSphereFriction);
+    F4 bias(SPHEREPHYSICS_ERP / dt);
+
+    for (unsigned b = 0; b < mNumPadded; b += SPHEREPHYSICS_LANES) {
+        F4 x = Load(&px[b]);
+        F4 y = Load(&py[b]);
+        F4 z = Load(&pz[b]);
+        F4 r = Load(&radius[b]);
+        F4 active = Greater(Load(&invMass[b]), zero);
+        F4 horizontal = Sqrt(x * x + z * z);
+
+        // Find the ring each sphere sinks into deepest
+        F4 bestDistance(SPHEREPHYSICS_CONTACT_MARGIN);
+        F4 bestRing(-1.0f);
+        F4 bestNX = zero, bestNY = zero, bestNZ = zero;
+        F4 bestFriction = zero, bestRestitution = zero;
+        for (unsigned k = 0; k < mNumRings; ++k) {
+            F4 ringRadius(mRingRadius[k]);
+            F4 top(mRingTop[k]);
+
+            // Closest point on the top of the ring. Over the ring, that's
+            // straight down; past its edge, it's on the rim.
+            F4 inside = LessEq(horizontal, ringRadius);
+            F4 toRim = ringRadius / Max(horizontal, epsilon);
+            F4 dx = Select(inside, zero, x - x * toRim);
+            F4 dy = y - top;
+            F4 dz = Select(inside, zero, z - z * toRim);
+            F4 length = Sqrt(dx * dx + dy * dy + dz * dz);
+            F4 distance = Select(inside, dy, length) - r;
+
+            // We only model the tops. Below the rim is the ring's side.
+            F4 valid = And(active, Or(inside, GreaterEq(dy, zero)));
+            F4 better = And(valid, Less(distance, bestDistance));
+
+            F4 invLength = one / Max(length, epsilon);
+            bestDistance = Select(better, distance, bestDistance);
+            bestRing = Select(better, F4((float) k), bestRing);
+            bestNX = Select(better, Select(inside, zero, dx * invLength), bestNX);
+            bestNY = Select(better, Select(inside, one, dy * invLength), bestNY);
+            bestNZ = Select(better, Select(inside, zero, dz * invLength), bestNZ);
+            bestFriction = Select(better, frictionSphere * F4(mRingFriction[k]), bestFriction);
+            bestRestitution = Select(better, restitutionSphere * F4(mRingRestitution[k]),
+                                     bestRestitution);
+        }
+
+        // Aim to bounce back, and to work out a share of any penetration.
+        // The contact normal goes through the center, so spin doesn't
+        // change the normal velocity.
+        F4 approach = Load(&vx[b]) * bestNX + Load(&vy[b]) * bestNY +
+                      Load(&vz[b]) * bestNZ;
+        F4 target = Max(zero, zero - approach) * bestRestitution +
+                    Max(zero, zero - bestDistance) * bias;
+
+        Store(&mRingOf[b], bestRing);
+        Store(&mRingDistance[b], bestDistance);
+        Store(&mRingNX[b], bestNX);
+        Store(&mRingNY[b], bestNY);
+        Store(&mRingNZ[b], bestNZ);
+        Store(&mRingTarget[b], target);
+        Store(&mRingFrictionCoeff[b], bestFriction);
+        Store(&mRingImpulse[b], zero);
+        Store(&mRingJX[b], zero);
+        Store(&mRingJY[b], zero);
+        Store(&mRingJZ[b], zero);
+    }
+}
+
+void
+SpherePhysics::FindSphereContacts(float dt)
+{
+    mSphereContacts.clear();
+    F4 lanes = Load(sLaneIndex);
+    F4 count((float) mNumSpheres);
+    F4 margin(SPHEREPHYSICS_CONTACT_MARGIN);
+    float restitution = mSphereRestitution * mSphereRestitution;
+
+    for (unsigned i = 0; i < mNumSpheres; ++i) {
+        F4 xi(px[i]), yi(py[i]), zi(pz[i]), ri(radius[i]);
+        F4 self((float) i);
+
+        // Test i against every later sphere, four at a time
+        unsigned first = (i + 1) & ~(SPHEREPHYSICS_LANES - 1);
+        for (unsigned b = first; b < mNumPadded; b += SPHEREPHYSICS_LANES) {
+            F4 index = lanes + F4((float) b);
+            F4 dx = xi - Load(&px[b]);
+            F4 dy = yi - Load(&py[b]);
+            F4 dz = zi - Load(&pz[b]);
+            F4 reach = ri + Load(&radius[b]) + margin;
+            F4 hit = And(And(Greater(index, self), Less(index, count)),
+                         Less(dx * dx + dy * dy + dz * dz, reach * reach));
+
+            unsigned bits = MoveMask(hit);
+            while (bits) {
+                unsigned lane = __builtin_ctz(bits);
+                bits &= bits - 1;
+                unsigned j = b + lane;
+
+                SphereContact contact;
+                contact.type = SPHERE_CONTACT_SPHERE;
+                contact.sphere = i;
+                contact.other = j;
+                float cx = px[i] - px[j];
+                float cy = py[i] - py[j];
+                float cz = pz[i] - pz[j];
+                float length = sqrtf(cx * cx + cy * cy + cz * cz);
+                if (length > SPHEREPHYSICS_EPSILON) {
+                    contact.nx = cx / length;
+                    contact.ny = cy / length;
+                    contact.nz = cz / length;
+                }
+                else {
+                    contact.nx = 0.0f;
+                    contact.ny = 1.0f;
+                    contact.nz = 0.0f;
+                }
+                contact.distance = length - radius[i] - radius[j];
+
+                float approach = (vx[i] - vx[j]) * contact.nx +
+                                 (vy[i] - vy[j]) * contact.ny +
+                                 (vz[i] - vz[j]) * contact.nz;
+                contact.target = (approach < 0.0f ? -approach * restitution : 0.0f) +
+                                 (contact.distance < 0.0f ?
+                                  -contact.distance * SPHEREPHYSICS_ERP / dt : 0.0f);
+                contact.impulse = 0.0f;
+                mSphereContacts.push_back(contact);
+            }
+        }
+    }
+}
+
+void
+SpherePhysics::SolveSphereContacts()
+{
+    for (unsigned c = 0; c < mSphereContacts.size(); ++c) {
+        SphereContact& contact = mSphereContacts[c];
+        unsigned i = contact.sphere;
+        unsigned j = contact.other;
+        float massTerm = invMass[i] + invMass[j];
+        if (massTerm <= 0.0f)
+            continue;
+
+        // Push apart along the normal, never pull together
+        float velocity = (vx[i] - vx[j]) * contact.nx +
+                         (vy[i] - vy[j]) * contact.ny +
+                         (vz[i] - vz[j]) * contact.nz;
+        float impulse = contact.impulse + (contact.target - velocity) / massTerm;
+        if (impulse < 0.0f)
+            impulse = 0.0f;
+        float delta = impulse - contact.impulse;
+        contact.impulse = impulse;
+
+        vx[i] += delta * invMass[i] * contact.nx;
+        vy[i] += delta * invMass[i] * contact.ny;
+        vz[i] += delta * invMass[i] * contact.nz;
+        vx[j] -= delta * invMass[j] * contact.nx;
+        vy[j] -= delta * invMass[j] * contact.ny;
+        vz[j] -= delta * invMass[j] * contact.nz;
+    }
+}
+
+void
+SpherePhysics::SolveRingContacts()
+{
+    F4 zero(0.0f);
+    F4 one(1.0f);
+    F4 epsilon(SPHEREPHYSICS_EPSILON);
+
+    for (unsigned b = 0; b < mNumPadded; b += SPHEREPHYSICS_LANES) {
+        F4 touching = GreaterEq(Load(&mRingOf[b]), zero);
+        if (!MoveMask(touching))
+            continue;
+
+        F4 nx = Load(&mRingNX[b]), ny = Load(&mRingNY[b]), nz = Load(&mRingNZ[b]);
+        F4 x = Load(&vx[b]), y = Load(&vy[b]), z = Load(&vz[b]);
+        F4 ax = Load(&wx[b]), ay = Load(&wy[b]), az = Load(&wz[b]);
+        F4 im = Load(&invMass[b]);
+        F4 ii = Load(&invInertia[b]);
+        F4 r = Load(&radius[b]);
+
+        // Normal impulse. The ring doesn't move, so only we take it.
+        F4 accumulated = Load(&mRingImpulse[b]);
+        F4 velocity = x * nx + y * ny + z * nz;
+        F4 impulse = Max(zero, accumulated + (Load(&mRingTarget[b]) - velocity) /
+                                             Max(im, epsilon));
+        impulse = Select(touching, impulse, accumulated);
+        F4 delta = (impulse - accumulated) * im;
+        x = x + delta * nx;
+        y = y + delta * ny;
+        z = z + delta * nz;
+        Store(&mRingImpulse[b], impulse);
+
+        // Friction at the contact point, which sits a radius below the
+        // center along the normal. Its velocity includes our spin.
+        F4 rx = zero - nx * r, ry = zero - ny * r, rz = zero - nz * r;
+        F4 cvx = x + (ay * rz - az * ry);
+        F4 cvy = y + (az * rx - ax * rz);
+        F4 cvz = z + (ax * ry - ay * rx);
+        F4 normalPart = cvx * nx + cvy * ny + cvz * nz;
+        F4 tvx = cvx - nx * normalPart;
+        F4 tvy = cvy - ny * normalPart;
+        F4 tvz = cvz - nz * normalPart;
+
+        // Stop the sliding, within the friction cone
+        F4 tangentMass = one / Max(im + ii * r * r, epsilon);
+        F4 oldJX = Load(&mRingJX[b]), oldJY = Load(&mRingJY[b]), oldJZ = Load(&mRingJZ[b]);
+        F4 jx = oldJX - tvx * tangentMass;
+        F4 jy = oldJY - tvy * tangentMass;
+        F4 jz = oldJZ - tvz * tangentMass;
+        F4 limit = Load(&mRingFrictionCoeff[b]) * impulse;
+        F4 length = Sqrt(jx * jx + jy * jy + jz * jz);
+        F4 scale = Select(Greater(length, limit), limit / Max(length, epsilon), one);
+        jx = Select(touching, jx * scale, oldJX);
+        jy = Select(touching, jy * scale, oldJY);
+        jz = Select(touching, jz * scale, oldJZ);
+        F4 dx = jx - oldJX, dy = jy - oldJY, dz = jz - oldJZ;
+        Store(&mRingJX[b], jx);
+        Store(&mRingJY[b], jy);
+        Store(&mRingJZ[b], jz);
+
+        Store(&vx[b], x + dx * im);
+        Store(&vy[b], y + dy * im);
+        Store(&vz[b], z + dz * im);
+        Store(&wx[b], ax + (ry * dz - rz * dy) * ii);
+        Store(&wy[b], ay + (rz * dx - rx * dz) * ii);
+        Store(&wz[b], az + (rx * dy - ry * dx) * ii);
+    }
+}
+
+void
+SpherePhysics::Integrate(float dt)
+{
+    F4 step(dt);
+    for (unsigned b = 0; b < mNumPadded; b += SPHEREPHYSICS_LANES) {
+        Store(&px[b], Load(&px[b]) + Load(&vx[b]) * step);
+        Store(&py[b], Load(&py[b]) + Load(&vy[b]) * step);
+        Store(&pz[b], Load(&pz[b]) + Load(&vz[b]) * step);
+    }
+}
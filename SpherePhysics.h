@@ -0,0 +1,159 @@
+#ifndef SPHEREPHYSICS_H
+#define SPHEREPHYSICS_H
+
+#include <vector>
+
+/*
+ * Specialised physics for Growbles.
+ *
+ * All the game ever simulates is spheres bouncing off each other and off
+ * the tops of a few coaxial cylinders (the platform rings). SpherePhysics
+ * does exactly that, and nothing else: there's no broadphase, no collision
+ * dispatcher and no general constraint solver. Spheres live in
+ * structure-of-arrays form, padded to a multiple of four, and integration,
+ * ring contacts and the search for sphere pairs run four spheres at a time
+ * with SSE. Sphere-sphere contacts are then resolved one at a time, since
+ * neighbouring contacts share spheres.
+ *
+ * The model follows what Bullet does with our settings, so that the two
+ * can be swapped (see WorldModel::SetPhysicsBackend()): forces and torques
+ * last one step, angular velocity is damped, contacts combine friction and
+ * restitution by multiplying them, ten solver iterations with accumulated
+ * impulses, and penetration is worked out with Baumgarte stabilisation.
+ * Contacts between spheres are frictionless, which is where we differ most.
+ * Players rarely spin each other up enough for it to show.
+ */
+
+// Spheres processed at once
+#define SPHEREPHYSICS_LANES 4
+
+// Most rings we support
+#define SPHEREPHYSICS_MAX_RINGS 8
+
+// Solver iterations per step, as in Bullet
+#define SPHEREPHYSICS_ITERATIONS 10
+
+// Objects closer than this are in contact, as in Bullet
+#define SPHEREPHYSICS_CONTACT_MARGIN 0.02f
+
+// Fraction of penetration worked out per step
+#define SPHEREPHYSICS_ERP 0.2f
+
+typedef enum {
+    SPHERE_CONTACT_SPHERE = 0,
+    SPHERE_CONTACT_RING
+} SphereContactType;
+
+/*
+ * A sphere touching another sphere or a ring.
+ */
+struct SphereContact {
+
+    SphereContactType type;
+
+    // The sphere, and the other sphere or the ring
+    unsigned sphere;
+    unsigned other;
+
+    // Distance between the surfaces. Negative means overlapping.
+    float distance;
+
+    // Contact normal, pointing from the other object towards the sphere
+    float nx, ny, nz;
+
+    // Solver state: the velocity we're aiming for along the normal, and
+    // the impulse applied so far
+    float target;
+    float impulse;
+};
+
+class SpherePhysics {
+
+    public:
+
+    /*
+     * Constructor. Starts with no spheres and no rings.
+     */
+    SpherePhysics();
+
+    /*
+     * Sets the number of spheres. New spheres are inert (zero inverse mass)
+     * until given a mass.
+     */
+    void Resize(unsigned numSpheres);
+    unsigned Size() { return mNumSpheres; };
+
+    /*
+     * World settings. Materials are shared by every sphere.
+     */
+    void SetGravity(float gravityY) { mGravityY = gravityY; };
+    void SetSphereMaterial(float friction, float restitution, float angularDamping);
+    void SetNumRings(unsigned numRings);
+    void SetRing(unsigned ring, float radius, float top, float friction,
+                 float restitution);
+
+    /*
+     * Steps the simulation, consuming the forces and torques.
+     */
+    void Step(float dt);
+
+    /*
+     * Contacts found during the last step.
+     */
+    const std::vector<SphereContact>& GetContacts() { return mContacts; };
+
+    // Sphere state, indexed by sphere. Each array holds a multiple of
+    // SPHEREPHYSICS_LANES entries.
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> wx, wy, wz;
+    std::vector<float> fx, fy, fz;
+    std::vector<float> tx, ty, tz;
+    std::vector<float> radius;
+    std::vector<float> invMass;
+    std::vector<float> invInertia;
+
+    protected:
+
+    /*
+     * The steps of Step().
+     */
+    void ApplyForces(float dt);
+    void FindRingContacts(float dt);
+    void FindSphereContacts(float dt);
+    void SolveRingContacts();
+    void SolveSphereContacts();
+    void Integrate(float dt);
+
+    unsigned mNumSpheres;
+    unsigned mNumPadded;
+
+    // Settings
+    float mGravityY;
+    float mSphereFriction;
+    float mSphereRestitution;
+    float mAngularDamping;
+
+    // Rings
+    unsigned mNumRings;
+    float mRingRadius[SPHEREPHYSICS_MAX_RINGS];
+    float mRingTop[SPHEREPHYSICS_MAX_RINGS];
+    float mRingFriction[SPHEREPHYSICS_MAX_RINGS];
+    float mRingRestitution[SPHEREPHYSICS_MAX_RINGS];
+
+    // Each sphere's deepest ring contact this step, by sphere. A ring of -1
+    // means none. Impulses are accumulated across iterations.
+    std::vector<float> mRingOf;
+    std::vector<float> mRingDistance;
+    std::vector<float> mRingNX, mRingNY, mRingNZ;
+    std::vector<float> mRingTarget;
+    std::vector<float> mRingFrictionCoeff;
+    std::vector<float> mRingImpulse;
+    std::vector<float> mRingJX, mRingJY, mRingJZ;
+
+    // Sphere-sphere contacts this step, and both kinds for reporting
+    std::vector<SphereContact> mSphereContacts;
+    std::vector<SphereContact> mContacts;
+};
+
+#endif /* SPHEREPHYSICS_H */
@@ -1,4 +1,6 @@
 #include "Timeline.h"
+#include "MatchLog.h"
+#include <algorithm>
 
 using std::list;
 using std::vector;
@@ -7,16 +9,21 @@ using std::vector;
  * Timeline methods.
  */
 
-Timeline::Timeline() : mWorld(NULL)
+Timeline::Timeline(Metrics& metrics) : mWorld(NULL)
+                                     , mDeterministic(false)
+                                     , mRepairRequested(false)
+                                     , mLastDumpTimestamp(0)
+                                     , mRecorder(NULL)
+                                     , mMetrics(metrics)
 {
 }
 
 Timeline::~Timeline()
 {
-    if (mKeyframes.size() == 0)
-        return;
-
-    Prune(mKeyframes.back()->timestamp + 1);
+    PruneAll();
+    for (KeyframeIterator it = mSpareKeyframes.begin();
+         it != mSpareKeyframes.end(); ++it)
+        delete (*it);
 }
 
 void
@@ -29,6 +36,10 @@ Timeline::Init(WorldModel& model, Gameclock& clock, CommunicatorMode mode)
 
     // Generate an initial keyframe
     GenerateCurrentKeyframe();
+    if (mRecorder) {
+        mRecorder->SetDeterministic(mDeterministic);
+        mRecorder->RecordState(mWorld->GetCurrentTimestamp(), mKeyframes.back()->state);
+    }
 }
 
 void
@@ -54,15 +65,46 @@ Timeline::SendUpdates(Communicator& communicator)
         (*candidate)->timestamp)
         return;
 
+    // In deterministic mode, everybody has computed the same state as us,
+    // so a hash is enough. We still send the whole thing if somebody asks,
+    // and once in a while just in case.
+    unsigned timestamp = (*candidate)->timestamp;
+    if (mDeterministic && !mRepairRequested &&
+        timestamp < mLastDumpTimestamp + STATE_REPAIR_INTERVAL) {
+        StateHash hash;
+        hash.tick = timestamp;
+        hash.hash = WireHashState((*candidate)->state);
+        communicator.SendStateHash(hash);
+    }
+
     // Send
-    communicator.SendAuthoritativeState((*candidate)->state);
+    else {
+        communicator.SendAuthoritativeState((*candidate)->state);
+        if (mRecorder)
+            mRecorder->RecordState(mWorld->GetCurrentTimestamp(), (*candidate)->state);
+        mLastDumpTimestamp = timestamp;
+        mRepairRequested = false;
+    }
 
-    // Prune
-    Prune((*candidate)->timestamp);
+    // Prune. Inputs from before the candidate are now too late, so the
+    // state we just described is final.
+    Prune(timestamp);
 }
 
 void
 Timeline::AddInput(UserInput& input)
+{
+    // Keyframes store inputs in compact form, which rounds them, and peers
+    // get them off the wire the same way. Round this one now, so that the
+    // world applies the same thing whether it's live or resimulating.
+    InputCodec::Quantise(input);
+    if (mRecorder)
+        mRecorder->RecordInput(mWorld->GetCurrentTimestamp(), input);
+    AcceptInput(input);
+}
+
+void
+Timeline::AcceptInput(UserInput& input)
 {
     // We may be fast-forwarding and rewinding, so make sure our timeline contains
     // the newest model state.
@@ -74,17 +116,25 @@ Timeline::AddInput(UserInput& input)
         printf("Warning - Received input for player %u with timestamp %u, but "
                "we only have keyframes dating back to %u. Dropping.\n",
                input.playerID, input.timestamp, mKeyframes.front()->timestamp);
+        mMetrics.Add(METRIC_INPUTS_DROPPED_LATE);
         return;
     }
 
-    // If the input is ahead of our current worldstate...
+    // If the input is ahead of our current worldstate, hold onto it until
+    // we get there. Clients run slightly ahead of the server on purpose,
+    // and our world may be catching up with our clock, so this is normal.
+    // Inputs absurdly far ahead of both are dropped.
     if (input.timestamp > mKeyframes.back()->timestamp) {
-
-        // TODO - we should probably handle this better. Servers should discard
-        // input, and clients should sync their game clocks.
+        unsigned newest = std::max(mKeyframes.back()->timestamp, mGameclock->Now());
+        if (input.timestamp <= newest + MAX_INPUT_LEAD) {
+            mFutureInputs.push_back(input);
+            mMetrics.Add(METRIC_INPUTS_HELD_EARLY);
+            return;
+        }
         printf("Warning - Received input for player %u with timestamp %u, but "
-               "we only have keyframes dating up to %u. Dropping.\n",
-               input.playerID, input.timestamp, mKeyframes.back()->timestamp);
+               "we're only up to %u. Dropping.\n",
+               input.playerID, input.timestamp, newest);
+        mMetrics.Add(METRIC_INPUTS_DROPPED_EARLY);
         return;
     }
 
@@ -97,6 +147,8 @@ Timeline::AddAuthoritativeState(WorldState& state)
 {
     // We should be a client
     assert(mMode == COMMUNICATOR_MODE_CLIENT);
+    if (mRecorder)
+        mRecorder->RecordState(mWorld->GetCurrentTimestamp(), state);
 
     // Make sure we have an up to date keyframe. This will get blown
     // away by whatever state update we receive, but we need the marker
@@ -114,6 +166,7 @@ Timeline::AddAuthoritativeState(WorldState& state)
         printf("Server clock is ahead of ours (>= %u, compared to %u). "
                "Fast-forwarding\n",
                minimumServerTime, mWorld->GetCurrentTimestamp());
+        mMetrics.Add(METRIC_CLOCK_FAST_FORWARDS);
         PruneAll();
         mWorld->SetState(state);
         mWorld->Step(MIN_STATEUPDATE_AGE);
@@ -128,17 +181,69 @@ Timeline::AddAuthoritativeState(WorldState& state)
     // If we don't have a keyframe for this timestamp, make one
     if (!mKeyframes.size() ||
         (*mKeyframes.begin())->timestamp != state.timestamp) {
-        Keyframe* frame = new Keyframe(state.timestamp, state);
-        mKeyframes.push_front(frame);
+        KeyframeIterator frame = NewKeyframe(state.timestamp, mKeyframes.begin());
+        (*frame)->state = state;
     }
     // Otherwise, just update the statedump on the first keyframes
-    else
+    else {
         (*mKeyframes.begin())->state = state;
+        (*mKeyframes.begin())->physics.Invalidate();
+    }
 
     // Rectify, starting at the front
     Rectify(mKeyframes.begin());
 }
 
+void
+Timeline::ApplyDueInputs()
+{
+    if (mFutureInputs.empty())
+        return;
+
+    // Pull out the inputs that are now due and close up the rest, in one
+    // pass that keeps both in the order they arrived in, then add the due
+    // ones like any other input.
+    unsigned now = mWorld->GetCurrentTimestamp();
+    mDueInputs.clear();
+    unsigned kept = 0;
+    for (unsigned i = 0; i < mFutureInputs.size(); ++i) {
+        if (mFutureInputs[i].timestamp <= now)
+            mDueInputs.push_back(mFutureInputs[i]);
+        else
+            mFutureInputs[kept++] = mFutureInputs[i];
+    }
+    mFutureInputs.resize(kept, UserInput(0, 0));
+    for (unsigned i = 0; i < mDueInputs.size(); ++i)
+        AcceptInput(mDueInputs[i]);
+}
+
+bool
+Timeline::CheckStateHash(StateHash& hash)
+{
+    assert(mMode == COMMUNICATOR_MODE_CLIENT);
+
+    // If we don't remember the tick, we can't say anything about it
+    uint64_t ours;
+    if (!mWorld->GetStateHash(hash.tick, ours))
+        return true;
+    mMetrics.Add(METRIC_STATE_HASHES_CHECKED);
+    if (ours != hash.hash) {
+        printf("Warning - Our state at tick %u doesn't match the server's "
+               "(%016llx, compared to %016llx)\n", hash.tick,
+               (unsigned long long) ours, (unsigned long long) hash.hash);
+        mMetrics.Add(METRIC_DESYNCS);
+        return false;
+    }
+
+    // The server won't accept inputs from before this tick anymore, so
+    // neither will we. Keep the keyframe the tick falls in, so that we can
+    // still take inputs for the tick itself.
+    KeyframeIterator settled = FindKeyframe(hash.tick);
+    if (settled != mKeyframes.end())
+        Prune((*settled)->timestamp);
+    return true;
+}
+
 void
 Timeline::AddInputInternal(UserInput& input)
 {
@@ -149,16 +254,24 @@ Timeline::AddInputInternal(UserInput& input)
     // If there isn't a keyframe already there, we have to make one.
     // Note that we're about to Rectify(), so the state snapshot can be garbage.
     if ((*nearest)->timestamp < input.timestamp) {
-        Keyframe* newFrame = new Keyframe(input.timestamp);
-        newFrame->inputs.push_back(input);
         KeyframeIterator pos = nearest;
         ++pos;
-        mKeyframes.insert(pos, newFrame);
+        (*NewKeyframe(input.timestamp, pos))->inputs.Append(input);
     }
 
     // If there is a keyframe, just add the input
-    else
-        (*nearest)->inputs.push_back(input);
+    else {
+        (*nearest)->inputs.Append(input);
+
+        // If that's the newest keyframe and the world is still there, the
+        // input lands in the present: apply it directly, no rewind needed.
+        KeyframeIterator next = nearest;
+        ++next;
+        if (next == mKeyframes.end() && UpToDate()) {
+            mWorld->ApplyInput(input);
+            return;
+        }
+    }
 
     // Rectify
     Rectify(nearest);
@@ -167,8 +280,17 @@ Timeline::AddInputInternal(UserInput& input)
 void
 Timeline::Rectify(KeyframeIterator lastGood)
 {
-    // Rewind ourselves to the state snapshot given
-    mWorld->SetState((*lastGood)->state);
+    // Record how far back we're going
+    unsigned depth = mKeyframes.back()->timestamp - (*lastGood)->timestamp;
+    mMetrics.Add(METRIC_ROLLBACKS);
+    mMetrics.Add(METRIC_RESIMULATED_TICKS, depth);
+    mMetrics.Observe(METRIC_HIST_ROLLBACK_DEPTH, depth);
+
+    // Rewind ourselves to the state snapshot given. If we took a full
+    // physics snapshot there, rewinding comes closer (and is exact in
+    // deterministic mode). Otherwise we only have what the network gives us.
+    if (!mWorld->RestoreSnapshot((*lastGood)->state, (*lastGood)->physics))
+        mWorld->SetState((*lastGood)->state);
     KeyframeIterator curr, upcoming;
     curr = upcoming = lastGood;
 
@@ -178,13 +300,14 @@ Timeline::Rectify(KeyframeIterator lastGood)
         ++upcoming;
 
         // Dump the world model state into the timeline
-        WorldState state;
-        mWorld->GetState(state);
-        (*curr)->state = state;
+        mWorld->GetState((*curr)->state);
+        mWorld->TakeSnapshot((*curr)->physics);
 
         // Apply all the inputs at this stage
-        for (unsigned i = 0; i < (*curr)->inputs.size(); ++i)
-            mWorld->ApplyInput((*curr)->inputs[i]);
+        InputStream::Reader reader((*curr)->inputs);
+        UserInput input(0, 0);
+        while (reader.Next(input))
+            mWorld->ApplyInput(input);
 
         // Step the world, if necessary
         if (upcoming != mKeyframes.end()) {
@@ -203,13 +326,23 @@ Timeline::GenerateCurrentKeyframe()
 {
     assert(mKeyframes.size() == 0 || !UpToDate());
 
-    // Grab the world state
-    WorldState state;
-    mWorld->GetState(state);
+    // Append our keyframe, with the world's state and a full snapshot
+    KeyframeIterator frame = NewKeyframe(mWorld->GetCurrentTimestamp(), mKeyframes.end());
+    mWorld->GetState((*frame)->state);
+    mWorld->TakeSnapshot((*frame)->physics);
+    mMetrics.Set(METRIC_GAUGE_KEYFRAMES, mKeyframes.size());
+}
 
-    // Append our keyframe
-    Keyframe* frame = new Keyframe(state.timestamp, state);
-    mKeyframes.push_back(frame);
+KeyframeIterator
+Timeline::NewKeyframe(unsigned timestamp, KeyframeIterator pos)
+{
+    if (mSpareKeyframes.empty())
+        return mKeyframes.insert(pos, new Keyframe(timestamp));
+
+    // Move the spare's list node over rather than making a new one
+    mSpareKeyframes.front()->Reset(timestamp);
+    mKeyframes.splice(pos, mSpareKeyframes, mSpareKeyframes.begin());
+    return --pos;
 }
 
 bool
@@ -226,8 +359,7 @@ Timeline::Prune(unsigned timestamp)
     while (it != mKeyframes.end()) {
         if ((*it)->timestamp >= timestamp)
             return;
-        delete (*it);
-        mKeyframes.erase(it++);
+        mSpareKeyframes.splice(mSpareKeyframes.begin(), mKeyframes, it++);
     }
 }
 
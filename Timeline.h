@@ -3,10 +3,13 @@
 
 #include "WorldModel.h"
 #include "UserInput.h"
+#include "InputCodec.h"
 #include "Communicator.h"
 #include <list>
 #include <vector>
 
+class MatchRecorder;
+
 // The minimum number of ticks between authoritative updates
 #define STATE_UPDATE_THRESHOLD 15
 
@@ -16,6 +19,12 @@
 // Minimum seperation between statedumps
 #define MIN_STATEDUMP_SEPARATION 5
 
+// How far ahead of our clock an input may be stamped before we drop it.
+// Clients deliberately run a little ahead of the server (see ClockSync.h).
+// It's measured from the clock rather than the world, which may be any
+// number of ticks behind the clock while it catches up (see CatchUp.h).
+#define MAX_INPUT_LEAD 30
+
 /*
  * A keyframe is an item in our timeline. It contains a snapshot of the
  * world state at the beginning of that timestep, and the input applied
@@ -24,10 +33,21 @@
 struct Keyframe {
 
     /*
-     * Constructors.
+     * Constructor.
+     */
+    Keyframe(unsigned t) : timestamp(t), inputs(t) {};
+
+    /*
+     * Makes a used keyframe over for timestamp t, with no inputs and no
+     * physics snapshot, keeping what it has allocated. The state is left
+     * as it was.
      */
-    Keyframe(unsigned t) : timestamp(t) {};
-    Keyframe(unsigned t, WorldState& s) : timestamp(t), state(s) {};
+    void Reset(unsigned t)
+    {
+        timestamp = t;
+        physics.Invalidate();
+        inputs.Clear(t);
+    };
 
     // Timestamp
     unsigned timestamp;
@@ -35,8 +55,12 @@ struct Keyframe {
     // state snapshot
     WorldState state;
 
-    // Inputs applied
-    std::vector<UserInput> inputs;
+    // Full physics snapshot taken alongside state, if we have one. State
+    // that arrives over the network doesn't come with one.
+    PhysicsSnapshot physics;
+
+    // Inputs applied, in compact form (see InputCodec.h)
+    InputStream inputs;
 };
 
 typedef std::list<Keyframe*>::iterator KeyframeIterator;
@@ -46,9 +70,9 @@ class Timeline {
     public:
 
     /*
-     * Dummy Constructor.
+     * Constructor. Rollback and input metrics go to the given registry.
      */
-    Timeline();
+    Timeline(Metrics& metrics = Metrics::Global());
 
     /*
      * Destructor.
@@ -71,13 +95,50 @@ class Timeline {
      */
     void AddInput(UserInput& input);
 
+    /*
+     * Records the inputs and full states we're given (see MatchLog.h).
+     * Set it before Init(), so that the log starts with the state we start
+     * from and says whether we're deterministic. Pass NULL to stop.
+     */
+    void SetRecorder(MatchRecorder* recorder) { mRecorder = recorder; };
+
     /*
      * Adds authoritative server state to the timeline.
      */
     void AddAuthoritativeState(WorldState& state);
 
+    /*
+     * Applies held inputs whose timestamps our world has reached.
+     */
+    void ApplyDueInputs();
+
+    /*
+     * Deterministic mode (see Determinism.h). Servers send state hashes
+     * instead of regular state dumps, and clients check them.
+     */
+    void SetDeterministic(bool deterministic) { mDeterministic = deterministic; };
+
+    /*
+     * Asks a deterministic server to send a full state dump with its next
+     * update.
+     */
+    void RequestRepair() { mRepairRequested = true; };
+
+    /*
+     * Checks a state hash from the server against our own state at that
+     * tick. Returns false if they differ. A match means everything up to
+     * that tick is settled, so we let go of the keyframes before it.
+     */
+    bool CheckStateHash(StateHash& hash);
+
     protected:
 
+    /*
+     * Adds a quantised input, holding it or dropping it if it's outside
+     * the range of our keyframes.
+     */
+    void AcceptInput(UserInput& input);
+
     /*
      * Internal method to add input. The input must be in the range
      * of our keyframes.
@@ -98,6 +159,12 @@ class Timeline {
      */
     void GenerateCurrentKeyframe();
 
+    /*
+     * Puts a keyframe for the given timestamp into the timeline before pos,
+     * reusing a pruned one if there is one. Its state is garbage.
+     */
+    KeyframeIterator NewKeyframe(unsigned timestamp, KeyframeIterator pos);
+
     /*
      * Does the newest timestamp in the timeline match the timestamp of the
      * world model?
@@ -134,6 +201,27 @@ class Timeline {
     // Our set of keyframes, from newest to oldest
     std::list<Keyframe*> mKeyframes;
 
+    // Pruned keyframes, list nodes and all, kept so that making new ones
+    // doesn't allocate
+    std::list<Keyframe*> mSpareKeyframes;
+
+    // Inputs stamped ahead of our world, waiting for it to catch up, and
+    // scratch for the ones ApplyDueInputs() takes out
+    std::vector<UserInput> mFutureInputs;
+    std::vector<UserInput> mDueInputs;
+
+    // Deterministic mode. Servers remember when they last sent a full dump,
+    // and whether a client has asked for one.
+    bool mDeterministic;
+    bool mRepairRequested;
+    unsigned mLastDumpTimestamp;
+
+    // Where to record what we're given, if anywhere
+    MatchRecorder* mRecorder;
+
+    // Where we record metrics
+    Metrics& mMetrics;
+
 };
 
 #endif /* TIMELINE_H */
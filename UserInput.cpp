@@ -6,6 +6,7 @@
 #define M_PI           3.14159265358979323846
 #endif
 #include "Communicator.h"
+#include "InputSampler.h"
 
 UserInput::UserInput(unsigned playerID_, unsigned timestamp_) : inputs(0)
                                                               , timestamp(timestamp_)
@@ -15,21 +16,13 @@ UserInput::UserInput(unsigned playerID_, unsigned timestamp_) : inputs(0)
 
 
 void
-UserInput::LoadInput(RenderContext& context, Communicator& communicator,
-    WorldModel &world)
+UserInput::PumpEvents(RenderContext& context, Communicator& communicator,
+    InputSampler& sampler)
 {
     static int sLastMouseX = 0;
     static int sLastMouseY = 0;
     static bool sMouseInitialized = false;
 
-#ifdef FALCON
-    if(context.falcon.isConnected()){
-        Player *player = world.GetPlayer(playerID);
-        if(player)
-            context.falcon.setInputs(*this, player->GetActiveInputs());
-    }
-#endif
-
     sf::Event evt;
     while (context.GetWindow()->GetEvent(evt)) {
 
@@ -136,31 +129,31 @@ UserInput::LoadInput(RenderContext& context, Communicator& communicator,
                 // Handle each key
                 switch(evt.Key.Code) {
                     case sf::Key::I:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_GROW, isPress);
+                        sampler.Key(USERINPUT_INDEX_GROW, isPress);
                         break;
                     case sf::Key::U:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_SHRINK, isPress);
+                        sampler.Key(USERINPUT_INDEX_SHRINK, isPress);
                         break;
                     case sf::Key::K:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_DASH, isPress);
+                        sampler.Key(USERINPUT_INDEX_DASH, isPress);
                         break;
                     case sf::Key::J:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_JUMP, isPress);
+                        sampler.Key(USERINPUT_INDEX_JUMP, isPress);
                         break;
                     case sf::Key::L:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_BRAKE, isPress);
+                        sampler.Key(USERINPUT_INDEX_BRAKE, isPress);
                         break;
                     case sf::Key::W:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_UP, isPress);
+                        sampler.Key(USERINPUT_INDEX_UP, isPress);
                         break;
                     case sf::Key::S:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_DOWN, isPress);
+                        sampler.Key(USERINPUT_INDEX_DOWN, isPress);
                         break;
                     case sf::Key::A:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_LEFT, isPress);
+                        sampler.Key(USERINPUT_INDEX_LEFT, isPress);
                         break;
                     case sf::Key::D:
-                        inputs |= GEN_INPUT_MASK(USERINPUT_INDEX_RIGHT, isPress);
+                        sampler.Key(USERINPUT_INDEX_RIGHT, isPress);
                         break;
                     default:
                         break;
@@ -8,6 +8,7 @@
 class RenderContext;
 class WorldModel;
 class Communicator;
+class InputSampler;
 
 typedef enum {
     USERINPUT_INDEX_GROW = 0,
@@ -36,15 +37,16 @@ struct UserInput {
     UserInput(unsigned playerID, unsigned timestamp);
 
     /*
-     * Loads input from the user.
+     * Takes whatever events the window has for us.
      *
      * Local input (that is to say, input that affects only the local
      * render client and doesn't get communicated over the network) is
-     * applied immediately. All other inputs are stored as instance data
-     * for later application.
+     * applied immediately. Presses and releases of all other keys are
+     * passed to the sampler, stamped with when we saw them, to be made
+     * into inputs later.
      */
-    void LoadInput(RenderContext& context, Communicator& communicator,
-	    WorldModel &world);
+    static void PumpEvents(RenderContext& context, Communicator& communicator,
+                           InputSampler& sampler);
 
 #ifdef FALCON
     /*
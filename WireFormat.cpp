@@ -0,0 +1,227 @@
+#include "WireFormat.h"
+#include "WorldModel.h"
+#include "UserInput.h"
+#include "InputCodec.h"
+#include "ClockSync.h"
+#include "Determinism.h"
+
+/*
+ * Message schemas.
+ *
+ * Each schema lists the fields that go on the wire, in order. Padding,
+ * dummies and unused vector components are simply left out.
+ */
+
+template <typename Archive>
+void
+WireSchema(Archive& ar, btVector3& v)
+{
+    ar.Field(v[0]);
+    ar.Field(v[1]);
+    ar.Field(v[2]);
+}
+
+template <typename Archive>
+void
+WireSchema(Archive& ar, btTransform& t)
+{
+    // We send the full basis rather than a quaternion so that a round trip
+    // through the wire reproduces the transform exactly.
+    for (int row = 0; row < 3; ++row)
+        WireSchema(ar, t.getBasis()[row]);
+    WireSchema(ar, t.getOrigin());
+}
+
+template <typename Archive>
+void
+WireSchema(Archive& ar, Vector& v)
+{
+    // The w component isn't meaningful for anything we send.
+    ar.Field(v.x);
+    ar.Field(v.y);
+    ar.Field(v.z);
+}
+
+template <typename Archive>
+void
+WireSchema(Archive& ar, PlayerInfo& info)
+{
+    ar.Field(info.transform);
+    ar.Field(info.linearVel);
+    ar.Field(info.angularVel);
+    ar.Field(info.activeFalconInputs);
+    ar.Field(info.playerID);
+    ar.Field(info.activeInputs);
+    ar.Field(info.scale);
+}
+
+template <typename Archive>
+void
+WireSchema(Archive& ar, platformState& state)
+{
+    ar.Field(state.dropTimer);
+    ar.Field(state.blinkTimer);
+    ar.Field(state.dropCount);
+    ar.Field(state.fallingRing);
+    ar.Field(state.blinkOn);
+    ar.Field(state.curRadius);
+    ar.Field(state.curDrawRadius);
+    ar.Field(state.dropVelocity);
+    ar.Field(state.dropY);
+    ar.Field(state.dropState);
+}
+
+template <typename Archive>
+void
+WireSchema(Archive& ar, WorldState& state)
+{
+    ar.Array(state.playerArray, state.numPlayers, WORLDSTATE_MAX_PLAYERS);
+    ar.Field(state.pstate);
+    ar.Field(state.timestamp);
+}
+
+template <typename Archive>
+void
+WireSchema(Archive& ar, ClockPing& ping)
+{
+    ar.Field(ping.sequence);
+    ar.Field(ping.originMicros);
+    ar.Field(ping.replyMicros);
+}
+
+template <typename Archive>
+void
+WireSchema(Archive& ar, StateHash& hash)
+{
+    ar.Field(hash.tick);
+    ar.Field(hash.hash);
+    ar.Field(hash.repair);
+}
+
+/*
+ * Helpers to run a schema with a given archive.
+ */
+
+template <typename T>
+static unsigned
+Encode(T& message, uint8_t* buffer, unsigned capacity)
+{
+    WireWriter writer(buffer, capacity);
+    writer.Field(message);
+    return writer.Ok() ? writer.Size() : 0;
+}
+
+template <typename T>
+static bool
+Decode(T& message, const uint8_t* buffer, unsigned size)
+{
+    WireReader reader(buffer, size);
+    reader.Field(message);
+    return reader.Ok();
+}
+
+/*
+ * Inputs have their own compact encoding (see InputCodec.h). Each payload
+ * stands alone.
+ */
+
+static unsigned
+EncodeInput(UserInput& input, uint8_t* buffer, unsigned capacity)
+{
+    InputCodec codec;
+    return codec.Encode(input, buffer, capacity);
+}
+
+static bool
+DecodeInput(UserInput& input, const uint8_t* buffer, unsigned size)
+{
+    InputCodec codec;
+    return size > 0 && codec.Decode(buffer, size, input) == size;
+}
+
+/*
+ * Entry points.
+ */
+
+unsigned
+WireEncodePayload(PayloadType type, void* data, uint8_t* buffer, unsigned capacity)
+{
+    switch (type) {
+        case PAYLOAD_TYPE_WORLDSTATE:
+            return Encode(*(WorldState*)data, buffer, capacity);
+        case PAYLOAD_TYPE_USERINPUT:
+            return EncodeInput(*(UserInput*)data, buffer, capacity);
+        case PAYLOAD_TYPE_PING:
+        case PAYLOAD_TYPE_PONG:
+            return Encode(*(ClockPing*)data, buffer, capacity);
+        case PAYLOAD_TYPE_STATEHASH:
+            return Encode(*(StateHash*)data, buffer, capacity);
+        default:
+            assert(0); // Not reached
+            return 0;
+    }
+}
+
+bool
+WireDecodePayload(PayloadType type, const uint8_t* buffer, unsigned size, void* data)
+{
+    switch (type) {
+        case PAYLOAD_TYPE_WORLDSTATE:
+            return Decode(*(WorldState*)data, buffer, size);
+        case PAYLOAD_TYPE_USERINPUT:
+            return DecodeInput(*(UserInput*)data, buffer, size);
+        case PAYLOAD_TYPE_PING:
+        case PAYLOAD_TYPE_PONG:
+            return Decode(*(ClockPing*)data, buffer, size);
+        case PAYLOAD_TYPE_STATEHASH:
+            return Decode(*(StateHash*)data, buffer, size);
+        default:
+            return false;
+    }
+}
+
+uint64_t
+WireHashState(WorldState& state)
+{
+    WireHasher hasher;
+    hasher.Field(state);
+    return hasher.Hash();
+}
+
+void
+WireEncodeHeader(uint8_t* buffer, PayloadType type, unsigned bodySize)
+{
+    uint8_t wireType = (uint8_t) type;
+    uint8_t version = WIRE_PROTOCOL_VERSION;
+    uint32_t wireSize = bodySize;
+
+    WireWriter writer(buffer, WIRE_HEADER_SIZE);
+    writer.Field(wireType);
+    writer.Field(version);
+    writer.Field(wireSize);
+    assert(writer.Ok());
+}
+
+bool
+WireDecodeHeader(const uint8_t* buffer, PayloadType& type, unsigned& bodySize)
+{
+    uint8_t wireType, version;
+    uint32_t wireSize;
+
+    WireReader reader(buffer, WIRE_HEADER_SIZE);
+    reader.Field(wireType);
+    reader.Field(version);
+    reader.Field(wireSize);
+
+    // Reject anything we can't make sense of
+    if (!reader.Ok() || version != WIRE_PROTOCOL_VERSION)
+        return false;
+    if (wireType == PAYLOAD_TYPE_NONE || wireType >= PAYLOAD_TYPE_COUNT)
+        return false;
+    if (wireSize > WIRE_MAX_MESSAGE_SIZE)
+        return false;
+
+    type = (PayloadType) wireType;
+    bodySize = wireSize;
+    return true;
+}
@@ -0,0 +1,392 @@
+#ifndef WIREFORMAT_H
+#define WIREFORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/*
+ * Portable wire format.
+ *
+ * Everything we put on the network is encoded explicitly, field by field,
+ * in little-endian byte order. We never memcpy structs onto the wire, so
+ * the compiler's struct packing and the host's byte order don't matter.
+ *
+ * Each message type describes its layout exactly once, as a WireSchema()
+ * template over an archive (see WireFormat.cpp). Instantiating the schema
+ * with WireWriter, WireReader and WireSizer generates the encoder, the
+ * decoder and the size computation for that message at compile time.
+ * WireHasher reuses the same schemas to hash a message's canonical form.
+ */
+
+// Version of the message schemas. Bump this whenever a schema changes.
+#define WIRE_PROTOCOL_VERSION 4
+
+// Frame header: type (1 byte), version (1 byte), body size (4 bytes)
+#define WIRE_HEADER_SIZE 6
+
+// Largest message body we'll accept
+#define WIRE_MAX_MESSAGE_SIZE 16384
+
+typedef enum {
+    PAYLOAD_TYPE_NONE = 0,
+    PAYLOAD_TYPE_WORLDSTATE,
+    PAYLOAD_TYPE_USERINPUT,
+    PAYLOAD_TYPE_PING,
+    PAYLOAD_TYPE_PONG,
+    PAYLOAD_TYPE_STATEHASH,
+    PAYLOAD_TYPE_COUNT
+} PayloadType;
+
+/*
+ * Encodes values into a caller-provided buffer.
+ *
+ * Writing past the end of the buffer doesn't crash; it marks the writer
+ * as failed, and Ok() returns false.
+ */
+class WireWriter {
+
+    public:
+
+    WireWriter(uint8_t* buffer, unsigned capacity) : mBuffer(buffer)
+                                                   , mCapacity(capacity)
+                                                   , mSize(0)
+                                                   , mFailed(false) {};
+
+    void Field(uint8_t& v) { PutBytes(v, 1); };
+    void Field(uint16_t& v) { PutBytes(v, 2); };
+    void Field(uint32_t& v) { PutBytes(v, 4); };
+    void Field(uint64_t& v) { PutBytes(v, 8); };
+    void Field(int32_t& v) { PutBytes((uint32_t)v, 4); };
+    void Field(bool& v) { PutBytes(v ? 1 : 0, 1); };
+    void Field(float& v);
+    void Field(double& v);
+
+    // Compound fields are described by their own schema
+    template <typename T> void Field(T& compound) { WireSchema(*this, compound); };
+
+    // Variable-length array. Only the first count items go on the wire.
+    template <typename T, typename N>
+    void Array(T* items, N& count, unsigned maxCount);
+    template <typename T, typename N>
+    void Array(std::vector<T>& items, N& count, unsigned maxCount);
+
+    // Number of bytes written
+    unsigned Size() { return mSize; };
+
+    // Did everything fit?
+    bool Ok() { return !mFailed; };
+
+    protected:
+
+    void PutBytes(uint64_t v, unsigned numBytes);
+
+    uint8_t* mBuffer;
+    unsigned mCapacity;
+    unsigned mSize;
+    bool mFailed;
+};
+
+/*
+ * Decodes values from a buffer.
+ *
+ * Reading past the end of the buffer, or an array count above its maximum,
+ * marks the reader as failed. Failed readers produce zeros.
+ */
+class WireReader {
+
+    public:
+
+    WireReader(const uint8_t* buffer, unsigned size) : mBuffer(buffer)
+                                                     , mSize(size)
+                                                     , mOffset(0)
+                                                     , mFailed(false) {};
+
+    void Field(uint8_t& v) { v = (uint8_t) GetBytes(1); };
+    void Field(uint16_t& v) { v = (uint16_t) GetBytes(2); };
+    void Field(uint32_t& v) { v = (uint32_t) GetBytes(4); };
+    void Field(uint64_t& v) { v = GetBytes(8); };
+    void Field(int32_t& v) { v = (int32_t)(uint32_t) GetBytes(4); };
+    void Field(bool& v) { v = GetBytes(1) != 0; };
+    void Field(float& v);
+    void Field(double& v);
+
+    template <typename T> void Field(T& compound) { WireSchema(*this, compound); };
+
+    // Arrays decoded into a vector resize it to fit
+    template <typename T, typename N>
+    void Array(T* items, N& count, unsigned maxCount);
+    template <typename T, typename N>
+    void Array(std::vector<T>& items, N& count, unsigned maxCount);
+
+    // Number of bytes consumed
+    unsigned Offset() { return mOffset; };
+
+    // Did we decode successfully, consuming the whole buffer?
+    bool Ok() { return !mFailed && mOffset == mSize; };
+
+    protected:
+
+    uint64_t GetBytes(unsigned numBytes);
+
+    const uint8_t* mBuffer;
+    unsigned mSize;
+    unsigned mOffset;
+    bool mFailed;
+};
+
+/*
+ * Computes the encoded size of a message without writing it.
+ */
+class WireSizer {
+
+    public:
+
+    WireSizer() : mSize(0) {};
+
+    void Field(uint8_t&) { mSize += 1; };
+    void Field(uint16_t&) { mSize += 2; };
+    void Field(uint32_t&) { mSize += 4; };
+    void Field(uint64_t&) { mSize += 8; };
+    void Field(int32_t&) { mSize += 4; };
+    void Field(bool&) { mSize += 1; };
+    void Field(float&) { mSize += 4; };
+    void Field(double&) { mSize += 4; };
+
+    template <typename T> void Field(T& compound) { WireSchema(*this, compound); };
+
+    template <typename T, typename N>
+    void Array(T* items, N& count, unsigned /* maxCount */)
+    {
+        mSize += 2;
+        for (unsigned i = 0; i < (unsigned) count; ++i)
+            Field(items[i]);
+    };
+    template <typename T, typename N>
+    void Array(std::vector<T>& items, N& count, unsigned maxCount)
+    { Array(items.empty() ? (T*) NULL : &items[0], count, maxCount); };
+
+    unsigned Size() { return mSize; };
+
+    protected:
+
+    unsigned mSize;
+};
+
+/*
+ * Hashes the fields of a message, exactly as they'd go on the wire, without
+ * writing them anywhere. Two messages that encode the same hash the same,
+ * regardless of padding or the host.
+ */
+class WireHasher {
+
+    public:
+
+    WireHasher() : mHash(0xcbf29ce484222325ULL) {};
+
+    void Field(uint8_t& v) { Mix(v); };
+    void Field(uint16_t& v) { Mix(v); };
+    void Field(uint32_t& v) { Mix(v); };
+    void Field(uint64_t& v) { Mix(v); };
+    void Field(int32_t& v) { Mix((uint32_t) v); };
+    void Field(bool& v) { Mix(v ? 1 : 0); };
+    void Field(float& v);
+    void Field(double& v) { float narrowed = (float) v; Field(narrowed); };
+
+    template <typename T> void Field(T& compound) { WireSchema(*this, compound); };
+
+    template <typename T, typename N>
+    void Array(T* items, N& count, unsigned /* maxCount */)
+    {
+        Mix((uint64_t) count);
+        for (unsigned i = 0; i < (unsigned) count; ++i)
+            Field(items[i]);
+    };
+    template <typename T, typename N>
+    void Array(std::vector<T>& items, N& count, unsigned maxCount)
+    { Array(items.empty() ? (T*) NULL : &items[0], count, maxCount); };
+
+    // The finished hash
+    uint64_t Hash();
+
+    protected:
+
+    // One FNV-style round per field, on the whole word at once
+    void Mix(uint64_t v) { mHash = (mHash ^ v) * 0x100000001b3ULL; };
+
+    uint64_t mHash;
+};
+
+/*
+ * Inline helpers.
+ */
+
+inline void
+WireWriter::PutBytes(uint64_t v, unsigned numBytes)
+{
+    if (mFailed || mSize + numBytes > mCapacity) {
+        mFailed = true;
+        return;
+    }
+    for (unsigned i = 0; i < numBytes; ++i)
+        mBuffer[mSize++] = (uint8_t)(v >> (8 * i));
+}
+
+inline void
+WireWriter::Field(float& v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    PutBytes(bits, 4);
+}
+
+inline void
+WireWriter::Field(double& v)
+{
+    // Doubles only show up when Bullet is built with double precision. We
+    // narrow them so that both kinds of build speak the same protocol.
+    float narrowed = (float) v;
+    Field(narrowed);
+}
+
+inline void
+WireHasher::Field(float& v)
+{
+    // Zero compares equal to negative zero, so it should hash the same
+    float canonical = (v == 0.0f) ? 0.0f : v;
+    uint32_t bits;
+    memcpy(&bits, &canonical, sizeof(bits));
+    Mix(bits);
+}
+
+inline uint64_t
+WireHasher::Hash()
+{
+    // Finish with a full avalanche, so that nearby states hash far apart
+    uint64_t h = mHash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+template <typename T, typename N>
+void
+WireWriter::Array(T* items, N& count, unsigned maxCount)
+{
+    if ((unsigned) count > maxCount || maxCount > 0xFFFF) {
+        mFailed = true;
+        return;
+    }
+    uint16_t wireCount = (uint16_t) count;
+    Field(wireCount);
+    for (unsigned i = 0; i < wireCount; ++i)
+        Field(items[i]);
+}
+
+template <typename T, typename N>
+void
+WireWriter::Array(std::vector<T>& items, N& count, unsigned maxCount)
+{
+    if ((unsigned) count > items.size()) {
+        mFailed = true;
+        return;
+    }
+    Array(items.empty() ? (T*) NULL : &items[0], count, maxCount);
+}
+
+inline uint64_t
+WireReader::GetBytes(unsigned numBytes)
+{
+    if (mFailed || mOffset + numBytes > mSize) {
+        mFailed = true;
+        return 0;
+    }
+    uint64_t v = 0;
+    for (unsigned i = 0; i < numBytes; ++i)
+        v |= ((uint64_t) mBuffer[mOffset++]) << (8 * i);
+    return v;
+}
+
+inline void
+WireReader::Field(float& v)
+{
+    uint32_t bits = (uint32_t) GetBytes(4);
+    memcpy(&v, &bits, sizeof(v));
+}
+
+inline void
+WireReader::Field(double& v)
+{
+    float narrowed;
+    Field(narrowed);
+    v = narrowed;
+}
+
+template <typename T, typename N>
+void
+WireReader::Array(T* items, N& count, unsigned maxCount)
+{
+    uint16_t wireCount;
+    Field(wireCount);
+    if (wireCount > maxCount) {
+        mFailed = true;
+        count = 0;
+        return;
+    }
+    count = (N) wireCount;
+    for (unsigned i = 0; i < wireCount; ++i)
+        Field(items[i]);
+}
+
+template <typename T, typename N>
+void
+WireReader::Array(std::vector<T>& items, N& count, unsigned maxCount)
+{
+    uint16_t wireCount;
+    Field(wireCount);
+    if (wireCount > maxCount) {
+        mFailed = true;
+        count = 0;
+        return;
+    }
+    items.resize(wireCount);
+    count = (N) wireCount;
+    for (unsigned i = 0; i < wireCount; ++i)
+        Field(items[i]);
+}
+
+/*
+ * Message-level entry points, implemented in WireFormat.cpp.
+ */
+
+/*
+ * Encodes the in-memory message for a payload type into buffer. Returns the
+ * number of bytes written, or 0 if the message didn't fit.
+ */
+unsigned WireEncodePayload(PayloadType type, void* data,
+                           uint8_t* buffer, unsigned capacity);
+
+/*
+ * Decodes a message body into data, which must point to a constructed
+ * in-memory message of the given type. Returns false on malformed input.
+ */
+bool WireDecodePayload(PayloadType type, const uint8_t* buffer,
+                       unsigned size, void* data);
+
+/*
+ * Hashes a world state's canonical encoding.
+ */
+struct WorldState;
+uint64_t WireHashState(WorldState& state);
+
+/*
+ * Frame headers.
+ */
+void WireEncodeHeader(uint8_t* buffer, PayloadType type, unsigned bodySize);
+bool WireDecodeHeader(const uint8_t* buffer, PayloadType& type,
+                      unsigned& bodySize);
+
+#endif /* WIREFORMAT_H */
@@ -0,0 +1,209 @@
+#include "WorldBatch.h"
+#include "UserInput.h"
+
+// Begin bits of an input bitfield
+#define WORLDBATCH_BEGIN_BITS 0x55555555
+
+// Where in a player's observations the standing flag goes
+#define WORLDBATCH_OBS_STANDING 7
+
+WorldBatch::WorldBatch(unsigned numWorlds, unsigned playersPerWorld,
+                       unsigned numThreads) : mNumWorlds(numWorlds)
+                                            , mPlayersPerWorld(playersPerWorld)
+                                            , mObservations(numWorlds * playersPerWorld *
+                                                            WORLDBATCH_OBS_PER_PLAYER)
+                                            , mRewards(numWorlds * playersPerWorld)
+                                            , mDones(numWorlds)
+                                            , mActions(NULL)
+                                            , mGeneration(0)
+                                            , mNextWorld(0)
+                                            , mNumFinished(0)
+                                            , mStopping(false)
+{
+    // Set up the worlds, and remember how they start
+    for (unsigned i = 0; i < numWorlds; ++i) {
+        Slot* slot = new Slot;
+        slot->world.InitHeadless();
+        for (unsigned playerID = 1; playerID <= playersPerWorld; ++playerID)
+            slot->world.AddPlayer(playerID);
+        slot->world.GetState(slot->start);
+        slot->world.TakeSnapshot(slot->startSnapshot);
+        slot->world.GetState(slot->state);
+        slot->events.reserve(16);
+        slot->episodeTicks = 0;
+        mSlots.push_back(slot);
+        Observe(i);
+    }
+
+    // The calling thread is one of the threads
+    for (unsigned i = 1; i < numThreads; ++i) {
+        sf::Thread* worker = new sf::Thread(&WorldBatch::WorkerEntry, this);
+        worker->Launch();
+        mWorkers.push_back(worker);
+    }
+}
+
+WorldBatch::~WorldBatch()
+{
+    mStopping = true;
+    for (unsigned i = 0; i < mWorkers.size(); ++i) {
+        mWorkers[i]->Wait();
+        delete mWorkers[i];
+    }
+
+    for (unsigned i = 0; i < mSlots.size(); ++i)
+        delete mSlots[i];
+}
+
+void
+WorldBatch::SetPhysicsBackend(PhysicsBackend backend)
+{
+    for (unsigned i = 0; i < mNumWorlds; ++i)
+        mSlots[i]->world.SetPhysicsBackend(backend);
+}
+
+void
+WorldBatch::Reset()
+{
+    for (unsigned i = 0; i < mNumWorlds; ++i) {
+        ResetWorld(i);
+        mDones[i] = 0;
+    }
+}
+
+void
+WorldBatch::Step(const uint32_t* actions)
+{
+    // Hand out the work
+    mActions = actions;
+    mNextWorld = 0;
+    mNumFinished = 0;
+    __sync_synchronize();
+    __sync_add_and_fetch(&mGeneration, 1);
+
+    // Do our share, then wait for everyone else
+    StepClaimedWorlds();
+    while (mNumFinished < mWorkers.size())
+        ;
+    __sync_synchronize();
+}
+
+void
+WorldBatch::WorkerEntry(void* batch)
+{
+    ((WorldBatch*)batch)->WorkerLoop();
+}
+
+void
+WorldBatch::WorkerLoop()
+{
+    unsigned seen = 0;
+    while (true) {
+
+        // Wait for a step. Steps usually come back to back, so spin for a
+        // bit before sleeping.
+        unsigned spins = 0;
+        while (mGeneration == seen && !mStopping) {
+            if (++spins > WORLDBATCH_SPINS)
+                sf::Sleep(0.0001f);
+        }
+        if (mStopping)
+            return;
+        seen = mGeneration;
+        __sync_synchronize();
+
+        StepClaimedWorlds();
+        __sync_fetch_and_add(&mNumFinished, 1);
+    }
+}
+
+void
+WorldBatch::StepClaimedWorlds()
+{
+    unsigned index;
+    while ((index = __sync_fetch_and_add(&mNextWorld, 1)) < mNumWorlds)
+        StepWorld(index);
+}
+
+void
+WorldBatch::StepWorld(unsigned index)
+{
+    Slot& slot = *mSlots[index];
+    WorldModel& world = slot.world;
+
+    // Hold down what we're told to
+    const uint32_t* actions = mActions + index * mPlayersPerWorld;
+    for (unsigned i = 0; i < mPlayersPerWorld; ++i)
+        world.GetPlayer(i + 1)->SetActiveInputs(actions[i] & WORLDBATCH_BEGIN_BITS);
+
+    world.SingleStep();
+    ++slot.episodeTicks;
+
+    // Nobody listens for sounds here, but the log still has to be drained
+    world.GetEvents().Collect(world.GetCurrentTimestamp(), slot.events);
+    slot.events.clear();
+
+    // Who fell this tick?
+    float* rewards = &mRewards[index * mPlayersPerWorld];
+    const float* standingFlags = &mObservations[index * mPlayersPerWorld *
+                                                WORLDBATCH_OBS_PER_PLAYER +
+                                                WORLDBATCH_OBS_STANDING];
+    for (unsigned i = 0; i < mPlayersPerWorld; ++i)
+        rewards[i] = -standingFlags[i * WORLDBATCH_OBS_PER_PLAYER];
+    unsigned standing = Observe(index);
+    for (unsigned i = 0; i < mPlayersPerWorld; ++i)
+        rewards[i] += standingFlags[i * WORLDBATCH_OBS_PER_PLAYER];
+
+    // Is the episode over?
+    bool done = standing == 0 || (mPlayersPerWorld > 1 && standing <= 1) ||
+                slot.episodeTicks >= WORLDBATCH_MAX_EPISODE_TICKS;
+    mDones[index] = done;
+    if (!done)
+        return;
+
+    // Crown the winner, and start again
+    if (mPlayersPerWorld > 1 && standing == 1)
+        for (unsigned i = 0; i < mPlayersPerWorld; ++i)
+            if (standingFlags[i * WORLDBATCH_OBS_PER_PLAYER] > 0.0f)
+                rewards[i] += 1.0f;
+    ResetWorld(index);
+}
+
+void
+WorldBatch::ResetWorld(unsigned index)
+{
+    Slot& slot = *mSlots[index];
+    if (!slot.world.RestoreSnapshot(slot.start, slot.startSnapshot))
+        slot.world.SetState(slot.start);
+    slot.episodeTicks = 0;
+    Observe(index);
+}
+
+unsigned
+WorldBatch::Observe(unsigned index)
+{
+    Slot& slot = *mSlots[index];
+    slot.world.GetState(slot.state);
+
+    // Players are in the order they joined, which is ID order
+    float* out = &mObservations[index * mPlayersPerWorld * WORLDBATCH_OBS_PER_PLAYER];
+    unsigned standing = 0;
+    for (unsigned i = 0; i < mPlayersPerWorld; ++i) {
+        const PlayerInfo& info = slot.state.playerArray[i];
+        const btVector3& position = info.transform.getOrigin();
+        bool wasStanding = slot.episodeTicks == 0 ||
+                           out[WORLDBATCH_OBS_STANDING] > 0.0f;
+        bool isStanding = wasStanding && position.y() >= WORLDBATCH_FALL_HEIGHT;
+        out[0] = position.x();
+        out[1] = position.y();
+        out[2] = position.z();
+        out[3] = info.linearVel.x();
+        out[4] = info.linearVel.y();
+        out[5] = info.linearVel.z();
+        out[6] = info.scale;
+        out[WORLDBATCH_OBS_STANDING] = isStanding ? 1.0f : 0.0f;
+        standing += isStanding;
+        out += WORLDBATCH_OBS_PER_PLAYER;
+    }
+    return standing;
+}
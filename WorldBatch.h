@@ -0,0 +1,161 @@
+#ifndef WORLDBATCH_H
+#define WORLDBATCH_H
+
+#include "WorldModel.h"
+#include "GameEvents.h"
+#include <vector>
+#include <stdint.h>
+
+/*
+ * Batched worlds, for training and evaluating bots.
+ *
+ * Holds a fixed number of identical headless worlds and steps them all at
+ * once. Each step takes one action per player per world, spreads the worlds
+ * over a pool of threads, and fills flat arrays of observations, rewards
+ * and episode ends that can be handed straight to a learner. Everything is
+ * allocated up front, so stepping doesn't allocate.
+ *
+ * Actions are bitfields of held inputs, built with
+ * GEN_INPUT_MASK(index, true). End bits are ignored.
+ *
+ * For each player, the observation is WORLDBATCH_OBS_PER_PLAYER floats:
+ * position, linear velocity, scale, and 1 if they're still on the
+ * platform or 0 if they've fallen. A player falls, as in the game, when
+ * they drop below WORLDBATCH_FALL_HEIGHT. A player is rewarded -1 on the
+ * step they fall, and the last one standing +1. An episode ends when at
+ * most one player is left standing (none, for single-player worlds), or
+ * after WORLDBATCH_MAX_EPISODE_TICKS.
+ *
+ * Worlds whose episode ended are put back to the start right away, so the
+ * rewards and episode ends describe the step just taken, but those worlds'
+ * observations are of the start of the next episode.
+ *
+ * Bullet's built-in profiler isn't thread safe, so running more than one
+ * thread needs a Bullet built with BT_NO_PROFILE.
+ */
+
+// Floats per player in the observations
+#define WORLDBATCH_OBS_PER_PLAYER 8
+
+// Players below this height have fallen off (see Game.cpp)
+#define WORLDBATCH_FALL_HEIGHT 1.0f
+
+// Longest an episode lasts (three minutes)
+#define WORLDBATCH_MAX_EPISODE_TICKS 5625
+
+// Times an idle thread checks for work before it starts sleeping
+#define WORLDBATCH_SPINS 4096
+
+class WorldBatch {
+
+    public:
+
+    /*
+     * Constructor. Sets up numWorlds worlds of playersPerWorld players
+     * each, stepped by numThreads threads (the calling thread included).
+     */
+    WorldBatch(unsigned numWorlds, unsigned playersPerWorld, unsigned numThreads);
+
+    /*
+     * Destructor. Stops the threads.
+     */
+    ~WorldBatch();
+
+    /*
+     * Chooses what steps the players in every world (see
+     * WorldModel::SetPhysicsBackend()).
+     */
+    void SetPhysicsBackend(PhysicsBackend backend);
+
+    /*
+     * Puts every world back to the start of an episode.
+     */
+    void Reset();
+
+    /*
+     * Steps every world by one tick. actions holds
+     * GetNumWorlds() * GetPlayersPerWorld() bitfields, world by world.
+     */
+    void Step(const uint32_t* actions);
+
+    /*
+     * Results of the last step. Observations hold WORLDBATCH_OBS_PER_PLAYER
+     * floats per player, rewards one per player, and episode ends one per
+     * world, all world by world.
+     */
+    const float* GetObservations() { return &mObservations[0]; };
+    const float* GetRewards() { return &mRewards[0]; };
+    const uint8_t* GetDones() { return &mDones[0]; };
+
+    unsigned GetNumWorlds() { return mNumWorlds; };
+    unsigned GetPlayersPerWorld() { return mPlayersPerWorld; };
+    unsigned GetNumThreads() { return mWorkers.size() + 1; };
+
+    protected:
+
+    /*
+     * A world, and what we need to run episodes in it.
+     */
+    struct Slot {
+
+        WorldModel world;
+
+        // The start of an episode
+        WorldState start;
+        PhysicsSnapshot startSnapshot;
+
+        // Scratch space
+        WorldState state;
+        std::vector<GameEvent> events;
+
+        // Ticks into the current episode
+        unsigned episodeTicks;
+    };
+
+    /*
+     * Thread body.
+     */
+    static void WorkerEntry(void* batch);
+    void WorkerLoop();
+
+    /*
+     * Steps worlds until there are none left to claim.
+     */
+    void StepClaimedWorlds();
+
+    /*
+     * Steps one world, and writes its results.
+     */
+    void StepWorld(unsigned index);
+
+    /*
+     * Puts one world back to the start, and writes its observations.
+     */
+    void ResetWorld(unsigned index);
+
+    /*
+     * Writes a world's observations. Returns the number of players still
+     * standing.
+     */
+    unsigned Observe(unsigned index);
+
+    unsigned mNumWorlds;
+    unsigned mPlayersPerWorld;
+    std::vector<Slot*> mSlots;
+
+    // Results, world by world
+    std::vector<float> mObservations;
+    std::vector<float> mRewards;
+    std::vector<uint8_t> mDones;
+
+    // Threads. Each step bumps the generation, and threads claim worlds
+    // one at a time until they run out.
+    std::vector<sf::Thread*> mWorkers;
+    const uint32_t* mActions;
+    volatile unsigned mGeneration;
+    volatile unsigned mNextWorld;
+    volatile unsigned mNumFinished;
+    volatile bool mStopping;
+};
+
+#endif /* WORLDBATCH_H */
@@ -1,7 +1,10 @@
 #include "WorldModel.h"
 #include "UserInput.h"
+#include "WireFormat.h"
+#include <bullet/LinearMath/btTransformUtil.h>
 #include <string>
 #include <sstream>
+#include <algorithm>
 
 using std::vector;
 using std::string;
@@ -28,31 +31,39 @@ static void MoveRigidBody(btRigidBody* body, float x, float y, float z)
     body->setWorldTransform(transform);
 }
 
+/*
+ * PlayerTable methods.
+ */
+
+const unsigned PlayerTable::NO_SLOT;
+
+unsigned
+PlayerTable::Add(Player* player, btRigidBody* body, btCollisionShape* shape)
+{
+    unsigned slot = Size();
+    players.push_back(player);
+    bodies.push_back(body);
+    shapes.push_back(shape);
+    activeInputs.push_back(player->GetActiveInputs());
+    activeFalconInputs.push_back(player->GetActiveFalconInputs());
+    scales.push_back(shape->getLocalScaling().x());
+
+    // Player IDs are handed out sequentially, so this stays small
+    unsigned playerID = player->GetPlayerID();
+    if (playerID >= slotByID.size())
+        slotByID.resize(playerID + 1, NO_SLOT);
+    slotByID[playerID] = slot;
+    return slot;
+}
+
+/*
+ * WorldModel methods.
+ */
+
 void
 WorldModel::Init(SceneGraph& sceneGraph)
 {
     
-    // Load sound file into sound buffer, sound cannot be used for music
-    if (!Buffer.LoadFromFile("scenefiles/bounce.wav"))
-    {
-        std::cout << "Error loading sound file\n";
-    }
-    // Bind sound buffer to sound
-    Sound.SetBuffer(Buffer);
-    //Sound.SetLoop(true);
-    //Sound.SetPitch(1.5f);
-    Sound.SetVolume(50.f);
-    
-    if (!Buffer2.LoadFromFile("scenefiles/ding.wav"))
-    {
-        std::cout << "Error loading sound file\n";
-    }
-    // Bind sound buffer to sound
-    Sound2.SetBuffer(Buffer2);
-    //Sound.SetLoop(true);
-    //Sound.SetPitch(1.5f);
-    Sound2.SetVolume(100.f);
-    
     // Save parameters
     mSceneGraph = &sceneGraph;
     
@@ -104,12 +115,28 @@ WorldModel::Init(SceneGraph& sceneGraph)
     sceneGraph.FindMesh("Armadillo_0")->EnvironmentMap(emapPos);
      */
 
+    InitPhysics();
+}
+
+void
+WorldModel::InitHeadless()
+{
+    mSceneGraph = NULL;
+    for (int i = 0; i < 5; ++i)
+        platformNodes[i] = NULL;
+
+    InitPhysics();
+}
+
+void
+WorldModel::InitPhysics()
+{
+
     // Setup physics simulation
     broadphase = new btDbvtBroadphase();
 
     collisionConfiguration = new btDefaultCollisionConfiguration();
     dispatcher = new btCollisionDispatcher(collisionConfiguration);
-    worldModels[dispatcher] = this;
 
     solver = new btSequentialImpulseConstraintSolver;
 
@@ -131,6 +158,8 @@ WorldModel::Init(SceneGraph& sceneGraph)
         platformRigidBodyCI.m_friction = 0.5;
         platformRigidBodyCI.m_restitution = 0.1;
         btRigidBody* platformRigidBody = new btRigidBody(platformRigidBodyCI);
+        platformRigidBody->setUserPointer(ContactTag(CONTACT_KIND_RING, i));
+        mContacts.Watch(platformRigidBody);
         dynamicsWorld->addRigidBody(platformRigidBody);
         platformRigidBodies.push_back(platformRigidBody);
         ringRadius -= 3.0;
@@ -153,13 +182,11 @@ WorldModel::~WorldModel()
 
     // Destroy physics simulation
     // Destroy players
-    for(unsigned i = 0; i < mPlayers.size(); ++i) {
-        Player *player = mPlayers[i];
-        assert(player);
-        btRigidBody *playerRigidBody = mPlayerRigidBodies[player];
+    for(unsigned i = 0; i < mPlayerTable.Size(); ++i) {
+        btRigidBody *playerRigidBody = mPlayerTable.bodies[i];
         dynamicsWorld->removeRigidBody(playerRigidBody);
         delete playerRigidBody;
-        delete mPlayerShapes[player];
+        delete mPlayerTable.shapes[i];
     }
 
     // Destroy platform
@@ -192,81 +219,221 @@ WorldModel::Step(unsigned numTicks)
 void
 WorldModel::SingleStep()
 {
+    // Inputs only change between steps
+    RefreshPlayerTable();
+
+    // In deterministic mode, a tick starts from the bodies alone, so that it
+    // comes out the same whether we got here straight or by rewinding
+    if (mDeterministic && mBackend == PHYSICS_BACKEND_BULLET)
+        ResetCollisionCaches();
+
+    // Collect this tick's contacts as Bullet finds them
+    mContacts.BeginTick();
+    mContacts.SetActive(true);
+
     // BOF step physics
     for (unsigned i = 0; i < BULLET_STEPS_PER_GROWBLE_STEP; ++i) {
-        for(unsigned j = 0; j < mPlayers.size(); ++j)
-            HandleInputForPlayer(mPlayers[j]->GetPlayerID());
-        dynamicsWorld->stepSimulation(BULLET_STEP_INTERVAL, 1, BULLET_STEP_INTERVAL);
-        
-        // Determine if a collision has taken place
-        int numManifolds = dispatcher->getNumManifolds();
-        for (int i=0;i<numManifolds;i++)
-        {
-            btPersistentManifold* contactManifold =  dispatcher->getManifoldByIndexInternal(i);
-            btCollisionObject* obA = static_cast<btCollisionObject*>(contactManifold->getBody0());
-            btCollisionObject* obB = static_cast<btCollisionObject*>(contactManifold->getBody1());
-            
-            int numContacts = contactManifold->getNumContacts();
-            for (int j=0;j<numContacts;j++)
-            {
-                btManifoldPoint& pt = contactManifold->getContactPoint(j);
-                if (pt.getDistance()<1)
-                {
-                    // If both collision shapes are 'SPHERE'
-                    if (!strcmp(obA->getCollisionShape()->getName(), obB->getCollisionShape()->getName())) {
-                        
-                        // A collision just happened
-                        DPS("COLLISION");
-                        DPF(pt.getDistance());
-                        
-                        sf::Sound::Status Status = Sound.GetStatus();
-                        if (Status != sf::Sound::Playing) Sound.Play();
-                    }
-                    //const btVector3& ptA = pt.getPositionWorldOnA();
-                    //const btVector3& ptB = pt.getPositionWorldOnB();
-                    //const btVector3& normalOnB = pt.m_normalWorldOnB;
-                }
-            }
+        for(unsigned slot = 0; slot < mPlayerTable.Size(); ++slot)
+            HandleInputForSlot(slot);
+        if (mBackend == PHYSICS_BACKEND_SPHERES)
+            StepSpheres(BULLET_STEP_INTERVAL);
+        else {
+            dynamicsWorld->stepSimulation(BULLET_STEP_INTERVAL, 1, BULLET_STEP_INTERVAL);
+            mContacts.AddImpulses(dispatcher);
         }
-        // EOF Determine if a collision has taken place
     }
-    
-    
+    mContacts.SetActive(false);
+
+    // Players who've just run into each other bounce
+    EmitBounces();
     
     // Loop over players
-    for(unsigned i = 0; i < mPlayers.size(); ++i){
-        Player *player = mPlayers[i];
-        assert(player);
-        btTransform trans = mPlayerRigidBodies[player]->getWorldTransform();
-        player->setTransform(trans);
-        HandleKinematicInputForPlayer(player->GetPlayerID());
-    }
+    for(unsigned slot = 0; slot < mPlayerTable.Size(); ++slot)
+        HandleKinematicInputForSlot(slot);
 
     // update platform position
+    int oldDropState = platform->getDropState();
     platform->update();
+    if (platform->getDropState() != oldDropState) {
+        if (platform->getDropState() == BLINKING)
+            mEvents.Emit(GameEvent(mCurrentTimestamp, GAME_EVENT_RING_WARNING,
+                                   platform->getFallingRing(), 0));
+        else if (platform->getDropState() == FALLING)
+            mEvents.Emit(GameEvent(mCurrentTimestamp, GAME_EVENT_RING_DROP,
+                                   platform->getFallingRing(), 0));
+    }
 
     // move the platform rigid bodies along with the rings
     int fallingRing = platform->getFallingRing();
     //std::cout << "falling ring: " << fallingRing << "\n";
     float fallingRingPos = platform->getFallingRingPos();
     MoveRigidBody(platformRigidBodies[fallingRing], 0.0, fallingRingPos+1.0, 0.0);
-    
-    // Move the platform ring meshes
-    Matrix transform;
-    transform.Translate(0, fallingRingPos, 0);
-    //btMatrix3x3 rotation(trans.getRotation());
-    //Matrix ourRotation(rotation);
-    //transform = transform.MMProduct(ourRotation);
-    platformNodes[fallingRing]->SetTransform(transform);
 
     // Update the current timestamp
     mCurrentTimestamp += 1;
+    RecordStateHash();
+}
+
+void
+WorldModel::StepSpheres(float dt)
+{
+    unsigned numPlayers = mPlayerTable.Size();
+    mSpheres.Resize(numPlayers);
+    mSpheres.SetGravity(dynamicsWorld->getGravity().y());
+
+    // The rings, where they are right now
+    mSpheres.SetNumRings(platformRigidBodies.size());
+    for (unsigned i = 0; i < platformRigidBodies.size(); ++i) {
+        btRigidBody* ring = platformRigidBodies[i];
+        btVector3 halfExtents =
+            static_cast<btCylinderShape*>(platformShapes[i])->getHalfExtentsWithMargin();
+        mSpheres.SetRing(i, halfExtents.x(),
+                         ring->getWorldTransform().getOrigin().y() + halfExtents.y(),
+                         ring->getFriction(), ring->getRestitution());
+    }
+
+    // The players. They're all made of the same stuff.
+    if (numPlayers) {
+        btRigidBody* body = mPlayerTable.bodies[0];
+        mSpheres.SetSphereMaterial(body->getFriction(), body->getRestitution(),
+                                   body->getAngularDamping());
+    }
+    for (unsigned slot = 0; slot < numPlayers; ++slot) {
+        btRigidBody* body = mPlayerTable.bodies[slot];
+        const btVector3& position = body->getWorldTransform().getOrigin();
+        const btVector3& linearVel = body->getLinearVelocity();
+        const btVector3& angularVel = body->getAngularVelocity();
+        const btVector3& force = body->getTotalForce();
+        const btVector3& torque = body->getTotalTorque();
+        mSpheres.px[slot] = position.x();
+        mSpheres.py[slot] = position.y();
+        mSpheres.pz[slot] = position.z();
+        mSpheres.vx[slot] = linearVel.x();
+        mSpheres.vy[slot] = linearVel.y();
+        mSpheres.vz[slot] = linearVel.z();
+        mSpheres.wx[slot] = angularVel.x();
+        mSpheres.wy[slot] = angularVel.y();
+        mSpheres.wz[slot] = angularVel.z();
+        mSpheres.fx[slot] = force.x();
+        mSpheres.fy[slot] = force.y();
+        mSpheres.fz[slot] = force.z();
+        mSpheres.tx[slot] = torque.x();
+        mSpheres.ty[slot] = torque.y();
+        mSpheres.tz[slot] = torque.z();
+        mSpheres.radius[slot] = mPlayerTable.scales[slot];
+        mSpheres.invMass[slot] = body->getInvMass();
+        mSpheres.invInertia[slot] = body->getInvInertiaDiagLocal().x();
+        body->clearForces();
+    }
+
+    mSpheres.Step(dt);
+
+    // Write the results back. We don't track orientation, so spin the
+    // bodies the way Bullet would have.
+    for (unsigned slot = 0; slot < numPlayers; ++slot) {
+        btRigidBody* body = mPlayerTable.bodies[slot];
+        btVector3 linearVel(mSpheres.vx[slot], mSpheres.vy[slot], mSpheres.vz[slot]);
+        btVector3 angularVel(mSpheres.wx[slot], mSpheres.wy[slot], mSpheres.wz[slot]);
+        btTransform transform;
+        btTransformUtil::integrateTransform(body->getWorldTransform(), linearVel,
+                                            angularVel, dt, transform);
+        transform.setOrigin(btVector3(mSpheres.px[slot], mSpheres.py[slot],
+                                      mSpheres.pz[slot]));
+        body->setWorldTransform(transform);
+        body->setLinearVelocity(linearVel);
+        body->setAngularVelocity(angularVel);
+    }
+
+    // Report contacts as Bullet's callback would
+    const std::vector<SphereContact>& contacts = mSpheres.GetContacts();
+    for (unsigned i = 0; i < contacts.size(); ++i) {
+        const SphereContact& contact = contacts[i];
+        btRigidBody* other = contact.type == SPHERE_CONTACT_SPHERE ?
+                             mPlayerTable.bodies[contact.other] :
+                             platformRigidBodies[contact.other];
+        void* sphereTag = mPlayerTable.bodies[contact.sphere]->getUserPointer();
+        mContacts.AddContact(sphereTag, other->getUserPointer(), contact.distance);
+        mContacts.AddImpulse(sphereTag, other->getUserPointer(),
+                             contact.nx * contact.impulse,
+                             contact.ny * contact.impulse,
+                             contact.nz * contact.impulse);
+    }
+}
+
+void
+WorldModel::SetDeterministic(bool deterministic)
+{
+    mDeterministic = deterministic;
+    if (!deterministic)
+        return;
+
+    SetDeterministicFloatingPoint();
+
+    // Solve constraints in the order they were added, with a known seed
+    btContactSolverInfo& info = dynamicsWorld->getSolverInfo();
+    info.m_solverMode &= ~SOLVER_RANDMIZE_ORDER;
+    solver->setRandSeed(0);
+
+    RecordStateHash();
+}
+
+void
+WorldModel::RecordStateHash()
+{
+    if (!mDeterministic)
+        return;
+
+    WorldState state;
+    GetState(state);
+    mStateHashes.Record(mCurrentTimestamp, WireHashState(state));
+}
+
+void
+WorldModel::EmitBounces()
+{
+    // Find the pairs of players touching this tick. The list is kept
+    // between ticks so that stepping doesn't allocate.
+    std::vector<std::pair<unsigned, unsigned> >& touching = mTouchingScratch;
+    touching.clear();
+    const std::vector<ContactEvent>& events = mContacts.GetEvents();
+    for (unsigned i = 0; i < events.size(); ++i)
+        if (events[i].type == CONTACT_EVENT_PLAYER_PLAYER)
+            touching.push_back(std::make_pair(events[i].playerID,
+                                              events[i].otherIndex));
+
+    // A bounce is a pair that wasn't touching last tick. Right after a
+    // rewind we don't know who was touching, so we wait a tick.
+    if (mTouchingValid) {
+        for (unsigned i = 0; i < touching.size(); ++i)
+            if (std::find(mTouching.begin(), mTouching.end(), touching[i]) ==
+                mTouching.end())
+                mEvents.Emit(GameEvent(mCurrentTimestamp, GAME_EVENT_BOUNCE,
+                                       touching[i].first, touching[i].second));
+    }
+    mTouching.swap(touching);
+    mTouchingValid = true;
+}
+
+void
+WorldModel::SyncRenderState()
+{
+    // Players
+    for(unsigned slot = 0; slot < mPlayerTable.Size(); ++slot)
+        mPlayerTable.players[slot]->setTransform(mPlayerTable.bodies[slot]->getWorldTransform());
+
+    // Move the platform ring meshes
+    if (!mSceneGraph)
+        return;
+    Matrix transform;
+    transform.Translate(0, platform->getFallingRingPos(), 0);
+    platformNodes[platform->getFallingRing()]->SetTransform(transform);
 }
 
 void
 WorldModel::GetState(WorldState& stateOut)
 {
     // Get the number of players in play
+    assert(mPlayers.size() <= WORLDSTATE_MAX_PLAYERS);
     stateOut.numPlayers = mPlayers.size();
     
     // Get the ID, inputs and position of each of the players
@@ -275,10 +442,10 @@ WorldModel::GetState(WorldState& stateOut)
         playerInfo.playerID = mPlayers[i]->GetPlayerID();
         playerInfo.activeInputs = mPlayers[i]->GetActiveInputs();
         playerInfo.activeFalconInputs = mPlayers[i]->GetActiveFalconInputs();
-        playerInfo.transform = mPlayerRigidBodies[mPlayers[i]]->getWorldTransform();
-        playerInfo.linearVel = mPlayerRigidBodies[mPlayers[i]]->getLinearVelocity();
-        playerInfo.angularVel = mPlayerRigidBodies[mPlayers[i]]->getAngularVelocity();
-        playerInfo.scale = mPlayerShapes[mPlayers[i]]->getLocalScaling().x();
+        playerInfo.transform = mPlayerTable.bodies[i]->getWorldTransform();
+        playerInfo.linearVel = mPlayerTable.bodies[i]->getLinearVelocity();
+        playerInfo.angularVel = mPlayerTable.bodies[i]->getAngularVelocity();
+        playerInfo.scale = mPlayerTable.shapes[i]->getLocalScaling().x();
         stateOut.playerArray[i] = playerInfo;
     }
     
@@ -295,9 +462,8 @@ WorldModel::SetState(WorldState& stateIn)
     // Set the number of players
     unsigned numPlayers = stateIn.numPlayers;
     
-    // Copy the player array
-    PlayerInfo *playerArray = new PlayerInfo[numPlayers];
-    memcpy(playerArray, stateIn.playerArray, numPlayers*sizeof(PlayerInfo));
+    PlayerInfo* playerArray = stateIn.playerArray;
+    assert(numPlayers <= WORLDSTATE_MAX_PLAYERS);
     
     // Set info for each of the players
     for (unsigned i=0; i<numPlayers; i++) {
@@ -307,24 +473,36 @@ WorldModel::SetState(WorldState& stateIn)
             AddPlayer(playerArray[i].playerID);
 
         // Get our local copy of the player
-        Player* player = GetPlayer(playerArray[i].playerID);
+        unsigned slot = mPlayerTable.Slot(playerArray[i].playerID);
+        Player* player = mPlayerTable.players[slot];
+        btRigidBody* body = mPlayerTable.bodies[slot];
 
         // Clean cached broadphase state
         if (dynamicsWorld->getBroadphase()->getOverlappingPairCache())
             dynamicsWorld->getBroadphase()
                          ->getOverlappingPairCache()
-                         ->cleanProxyFromPairs(mPlayerRigidBodies[player]->getBroadphaseHandle(),
+                         ->cleanProxyFromPairs(body->getBroadphaseHandle(),
                                                dynamicsWorld->getDispatcher());
 
         // Physics
-        mPlayerRigidBodies[player]->setWorldTransform(playerArray[i].transform);
-        player->setTransform(playerArray[i].transform);
-        mPlayerRigidBodies[player]->setLinearVelocity(playerArray[i].linearVel);
-        mPlayerRigidBodies[player]->setAngularVelocity(playerArray[i].angularVel);
+        body->setWorldTransform(playerArray[i].transform);
+        body->setLinearVelocity(playerArray[i].linearVel);
+        body->setAngularVelocity(playerArray[i].angularVel);
 
-        //Scale
+        // Scale. If the player has grown or shrunk since, their mass has to
+        // follow, the same way HandleInputForSlot() changes it.
         float scale = playerArray[i].scale;
-        mPlayerShapes[player]->setLocalScaling(btVector3(scale,scale,scale));
+        btCollisionShape* shape = mPlayerTable.shapes[slot];
+        btVector3 scaling(scale, scale, scale);
+        if (shape->getLocalScaling() != scaling) {
+            float mass = PLAYER_MASS_DENSITY * scale*scale*scale;
+            btVector3 inertia(0, 0, 0);
+            shape->calculateLocalInertia(mass, inertia);
+            body->setMassProps(mass, inertia);
+            body->updateInertiaTensor();
+        }
+        shape->setLocalScaling(scaling);
+        mPlayerTable.scales[slot] = scale;
 
         // Active inputs
         player->SetActiveInputs(playerArray[i].activeInputs);
@@ -340,30 +518,270 @@ WorldModel::SetState(WorldState& stateIn)
     // Set the platform state
     platform->SetPlatformState(stateIn.pstate);
 
+    // Whatever happened from here on is up for debate again
     mCurrentTimestamp = stateIn.timestamp;
-    delete playerArray;
+    mEvents.Rewind(mCurrentTimestamp);
+    mTouchingValid = false;
+    RecordStateHash();
+}
+
+void
+WorldModel::TakeSnapshot(PhysicsSnapshot& snapshotOut)
+{
+    snapshotOut.valid = false;
+
+    // Bodies
+    btCollisionObjectArray& objects = dynamicsWorld->getCollisionObjectArray();
+    if (snapshotOut.bodies.size() < (unsigned) objects.size())
+        snapshotOut.bodies.resize(objects.size());
+    snapshotOut.numBodies = objects.size();
+    for (int i = 0; i < objects.size(); ++i) {
+        btCollisionObject* object = objects[i];
+        BodySnapshot& body = snapshotOut.bodies[i];
+        body.worldTransform = object->getWorldTransform();
+        body.interpolationWorldTransform = object->getInterpolationWorldTransform();
+        body.interpolationLinearVel = object->getInterpolationLinearVelocity();
+        body.interpolationAngularVel = object->getInterpolationAngularVelocity();
+        body.localScaling = object->getCollisionShape()->getLocalScaling();
+        body.hitFraction = object->getHitFraction();
+        body.deactivationTime = object->getDeactivationTime();
+        body.activationState = object->getActivationState();
+
+        btRigidBody* rigidBody = btRigidBody::upcast(object);
+        if (rigidBody) {
+            body.linearVel = rigidBody->getLinearVelocity();
+            body.angularVel = rigidBody->getAngularVelocity();
+            body.totalForce = rigidBody->getTotalForce();
+            body.totalTorque = rigidBody->getTotalTorque();
+            body.invInertiaLocal = rigidBody->getInvInertiaDiagLocal();
+        }
+    }
+
+    // Contact caches. Empty manifolds carry nothing worth restoring.
+    snapshotOut.numManifolds = 0;
+    for (int i = 0; i < dispatcher->getNumManifolds(); ++i) {
+        btPersistentManifold* manifold = dispatcher->getManifoldByIndexInternal(i);
+        if (manifold->getNumContacts() == 0)
+            continue;
+        if (snapshotOut.manifolds.size() == (unsigned) snapshotOut.numManifolds)
+            snapshotOut.manifolds.resize(snapshotOut.numManifolds + 1);
+
+        ManifoldSnapshot& cache = snapshotOut.manifolds[snapshotOut.numManifolds++];
+        cache.body0 = objects.findLinearSearch(static_cast<btCollisionObject*>(manifold->getBody0()));
+        cache.body1 = objects.findLinearSearch(static_cast<btCollisionObject*>(manifold->getBody1()));
+        cache.numContacts = manifold->getNumContacts();
+        for (int j = 0; j < cache.numContacts; ++j) {
+            cache.contacts[j] = manifold->getContactPoint(j);
+            cache.contacts[j].m_userPersistentData = NULL;
+        }
+    }
+
+    // Solver
+    snapshotOut.solverSeed = solver->getRandSeed();
+
+    snapshotOut.valid = true;
 }
 
-static float sInitialPositions[][3] = { {-8.0, 5.0, 0.0},
-                                        {-4.0, 5.0, 4.0},
-                                        {4.0, 5.0, -4.0}};
+bool
+WorldModel::RestoreSnapshot(WorldState& state, PhysicsSnapshot& snapshot)
+{
+    // Make sure the snapshot was taken of the world we have now
+    btCollisionObjectArray& objects = dynamicsWorld->getCollisionObjectArray();
+    if (!snapshot.valid || snapshot.numBodies != objects.size() ||
+        state.numPlayers != (int) mPlayers.size()) {
+        mMetrics.Add(METRIC_SNAPSHOT_FALLBACKS);
+        return false;
+    }
+    for (int i = 0; i < state.numPlayers; ++i) {
+        if (!GetPlayer(state.playerArray[i].playerID)) {
+            mMetrics.Add(METRIC_SNAPSHOT_FALLBACKS);
+            return false;
+        }
+    }
+
+    // Bodies
+    for (int i = 0; i < snapshot.numBodies; ++i) {
+        btCollisionObject* object = objects[i];
+        BodySnapshot& body = snapshot.bodies[i];
+        object->setWorldTransform(body.worldTransform);
+        object->setInterpolationWorldTransform(body.interpolationWorldTransform);
+        object->setInterpolationLinearVelocity(body.interpolationLinearVel);
+        object->setInterpolationAngularVelocity(body.interpolationAngularVel);
+        object->setHitFraction(body.hitFraction);
+        object->forceActivationState(body.activationState);
+        object->setDeactivationTime(body.deactivationTime);
+
+        btRigidBody* rigidBody = btRigidBody::upcast(object);
+        if (!rigidBody) {
+            object->getCollisionShape()->setLocalScaling(body.localScaling);
+            continue;
+        }
+
+        // If the player has grown or shrunk since, put their mass back the
+        // same way HandleInputForSlot() changes it.
+        btCollisionShape* shape = object->getCollisionShape();
+        if (rigidBody->getInvMass() != 0 &&
+            shape->getLocalScaling() != body.localScaling) {
+            float scale = body.localScaling.x();
+            float mass = PLAYER_MASS_DENSITY * scale*scale*scale;
+            btVector3 inertia(0, 0, 0);
+            shape->calculateLocalInertia(mass, inertia);
+            rigidBody->setMassProps(mass, inertia);
+        }
+        shape->setLocalScaling(body.localScaling);
+        rigidBody->setInvInertiaDiagLocal(body.invInertiaLocal);
+        rigidBody->updateInertiaTensor();
+
+        rigidBody->setLinearVelocity(body.linearVel);
+        rigidBody->setAngularVelocity(body.angularVel);
+        rigidBody->clearForces();
+        rigidBody->applyCentralForce(body.totalForce);
+        rigidBody->applyTorque(body.totalTorque);
+    }
+
+    // Contact caches. In deterministic mode, the next tick throws them
+    // away before anything looks at them (see SingleStep()). Otherwise we
+    // refill the manifolds the dispatcher already has rather than making
+    // new ones, since the collision algorithms own them. A pair that has
+    // no manifold right now, or none at all because Bullet hasn't found it
+    // yet, starts cold, and the order Bullet visits pairs in isn't restored
+    // either. So this comes close, but isn't exact.
+    if (!mDeterministic) {
+        for (int i = 0; i < dispatcher->getNumManifolds(); ++i)
+            dispatcher->getManifoldByIndexInternal(i)->clearManifold();
+        for (int i = 0; i < snapshot.numManifolds; ++i) {
+            ManifoldSnapshot& cache = snapshot.manifolds[i];
+            btPersistentManifold* manifold = NULL;
+            for (int j = 0; j < dispatcher->getNumManifolds(); ++j) {
+                btPersistentManifold* candidate = dispatcher->getManifoldByIndexInternal(j);
+                if (candidate->getBody0() == objects[cache.body0] &&
+                    candidate->getBody1() == objects[cache.body1]) {
+                    manifold = candidate;
+                    break;
+                }
+            }
+            if (!manifold) {
+                mMetrics.Add(METRIC_SNAPSHOT_CONTACTS_MISSED);
+                continue;
+            }
+            for (int j = 0; j < cache.numContacts; ++j)
+                manifold->addManifoldPoint(cache.contacts[j]);
+        }
+    }
+
+    // Solver
+    solver->setRandSeed(snapshot.solverSeed);
+
+    // Everything outside of Bullet comes from the WorldState
+    for (int i = 0; i < state.numPlayers; ++i) {
+        PlayerInfo& info = state.playerArray[i];
+        unsigned slot = mPlayerTable.Slot(info.playerID);
+        Player* player = mPlayerTable.players[slot];
+        player->SetScale(info.scale);
+        mPlayerTable.scales[slot] = info.scale;
+        player->SetActiveInputs(info.activeInputs);
+        player->SetActiveFalconInputs(info.activeFalconInputs);
+    }
+    platform->SetPlatformState(state.pstate);
+    mCurrentTimestamp = state.timestamp;
+    mEvents.Rewind(mCurrentTimestamp);
+    mTouchingValid = false;
+    RecordStateHash();
+
+    mMetrics.Add(METRIC_SNAPSHOT_RESTORES);
+    return true;
+}
+
+void
+WorldModel::ResetCollisionCaches()
+{
+    // Take every body out of the broadphase, which releases its pairs and
+    // their manifolds, the same way btCollisionWorld does when removing one
+    btCollisionObjectArray& objects = dynamicsWorld->getCollisionObjectArray();
+    btOverlappingPairCache* pairCache = broadphase->getOverlappingPairCache();
+    if (mFilterGroups.size() < (unsigned) objects.size()) {
+        mFilterGroups.resize(objects.size());
+        mFilterMasks.resize(objects.size());
+    }
+    for (int i = 0; i < objects.size(); ++i) {
+        btBroadphaseProxy* proxy = objects[i]->getBroadphaseHandle();
+        mFilterGroups[i] = proxy->m_collisionFilterGroup;
+        mFilterMasks[i] = proxy->m_collisionFilterMask;
+        pairCache->cleanProxyFromPairs(proxy, dispatcher);
+        broadphase->destroyProxy(proxy, dispatcher);
+        objects[i]->setBroadphaseHandle(NULL);
+    }
+
+    // The broadphase tunes its tree and numbers its proxies as it goes, so
+    // emptying it isn't enough. Once it's empty it can be put back the way
+    // it started, without reallocating, and the bodies go back in order.
+    broadphase->resetPool(dispatcher);
+    for (int i = 0; i < objects.size(); ++i) {
+        btVector3 aabbMin, aabbMax;
+        btCollisionShape* shape = objects[i]->getCollisionShape();
+        shape->getAabb(objects[i]->getWorldTransform(), aabbMin, aabbMax);
+        objects[i]->setBroadphaseHandle(
+            broadphase->createProxy(aabbMin, aabbMax, shape->getShapeType(),
+                                    objects[i], mFilterGroups[i], mFilterMasks[i],
+                                    dispatcher, 0));
+    }
+}
+
+// Radii of the spawn rings, as fractions of the platform's starting radius,
+// in the order we fill them
+static const float sSpawnRings[] = { 0.53, 0.72, 0.36, 0.9, 0.18 };
+static const unsigned sNumSpawnRings = sizeof(sSpawnRings) / sizeof(sSpawnRings[0]);
+
+/*
+ * Reverses the bits of an index within a ring, so that consecutive indices
+ * land on opposite sides of it.
+ */
+static unsigned ReverseBits(unsigned index, unsigned numBits)
+{
+    unsigned reversed = 0;
+    for (unsigned i = 0; i < numBits; ++i)
+        if (index & (1 << i))
+            reversed |= 1 << (numBits - 1 - i);
+    return reversed;
+}
+
+Vector
+WorldModel::GetSpawnPoint(unsigned index)
+{
+    // Walk the rings, and when we've filled them all, start over one layer
+    // up. Players that far in simply drop into the crowd.
+    unsigned layer = 0;
+    while (true) {
+        for (unsigned ring = 0; ring < sNumSpawnRings; ++ring) {
+
+            // Each ring holds a power of two players, as many as fit
+            float radius = sSpawnRings[ring] * START_RADIUS;
+            unsigned numBits = 0;
+            while ((2 << numBits) * SPAWN_SPACING <= 2 * M_PI * radius)
+                ++numBits;
+            unsigned capacity = 1 << numBits;
+            if (index >= capacity) {
+                index -= capacity;
+                continue;
+            }
+
+            // Stagger alternate rings so players don't line up radially
+            float angle = 2 * M_PI * (ReverseBits(index, numBits) + 0.5 * (ring % 2)) /
+                          capacity;
+            return Vector(radius * cos(angle),
+                          SPAWN_HEIGHT + layer * SPAWN_SPACING,
+                          radius * sin(angle),
+                          0.0f);
+        }
+        ++layer;
+    }
+}
 
 void
 WorldModel::AddPlayer(unsigned playerID)
 {
-    // Generate the initial position.
-    //
-    // We only have enough initial positions for two players. This can be trivially
-    // fixed.
-    unsigned posIndex = mPlayers.size();
-    assert(posIndex <= 2);
-    Vector initialPosition(sInitialPositions[posIndex][0],
-                           sInitialPositions[posIndex][1],
-                           sInitialPositions[posIndex][2],
-                           0.0f);
-
-    // Call the internal helper
-    AddPlayer(playerID, initialPosition);
+    assert(mPlayers.size() < WORLDSTATE_MAX_PLAYERS);
+    AddPlayer(playerID, GetSpawnPoint(mPlayers.size()));
 }
 
 void
@@ -392,7 +810,6 @@ WorldModel::AddPlayer(unsigned playerID, Vector initialPosition)
 
     // Create the player rigidBody
     btCollisionShape* playerShape = new btSphereShape(1);
-    mPlayerShapes[player] = playerShape;
 
 	btScalar playerScale = 1;
     btScalar playerMass = PLAYER_MASS_DENSITY *playerScale*playerScale;
@@ -407,30 +824,26 @@ WorldModel::AddPlayer(unsigned playerID, Vector initialPosition)
     playerRigidBodyCI.m_restitution = 0.9;
     playerRigidBodyCI.m_angularDamping = 0.5;
     btRigidBody *playerRigidBody = new btRigidBody(playerRigidBodyCI);
-    mPlayerRigidBodies[player] = playerRigidBody;
+    mPlayerTable.Add(player, playerRigidBody, playerShape);
     playerRigidBody->setActivationState(DISABLE_DEACTIVATION);
+    playerRigidBody->setUserPointer(ContactTag(CONTACT_KIND_PLAYER, playerID));
+    mContacts.Watch(playerRigidBody);
     dynamicsWorld->addRigidBody(playerRigidBody);
 }
 
 Player*
 WorldModel::GetPlayer(unsigned playerID)
 {
-    // Search our list of players
-    for (vector<Player*>::iterator it = mPlayers.begin();
-         it != mPlayers.end(); ++it)
-        if ((*it)->GetPlayerID() == playerID)
-            return *it;
-
-    // None found. Return null.
-    return NULL;
+    unsigned slot = mPlayerTable.Slot(playerID);
+    return slot == PlayerTable::NO_SLOT ? NULL : mPlayerTable.players[slot];
 }
 
 Vector
 WorldModel::GetPlayerPosition(unsigned playerID)
 {
-    Player* player = GetPlayer(playerID);
-    assert(player);
-    btTransform trans = mPlayerRigidBodies[player]->getWorldTransform();
+    unsigned slot = mPlayerTable.Slot(playerID);
+    assert(slot != PlayerTable::NO_SLOT);
+    btTransform trans = mPlayerTable.bodies[slot]->getWorldTransform();
     Vector rv(trans.getOrigin());
     return rv;
 }
@@ -447,16 +860,24 @@ WorldModel::ApplyInput(UserInput& input)
 }
 
 void
-WorldModel::HandleKinematicInputForPlayer(unsigned playerID)
+WorldModel::RefreshPlayerTable()
+{
+    for (unsigned slot = 0; slot < mPlayerTable.Size(); ++slot) {
+        Player* player = mPlayerTable.players[slot];
+        mPlayerTable.activeInputs[slot] = player->GetActiveInputs();
+        mPlayerTable.activeFalconInputs[slot] = player->GetActiveFalconInputs();
+    }
+}
+
+void
+WorldModel::HandleKinematicInputForSlot(unsigned slot)
 {
     // Get the referenced player
-    Player* player = GetPlayer(playerID);
-    assert(player);
-    btRigidBody* playerRigidBody = mPlayerRigidBodies[player];
+    btRigidBody* playerRigidBody = mPlayerTable.bodies[slot];
     
     // Get the inputs
-    Vector activeFalconInputs = player->GetActiveFalconInputs();
-    uint32_t activeInputs = player->GetActiveInputs();
+    const Vector& activeFalconInputs = mPlayerTable.activeFalconInputs[slot];
+    uint32_t activeInputs = mPlayerTable.activeInputs[slot];
     if(activeFalconInputs.x != 0 || activeFalconInputs.y != 0 || activeFalconInputs.z != 0){
         //if we have falcon input, use that. the maximum force magnitude
         //we will have is 1.        
@@ -481,18 +902,16 @@ WorldModel::HandleKinematicInputForPlayer(unsigned playerID)
 }
 
 void
-WorldModel::HandleInputForPlayer(unsigned playerID)
+WorldModel::HandleInputForSlot(unsigned slot)
 {
     // Get the referenced player
-    Player* player = GetPlayer(playerID);
-    assert(player);
-    btRigidBody* playerRigidBody = mPlayerRigidBodies[player];
+    btRigidBody* playerRigidBody = mPlayerTable.bodies[slot];
 
     // Get the inputs
     btVector3 forceVector(0,0,0);
     int growthFactor = 0;
-    Vector activeFalconInputs = player->GetActiveFalconInputs();
-    uint32_t activeInputs = player->GetActiveInputs();
+    const Vector& activeFalconInputs = mPlayerTable.activeFalconInputs[slot];
+    uint32_t activeInputs = mPlayerTable.activeInputs[slot];
     if(activeFalconInputs.x != 0 || activeFalconInputs.y != 0 || activeFalconInputs.z != 0){
         //if we have falcon input, use that. the maximum force magnitude
         //we will have is 1.        
@@ -525,57 +944,98 @@ WorldModel::HandleInputForPlayer(unsigned playerID)
     if (activeInputs & GEN_INPUT_MASK(USERINPUT_INDEX_SHRINK, true))
         growthFactor += -1;
     playerRigidBody->applyForce(forceVector*PLAYER_MAX_FORCE, btVector3(0, 1.0, 0));
-    btCollisionShape *collShape = mPlayerShapes[player];
+    btCollisionShape *collShape = mPlayerTable.shapes[slot];
     if(growthFactor != 0){
-        float newScale = collShape->getLocalScaling().x() + growthFactor*PLAYER_SCALING_RATE;
+        float newScale = mPlayerTable.scales[slot] + growthFactor*PLAYER_SCALING_RATE;
         if(newScale <= PLAYER_MAXIMUM_SCALE && newScale >= PLAYER_MINIMUM_SCALE){
             float newMass = PLAYER_MASS_DENSITY * newScale*newScale*newScale;
             btVector3 newInertia(0, 0, 0);
             collShape->calculateLocalInertia(newMass,newInertia);
             playerRigidBody->setMassProps(newMass, newInertia);
             collShape->setLocalScaling(btVector3(newScale,newScale,newScale));
-            player->SetScale(newScale);
+            mPlayerTable.scales[slot] = newScale;
+            mPlayerTable.players[slot]->SetScale(newScale);
         }
     }
 }
 
-void WorldModel::ApplyHapticGravityForce(){
-    Player *player = GetPlayer(mPlayerID);
-    assert(player);
-    mFalcon->setVerticalForce((GetPlayerPosition(mPlayerID).y-4)/10);
+/*
+ * Fills in a proxy body from a player's rigid body.
+ */
+static void SetProxyBody(HapticProxyBody& proxy, btRigidBody* body, float radius){
+    proxy.position = Vector(body->getWorldTransform().getOrigin());
+    proxy.velocity = Vector(body->getLinearVelocity());
+    proxy.radius = radius;
 }
 
-void WorldModel::ApplyHapticCollisionForce(){
-    Player *player = GetPlayer(mPlayerID);
-    assert(player);
-    btVector3 impulse(0,0,0);
-    for(unsigned i = 0; i < mPlayers.size(); ++i){
-        Player *otherPlayer = mPlayers[i];
-        if(otherPlayer == NULL || otherPlayer == player)
-            continue;
+void WorldModel::UpdateHapticProxy(){
+    unsigned slot = mPlayerTable.Slot(mPlayerID);
+    assert(slot != PlayerTable::NO_SLOT);
+    btVector3 playerCenter = mPlayerTable.bodies[slot]->getWorldTransform().getOrigin();
 
-        btRigidBody *playerRigidBody = mPlayerRigidBodies[player];
-        assert(playerRigidBody);
-        btCollisionShape *playerShape = mPlayerShapes[player];
-        assert(playerShape);
-        btVector3 playerCenter = playerRigidBody->getWorldTransform().getOrigin();
-        float playerRadius = 1.1*playerShape->getLocalScaling().x();
-        btRigidBody *otherRigidBody = mPlayerRigidBodies[otherPlayer];
-        assert(otherRigidBody);
-        btCollisionShape *otherShape = mPlayerShapes[otherPlayer];
-        assert(otherShape);
-        btVector3 otherCenter = otherRigidBody->getWorldTransform().getOrigin();
-        float otherRadius = 1.1*otherShape->getLocalScaling().y();
-        if((otherCenter-playerCenter).length() <= otherRadius+playerRadius){
-            //player is colliding with other. need to add impulse.
-            btVector3 playerMomentum = (1/playerRigidBody->getInvMass())*playerRigidBody->getLinearVelocity();
-            btVector3 otherPlayerMomentum = (1/otherRigidBody->getInvMass())*otherRigidBody->getLinearVelocity();
-            float impulseMag = (playerMomentum-otherPlayerMomentum).length();
-            btVector3 impulseDir = playerCenter-otherCenter;
-            impulse += impulseMag*impulseDir;
+    HapticScene scene;
+    scene.sequence = ++mHapticSequence;
+    SetProxyBody(scene.player, mPlayerTable.bodies[slot], mPlayerTable.scales[slot]);
+
+    // The nearest opponents, nearest first. There are few enough that an
+    // insertion sort will do.
+    float distances[HAPTICPROXY_MAX_OPPONENTS];
+    unsigned slots[HAPTICPROXY_MAX_OPPONENTS];
+    unsigned numNearest = 0;
+    for(unsigned other = 0; other < mPlayerTable.Size(); ++other){
+        if(other == slot)
+            continue;
+        float distance = (mPlayerTable.bodies[other]->getWorldTransform().getOrigin() -
+                          playerCenter).length2();
+        unsigned i = numNearest;
+        if(i == HAPTICPROXY_MAX_OPPONENTS){
+            if(distance >= distances[i-1])
+                continue;
+            --i;
+        }
+        else
+            ++numNearest;
+        for(; i > 0 && distances[i-1] > distance; --i){
+            distances[i] = distances[i-1];
+            slots[i] = slots[i-1];
         }
+        distances[i] = distance;
+        slots[i] = other;
+    }
+    scene.numOpponents = numNearest;
+    for(unsigned i = 0; i < numNearest; ++i)
+        SetProxyBody(scene.opponents[i], mPlayerTable.bodies[slots[i]],
+                     mPlayerTable.scales[slots[i]]);
+
+    // What the solver did to us when we hit people. The contacts say, so
+    // this costs only as much as there were collisions.
+    const std::vector<ContactEvent>& events = mContacts.GetEvents();
+    for(unsigned i = 0; i < events.size(); ++i){
+        const ContactEvent& event = events[i];
+        if(event.type != CONTACT_EVENT_PLAYER_PLAYER)
+            continue;
+        float sign;
+        if(event.playerID == (unsigned) mPlayerID)
+            sign = 1.0f;
+        else if(event.otherIndex == (unsigned) mPlayerID)
+            sign = -1.0f;
+        else
+            continue;
+        scene.impulse.x += sign*event.impulse[0];
+        scene.impulse.y += sign*event.impulse[1];
+        scene.impulse.z += sign*event.impulse[2];
     }
-    mFalcon->setHorizontalForce(impulse.z(), impulse.x());
-}
 
+    // The rings, where they are right now
+    scene.numRings = 0;
+    for(unsigned i = 0; i < platformRigidBodies.size() && i < HAPTICPROXY_MAX_RINGS; ++i){
+        btVector3 halfExtents =
+            static_cast<btCylinderShape*>(platformShapes[i])->getHalfExtentsWithMargin();
+        scene.ringRadius[i] = halfExtents.x();
+        scene.ringTop[i] = platformRigidBodies[i]->getWorldTransform().getOrigin().y() +
+                           halfExtents.y();
+        ++scene.numRings;
+    }
 
+    mFalcon->setScene(scene);
+}
@@ -8,8 +8,15 @@
 #include "Gameclock.h"
 #include "UserInput.h"
 #include "FalconDevice.h"
+#include "PhysicsSnapshot.h"
+#include "ContactEvents.h"
+#include "GameEvents.h"
+#include "Determinism.h"
+#include "SpherePhysics.h"
+#include "Metrics.h"
 #include <vector>
 #include <map>
+#include <string.h>
 using namespace std;
 
 #define BULLET_STEP_INTERVAL (1.0/60.0)
@@ -24,8 +31,30 @@ const double PLAYER_MINIMUM_SCALE = 0.8;
 const double PLAYER_MAX_FORCE = 2;
 const double PLAYER_MASS_DENSITY = 1;
 
+// The most players a world can hold
+#define WORLDSTATE_MAX_PLAYERS 64
+
+// Spawn points sit on concentric rings (as fractions of the platform's
+// starting radius), at least this far apart
+#define SPAWN_HEIGHT 5.0
+#define SPAWN_SPACING 2.5
+
+// What steps the players. Bullet handles anything; SpherePhysics handles
+// only what Growbles needs, much faster (see SpherePhysics.h).
+typedef enum {
+    PHYSICS_BACKEND_BULLET = 0,
+    PHYSICS_BACKEND_SPHERES
+} PhysicsBackend;
+
 // struct containing information about a player
 struct PlayerInfo {
+
+    // Everything starts out zeroed, so that states are comparable byte for
+    // byte no matter where they came from
+    PlayerInfo() : transform(btTransform::getIdentity()), linearVel(0, 0, 0),
+                   angularVel(0, 0, 0), playerID(0), activeInputs(0),
+                   scale(0), packingDummy(0) {};
+
     btTransform transform;
     btVector3 linearVel;
     btVector3 angularVel;
@@ -39,12 +68,15 @@ struct PlayerInfo {
 // Struct containing all mutable world state
 struct WorldState {
 
-    // We want some values here so that this structure
-    // takes up room in order to test the network code.
-    WorldState(){};
-    
-    // The array of players, increase the size to allow more players
-    PlayerInfo playerArray[3];
+    WorldState() : numPlayers(0), timestamp(0)
+    {
+        memset(&pstate, 0, sizeof(pstate));
+    };
+
+    // The players in play. Only the first numPlayers entries are in use,
+    // and only those go on the wire. Keeping them in place means taking
+    // and copying states never allocates.
+    PlayerInfo playerArray[WORLDSTATE_MAX_PLAYERS];
     
     // The number of players in play
     int numPlayers;
@@ -56,14 +88,59 @@ struct WorldState {
     unsigned timestamp;
 };
 
+/*
+ * Dense table of per-player physics data, stored structure-of-arrays style
+ * so that the per-substep passes walk contiguous memory. Slot i holds the
+ * data for the i'th player added, and player IDs map to slots directly.
+ *
+ * Active inputs are copied in from the Player objects once per step (they
+ * only change between steps), and the table's scale is kept up to date as
+ * players grow and shrink.
+ */
+struct PlayerTable {
+
+    // Marks an ID with no slot
+    static const unsigned NO_SLOT = ~0U;
+
+    /*
+     * Number of occupied slots.
+     */
+    unsigned Size() const { return (unsigned) players.size(); };
+
+    /*
+     * Gets the slot for a player ID, or NO_SLOT.
+     */
+    unsigned Slot(unsigned playerID) const
+    { return playerID < slotByID.size() ? slotByID[playerID] : NO_SLOT; };
+
+    /*
+     * Adds a player, returning their slot.
+     */
+    unsigned Add(Player* player, btRigidBody* body, btCollisionShape* shape);
+
+    // Per-slot data
+    std::vector<Player*> players;
+    std::vector<btRigidBody*> bodies;
+    std::vector<btCollisionShape*> shapes;
+    std::vector<uint32_t> activeInputs;
+    std::vector<Vector> activeFalconInputs;
+    std::vector<float> scales;
+
+    // Slot for each player ID
+    std::vector<unsigned> slotByID;
+};
+
 class WorldModel {
 
     public:
 
     /*
-     * Dummy constructor.
+     * Dummy constructor. Snapshot metrics go to the given registry.
      */
-    WorldModel() : mCurrentTimestamp(0) {};
+    WorldModel(Metrics& metrics = Metrics::Global())
+        : mHapticSequence(0), mTouchingValid(false), mDeterministic(false),
+          mBackend(PHYSICS_BACKEND_BULLET), mCurrentTimestamp(0),
+          mMetrics(metrics) {};
 
     /*
      * Initializes the world model.
@@ -72,6 +149,13 @@ class WorldModel {
      */
     void Init(SceneGraph& sceneGraph);
 
+    /*
+     * Initializes the world model without anything to render it with, for
+     * servers and benchmarks. SyncRenderState() then only updates the
+     * players.
+     */
+    void InitHeadless();
+
     /*
      * Destructor.
      */
@@ -89,6 +173,44 @@ class WorldModel {
     void GetState(WorldState& stateOut);
     void SetState(WorldState& stateIn);
 
+    /*
+     * Full checkpoints of the physics simulation (see PhysicsSnapshot.h).
+     * A snapshot goes together with the WorldState taken at the same
+     * moment. Rewinding to one is exact in deterministic mode, and close
+     * otherwise.
+     *
+     * RestoreSnapshot() returns false, and changes nothing, if the snapshot
+     * doesn't fit the current world. Fall back to SetState() then.
+     */
+    void TakeSnapshot(PhysicsSnapshot& snapshotOut);
+    bool RestoreSnapshot(WorldState& state, PhysicsSnapshot& snapshot);
+
+    /*
+     * Deterministic mode (see Determinism.h). Fixes the floating point mode
+     * and the solver's settings, starts every tick with Bullet's collision
+     * caches empty, and starts recording a hash of our state at every
+     * tick. Everyone in a game must agree on this, and it must be set
+     * before the world starts stepping.
+     */
+    void SetDeterministic(bool deterministic);
+    bool IsDeterministic() { return mDeterministic; };
+
+    /*
+     * Chooses what steps the players. The two give slightly different
+     * results, so everyone in a game must use the same one. Bullet remains
+     * the source of truth for state either way, so this can be switched at
+     * any time.
+     */
+    void SetPhysicsBackend(PhysicsBackend backend) { mBackend = backend; };
+    PhysicsBackend GetPhysicsBackend() { return mBackend; };
+
+    /*
+     * Gets the hash of our state at the beginning of a recent tick. Returns
+     * false if we don't have one.
+     */
+    bool GetStateHash(unsigned tick, uint64_t& hashOut)
+    { return mStateHashes.Lookup(tick, hashOut); };
+
     /*
      * Adds a player to the world.
      *
@@ -98,6 +220,13 @@ class WorldModel {
      */
     void AddPlayer(unsigned playerID);
 
+    /*
+     * Gets where the index'th player to join starts out. Early players are
+     * spread as far apart as possible, and later ones fill in the gaps, so
+     * this works for any number of players without knowing it in advance.
+     */
+    static Vector GetSpawnPoint(unsigned index);
+
     /*
      * Gets a player by ID.
      *
@@ -130,6 +259,24 @@ class WorldModel {
      */
     btDiscreteDynamicsWorld* GetDynamicsWorld() { return dynamicsWorld; };
 
+    /*
+     * Updates the scenegraph and the players' render transforms to match
+     * the simulation. Stepping doesn't, so that resimulating is pure
+     * computation; call this once before rendering.
+     */
+    void SyncRenderState();
+
+    /*
+     * Gets the log of game events, from which the game fires sounds and
+     * effects.
+     */
+    GameEventLog& GetEvents() { return mEvents; };
+
+    /*
+     * Gets the contacts from the most recent step.
+     */
+    const ContactQueue& GetContacts() { return mContacts; };
+
     /*
      * Set the falcon controlled by this computer
      */
@@ -141,19 +288,19 @@ class WorldModel {
     void SetThisPlayer(int playerID){ mPlayerID = playerID; };
 
     /*
-     * Respond to collision between the player on this computer and
-     * the player specified by otherPlayerID
-     * Apply a haptic impulse force to the falcon controlled by this player.
+     * Sends the falcon controlled by the player on this computer what's
+     * around them: their sphere, the nearest opponents and the platform.
+     * The haptics thread renders the platform height and collisions from
+     * it until the next tick (see HapticProxy.h).
      */
-    void ApplyHapticCollisionForce();
+    void UpdateHapticProxy();
+
+    protected:
 
     /*
-     * Apply gravity force to  the falcon controlled by the player on this
-     * computer.
+     * Sets up the physics simulation. Shared by both kinds of Init().
      */
-    void ApplyHapticGravityForce();
-
-    protected:
+    void InitPhysics();
 
     /*
      * Internal-only method. Adds a player at a specified position.
@@ -161,20 +308,50 @@ class WorldModel {
     void AddPlayer(unsigned playerID, Vector position);
 
     /*
-     * Applies forces for the current inputs.
+     * Applies forces for the current inputs of the player in a slot.
+     */
+    void HandleInputForSlot(unsigned slot);
+    void HandleKinematicInputForSlot(unsigned slot);
+
+    /*
+     * Steps the players with SpherePhysics instead of Bullet. The players'
+     * rigid bodies are loaded into it beforehand and updated afterwards.
+     */
+    void StepSpheres(float dt);
+
+    /*
+     * Copies each player's active inputs into the player table.
      */
-    void HandleInputForPlayer(unsigned playerID);
-    void HandleKinematicInputForPlayer(unsigned playerID);
+    void RefreshPlayerTable();
 
-    // The scenegraph associated with this world
+    /*
+     * Emits a bounce event for each pair of players that started touching
+     * this tick.
+     */
+    void EmitBounces();
+
+    /*
+     * Records the hash of our current state, in deterministic mode.
+     */
+    void RecordStateHash();
+
+    /*
+     * Throws away everything Bullet remembers about collisions between
+     * steps: the broadphase, its overlapping pairs, and their contact
+     * manifolds. The bodies are put back into a new broadphase in world
+     * order, so what Bullet finds next depends only on where they are.
+     */
+    void ResetCollisionCaches();
+
+    // The scenegraph associated with this world. NULL if we're headless.
     SceneGraph* mSceneGraph;
 
     // The players
     std::vector<Player*> mPlayers;
     
-    // Physics properties of each player
-    std::map<Player *, btCollisionShape*> mPlayerShapes;
-    std::map<Player *, btRigidBody*> mPlayerRigidBodies;
+    // Physics properties of each player, by slot. Slots are in the same
+    // order as mPlayers.
+    PlayerTable mPlayerTable;
     // Physics Simulation
     btBroadphaseInterface* broadphase;
     btDefaultCollisionConfiguration* collisionConfiguration;
@@ -193,24 +370,46 @@ class WorldModel {
 
     //falcon controlled by this player
     FalconDevice *mFalcon;
+
+    // Scenes sent to the falcon so far
+    unsigned mHapticSequence;
     
     // Debug drawer
     GLDebugDrawer debugDrawer;
 
+    // Contacts found during the most recent step
+    ContactQueue mContacts;
+
+    // Pairs of players touching at the end of the last step, if we know
+    std::vector<std::pair<unsigned, unsigned> > mTouching;
+    std::vector<std::pair<unsigned, unsigned> > mTouchingScratch;
+    bool mTouchingValid;
+
+    // Collision filters of each body, kept while ResetCollisionCaches()
+    // rebuilds the broadphase
+    std::vector<short> mFilterGroups;
+    std::vector<short> mFilterMasks;
+
+    // Things that happened, for sounds and effects
+    GameEventLog mEvents;
+
+    // Deterministic mode, and the hashes of recent states
+    bool mDeterministic;
+    StateHashHistory mStateHashes;
+
+    // What steps the players, and the specialised simulation if it's us
+    PhysicsBackend mBackend;
+    SpherePhysics mSpheres;
+
     // Current timestamp
     unsigned mCurrentTimestamp;
+
+    // Where we record snapshot metrics
+    Metrics& mMetrics;
     
     friend class Game;
     
     // SceneNodes for the platform rings
     SceneNode* platformNodes[5];
-    
-    sf::SoundBuffer Buffer;
-    sf::Sound Sound;
-    sf::SoundBuffer Buffer2;
-    sf::Sound Sound2;
 };
-// used by Falcon
-static map<btCollisionDispatcher *, WorldModel *> worldModels;
-
 #endif /* WORLDMODEL_H */